@@ -0,0 +1,268 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <string.h>
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRYPTO)
+#include <arm_neon.h>
+#endif
+
+#include "blink/endian.h"
+#include "blink/intrin.h"
+#include "blink/machine.h"
+#include "blink/modrm.h"
+#include "blink/rde.h"
+#include "blink/sse.h"
+
+// the aes round instructions operate on a 4x4 byte matrix that's stored
+// in column major order, i.e. byte i of the xmm register is row i % 4 of
+// column i / 4. when the host has its own aes instructions we use those
+// and otherwise fall back to a straightforward byte-wise implementation
+
+static u8 kAesSbox[256];
+static u8 kAesInvSbox[256];
+
+static u8 AesMul(u8 a, u8 b) {
+  u8 r = 0;
+  while (b) {
+    if (b & 1) r ^= a;
+    a = a << 1 ^ (a & 0x80 ? 0x1b : 0);
+    b >>= 1;
+  }
+  return r;
+}
+
+static u8 Rol8(u8 x, int k) {
+  return x << k | x >> (8 - k);
+}
+
+static void InitializeAes(void) {
+  int i, j;
+  u8 s, t, inv;
+  for (i = 0; i < 256; ++i) {
+    // multiplicative inverse in GF(2^8) is a^254
+    for (inv = i ? 1 : 0, j = 0; i && j < 254; ++j) {
+      inv = AesMul(inv, i);
+    }
+    t = inv;
+    s = t ^ Rol8(t, 1) ^ Rol8(t, 2) ^ Rol8(t, 3) ^ Rol8(t, 4) ^ 0x63;
+    kAesSbox[i] = s;
+    kAesInvSbox[s] = i;
+  }
+}
+
+static void AesInit(void) {
+  static int once;
+  if (!once) {
+    InitializeAes();
+    once = 1;
+  }
+}
+
+static void AesSubShift(u8 x[16], const u8 s[16]) {
+  int r, c;
+  for (c = 0; c < 4; ++c) {
+    for (r = 0; r < 4; ++r) {
+      x[c * 4 + r] = kAesSbox[s[(c + r) % 4 * 4 + r]];
+    }
+  }
+}
+
+static void AesInvSubShift(u8 x[16], const u8 s[16]) {
+  int r, c;
+  for (c = 0; c < 4; ++c) {
+    for (r = 0; r < 4; ++r) {
+      x[(c + r) % 4 * 4 + r] = kAesInvSbox[s[c * 4 + r]];
+    }
+  }
+}
+
+static void AesMixColumns(u8 x[16]) {
+  int c;
+  u8 a0, a1, a2, a3;
+  for (c = 0; c < 4; ++c) {
+    a0 = x[c * 4 + 0];
+    a1 = x[c * 4 + 1];
+    a2 = x[c * 4 + 2];
+    a3 = x[c * 4 + 3];
+    x[c * 4 + 0] = AesMul(a0, 2) ^ AesMul(a1, 3) ^ a2 ^ a3;
+    x[c * 4 + 1] = a0 ^ AesMul(a1, 2) ^ AesMul(a2, 3) ^ a3;
+    x[c * 4 + 2] = a0 ^ a1 ^ AesMul(a2, 2) ^ AesMul(a3, 3);
+    x[c * 4 + 3] = AesMul(a0, 3) ^ a1 ^ a2 ^ AesMul(a3, 2);
+  }
+}
+
+static void AesInvMixColumns(u8 x[16]) {
+  int c;
+  u8 a0, a1, a2, a3;
+  for (c = 0; c < 4; ++c) {
+    a0 = x[c * 4 + 0];
+    a1 = x[c * 4 + 1];
+    a2 = x[c * 4 + 2];
+    a3 = x[c * 4 + 3];
+    x[c * 4 + 0] = AesMul(a0, 14) ^ AesMul(a1, 11) ^  //
+                   AesMul(a2, 13) ^ AesMul(a3, 9);
+    x[c * 4 + 1] = AesMul(a0, 9) ^ AesMul(a1, 14) ^  //
+                   AesMul(a2, 11) ^ AesMul(a3, 13);
+    x[c * 4 + 2] = AesMul(a0, 13) ^ AesMul(a1, 9) ^  //
+                   AesMul(a2, 14) ^ AesMul(a3, 11);
+    x[c * 4 + 3] = AesMul(a0, 11) ^ AesMul(a1, 13) ^  //
+                   AesMul(a2, 9) ^ AesMul(a3, 14);
+  }
+}
+
+static void AesAddRoundKey(u8 x[16], const u8 k[16]) {
+  int i;
+  for (i = 0; i < 16; ++i) {
+    x[i] ^= k[i];
+  }
+}
+
+#if X86_INTRINSICS
+#define AES_HOST(INSN, x, y)                \
+  if (X86_HAVE(Aes)) {                      \
+    char_xmmu_t a, b;                       \
+    memcpy(&a, x, 16);                      \
+    memcpy(&b, y, 16);                      \
+    asm(INSN "\t%1,%0" : "+x"(a) : "x"(b)); \
+    memcpy(x, &a, 16);                      \
+    return;                                 \
+  }
+#else
+#define AES_HOST(INSN, x, y)
+#endif
+
+static void SseAesenc(u8 x[16], const u8 y[16]) {
+  u8 t[16];
+  AES_HOST("aesenc", x, y);
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRYPTO)
+  vst1q_u8(x, veorq_u8(vaesmcq_u8(vaeseq_u8(vld1q_u8(x), vdupq_n_u8(0))),
+                       vld1q_u8(y)));
+  return;
+#endif
+  AesInit();
+  AesSubShift(t, x);
+  AesMixColumns(t);
+  AesAddRoundKey(t, y);
+  memcpy(x, t, 16);
+}
+
+static void SseAesenclast(u8 x[16], const u8 y[16]) {
+  u8 t[16];
+  AES_HOST("aesenclast", x, y);
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRYPTO)
+  vst1q_u8(x, veorq_u8(vaeseq_u8(vld1q_u8(x), vdupq_n_u8(0)), vld1q_u8(y)));
+  return;
+#endif
+  AesInit();
+  AesSubShift(t, x);
+  AesAddRoundKey(t, y);
+  memcpy(x, t, 16);
+}
+
+static void SseAesdec(u8 x[16], const u8 y[16]) {
+  u8 t[16];
+  AES_HOST("aesdec", x, y);
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRYPTO)
+  vst1q_u8(x, veorq_u8(vaesimcq_u8(vaesdq_u8(vld1q_u8(x), vdupq_n_u8(0))),
+                       vld1q_u8(y)));
+  return;
+#endif
+  AesInit();
+  AesInvSubShift(t, x);
+  AesInvMixColumns(t);
+  AesAddRoundKey(t, y);
+  memcpy(x, t, 16);
+}
+
+static void SseAesdeclast(u8 x[16], const u8 y[16]) {
+  u8 t[16];
+  AES_HOST("aesdeclast", x, y);
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRYPTO)
+  vst1q_u8(x, veorq_u8(vaesdq_u8(vld1q_u8(x), vdupq_n_u8(0)), vld1q_u8(y)));
+  return;
+#endif
+  AesInit();
+  AesInvSubShift(t, x);
+  AesAddRoundKey(t, y);
+  memcpy(x, t, 16);
+}
+
+static void SseAesimc(u8 x[16], const u8 y[16]) {
+  AES_HOST("aesimc", x, y);
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRYPTO)
+  vst1q_u8(x, vaesimcq_u8(vld1q_u8(y)));
+  return;
+#endif
+  memcpy(x, y, 16);
+  AesInvMixColumns(x);
+}
+
+static u32 AesSubWord(u32 w) {
+  return (u32)kAesSbox[w >> 24 & 255] << 24 |  //
+         (u32)kAesSbox[w >> 16 & 255] << 16 |  //
+         (u32)kAesSbox[w >> 8 & 255] << 8 |    //
+         (u32)kAesSbox[w & 255];
+}
+
+static void OpAes(P, void kernel(u8[16], const u8[16])) {
+  if (Osz(rde)) {
+    OpSse(A, 0, kernel);
+  } else {
+    OpUdImpl(m);
+  }
+}
+
+void OpAesimc(P) {
+  OpAes(A, SseAesimc);
+}
+
+void OpAesenc(P) {
+  OpAes(A, SseAesenc);
+}
+
+void OpAesenclast(P) {
+  OpAes(A, SseAesenclast);
+}
+
+void OpAesdec(P) {
+  OpAes(A, SseAesdec);
+}
+
+void OpAesdeclast(P) {
+  OpAes(A, SseAesdeclast);
+}
+
+void OpAeskeygenassist(P) {
+  u32 x1, x3;
+  const u8 *p;
+  if (!Osz(rde) || Ymm(rde)) OpUdImpl(m);
+  AesInit();
+  p = GetModrmRegisterXmmPointerRead16(A);
+  x1 = AesSubWord(Read32(p + 4));
+  x3 = AesSubWord(Read32(p + 12));
+  Put32(XmmRexrReg(m, rde) + 0, x1);
+  Put32(XmmRexrReg(m, rde) + 4, (x1 >> 8 | x1 << 24) ^ (u8)uimm0);
+  Put32(XmmRexrReg(m, rde) + 8, x3);
+  Put32(XmmRexrReg(m, rde) + 12, (x3 >> 8 | x3 << 24) ^ (u8)uimm0);
+#ifndef DISABLE_AVX
+  if (Vex(rde)) {
+    memset(m->ymmh[RexrReg(rde)], 0, 16);
+  }
+#endif
+}
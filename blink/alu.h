@@ -45,6 +45,7 @@ extern const aluop_f kAluFast[8][4];
 extern const aluop_f kJustBsuCl32[8];
 extern const aluop_f kJustBsuCl64[8];
 
+i64 JustInc(u64);
 i64 JustDec(u64);
 i64 JustNeg(u64);
 i64 JustAdd(struct Machine *, u64, u64);
@@ -164,6 +164,18 @@ void OpNegEvqp(P) {
 void OpIncEvqp(P) {
   AluEvqp(A, kAlu[ALU_INC]);
   if (IsMakingPath(m) && !Lock(rde)) {
+    if (GetNeededFlags(m, m->ip, ZF | SF) && CanFuseBranchAlu(A, ALU_INC)) {
+      STATISTIC(++fused_incdec_branches);
+      Jitter(A,
+             "B"      // res0 = GetRegOrMem(RexbRm)
+             "t"      // arg0 = res0
+             "m"      // call micro-op
+             "r0s1="  // sav1 = res0
+             "s1D",   // PutRegOrMem(RexbRm, sav1)
+             JustInc);
+      FuseBranchResult(A);
+      return;
+    }
     Jitter(A,
            "B"      // res0 = GetRegOrMem(RexbRm)
            "r0a1="  // arg1 = res0
@@ -175,10 +187,24 @@ void OpIncEvqp(P) {
 }
 
 void OpDecEvqp(P) {
+  int flags;
   AluEvqp(A, kAlu[ALU_DEC]);
   if (IsMakingPath(m) && !Lock(rde)) {
     STATISTIC(++alu_ops);
-    switch (GetNeededFlags(m, m->ip, ZF | SF | OF | AF | PF)) {
+    flags = GetNeededFlags(m, m->ip, ZF | SF | OF | AF | PF);
+    if (flags && CanFuseBranchAlu(A, ALU_DEC)) {
+      STATISTIC(++fused_incdec_branches);
+      Jitter(A,
+             "B"      // res0 = GetRegOrMem(RexbRm)
+             "t"      // arg0 = res0
+             "m"      // call micro-op
+             "r0s1="  // sav1 = res0
+             "s1D",   // PutRegOrMem(RexbRm, sav1)
+             JustDec);
+      FuseBranchResult(A);
+      return;
+    }
+    switch (flags) {
       case 0:
         STATISTIC(++alu_unflagged);
         Jitter(A,
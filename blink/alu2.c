@@ -173,10 +173,11 @@ void OpAluw(P) {
   if (IsMakingPath(m) && !Lock(rde)) {
     STATISTIC(++alu_ops);
     flags = GetNeededFlags(m, m->ip, CF | ZF | SF | OF | AF | PF);
-    if (t == ALU_XOR &&          //
-        RegLog2(rde) >= 2 &&     //
-        IsModrmRegister(rde) &&  //
+    if ((t == ALU_XOR || t == ALU_SUB) &&  //
+        RegLog2(rde) >= 2 &&               //
+        IsModrmRegister(rde) &&            //
         RexrReg(rde) == RexbRm(rde)) {
+      STATISTIC(++fused_zero_idioms);
       if (flags) {
         Jitter(A,
                "a1i"  // arg1 = register index
@@ -189,6 +190,15 @@ void OpAluw(P) {
                "m",     // call micro-op
                (u64)0, kPutReg64[RexrReg(rde)]);
       }
+    } else if (flags && CanFuseBranchAlu(A, t)) {
+      STATISTIC(++fused_alu_branches);
+      LoadAluArgs(A);
+      Jitter(A,
+             "m"      // call micro-op
+             "r0s1="  // sav1 = res0
+             "s1D",   // PutRegOrMem(RexbRm, sav1)
+             kJustAlu[t]);
+      FuseBranchResult(A);
     } else {
       LoadAluArgs(A);
       switch (flags) {
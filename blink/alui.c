@@ -57,6 +57,7 @@ static void AluiRo(P, const aluop_f ops[4], const aluop_f fast[4]) {
 }
 
 static void AluiUnlocked(P, u8 *p, aluop_f op) {
+  int flags;
   WriteRegisterOrMemoryBW(rde, p, op(m, ReadRegisterOrMemoryBW(rde, p), uimm0));
   if (IsMakingPath(m)) {
     STATISTIC(++alu_ops);
@@ -65,7 +66,18 @@ static void AluiUnlocked(P, u8 *p, aluop_f op) {
            "r0a1="  // arg1 = res0
            "a2i",   // arg2 = uimm0
            uimm0);
-    switch (GetNeededFlags(m, m->ip, CF | ZF | SF | OF | AF | PF)) {
+    flags = GetNeededFlags(m, m->ip, CF | ZF | SF | OF | AF | PF);
+    if (flags && CanFuseBranchAlu(A, ModrmReg(rde))) {
+      STATISTIC(++fused_alu_branches);
+      Jitter(A,
+             "m"      // call micro-op
+             "r0s1="  // sav1 = res0
+             "s1D",   // PutRegOrMem(RexbRm, sav1)
+             kJustAlu[ModrmReg(rde)]);
+      FuseBranchResult(A);
+      return;
+    }
+    switch (flags) {
       case 0:
         STATISTIC(++alu_unflagged);
         if (GetFlagDeps(rde)) {
@@ -174,17 +186,24 @@ static void Alui(P) {
 
 void OpAlui(P) {
   if (ModrmReg(rde) == ALU_CMP) {
-    if (IsMakingPath(m) && FuseBranchCmp(A, true)) {
+    if (IsMakingPath(m)) {
+      // flags are computed first so fusion can see which way we'll go
       kAlu[ALU_SUB][RegLog2(rde)](
           m, ReadRegisterOrMemoryBW(rde, GetModrmReadBW(A)), uimm0);
-    } else {
-      AluiRo(A, kAlu[ALU_SUB], kAluFast[ALU_SUB]);
+      if (FuseBranchCmp(A, true)) return;
     }
+    AluiRo(A, kAlu[ALU_SUB], kAluFast[ALU_SUB]);
   } else {
     Alui(A);
   }
 }
 
 void OpTest(P) {
+  if (IsMakingPath(m)) {
+    // flags are computed first so fusion can see which way we'll go
+    kAlu[ALU_AND][RegLog2(rde)](
+        m, ReadRegisterOrMemoryBW(rde, GetModrmReadBW(A)), uimm0);
+    if (FuseBranchTest(A, true)) return;
+  }
   AluiRo(A, kAlu[ALU_AND], kAluFast[ALU_AND]);
 }
@@ -0,0 +1,1999 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <limits.h>
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "blink/avx.h"
+#include "blink/builtin.h"
+#include "blink/bus.h"
+#include "blink/case.h"
+#include "blink/endian.h"
+#include "blink/flags.h"
+#include "blink/fpu.h"
+#include "blink/intrin.h"
+#include "blink/jit.h"
+#include "blink/machine.h"
+#include "blink/macros.h"
+#include "blink/modrm.h"
+#include "blink/pun.h"
+#include "blink/sse.h"
+#include "blink/stats.h"
+#include "blink/x86.h"
+
+#ifndef DISABLE_AVX
+
+// avx registers are stored as m->xmm[r] for the low 128 bits and
+// m->ymmh[r] for the upper 128 bits, so the legacy sse code doesn't
+// need to change. every vex encoded op zeroes the bits beyond its own
+// vector length, whereas legacy sse ops leave the upper halves alone.
+
+#define VL(rde) (16 << Ymm(rde))
+
+void LoadYmm(struct Machine *m, u8 y[32], int r) {
+  memcpy(y, m->xmm[r], 16);
+  memcpy(y + 16, m->ymmh[r], 16);
+}
+
+void StoreYmm(struct Machine *m, int r, const u8 y[32], int n) {
+  memcpy(m->xmm[r], y, 16);
+  if (n > 16) {
+    memcpy(m->ymmh[r], y + 16, 16);
+  } else {
+    memset(m->ymmh[r], 0, 16);
+  }
+}
+
+static u8 *GetYmmByte(struct Machine *m, int r, int i) {
+  return i < 16 ? m->xmm[r] + i : m->ymmh[r] + (i - 16);
+}
+
+static i64 GetVexAddress(P, size_t n, bool aligned) {
+  i64 v = ComputeAddress(A);
+  if (aligned && (v & (n - 1))) {
+    ThrowSegmentationFault(m, v);
+  }
+  return v;
+}
+
+// reads r/m operand, where memory operands are n bytes wide
+void ReadVexRm(P, u8 y[32], size_t n, bool aligned) {
+  if (IsModrmRegister(rde)) {
+    LoadYmm(m, y, RexbRm(rde));
+  } else {
+    memset(y, 0, 32);
+    memcpy(y, ReserveAddress(m, GetVexAddress(A, n, aligned), n, false), n);
+  }
+}
+
+void WriteVexMemory(P, const u8 *y, size_t n, bool aligned) {
+  memcpy(ReserveAddress(m, GetVexAddress(A, n, aligned), n, true), y, n);
+}
+
+static void ReadElement(struct Machine *m, i64 v, u8 *p, int n) {
+  memcpy(p, ReserveAddress(m, v, n, false), n);
+}
+
+// masked stores may write several elements, each of which could be
+// overlapping a page boundary, so we need to commit them as we go
+static void WriteElement(struct Machine *m, i64 v, const u8 *p, int n) {
+  memcpy(ReserveAddress(m, v, n, true), p, n);
+  if (m->stashaddr) CommitStash(m);
+}
+
+#if defined(HAVE_JIT) && defined(__x86_64__)
+static bool IsFma(u64 rde) {
+  switch (Mopcode(rde)) {
+    case 0x296 ... 0x29F:
+    case 0x2A6 ... 0x2AF:
+    case 0x2B6 ... 0x2BF:
+      return true;
+    default:
+      return false;
+  }
+}
+
+static bool CanLowerAvx(P) {
+  switch (Mopcode(rde)) {
+    case 0x128:
+    case 0x16F:
+    case 0x22A:
+      // aligned loads would crash the host rather than the guest
+      return IsModrmRegister(rde) || (Mopcode(rde) == 0x16F && !Osz(rde));
+    case 0x296 ... 0x29F:
+    case 0x2A6 ... 0x2AF:
+    case 0x2B6 ... 0x2BF:
+      return X86_HAVE(Fma) && Osz(rde);
+    case 0x213:
+      return X86_HAVE(F16c) && Osz(rde) && !Rexw(rde);
+    case 0x31D:
+      // memory destination would need a store we can't check
+      return X86_HAVE(F16c) && Osz(rde) && !Rexw(rde) && IsModrmRegister(rde);
+    case 0x110:
+    case 0x112:
+    case 0x114:
+    case 0x115:
+    case 0x116:
+    case 0x151:
+    case 0x154 ... 0x159:
+    case 0x15C ... 0x15F:
+    case 0x160 ... 0x16D:
+    case 0x170 ... 0x176:
+    case 0x17C:
+    case 0x17D:
+    case 0x1C2:
+    case 0x1C6:
+    case 0x1D0 ... 0x1D5:
+    case 0x1D8 ... 0x1E5:
+    case 0x1E8 ... 0x1F6:
+    case 0x1F8 ... 0x1FE:
+    case 0x200 ... 0x20D:
+    case 0x216:
+    case 0x218 ... 0x21A:
+    case 0x21C ... 0x21E:
+    case 0x220 ... 0x225:
+    case 0x228:
+    case 0x229:
+    case 0x22B:
+    case 0x22C:
+    case 0x22D:
+    case 0x230 ... 0x241:
+    case 0x245 ... 0x247:
+    case 0x258 ... 0x25A:
+    case 0x278:
+    case 0x279:
+    case 0x28C:
+    case 0x300 ... 0x302:
+    case 0x304 ... 0x306:
+    case 0x308 ... 0x30F:
+    case 0x318:
+    case 0x321:
+    case 0x338:
+    case 0x340 ... 0x342:
+    case 0x346:
+    case 0x34A ... 0x34C:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// vmovdqu xmm_off(%rbx),%xmm<h> and vinsertf128 $1,ymmh_off(%rbx),...
+static u8 *LoadYmmJit(u8 *p, int h, int r, bool ymm) {
+  *p++ = 0xc5;
+  *p++ = 0xfa;
+  *p++ = 0x6f;
+  *p++ = 0200 | h << 3 | kJitSav0;
+  Write32(p, offsetof(struct Machine, xmm) + r * 16), p += 4;
+  if (ymm) {
+    *p++ = 0xc4;
+    *p++ = 0xe3;
+    *p++ = (15 - h) << 3 | 1 << 2 | 1;
+    *p++ = 0x18;
+    *p++ = 0200 | h << 3 | kJitSav0;
+    Write32(p, offsetof(struct Machine, ymmh) + r * 16), p += 4;
+    *p++ = 1;
+  }
+  return p;
+}
+
+// generates code that performs a vex operation with the host's own avx
+// instruction, by loading the operands into %ymm0, %ymm1, and %ymm2 and
+// storing %ymm0 back to the destination register, or %ymm1 in the case
+// of vcvtps2ph. the host instruction zeroes the upper half of the result
+// on its own when vex.l isn't set.
+static void JitAvx(P) {
+  u8 *p, code[112];
+  bool isimmshift;
+  int dst, reg, out, vvvv, pp;
+  if (!X86_HAVE(Avx2)) return;
+  if (!CanLowerAvx(A)) return;
+  if (!IsModrmRegister(rde) && !HasLinearMapping()) return;
+  isimmshift = Mopcode(rde) >= 0x171 && Mopcode(rde) <= 0x173;
+  if (!IsModrmRegister(rde)) {
+    Jitter(A, "z4P");  // res0 = GetXmmOrMemPointer(RexbRm)
+  }
+  p = code;
+  out = 0;
+  vvvv = 0;
+  if (isimmshift) {
+    dst = Vreg(rde);
+    reg = ModrmReg(rde);
+  } else if (Mopcode(rde) == 0x31D) {
+    // vcvtps2ph $imm,%ymm0,%xmm1
+    dst = RexbRm(rde);
+    reg = 0;
+    out = 1;
+    p = LoadYmmJit(p, 0, RexrReg(rde), Ymm(rde));
+  } else if (IsFma(rde)) {
+    // fused multiply add also reads its destination, e.g.
+    // vfmadd231ps %ymm1,%ymm2,%ymm0
+    dst = RexrReg(rde);
+    reg = 0;
+    vvvv = 2;
+    p = LoadYmmJit(p, 0, RexrReg(rde), Ymm(rde));
+    p = LoadYmmJit(p, 2, Vreg(rde), Ymm(rde));
+  } else {
+    dst = RexrReg(rde);
+    reg = 0;
+    p = LoadYmmJit(p, 0, Vreg(rde), Ymm(rde));
+  }
+  if (IsModrmRegister(rde)) {
+    p = LoadYmmJit(p, 1, RexbRm(rde), Ymm(rde));
+  }
+  if (Mopcode(rde) >= 0x34A && Mopcode(rde) <= 0x34C) {
+    p = LoadYmmJit(p, 2, uimm0 >> 4 & 15, Ymm(rde));
+  }
+  // same opcode as guest, e.g. vpaddb %ymm1,%ymm0,%ymm0
+  if (Osz(rde)) {
+    pp = 1;
+  } else if (Rep(rde) == 3) {
+    pp = 2;
+  } else if (Rep(rde) == 2) {
+    pp = 3;
+  } else {
+    pp = 0;
+  }
+  *p++ = 0xc4;
+  *p++ = 0xe0 | Mopcode(rde) >> 8;
+  *p++ = Rexw(rde) << 7 | (15 - vvvv) << 3 | Ymm(rde) << 2 | pp;
+  *p++ = Opcode(rde);
+  if (IsModrmRegister(rde)) {
+    *p++ = 0300 | reg << 3 | 1;
+  } else {
+    *p++ = 0000 | reg << 3 | kJitRes0;
+  }
+  if (Mopcode(rde) >= 0x34A && Mopcode(rde) <= 0x34C) {
+    *p++ = 2 << 4 | (uimm0 & 15);
+  } else if (Mopcode(rde) >= 0x300 ||                              //
+             (Mopcode(rde) >= 0x170 && Mopcode(rde) <= 0x173) ||  //
+             Mopcode(rde) == 0x1C2 || Mopcode(rde) == 0x1C6) {
+    *p++ = uimm0;
+  }
+  *p++ = 0xc5;  // vmovdqu %xmm0,xmm_off(%rbx)
+  *p++ = 0xfa;
+  *p++ = 0x7f;
+  *p++ = 0200 | out << 3 | kJitSav0;
+  Write32(p, offsetof(struct Machine, xmm) + dst * 16), p += 4;
+  *p++ = 0xc4;  // vextractf128 $1,%ymm0,ymmh_off(%rbx)
+  *p++ = 0xe3;
+  *p++ = 0x7d;
+  *p++ = 0x19;
+  *p++ = 0200 | out << 3 | kJitSav0;
+  Write32(p, offsetof(struct Machine, ymmh) + dst * 16), p += 4;
+  *p++ = 1;
+  *p++ = 0xc5;  // vzeroupper
+  *p++ = 0xf8;
+  *p++ = 0x77;
+  unassert(p - code <= sizeof(code));
+  AppendJit(m->path.jb, code, p - code);
+  STATISTIC(++avx_lowered);
+}
+#endif
+
+// stores result to the vex.reg register and lowers the op if possible
+void PutVex(P, const u8 y[32], int n) {
+  StoreYmm(m, RexrReg(rde), y, n);
+#if defined(HAVE_JIT) && defined(__x86_64__)
+  if (IsMakingPath(m)) {
+    JitAvx(A);
+  }
+#endif
+}
+
+// stores result to the modrm.rm register and lowers the op if possible
+void PutVexRm(P, const u8 y[32], int n) {
+  StoreYmm(m, RexbRm(rde), y, n);
+#if defined(HAVE_JIT) && defined(__x86_64__)
+  if (IsMakingPath(m)) {
+    JitAvx(A);
+  }
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// INTEGER
+
+static bool IsShiftByXmm(u64 rde) {
+  switch (Mopcode(rde)) {
+    case 0x1D1:  // vpsrlw
+    case 0x1D2:  // vpsrld
+    case 0x1D3:  // vpsrlq
+    case 0x1E1:  // vpsraw
+    case 0x1E2:  // vpsrad
+    case 0x1F1:  // vpsllw
+    case 0x1F2:  // vpslld
+    case 0x1F3:  // vpsllq
+      return true;
+    default:
+      return false;
+  }
+}
+
+// runs sse kernel on each 128-bit lane, e.g. vpaddb %ymm2,%ymm1,%ymm0
+void OpAvx(P, void kernel(u8[16], const u8[16])) {
+  int i, n;
+  u8 x[32], y[32];
+  n = VL(rde);
+  if (!Osz(rde)) OpUdImpl(m);
+  if (Ymm(rde) && Mopcode(rde) == 0x241) OpUdImpl(m);  // vphminposuw
+  if (IsShiftByXmm(rde)) {
+    ReadVexRm(A, y, 16, false);
+    memcpy(y + 16, y, 16);  // count applies to both lanes
+  } else {
+    ReadVexRm(A, y, n, false);
+  }
+  LoadYmm(m, x, Vreg(rde));
+  for (i = 0; i < n; i += 16) {
+    kernel(x + i, y + i);
+  }
+  PutVex(A, x, n);
+}
+
+// runs sse kernel with immediate on each lane, e.g. vpalignr
+void OpAvxImm(P, void kernel(u8[16], const u8[16], unsigned)) {
+  int i, n;
+  u8 x[32], y[32];
+  n = VL(rde);
+  if (!Osz(rde)) OpUdImpl(m);
+  ReadVexRm(A, y, n, false);
+  LoadYmm(m, x, Vreg(rde));
+  for (i = 0; i < n; i += 16) {
+    kernel(x + i, y + i, uimm0);
+  }
+  PutVex(A, x, n);
+}
+
+// vpsrlw, vpsraw, vpsllw, ..., vpslldq with an immediate shift count
+// which, unlike other vex ops, has its destination in the vvvv field
+void OpAvxShift(P, void kernel(u8[16], unsigned)) {
+  int i, n;
+  u8 x[32];
+  n = VL(rde);
+  if (!Osz(rde) || !IsModrmRegister(rde)) OpUdImpl(m);
+  LoadYmm(m, x, RexbRm(rde));
+  for (i = 0; i < n; i += 16) {
+    kernel(x + i, uimm0);
+  }
+  StoreYmm(m, Vreg(rde), x, n);
+#if defined(HAVE_JIT) && defined(__x86_64__)
+  if (IsMakingPath(m)) {
+    JitAvx(A);
+  }
+#endif
+}
+
+// vpsrlvd, vpsrlvq, vpsravd, vpsllvd, vpsllvq
+static void OpVpshv(P) {
+  int i, n;
+  u64 a, k;
+  u8 x[32], y[32];
+  n = VL(rde);
+  if (!Osz(rde)) OpUdImpl(m);
+  ReadVexRm(A, y, n, false);
+  LoadYmm(m, x, Vreg(rde));
+  if (Rexw(rde)) {
+    if (Opcode(rde) == 0x46) OpUdImpl(m);
+    for (i = 0; i < n; i += 8) {
+      a = Get64(x + i);
+      k = Get64(y + i);
+      if (k > 63) {
+        a = 0;
+      } else if (Opcode(rde) == 0x45) {
+        a >>= k;
+      } else {
+        a <<= k;
+      }
+      Put64(x + i, a);
+    }
+  } else {
+    for (i = 0; i < n; i += 4) {
+      a = Get32(x + i);
+      k = Get32(y + i);
+      if (Opcode(rde) == 0x46) {
+        a = (i32)a >> MIN(k, 31);
+      } else if (k > 31) {
+        a = 0;
+      } else if (Opcode(rde) == 0x45) {
+        a >>= k;
+      } else {
+        a <<= k;
+      }
+      Put32(x + i, a);
+    }
+  }
+  PutVex(A, x, n);
+}
+
+// vpshufd, vpshufhw, vpshuflw
+static void OpVpshuf(P) {
+  int i, j, n;
+  u8 y[32], z[32];
+  n = VL(rde);
+  ReadVexRm(A, y, n, false);
+  for (i = 0; i < n; i += 16) {
+    switch (Rep(rde) | Osz(rde)) {
+      case 1:
+        for (j = 0; j < 4; ++j) {
+          memcpy(z + i + j * 4, y + i + (uimm0 >> j * 2 & 3) * 4, 4);
+        }
+        break;
+      case 2:
+        for (j = 0; j < 4; ++j) {
+          memcpy(z + i + j * 2, y + i + (uimm0 >> j * 2 & 3) * 2, 2);
+        }
+        memcpy(z + i + 8, y + i + 8, 8);
+        break;
+      case 3:
+        memcpy(z + i, y + i, 8);
+        for (j = 0; j < 4; ++j) {
+          memcpy(z + i + 8 + j * 2, y + i + 8 + (uimm0 >> j * 2 & 3) * 2, 2);
+        }
+        break;
+      default:
+        OpUdImpl(m);
+    }
+  }
+  PutVex(A, z, n);
+}
+
+static void OpVpmovmskb(P) {
+  u32 r;
+  int i, n;
+  u8 y[32];
+  n = VL(rde);
+  if (!Osz(rde) || !IsModrmRegister(rde)) OpUdImpl(m);
+  LoadYmm(m, y, RexbRm(rde));
+  for (r = i = 0; i < n; ++i) {
+    r |= (u32)(y[i] >> 7) << i;
+  }
+  Put64(RegRexrReg(m, rde), r);
+}
+
+static void OpVpinsrw(P) {
+  u8 x[32];
+  if (!Osz(rde) || Ymm(rde)) OpUdImpl(m);
+  LoadYmm(m, x, Vreg(rde));
+  Put16(x + (uimm0 & 7) * 2, Read16(GetModrmRegisterWordPointerRead2(A)));
+  PutVex(A, x, 16);
+}
+
+// vpinsrb, vpinsrd, vpinsrq
+static void OpVpinsr(P) {
+  u8 x[32];
+  if (!Osz(rde) || Ymm(rde)) OpUdImpl(m);
+  LoadYmm(m, x, Vreg(rde));
+  if (Opcode(rde) == 0x20) {
+    x[uimm0 & 15] = Read8(GetModrmRegisterWordPointerRead(A, 1));
+  } else if (Rexw(rde)) {
+    Put64(x + (uimm0 & 1) * 8, Read64(GetModrmRegisterWordPointerRead8(A)));
+  } else {
+    Put32(x + (uimm0 & 3) * 4, Read32(GetModrmRegisterWordPointerRead4(A)));
+  }
+  PutVex(A, x, 16);
+}
+
+// vpextrb, vpextrw, vpextrd, vpextrq, vextractps
+static void OpVpextr(P) {
+  if (Ymm(rde)) OpUdImpl(m);
+  OpSsePextr(A);
+}
+
+// vptest, vtestps, vtestpd
+static void OpVptest(P) {
+  int i, n;
+  u8 x[32], y[32];
+  u64 a, b, zf, cf, mask;
+  n = VL(rde);
+  if (!Osz(rde)) OpUdImpl(m);
+  switch (Opcode(rde)) {
+    case 0x0E:
+      mask = 0x8000000080000000;
+      break;
+    case 0x0F:
+      mask = 0x8000000000000000;
+      break;
+    default:
+      mask = -1;
+      break;
+  }
+  ReadVexRm(A, y, n, false);
+  LoadYmm(m, x, RexrReg(rde));
+  for (zf = cf = i = 0; i < n; i += 8) {
+    a = Get64(x + i);
+    b = Get64(y + i);
+    zf |= a & b;
+    cf |= ~a & b;
+  }
+  m->flags = SetFlag(m->flags, FLAGS_ZF, !(zf & mask));
+  m->flags = SetFlag(m->flags, FLAGS_CF, !(cf & mask));
+  m->flags = SetFlag(m->flags, FLAGS_SF, false);
+  m->flags = SetFlag(m->flags, FLAGS_OF, false);
+  m->flags = SetFlag(m->flags, FLAGS_AF, false);
+  m->flags = SetFlag(m->flags, FLAGS_PF, false);
+}
+
+// vpmovsxbw, vpmovsxbd, ..., vpmovzxdq
+static void OpVpmovx(P) {
+  u64 v;
+  int i, k, n, from, to;
+  u8 t[32], z[32];
+  static const u8 kFrom[6] = {0, 0, 0, 1, 1, 2};
+  static const u8 kTo[6] = {1, 2, 3, 2, 3, 3};
+  if (!Osz(rde) || (k = Opcode(rde) & 15) > 5) OpUdImpl(m);
+  from = kFrom[k];
+  to = kTo[k];
+  n = VL(rde) >> to;
+  ReadVexRm(A, t, n << from, false);
+  for (i = 0; i < n; ++i) {
+    switch (from) {
+      case 0:
+        v = Opcode(rde) & 0x10 ? t[i] : (u64)(i8)t[i];
+        break;
+      case 1:
+        v = Opcode(rde) & 0x10 ? Get16(t + i * 2) : (u64)(i16)Get16(t + i * 2);
+        break;
+      case 2:
+        v = Opcode(rde) & 0x10 ? Get32(t + i * 4) : (u64)(i32)Get32(t + i * 4);
+        break;
+      default:
+        __builtin_unreachable();
+    }
+    switch (to) {
+      case 1:
+        Put16(z + i * 2, v);
+        break;
+      case 2:
+        Put32(z + i * 4, v);
+        break;
+      case 3:
+        Put64(z + i * 8, v);
+        break;
+      default:
+        __builtin_unreachable();
+    }
+  }
+  PutVex(A, z, VL(rde));
+}
+
+// vbroadcastss, vbroadcastsd, vbroadcastf128, vpbroadcastb, etc.
+static void OpVbroadcast(P) {
+  int i, w, n;
+  u8 y[32], z[32];
+  n = VL(rde);
+  if (!Osz(rde) || Rexw(rde)) OpUdImpl(m);
+  switch (Opcode(rde)) {
+    case 0x78:
+      w = 1;
+      break;
+    case 0x79:
+      w = 2;
+      break;
+    case 0x18:
+    case 0x58:
+      w = 4;
+      break;
+    case 0x19:
+      if (!Ymm(rde)) OpUdImpl(m);
+      // fallthrough
+    case 0x59:
+      w = 8;
+      break;
+    case 0x1A:
+    case 0x5A:
+      if (!Ymm(rde) || IsModrmRegister(rde)) OpUdImpl(m);
+      w = 16;
+      break;
+    default:
+      __builtin_unreachable();
+  }
+  ReadVexRm(A, y, w, false);
+  for (i = 0; i < n; i += w) {
+    memcpy(z + i, y, w);
+  }
+  PutVex(A, z, n);
+}
+
+// vpermd, vpermps
+static void OpVpermd(P) {
+  int i;
+  u8 x[32], y[32], z[32];
+  if (!Osz(rde) || !Ymm(rde) || Rexw(rde)) OpUdImpl(m);
+  ReadVexRm(A, y, 32, false);
+  LoadYmm(m, x, Vreg(rde));
+  for (i = 0; i < 8; ++i) {
+    memcpy(z + i * 4, y + (Get32(x + i * 4) & 7) * 4, 4);
+  }
+  PutVex(A, z, 32);
+}
+
+// vpermq, vpermpd
+static void OpVpermq(P) {
+  int i;
+  u8 y[32], z[32];
+  if (!Osz(rde) || !Ymm(rde) || !Rexw(rde)) OpUdImpl(m);
+  ReadVexRm(A, y, 32, false);
+  for (i = 0; i < 4; ++i) {
+    memcpy(z + i * 8, y + (uimm0 >> i * 2 & 3) * 8, 8);
+  }
+  PutVex(A, z, 32);
+}
+
+// vperm2f128, vperm2i128
+static void OpVperm2(P) {
+  int i, s;
+  u8 x[32], y[32], z[32];
+  if (!Osz(rde) || !Ymm(rde) || Rexw(rde)) OpUdImpl(m);
+  ReadVexRm(A, y, 32, false);
+  LoadYmm(m, x, Vreg(rde));
+  for (i = 0; i < 2; ++i) {
+    s = uimm0 >> i * 4;
+    if (s & 8) {
+      memset(z + i * 16, 0, 16);
+    } else {
+      memcpy(z + i * 16, (s & 2 ? y : x) + (s & 1) * 16, 16);
+    }
+  }
+  PutVex(A, z, 32);
+}
+
+// vinsertf128, vinserti128
+static void OpVinsert128(P) {
+  u8 x[32], y[32];
+  if (!Osz(rde) || !Ymm(rde) || Rexw(rde)) OpUdImpl(m);
+  ReadVexRm(A, y, 16, false);
+  LoadYmm(m, x, Vreg(rde));
+  memcpy(x + (uimm0 & 1) * 16, y, 16);
+  PutVex(A, x, 32);
+}
+
+// vextractf128, vextracti128
+static void OpVextract128(P) {
+  u8 x[32], z[32];
+  if (!Osz(rde) || !Ymm(rde) || Rexw(rde)) OpUdImpl(m);
+  LoadYmm(m, x, RexrReg(rde));
+  if (IsModrmRegister(rde)) {
+    memcpy(z, x + (uimm0 & 1) * 16, 16);
+    StoreYmm(m, RexbRm(rde), z, 16);
+  } else {
+    WriteVexMemory(A, x + (uimm0 & 1) * 16, 16, false);
+  }
+}
+
+// vpblendd, vblendps, vblendpd, vpblendw
+static void OpVblend(P) {
+  int i, n, w;
+  u8 x[32], y[32];
+  n = VL(rde);
+  if (!Osz(rde) || Rexw(rde)) OpUdImpl(m);
+  switch (Opcode(rde)) {
+    case 0x02:
+    case 0x0C:
+      w = 4;
+      break;
+    case 0x0D:
+      w = 8;
+      break;
+    case 0x0E:
+      w = 2;
+      break;
+    default:
+      __builtin_unreachable();
+  }
+  ReadVexRm(A, y, n, false);
+  LoadYmm(m, x, Vreg(rde));
+  for (i = 0; i < n / w; ++i) {
+    if (uimm0 >> (i & 7) & 1) {
+      memcpy(x + i * w, y + i * w, w);
+    }
+  }
+  PutVex(A, x, n);
+}
+
+// vblendvps, vblendvpd, vpblendvb
+static void OpVblendv(P) {
+  int i, n, w;
+  u8 x[32], y[32], k[32];
+  n = VL(rde);
+  if (!Osz(rde) || Rexw(rde)) OpUdImpl(m);
+  switch (Opcode(rde)) {
+    case 0x4A:
+      w = 4;
+      break;
+    case 0x4B:
+      w = 8;
+      break;
+    case 0x4C:
+      w = 1;
+      break;
+    default:
+      __builtin_unreachable();
+  }
+  ReadVexRm(A, y, n, false);
+  LoadYmm(m, x, Vreg(rde));
+  LoadYmm(m, k, uimm0 >> 4 & 15);
+  for (i = 0; i < n; i += w) {
+    if (k[i + w - 1] & 0x80) {
+      memcpy(x + i, y + i, w);
+    }
+  }
+  PutVex(A, x, n);
+}
+
+static void Mpsadbw(u8 x[16], const u8 y[16], unsigned imm) {
+  u16 r[8];
+  int i, j, k;
+  const u8 *a, *b;
+  a = x + (imm & 4);
+  b = y + (imm & 3) * 4;
+  for (i = 0; i < 8; ++i) {
+    for (r[i] = k = 0; k < 4; ++k) {
+      j = a[i + k] - b[k];
+      r[i] += j < 0 ? -j : j;
+    }
+  }
+  for (i = 0; i < 8; ++i) {
+    Put16(x + i * 2, r[i]);
+  }
+}
+
+static void OpVmpsadbw(P) {
+  u8 x[32], y[32];
+  if (!Osz(rde)) OpUdImpl(m);
+  ReadVexRm(A, y, VL(rde), false);
+  LoadYmm(m, x, Vreg(rde));
+  Mpsadbw(x, y, uimm0);
+  Mpsadbw(x + 16, y + 16, uimm0 >> 3);  // second lane uses bits 3..5
+  PutVex(A, x, VL(rde));
+}
+
+// vmaskmovps, vmaskmovpd, vpmaskmovd, vpmaskmovq
+static void OpVmaskmov(P) {
+  i64 v;
+  int i, n, w;
+  bool isstore;
+  u8 k[32], x[32];
+  n = VL(rde);
+  if (!Osz(rde) || IsModrmRegister(rde)) OpUdImpl(m);
+  switch (Opcode(rde)) {
+    case 0x2C:
+    case 0x2E:
+      w = 4;
+      break;
+    case 0x2D:
+    case 0x2F:
+      w = 8;
+      break;
+    case 0x8C:
+    case 0x8E:
+      w = Rexw(rde) ? 8 : 4;
+      break;
+    default:
+      __builtin_unreachable();
+  }
+  isstore = Opcode(rde) == 0x2E || Opcode(rde) == 0x2F || Opcode(rde) == 0x8E;
+  LoadYmm(m, k, Vreg(rde));
+  v = ComputeAddress(A);
+  if (isstore) {
+    LoadYmm(m, x, RexrReg(rde));
+    for (i = 0; i < n; i += w) {
+      if (k[i + w - 1] & 0x80) {
+        WriteElement(m, v + i, x + i, w);
+      }
+    }
+  } else {
+    // masked out elements must not fault, even if they aren't mapped
+    memset(x, 0, 32);
+    for (i = 0; i < n; i += w) {
+      if (k[i + w - 1] & 0x80) {
+        ReadElement(m, v + i, x + i, w);
+      }
+    }
+    PutVex(A, x, n);
+  }
+}
+
+// vpgatherdd, vpgatherdq, vpgatherqd, vpgatherqq, vgatherdps, etc.
+//
+// elements are loaded in order, clearing their mask bits as they go,
+// so if a page fault happens the instruction can be restarted later.
+static void OpVgather(P) {
+  u64 x, a;
+  u8 ix[32];
+  struct AddrSeg ea;
+  int i, n, w, iw, dst, msk, idx;
+  if (!Osz(rde) || IsModrmRegister(rde) || !SibExists(rde)) OpUdImpl(m);
+  dst = RexrReg(rde);
+  msk = Vreg(rde);
+  idx = Rexx(rde) << 3 | SibIndex(rde);
+  if (dst == msk || dst == idx || msk == idx) OpUdImpl(m);
+  w = Rexw(rde) ? 8 : 4;
+  iw = Opcode(rde) & 1 ? 8 : 4;
+  n = VL(rde) / MAX(w, iw);
+  LoadYmm(m, ix, idx);
+  ea = LoadEffectiveAddress(A);
+  if (SibHasIndex(rde)) {
+    ea.addr -= Get64(RegRexxIndex(m, rde)) << SibScale(rde);
+  }
+  for (i = 0; i < n; ++i) {
+    if (!(*GetYmmByte(m, msk, i * w + w - 1) & 0x80)) continue;
+    x = iw == 8 ? Get64(ix + i * 8) : (u64)(i32)Get32(ix + i * 4);
+    a = ea.addr + (x << SibScale(rde));
+    if (Eamode(rde) == XED_MODE_LEGACY) a &= 0xffffffff;
+    ReadElement(m, AddSegment(A, a, ea.seg), GetYmmByte(m, dst, i * w), w);
+    memset(GetYmmByte(m, msk, i * w), 0, w);
+  }
+  for (i = n * w; i < 32; ++i) {
+    *GetYmmByte(m, dst, i) = 0;
+  }
+  memset(m->xmm[msk], 0, 16);
+  memset(m->ymmh[msk], 0, 16);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// FLOATING POINT
+
+static float Adds(float x, float y) {
+  return x + y;
+}
+
+static double Addd(double x, double y) {
+  return x + y;
+}
+
+static float Subs(float x, float y) {
+  return x - y;
+}
+
+static double Subd(double x, double y) {
+  return x - y;
+}
+
+static float Muls(float x, float y) {
+  return x * y;
+}
+
+static double Muld(double x, double y) {
+  return x * y;
+}
+
+static float Divs(float x, float y) {
+  return x / y;
+}
+
+static double Divd(double x, double y) {
+  return x / y;
+}
+
+static float Mins(float x, float y) {
+  return MIN(x, y);
+}
+
+static double Mind(double x, double y) {
+  return MIN(x, y);
+}
+
+static float Maxs(float x, float y) {
+  return MAX(x, y);
+}
+
+static double Maxd(double x, double y) {
+  return MAX(x, y);
+}
+
+static float Sqrts(float x, float y) {
+  return sqrtf(y);
+}
+
+static double Sqrtd(double x, double y) {
+  return sqrt(y);
+}
+
+static float Rsqrts(float x, float y) {
+  return 1 / sqrtf(y);
+}
+
+static float Rcps(float x, float y) {
+  return 1 / y;
+}
+
+// vaddps, vaddpd, vaddss, vaddsd, vsubps, ..., vsqrtsd
+static void OpVpsd(P, float fs(float, float), double fd(double, double)) {
+  int i, n;
+  u8 x[32], y[32];
+  union FloatPun a, b;
+  union DoublePun c, d;
+  n = VL(rde);
+  LoadYmm(m, x, Vreg(rde));
+  switch (Rep(rde) | Osz(rde)) {
+    case 0:
+      ReadVexRm(A, y, n, false);
+      for (i = 0; i < n; i += 4) {
+        a.i = Get32(x + i);
+        b.i = Get32(y + i);
+        a.f = fs(a.f, b.f);
+        Put32(x + i, a.i);
+      }
+      break;
+    case 1:
+      ReadVexRm(A, y, n, false);
+      for (i = 0; i < n; i += 8) {
+        c.i = Get64(x + i);
+        d.i = Get64(y + i);
+        c.f = fd(c.f, d.f);
+        Put64(x + i, c.i);
+      }
+      break;
+    case 2:
+      ReadVexRm(A, y, 8, false);
+      c.i = Get64(x);
+      d.i = Get64(y);
+      c.f = fd(c.f, d.f);
+      Put64(x, c.i);
+      n = 16;
+      break;
+    case 3:
+      ReadVexRm(A, y, 4, false);
+      a.i = Get32(x);
+      b.i = Get32(y);
+      a.f = fs(a.f, b.f);
+      Put32(x, a.i);
+      n = 16;
+      break;
+    default:
+      __builtin_unreachable();
+  }
+  PutVex(A, x, n);
+}
+
+static void OpVadd(P) {
+  OpVpsd(A, Adds, Addd);
+}
+
+static void OpVsub(P) {
+  OpVpsd(A, Subs, Subd);
+}
+
+static void OpVmul(P) {
+  OpVpsd(A, Muls, Muld);
+}
+
+static void OpVdiv(P) {
+  OpVpsd(A, Divs, Divd);
+}
+
+static void OpVmin(P) {
+  OpVpsd(A, Mins, Mind);
+}
+
+static void OpVmax(P) {
+  OpVpsd(A, Maxs, Maxd);
+}
+
+static void OpVsqrt(P) {
+  OpVpsd(A, Sqrts, Sqrtd);
+}
+
+static void OpVrsqrt(P) {
+  if (Osz(rde) || Rep(rde) == 2) OpUdImpl(m);
+  OpVpsd(A, Rsqrts, 0);
+}
+
+static void OpVrcp(P) {
+  if (Osz(rde) || Rep(rde) == 2) OpUdImpl(m);
+  OpVpsd(A, Rcps, 0);
+}
+
+// vandps, vandnps, vorps, vxorps, and their pd counterparts
+static void OpVlogic(P) {
+  int i, n;
+  u64 a, b;
+  u8 x[32], y[32];
+  n = VL(rde);
+  if (Rep(rde)) OpUdImpl(m);
+  ReadVexRm(A, y, n, false);
+  LoadYmm(m, x, Vreg(rde));
+  for (i = 0; i < n; i += 8) {
+    a = Get64(x + i);
+    b = Get64(y + i);
+    switch (Opcode(rde)) {
+      case 0x54:
+        a &= b;
+        break;
+      case 0x55:
+        a = ~a & b;
+        break;
+      case 0x56:
+        a |= b;
+        break;
+      case 0x57:
+        a ^= b;
+        break;
+      default:
+        __builtin_unreachable();
+    }
+    Put64(x + i, a);
+  }
+  PutVex(A, x, n);
+}
+
+// bit 0 is less, bit 1 is equal, bit 2 is greater, bit 3 is unordered
+static const u8 kVcmp[16] = {
+    002,  // eq_oq
+    001,  // lt_os
+    003,  // le_os
+    010,  // unord_q
+    015,  // neq_uq
+    016,  // nlt_us
+    014,  // nle_us
+    007,  // ord_q
+    012,  // eq_uq
+    011,  // nge_us
+    013,  // ngt_us
+    000,  // false_oq
+    005,  // neq_oq
+    006,  // ge_os
+    004,  // gt_os
+    017,  // true_uq
+};
+
+static bool Vcmp(int imm, double x, double y) {
+  int rel;
+  if (isunordered(x, y)) {
+    rel = 8;
+  } else if (x < y) {
+    rel = 1;
+  } else if (x == y) {
+    rel = 2;
+  } else {
+    rel = 4;
+  }
+  return kVcmp[imm & 15] & rel;
+}
+
+// vcmpps, vcmppd, vcmpss, vcmpsd
+static void OpVcmp(P) {
+  int i, n;
+  u8 x[32], y[32];
+  union FloatPun a, b;
+  union DoublePun c, d;
+  n = VL(rde);
+  LoadYmm(m, x, Vreg(rde));
+  switch (Rep(rde) | Osz(rde)) {
+    case 0:
+      ReadVexRm(A, y, n, false);
+      for (i = 0; i < n; i += 4) {
+        a.i = Get32(x + i);
+        b.i = Get32(y + i);
+        Put32(x + i, Vcmp(uimm0, a.f, b.f) ? -1 : 0);
+      }
+      break;
+    case 1:
+      ReadVexRm(A, y, n, false);
+      for (i = 0; i < n; i += 8) {
+        c.i = Get64(x + i);
+        d.i = Get64(y + i);
+        Put64(x + i, Vcmp(uimm0, c.f, d.f) ? -1 : 0);
+      }
+      break;
+    case 2:
+      ReadVexRm(A, y, 8, false);
+      c.i = Get64(x);
+      d.i = Get64(y);
+      Put64(x, Vcmp(uimm0, c.f, d.f) ? -1 : 0);
+      n = 16;
+      break;
+    case 3:
+      ReadVexRm(A, y, 4, false);
+      a.i = Get32(x);
+      b.i = Get32(y);
+      Put32(x, Vcmp(uimm0, a.f, b.f) ? -1 : 0);
+      n = 16;
+      break;
+    default:
+      __builtin_unreachable();
+  }
+  PutVex(A, x, n);
+}
+
+// vhaddps, vhaddpd, vhsubps, vhsubpd
+static void OpVhadd(P) {
+  int i, j, n;
+  bool sub;
+  const u8 *s;
+  u8 x[32], y[32], z[32];
+  union FloatPun a, b;
+  union DoublePun c, d;
+  n = VL(rde);
+  sub = Opcode(rde) & 1;
+  ReadVexRm(A, y, n, false);
+  LoadYmm(m, x, Vreg(rde));
+  for (i = 0; i < n; i += 16) {
+    if (Osz(rde)) {
+      for (j = 0; j < 2; ++j) {
+        s = (j ? y : x) + i;
+        c.i = Get64(s + 0);
+        d.i = Get64(s + 8);
+        c.f = sub ? c.f - d.f : c.f + d.f;
+        Put64(z + i + j * 8, c.i);
+      }
+    } else if (Rep(rde) == 2) {
+      for (j = 0; j < 4; ++j) {
+        s = (j & 2 ? y : x) + i + (j & 1) * 8;
+        a.i = Get32(s + 0);
+        b.i = Get32(s + 4);
+        a.f = sub ? a.f - b.f : a.f + b.f;
+        Put32(z + i + j * 4, a.i);
+      }
+    } else {
+      OpUdImpl(m);
+    }
+  }
+  PutVex(A, z, n);
+}
+
+// vaddsubps, vaddsubpd
+static void OpVaddsub(P) {
+  int i, n;
+  u8 x[32], y[32];
+  union FloatPun a, b;
+  union DoublePun c, d;
+  n = VL(rde);
+  ReadVexRm(A, y, n, false);
+  LoadYmm(m, x, Vreg(rde));
+  if (Osz(rde)) {
+    for (i = 0; i < n; i += 8) {
+      c.i = Get64(x + i);
+      d.i = Get64(y + i);
+      c.f = i & 8 ? c.f + d.f : c.f - d.f;
+      Put64(x + i, c.i);
+    }
+  } else if (Rep(rde) == 2) {
+    for (i = 0; i < n; i += 4) {
+      a.i = Get32(x + i);
+      b.i = Get32(y + i);
+      a.f = i & 4 ? a.f + b.f : a.f - b.f;
+      Put32(x + i, a.i);
+    }
+  } else {
+    OpUdImpl(m);
+  }
+  PutVex(A, x, n);
+}
+
+// vunpcklps, vunpcklpd, vunpckhps, vunpckhpd
+static void OpVunpck(P) {
+  int i, j, h, n;
+  u8 x[32], y[32], z[32];
+  n = VL(rde);
+  if (Rep(rde)) OpUdImpl(m);
+  h = Opcode(rde) & 1 ? 8 : 0;
+  ReadVexRm(A, y, n, false);
+  LoadYmm(m, x, Vreg(rde));
+  for (i = 0; i < n; i += 16) {
+    if (Osz(rde)) {
+      memcpy(z + i + 0, x + i + h, 8);
+      memcpy(z + i + 8, y + i + h, 8);
+    } else {
+      for (j = 0; j < 2; ++j) {
+        memcpy(z + i + j * 8 + 0, x + i + h + j * 4, 4);
+        memcpy(z + i + j * 8 + 4, y + i + h + j * 4, 4);
+      }
+    }
+  }
+  PutVex(A, z, n);
+}
+
+// vshufps, vshufpd
+static void OpVshuf(P) {
+  int i, k, n;
+  u8 x[32], y[32], z[32];
+  n = VL(rde);
+  if (Rep(rde)) OpUdImpl(m);
+  ReadVexRm(A, y, n, false);
+  LoadYmm(m, x, Vreg(rde));
+  for (i = 0; i < n; i += 16) {
+    if (Osz(rde)) {
+      k = i / 16 * 2;
+      memcpy(z + i + 0, x + i + (uimm0 >> k & 1) * 8, 8);
+      memcpy(z + i + 8, y + i + (uimm0 >> (k + 1) & 1) * 8, 8);
+    } else {
+      memcpy(z + i + 0, x + i + (uimm0 >> 0 & 3) * 4, 4);
+      memcpy(z + i + 4, x + i + (uimm0 >> 2 & 3) * 4, 4);
+      memcpy(z + i + 8, y + i + (uimm0 >> 4 & 3) * 4, 4);
+      memcpy(z + i + 12, y + i + (uimm0 >> 6 & 3) * 4, 4);
+    }
+  }
+  PutVex(A, z, n);
+}
+
+// vpermilps, vpermilpd with a variable selector in r/m
+static void OpVpermilv(P) {
+  int i, n;
+  u8 x[32], y[32], z[32];
+  n = VL(rde);
+  if (!Osz(rde) || Rexw(rde)) OpUdImpl(m);
+  ReadVexRm(A, y, n, false);
+  LoadYmm(m, x, Vreg(rde));
+  if (Opcode(rde) == 0x0C) {
+    for (i = 0; i < n / 4; ++i) {
+      memcpy(z + i * 4, x + ((i & ~3) + (Get32(y + i * 4) & 3)) * 4, 4);
+    }
+  } else {
+    for (i = 0; i < n / 8; ++i) {
+      memcpy(z + i * 8, x + ((i & ~1) + (Get64(y + i * 8) >> 1 & 1)) * 8, 8);
+    }
+  }
+  PutVex(A, z, n);
+}
+
+// vpermilps, vpermilpd with an immediate selector
+static void OpVpermil(P) {
+  int i, n;
+  u8 y[32], z[32];
+  n = VL(rde);
+  if (!Osz(rde) || Rexw(rde)) OpUdImpl(m);
+  ReadVexRm(A, y, n, false);
+  if (Opcode(rde) == 0x04) {
+    for (i = 0; i < n / 4; ++i) {
+      memcpy(z + i * 4, y + ((i & ~3) + (uimm0 >> (i & 3) * 2 & 3)) * 4, 4);
+    }
+  } else {
+    for (i = 0; i < n / 8; ++i) {
+      memcpy(z + i * 8, y + ((i & ~1) + (uimm0 >> i & 1)) * 8, 8);
+    }
+  }
+  PutVex(A, z, n);
+}
+
+// vmovmskps, vmovmskpd
+static void OpVmovmsk(P) {
+  u32 r;
+  int i, n, w;
+  u8 y[32];
+  n = VL(rde);
+  if (Rep(rde) || !IsModrmRegister(rde)) OpUdImpl(m);
+  w = Osz(rde) ? 8 : 4;
+  LoadYmm(m, y, RexbRm(rde));
+  for (r = i = 0; i < n / w; ++i) {
+    r |= (u32)(y[i * w + w - 1] >> 7) << i;
+  }
+  Put64(RegRexrReg(m, rde), r);
+}
+
+int GetRoundingMode(struct Machine *m, u8 imm) {
+  return imm & 4 ? (m->mxcsr & kMxcsrRc) >> 13 : imm & 3;
+}
+
+double RoundDouble(double x, int mode) {
+  switch (mode) {
+    case 0:
+      return RoundEven(x);
+    case 1:
+      return floor(x);
+    case 2:
+      return ceil(x);
+    case 3:
+      return trunc(x);
+    default:
+      __builtin_unreachable();
+  }
+}
+
+// returns integer indefinite if the value doesn't fit
+static i32 ToInt32(double x) {
+  if (x > -2147483649. && x < 2147483648.) {
+    return x;
+  } else {
+    return INT_MIN;
+  }
+}
+
+// vroundps, vroundpd, vroundss, vroundsd
+static void OpVround(P) {
+  int i, n, mode;
+  u8 x[32], y[32];
+  union FloatPun f;
+  union DoublePun d;
+  n = VL(rde);
+  if (!Osz(rde)) OpUdImpl(m);
+  mode = GetRoundingMode(m, uimm0);
+  switch (Opcode(rde)) {
+    case 0x08:
+      ReadVexRm(A, y, n, false);
+      for (i = 0; i < n; i += 4) {
+        f.i = Get32(y + i);
+        f.f = RoundDouble(f.f, mode);
+        Put32(x + i, f.i);
+      }
+      break;
+    case 0x09:
+      ReadVexRm(A, y, n, false);
+      for (i = 0; i < n; i += 8) {
+        d.i = Get64(y + i);
+        d.f = RoundDouble(d.f, mode);
+        Put64(x + i, d.i);
+      }
+      break;
+    case 0x0A:
+      ReadVexRm(A, y, 4, false);
+      LoadYmm(m, x, Vreg(rde));
+      f.i = Get32(y);
+      f.f = RoundDouble(f.f, mode);
+      Put32(x, f.i);
+      n = 16;
+      break;
+    case 0x0B:
+      ReadVexRm(A, y, 8, false);
+      LoadYmm(m, x, Vreg(rde));
+      d.i = Get64(y);
+      d.f = RoundDouble(d.f, mode);
+      Put64(x, d.i);
+      n = 16;
+      break;
+    default:
+      __builtin_unreachable();
+  }
+  PutVex(A, x, n);
+}
+
+// vcvtps2pd, vcvtpd2ps, vcvtss2sd, vcvtsd2ss
+static void OpVcvt5a(P) {
+  int i, n;
+  u8 x[32], y[32];
+  union FloatPun f;
+  union DoublePun d;
+  n = VL(rde);
+  switch (Rep(rde) | Osz(rde)) {
+    case 0:
+      ReadVexRm(A, y, n / 2, false);
+      for (i = 0; i < n / 8; ++i) {
+        f.i = Get32(y + i * 4);
+        d.f = f.f;
+        Put64(x + i * 8, d.i);
+      }
+      break;
+    case 1:
+      ReadVexRm(A, y, n, false);
+      memset(x, 0, 32);
+      for (i = 0; i < n / 8; ++i) {
+        d.i = Get64(y + i * 8);
+        f.f = d.f;
+        Put32(x + i * 4, f.i);
+      }
+      n = 16;
+      break;
+    case 2:
+      ReadVexRm(A, y, 8, false);
+      LoadYmm(m, x, Vreg(rde));
+      d.i = Get64(y);
+      f.f = d.f;
+      Put32(x, f.i);
+      n = 16;
+      break;
+    case 3:
+      ReadVexRm(A, y, 4, false);
+      LoadYmm(m, x, Vreg(rde));
+      f.i = Get32(y);
+      d.f = f.f;
+      Put64(x, d.i);
+      n = 16;
+      break;
+    default:
+      __builtin_unreachable();
+  }
+  PutVex(A, x, n);
+}
+
+// vcvtdq2ps, vcvtps2dq, vcvttps2dq
+static void OpVcvt5b(P) {
+  int i, n, mode;
+  u8 x[32], y[32];
+  union FloatPun f;
+  n = VL(rde);
+  mode = (m->mxcsr & kMxcsrRc) >> 13;
+  ReadVexRm(A, y, n, false);
+  for (i = 0; i < n; i += 4) {
+    switch (Rep(rde) | Osz(rde)) {
+      case 0:
+        f.f = (i32)Get32(y + i);
+        Put32(x + i, f.i);
+        break;
+      case 1:
+        f.i = Get32(y + i);
+        Put32(x + i, ToInt32(RoundDouble(f.f, mode)));
+        break;
+      case 3:
+        f.i = Get32(y + i);
+        Put32(x + i, ToInt32(f.f));
+        break;
+      default:
+        OpUdImpl(m);
+    }
+  }
+  PutVex(A, x, n);
+}
+
+// vcvttpd2dq, vcvtpd2dq, vcvtdq2pd
+static void OpVcvtE6(P) {
+  int i, n, mode;
+  u8 x[32], y[32];
+  union DoublePun d;
+  n = VL(rde);
+  mode = (m->mxcsr & kMxcsrRc) >> 13;
+  memset(x, 0, 32);
+  switch (Rep(rde) | Osz(rde)) {
+    case 1:
+      ReadVexRm(A, y, n, false);
+      for (i = 0; i < n / 8; ++i) {
+        d.i = Get64(y + i * 8);
+        Put32(x + i * 4, ToInt32(d.f));
+      }
+      n = 16;
+      break;
+    case 2:
+      ReadVexRm(A, y, n, false);
+      for (i = 0; i < n / 8; ++i) {
+        d.i = Get64(y + i * 8);
+        Put32(x + i * 4, ToInt32(RoundDouble(d.f, mode)));
+      }
+      n = 16;
+      break;
+    case 3:
+      ReadVexRm(A, y, n / 2, false);
+      for (i = 0; i < n / 8; ++i) {
+        d.f = (i32)Get32(y + i * 4);
+        Put64(x + i * 8, d.i);
+      }
+      break;
+    default:
+      OpUdImpl(m);
+  }
+  PutVex(A, x, n);
+}
+
+// vcvtsi2ss, vcvtsi2sd
+static void OpVcvtsi2s(P) {
+  i64 v;
+  u8 x[32];
+  union FloatPun f;
+  union DoublePun d;
+  if (!Rep(rde)) OpUdImpl(m);
+  if (Rexw(rde)) {
+    v = (i64)Read64(GetModrmRegisterWordPointerRead8(A));
+  } else {
+    v = (i32)Read32(GetModrmRegisterWordPointerRead4(A));
+  }
+  LoadYmm(m, x, Vreg(rde));
+  if (Rep(rde) == 3) {
+    f.f = v;
+    Put32(x, f.i);
+  } else {
+    d.f = v;
+    Put64(x, d.i);
+  }
+  PutVex(A, x, 16);
+}
+
+// vcvttss2si, vcvttsd2si, vcvtss2si, vcvtsd2si
+static void OpVcvt2si(P) {
+  if (!Rep(rde)) OpUdImpl(m);
+  if (Opcode(rde) == 0x2C) {
+    OpCvtt0f2c(A);
+  } else {
+    OpCvt0f2d(A);
+  }
+}
+
+static void Dpps(u8 x[16], const u8 y[16], unsigned imm) {
+  int i;
+  union FloatPun a, b, s, f[4];
+  for (i = 0; i < 4; ++i) {
+    a.i = Get32(x + i * 4);
+    b.i = Get32(y + i * 4);
+    f[i].f = imm & 0x10 << i ? a.f * b.f : 0;
+  }
+  s.f = (f[0].f + f[1].f) + (f[2].f + f[3].f);
+  for (i = 0; i < 4; ++i) {
+    Put32(x + i * 4, imm & 1 << i ? s.i : 0);
+  }
+}
+
+static void Dppd(u8 x[16], const u8 y[16], unsigned imm) {
+  int i;
+  union DoublePun a, b, s, d[2];
+  for (i = 0; i < 2; ++i) {
+    a.i = Get64(x + i * 8);
+    b.i = Get64(y + i * 8);
+    d[i].f = imm & 0x10 << i ? a.f * b.f : 0;
+  }
+  s.f = d[0].f + d[1].f;
+  for (i = 0; i < 2; ++i) {
+    Put64(x + i * 8, imm & 1 << i ? s.i : 0);
+  }
+}
+
+// vdpps, vdppd
+static void OpVdp(P) {
+  if (Opcode(rde) == 0x40) {
+    OpAvxImm(A, Dpps);
+  } else if (!Ymm(rde)) {
+    OpAvxImm(A, Dppd);
+  } else {
+    OpUdImpl(m);
+  }
+}
+
+static void OpVinsertps(P) {
+  int i;
+  u32 v;
+  u8 x[32];
+  if (!Osz(rde) || Ymm(rde)) OpUdImpl(m);
+  if (IsModrmRegister(rde)) {
+    v = Get32(XmmRexbRm(m, rde) + (uimm0 >> 6) * 4);
+  } else {
+    v = Read32(ComputeReserveAddressRead4(A));
+  }
+  LoadYmm(m, x, Vreg(rde));
+  Put32(x + (uimm0 >> 4 & 3) * 4, v);
+  for (i = 0; i < 4; ++i) {
+    if (uimm0 & 1 << i) {
+      Put32(x + i * 4, 0);
+    }
+  }
+  PutVex(A, x, 16);
+}
+
+// vpcmpestrm, vpcmpestri, vpcmpistrm, vpcmpistri
+static void OpVpcmpstr(P) {
+  if (Ymm(rde)) OpUdImpl(m);
+  OpSsePcmpstr(A);
+  if (!(Opcode(rde) & 1)) {
+    memset(m->ymmh[0], 0, 16);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// DATA MOVEMENT
+
+// vmovups, vmovupd, vmovss, vmovsd
+static void OpVmov10(P) {
+  int n;
+  u8 x[32], y[32];
+  switch (Rep(rde) | Osz(rde)) {
+    case 0:
+    case 1:
+      n = VL(rde);
+      ReadVexRm(A, y, n, false);
+      PutVex(A, y, n);
+      break;
+    case 2:
+    case 3:
+      n = Rep(rde) == 3 ? 4 : 8;
+      if (IsModrmRegister(rde)) {
+        LoadYmm(m, x, Vreg(rde));
+        memcpy(x, XmmRexbRm(m, rde), n);
+      } else {
+        ReadVexRm(A, x, n, false);
+      }
+      PutVex(A, x, 16);
+      break;
+    default:
+      __builtin_unreachable();
+  }
+}
+
+// vmovups, vmovupd, vmovss, vmovsd
+static void OpVmov11(P) {
+  int n;
+  u8 x[32], y[32];
+  LoadYmm(m, y, RexrReg(rde));
+  switch (Rep(rde) | Osz(rde)) {
+    case 0:
+    case 1:
+      n = VL(rde);
+      if (IsModrmRegister(rde)) {
+        StoreYmm(m, RexbRm(rde), y, n);
+      } else {
+        WriteVexMemory(A, y, n, false);
+      }
+      break;
+    case 2:
+    case 3:
+      n = Rep(rde) == 3 ? 4 : 8;
+      if (IsModrmRegister(rde)) {
+        LoadYmm(m, x, Vreg(rde));
+        memcpy(x, y, n);
+        StoreYmm(m, RexbRm(rde), x, 16);
+      } else {
+        WriteVexMemory(A, y, n, false);
+      }
+      break;
+    default:
+      __builtin_unreachable();
+  }
+}
+
+// vmovlps, vmovhlps, vmovlpd, vmovsldup, vmovddup
+static void OpVmov12(P) {
+  int i, n;
+  u8 x[32], y[32];
+  n = VL(rde);
+  switch (Rep(rde) | Osz(rde)) {
+    case 0:
+    case 1:
+      if (Ymm(rde)) OpUdImpl(m);
+      LoadYmm(m, x, Vreg(rde));
+      if (IsModrmRegister(rde)) {
+        if (Osz(rde)) OpUdImpl(m);
+        memcpy(x, XmmRexbRm(m, rde) + 8, 8);
+      } else {
+        memcpy(x, ComputeReserveAddressRead8(A), 8);
+      }
+      n = 16;
+      break;
+    case 2:
+      ReadVexRm(A, y, Ymm(rde) ? 32 : 8, false);
+      for (i = 0; i < n; i += 16) {
+        memcpy(x + i + 0, y + i, 8);
+        memcpy(x + i + 8, y + i, 8);
+      }
+      break;
+    case 3:
+      ReadVexRm(A, y, n, false);
+      for (i = 0; i < n; i += 8) {
+        memcpy(x + i + 0, y + i, 4);
+        memcpy(x + i + 4, y + i, 4);
+      }
+      break;
+    default:
+      __builtin_unreachable();
+  }
+  PutVex(A, x, n);
+}
+
+// vmovhps, vmovlhps, vmovhpd, vmovshdup
+static void OpVmov16(P) {
+  int i, n;
+  u8 x[32], y[32];
+  n = VL(rde);
+  switch (Rep(rde) | Osz(rde)) {
+    case 0:
+    case 1:
+      if (Ymm(rde)) OpUdImpl(m);
+      LoadYmm(m, x, Vreg(rde));
+      if (IsModrmRegister(rde)) {
+        if (Osz(rde)) OpUdImpl(m);
+        memcpy(x + 8, XmmRexbRm(m, rde), 8);
+      } else {
+        memcpy(x + 8, ComputeReserveAddressRead8(A), 8);
+      }
+      n = 16;
+      break;
+    case 3:
+      ReadVexRm(A, y, n, false);
+      for (i = 0; i < n; i += 8) {
+        memcpy(x + i + 0, y + i + 4, 4);
+        memcpy(x + i + 4, y + i + 4, 4);
+      }
+      break;
+    default:
+      OpUdImpl(m);
+  }
+  PutVex(A, x, n);
+}
+
+// vmovlps, vmovlpd, vmovhps, vmovhpd to memory
+static void OpVmov13(P) {
+  if (Rep(rde) || Ymm(rde) || IsModrmRegister(rde)) OpUdImpl(m);
+  WriteVexMemory(A, XmmRexrReg(m, rde) + (Opcode(rde) & 4 ? 8 : 0), 8, false);
+}
+
+// vmovaps, vmovapd
+static void OpVmov28(P) {
+  u8 y[32];
+  if (Rep(rde)) OpUdImpl(m);
+  ReadVexRm(A, y, VL(rde), true);
+  PutVex(A, y, VL(rde));
+}
+
+// vmovaps, vmovapd, vmovntps, vmovntpd, vmovntdq to memory
+static void OpVmov29(P) {
+  u8 y[32];
+  if (Rep(rde)) OpUdImpl(m);
+  if (Opcode(rde) == 0xE7 && !Osz(rde)) OpUdImpl(m);
+  LoadYmm(m, y, RexrReg(rde));
+  if (IsModrmRegister(rde)) {
+    if (Opcode(rde) != 0x29) OpUdImpl(m);
+    StoreYmm(m, RexbRm(rde), y, VL(rde));
+  } else {
+    WriteVexMemory(A, y, VL(rde), true);
+  }
+}
+
+// vmovdqa, vmovdqu, vlddqu, vmovntdqa
+static void OpVmov6f(P) {
+  u8 y[32];
+  bool aligned;
+  switch (Mopcode(rde)) {
+    case 0x16F:
+      if (!Osz(rde) && Rep(rde) != 3) OpUdImpl(m);
+      aligned = Osz(rde);
+      break;
+    case 0x1F0:
+      if (Rep(rde) != 2 || IsModrmRegister(rde)) OpUdImpl(m);
+      aligned = false;
+      break;
+    case 0x22A:
+      if (!Osz(rde) || IsModrmRegister(rde)) OpUdImpl(m);
+      aligned = true;
+      break;
+    default:
+      __builtin_unreachable();
+  }
+  ReadVexRm(A, y, VL(rde), aligned);
+  PutVex(A, y, VL(rde));
+}
+
+// vmovdqa, vmovdqu to r/m
+static void OpVmov7f(P) {
+  u8 y[32];
+  if (!Osz(rde) && Rep(rde) != 3) OpUdImpl(m);
+  LoadYmm(m, y, RexrReg(rde));
+  if (IsModrmRegister(rde)) {
+    StoreYmm(m, RexbRm(rde), y, VL(rde));
+  } else {
+    WriteVexMemory(A, y, VL(rde), Osz(rde));
+  }
+}
+
+// vmovd, vmovq from general register or memory
+static void OpVmov6e(P) {
+  u8 x[32];
+  if (!Osz(rde) || Ymm(rde)) OpUdImpl(m);
+  memset(x, 0, 32);
+  if (Rexw(rde)) {
+    memcpy(x, GetModrmRegisterWordPointerRead8(A), 8);
+  } else {
+    memcpy(x, GetModrmRegisterWordPointerRead4(A), 4);
+  }
+  PutVex(A, x, 16);
+}
+
+// vmovd, vmovq to general register or memory, and vmovq xmm, xmm/m64
+static void OpVmov7e(P) {
+  u8 x[32];
+  if (Ymm(rde)) OpUdImpl(m);
+  if (Osz(rde)) {
+    if (IsModrmRegister(rde)) {
+      Put64(RegRexbRm(m, rde), Rexw(rde) ? Get64(XmmRexrReg(m, rde))
+                                         : Get32(XmmRexrReg(m, rde)));
+    } else {
+      WriteVexMemory(A, XmmRexrReg(m, rde), Rexw(rde) ? 8 : 4, false);
+    }
+  } else if (Rep(rde) == 3) {
+    ReadVexRm(A, x, 8, false);
+    memset(x + 8, 0, 24);
+    PutVex(A, x, 16);
+  } else {
+    OpUdImpl(m);
+  }
+}
+
+// vmovq xmm/m64, xmm
+static void OpVmovD6(P) {
+  u8 x[32];
+  if (!Osz(rde) || Ymm(rde)) OpUdImpl(m);
+  if (IsModrmRegister(rde)) {
+    memset(x, 0, 32);
+    memcpy(x, XmmRexrReg(m, rde), 8);
+    StoreYmm(m, RexbRm(rde), x, 16);
+  } else {
+    WriteVexMemory(A, XmmRexrReg(m, rde), 8, false);
+  }
+}
+
+// vzeroupper, vzeroall
+static void OpVzero(P) {
+  if (Osz(rde) || Rep(rde)) OpUdImpl(m);
+  if (Ymm(rde)) {
+    memset(m->xmm, 0, sizeof(m->xmm));
+  }
+  memset(m->ymmh, 0, sizeof(m->ymmh));
+}
+
+// vldmxcsr, vstmxcsr
+static void OpVmxcsr(P) {
+  if (Osz(rde) || Rep(rde) || Ymm(rde) || IsModrmRegister(rde)) {
+    OpUdImpl(m);
+  }
+  switch (ModrmReg(rde)) {
+    case 2:
+      SetMxcsr(m, Load32(ComputeReserveAddressRead4(A)));
+      break;
+    case 3:
+      Store32(ComputeReserveAddressWrite4(A), GetMxcsr(m));
+      break;
+    default:
+      OpUdImpl(m);
+  }
+}
+
+// returns implementation of vex encoded op, or null if the legacy op
+// knows how to handle vex encoding itself (e.g. by calling OpAvx)
+nexgen32e_f GetAvxOp(long op) {
+  switch (op) {
+    XLAT(0x110, OpVmov10);
+    XLAT(0x111, OpVmov11);
+    XLAT(0x112, OpVmov12);
+    XLAT(0x113, OpVmov13);
+    XLAT(0x114, OpVunpck);
+    XLAT(0x115, OpVunpck);
+    XLAT(0x116, OpVmov16);
+    XLAT(0x117, OpVmov13);
+    XLAT(0x128, OpVmov28);
+    XLAT(0x129, OpVmov29);
+    XLAT(0x12A, OpVcvtsi2s);
+    XLAT(0x12B, OpVmov29);
+    XLAT(0x12C, OpVcvt2si);
+    XLAT(0x12D, OpVcvt2si);
+    XLAT(0x150, OpVmovmsk);
+    XLAT(0x151, OpVsqrt);
+    XLAT(0x152, OpVrsqrt);
+    XLAT(0x153, OpVrcp);
+    XLAT(0x154, OpVlogic);
+    XLAT(0x155, OpVlogic);
+    XLAT(0x156, OpVlogic);
+    XLAT(0x157, OpVlogic);
+    XLAT(0x158, OpVadd);
+    XLAT(0x159, OpVmul);
+    XLAT(0x15A, OpVcvt5a);
+    XLAT(0x15B, OpVcvt5b);
+    XLAT(0x15C, OpVsub);
+    XLAT(0x15D, OpVmin);
+    XLAT(0x15E, OpVdiv);
+    XLAT(0x15F, OpVmax);
+    XLAT(0x16E, OpVmov6e);
+    XLAT(0x16F, OpVmov6f);
+    XLAT(0x170, OpVpshuf);
+    XLAT(0x177, OpVzero);
+    XLAT(0x17C, OpVhadd);
+    XLAT(0x17D, OpVhadd);
+    XLAT(0x17E, OpVmov7e);
+    XLAT(0x17F, OpVmov7f);
+    XLAT(0x1AE, OpVmxcsr);
+    XLAT(0x1C2, OpVcmp);
+    XLAT(0x1C4, OpVpinsrw);
+    XLAT(0x1C6, OpVshuf);
+    XLAT(0x1D0, OpVaddsub);
+    XLAT(0x1D6, OpVmovD6);
+    XLAT(0x1D7, OpVpmovmskb);
+    XLAT(0x1E6, OpVcvtE6);
+    XLAT(0x1E7, OpVmov29);
+    XLAT(0x1F0, OpVmov6f);
+    XLAT(0x20C, OpVpermilv);
+    XLAT(0x20D, OpVpermilv);
+    XLAT(0x20E, OpVptest);
+    XLAT(0x20F, OpVptest);
+    XLAT(0x213, OpVcvtph2ps);
+    XLAT(0x216, OpVpermd);
+    XLAT(0x217, OpVptest);
+    XLAT(0x218, OpVbroadcast);
+    XLAT(0x219, OpVbroadcast);
+    XLAT(0x21A, OpVbroadcast);
+    XLAT(0x220, OpVpmovx);
+    XLAT(0x221, OpVpmovx);
+    XLAT(0x222, OpVpmovx);
+    XLAT(0x223, OpVpmovx);
+    XLAT(0x224, OpVpmovx);
+    XLAT(0x225, OpVpmovx);
+    XLAT(0x22A, OpVmov6f);
+    XLAT(0x22C, OpVmaskmov);
+    XLAT(0x22D, OpVmaskmov);
+    XLAT(0x22E, OpVmaskmov);
+    XLAT(0x22F, OpVmaskmov);
+    XLAT(0x230, OpVpmovx);
+    XLAT(0x231, OpVpmovx);
+    XLAT(0x232, OpVpmovx);
+    XLAT(0x233, OpVpmovx);
+    XLAT(0x234, OpVpmovx);
+    XLAT(0x235, OpVpmovx);
+    XLAT(0x236, OpVpermd);
+    XLAT(0x245, OpVpshv);
+    XLAT(0x246, OpVpshv);
+    XLAT(0x247, OpVpshv);
+    XLAT(0x258, OpVbroadcast);
+    XLAT(0x259, OpVbroadcast);
+    XLAT(0x25A, OpVbroadcast);
+    XLAT(0x278, OpVbroadcast);
+    XLAT(0x279, OpVbroadcast);
+    XLAT(0x28C, OpVmaskmov);
+    XLAT(0x28E, OpVmaskmov);
+    XLAT(0x290, OpVgather);
+    XLAT(0x291, OpVgather);
+    XLAT(0x292, OpVgather);
+    XLAT(0x293, OpVgather);
+    case 0x296 ... 0x29F:
+    case 0x2A6 ... 0x2AF:
+    case 0x2B6 ... 0x2BF:
+      return OpVfma;
+    XLAT(0x300, OpVpermq);
+    XLAT(0x301, OpVpermq);
+    XLAT(0x302, OpVblend);
+    XLAT(0x304, OpVpermil);
+    XLAT(0x305, OpVpermil);
+    XLAT(0x306, OpVperm2);
+    XLAT(0x308, OpVround);
+    XLAT(0x309, OpVround);
+    XLAT(0x30A, OpVround);
+    XLAT(0x30B, OpVround);
+    XLAT(0x30C, OpVblend);
+    XLAT(0x30D, OpVblend);
+    XLAT(0x30E, OpVblend);
+    XLAT(0x314, OpVpextr);
+    XLAT(0x315, OpVpextr);
+    XLAT(0x316, OpVpextr);
+    XLAT(0x317, OpVpextr);
+    XLAT(0x318, OpVinsert128);
+    XLAT(0x319, OpVextract128);
+    XLAT(0x31D, OpVcvtps2ph);
+    XLAT(0x320, OpVpinsr);
+    XLAT(0x321, OpVinsertps);
+    XLAT(0x322, OpVpinsr);
+    XLAT(0x338, OpVinsert128);
+    XLAT(0x339, OpVextract128);
+    XLAT(0x340, OpVdp);
+    XLAT(0x341, OpVdp);
+    XLAT(0x342, OpVmpsadbw);
+    XLAT(0x346, OpVperm2);
+    XLAT(0x34A, OpVblendv);
+    XLAT(0x34B, OpVblendv);
+    XLAT(0x34C, OpVblendv);
+    XLAT(0x360, OpVpcmpstr);
+    XLAT(0x361, OpVpcmpstr);
+    XLAT(0x362, OpVpcmpstr);
+    XLAT(0x363, OpVpcmpstr);
+    case 0x12E:  // vucomiss, vucomisd
+    case 0x12F:  // vcomiss, vcomisd
+    case 0x160 ... 0x16D:
+    case 0x171 ... 0x176:
+    case 0x1C5:  // vpextrw
+    case 0x1D1 ... 0x1D5:
+    case 0x1D8 ... 0x1E5:
+    case 0x1E8 ... 0x1EF:
+    case 0x1F1 ... 0x1F7:
+    case 0x1F8 ... 0x1FE:
+    case 0x200 ... 0x20B:
+    case 0x21C ... 0x21E:
+    case 0x228:
+    case 0x229:
+    case 0x22B:
+    case 0x237 ... 0x241:
+    case 0x2DB ... 0x2DF:  // vaesenc, etc.
+    case 0x30F:  // vpalignr
+    case 0x344:  // vpclmulqdq
+    case 0x3DF:  // vaeskeygenassist
+      return 0;
+    default:
+      return OpUd;
+  }
+}
+
+#endif /* DISABLE_AVX */
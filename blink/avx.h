@@ -0,0 +1,23 @@
+#ifndef BLINK_AVX_H_
+#define BLINK_AVX_H_
+#include "blink/machine.h"
+
+nexgen32e_f GetAvxOp(long);
+void OpAvx(P, void (*)(u8[16], const u8[16]));
+void OpAvxImm(P, void (*)(u8[16], const u8[16], unsigned));
+void OpAvxShift(P, void (*)(u8[16], unsigned));
+
+void LoadYmm(struct Machine *, u8[32], int);
+void StoreYmm(struct Machine *, int, const u8[32], int);
+void ReadVexRm(P, u8[32], size_t, bool);
+void WriteVexMemory(P, const u8 *, size_t, bool);
+void PutVex(P, const u8[32], int);
+void PutVexRm(P, const u8[32], int);
+int GetRoundingMode(struct Machine *, u8);
+double RoundDouble(double, int);
+
+void OpVfma(P);
+void OpVcvtph2ps(P);
+void OpVcvtps2ph(P);
+
+#endif /* BLINK_AVX_H_ */
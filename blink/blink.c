@@ -90,7 +90,7 @@ Toolchain: " BUILD_TOOLCHAIN "\n\
 Revision: #" BLINK_COMMITS " " BLINK_GITSHA "\n\
 Config: ./configure MODE=" BUILD_MODE " " CONFIG_ARGUMENTS "\n"
 
-#define OPTS "hvjemZs0L:C:"
+#define OPTS "hvjemZs0L:C:J:"
 
 _Alignas(1) static const char USAGE[] =
     " [-" OPTS "] PROG [ARGS...]\n"
@@ -98,6 +98,7 @@ _Alignas(1) static const char USAGE[] =
     "  -h                   help\n"
 #ifndef DISABLE_JIT
     "  -j                   disable jit\n"
+    "  -J PATH              persistent jit cache directory\n"
 #endif
     "  -v                   show version\n"
 #ifndef NDEBUG
@@ -115,7 +116,7 @@ _Alignas(1) static const char USAGE[] =
 #if !defined(DISABLE_OVERLAYS) || !defined(DISABLE_VFS)
     "  -C PATH              sets chroot dir or overlay spec [default \":o\"]\n"
 #endif
-#if !defined(DISABLE_OVERLAYS) || !defined(NDEBUG)
+#if !defined(DISABLE_OVERLAYS) || !defined(DISABLE_JIT) || !defined(NDEBUG)
     "Environment:\n"
 #endif
 #ifndef DISABLE_OVERLAYS
@@ -124,6 +125,11 @@ _Alignas(1) static const char USAGE[] =
 #ifndef DISABLE_VFS
     "  $BLINK_PREFIX        file system root [default \"/\"]\n"
 #endif
+#ifndef DISABLE_JIT
+    "  $BLINK_JIT_CACHE     persistent jit cache dir (same as -J flag)\n"
+    "  $BLINK_JIT_THRESHOLD executions before code is jitted [default 8]\n"
+    "  $BLINK_JIT_MEMORY    max megabytes of jit code memory [default 256]\n"
+#endif
 #ifndef NDEBUG
 
     "  $BLINK_LOG_FILENAME  log filename (same as -L flag)\n"
@@ -265,6 +271,7 @@ _Noreturn static void PrintVersion(void) {
 
 static void GetOpts(int argc, char *argv[]) {
   int opt;
+  const char *s;
   FLAG_nolinear = !CanHaveLinearMemory();
 #ifndef DISABLE_OVERLAYS
   FLAG_overlays = getenv("BLINK_OVERLAYS");
@@ -276,6 +283,9 @@ static void GetOpts(int argc, char *argv[]) {
 #if LOG_ENABLED
   FLAG_logpath = getenv("BLINK_LOG_FILENAME");
 #endif
+  FLAG_jitcache = getenv("BLINK_JIT_CACHE");
+  if ((s = getenv("BLINK_JIT_THRESHOLD"))) FLAG_jitthreshold = atoi(s);
+  if ((s = getenv("BLINK_JIT_MEMORY"))) FLAG_jitmemory = atol(s) * 1048576;
 #ifdef __COSMOPOLITAN__
   if (IsWindows()) {
     FLAG_nojit = true;
@@ -290,6 +300,9 @@ static void GetOpts(int argc, char *argv[]) {
       case 'j':
         FLAG_nojit = true;
         break;
+      case 'J':
+        FLAG_jitcache = optarg_;
+        break;
       case 's':
         ++FLAG_strace;
         break;
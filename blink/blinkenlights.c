@@ -3548,6 +3548,9 @@ static void Execute(void) {
     ProfileOp(m, GetPc(m) - m->oplen);
   }
   if (atomic_load_explicit(&m->attention, memory_order_acquire)) {
+#ifdef HAVE_JIT
+    ObserveJitEpoch(&m->jitreader);
+#endif
     CheckForSignals(m);
   }
 }
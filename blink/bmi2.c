@@ -16,13 +16,19 @@
 │ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
 │ PERFORMANCE OF THIS SOFTWARE.                                                │
 ╚─────────────────────────────────────────────────────────────────────────────*/
+#include <stddef.h>
+
+#include "blink/assert.h"
 #include "blink/bus.h"
 #include "blink/endian.h"
 #include "blink/flags.h"
+#include "blink/intrin.h"
+#include "blink/jit.h"
 #include "blink/log.h"
 #include "blink/machine.h"
 #include "blink/modrm.h"
 #include "blink/rde.h"
+#include "blink/stats.h"
 
 #ifndef DISABLE_BMI2
 
@@ -38,6 +44,12 @@
 
 static u64 Pdep(u64 x, u64 mask) {
   u64 r, b;
+#if X86_INTRINSICS
+  if (X86_HAVE(Bmi2)) {
+    asm("pdep\t%2,%1,%0" : "=r"(r) : "r"(x), "rm"(mask));
+    return r;
+  }
+#endif
   for (r = 0, b = 1; mask; mask >>= 1, b <<= 1) {
     if (mask & 1) {
       if (x & 1) r |= b;
@@ -49,6 +61,12 @@ static u64 Pdep(u64 x, u64 mask) {
 
 static u64 Pext(u64 x, u64 mask) {
   u64 r, b;
+#if X86_INTRINSICS
+  if (X86_HAVE(Bmi2)) {
+    asm("pext\t%2,%1,%0" : "=r"(r) : "r"(x), "rm"(mask));
+    return r;
+  }
+#endif
   for (r = 0, b = 1; mask; mask >>= 1, x >>= 1) {
     if (mask & 1) {
       if (x & 1) r |= b;
@@ -58,6 +76,29 @@ static u64 Pext(u64 x, u64 mask) {
   return r;
 }
 
+#if defined(HAVE_JIT) && defined(__x86_64__)
+// runs pdep and pext natively, reading the source operand out of the
+// register file, which is kept up to date by the pinned register cache
+static void JitPbit(P) {
+  u8 *p, code[16];
+  Jitter(A, "wB");  // res0 = GetRegOrMem[force32+bit](RexbRm)
+  p = code;
+  if (Rexw(rde)) *p++ = kAmdRexw;  // mov vreg(%rbx),%rdx
+  *p++ = 0x8b;
+  *p++ = 0200 | kAmdDx << 3 | kJitSav0;
+  Write32(p, offsetof(struct Machine, weg) + Vreg(rde) * 8), p += 4;
+  *p++ = 0xc4;  // pdep %rax,%rdx,%rax
+  *p++ = 0xe2;
+  *p++ = Rexw(rde) << 7 | (~kAmdDx & 15) << 3 | (Rep(rde) == 2 ? 3 : 2);
+  *p++ = 0xf5;
+  *p++ = 0300 | kJitRes0 << 3 | kJitRes0;
+  unassert(p - code <= sizeof(code));
+  AppendJit(m->path.jb, code, p - code);
+  Jitter(A, "r0z3C");  // PutReg[force64bit](RexrReg, res0)
+  STATISTIC(++bits_lowered);
+}
+#endif
+
 static void OpPbit(P, u64 op(u64, u64)) {
   if (Rexw(rde)) {
     Put64(RegRexrReg(m, rde), op(Get64(RegVreg(m, rde)),
@@ -67,6 +108,11 @@ static void OpPbit(P, u64 op(u64, u64)) {
           (u32)op(Get32(RegVreg(m, rde)),
                   Load32(GetModrmRegisterWordPointerRead4(A))));
   }
+#if defined(HAVE_JIT) && defined(__x86_64__)
+  if (IsMakingPath(m) && X86_HAVE(Bmi2)) {
+    JitPbit(A);
+  }
+#endif
 }
 
 static void OpBzhi(P) {
@@ -16,6 +16,8 @@
 │ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
 │ PERFORMANCE OF THIS SOFTWARE.                                                │
 ╚─────────────────────────────────────────────────────────────────────────────*/
+#include <string.h>
+
 #include "blink/bitscan.h"
 #include "blink/endian.h"
 #include "blink/machine.h"
@@ -39,13 +41,22 @@ static struct clmul clmul(u64 a, u64 b) {
 }
 
 void OpSsePclmulqdq(P) {
+  u8 *x;
   struct clmul res;
   if (Osz(rde)) {
+    // vpclmulqdq takes its first source from vex.vvvv
+    x = Vex(rde) ? m->xmm[Vreg(rde)] : XmmRexrReg(m, rde);
+    if (Ymm(rde)) OpUdImpl(m);
     res = clmul(
-        Get64(XmmRexrReg(m, rde) + ((uimm0 & 0x01) << 3)),
+        Get64(x + ((uimm0 & 0x01) << 3)),
         Read64(GetModrmRegisterXmmPointerRead16(A) + ((uimm0 & 0x10) >> 1)));
     Put64(XmmRexrReg(m, rde) + 0, res.x);
     Put64(XmmRexrReg(m, rde) + 8, res.y);
+#ifndef DISABLE_AVX
+    if (Vex(rde)) {
+      memset(m->ymmh[RexrReg(rde)], 0, 16);
+    }
+#endif
   } else {
     OpUdImpl(m);
   }
@@ -67,7 +67,7 @@ void OpCpuid(P) {
   ax = bx = cx = dx = 0;
   switch (Get32(m->ax)) {
     case 0:
-      ax = 7;
+      ax = 0xd;
       goto vendor;
     case 0x80000000:
       ax = 0x80000001;
@@ -94,7 +94,7 @@ void OpCpuid(P) {
       cx |= 1 << 9;    // ssse3
       cx |= 1 << 23;   // popcnt
       cx |= 1 << 30;   // rdrnd
-      cx |= 0 << 25;   // aes
+      cx |= 1 << 25;   // aes
       cx |= 1 << 13;   // cmpxchg16b
       cx |= 1u << 31;  // hypervisor
       dx |= 1 << 4;    // tsc
@@ -106,8 +106,15 @@ void OpCpuid(P) {
       dx |= 1 << 24;   // fxsave
       dx |= 1 << 25;   // sse
       dx |= 1 << 26;   // sse2
-      cx |= 0 << 19;   // sse4.1
-      cx |= 0 << 20;   // sse4.2
+      cx |= 1 << 19;   // sse4.1
+      cx |= 1 << 20;   // sse4.2
+      cx |= 1 << 26;   // xsave
+      cx |= 1 << 27;   // osxsave
+#ifndef DISABLE_AVX
+      cx |= 1 << 28;  // avx
+      cx |= 1 << 12;  // fma
+      cx |= 1 << 29;  // f16c
+#endif
 #ifndef DISABLE_X87
       dx |= 1 << 0;  // fpu
 #endif
@@ -129,6 +136,27 @@ void OpCpuid(P) {
           bx |= 1 << 8;   // bmi2
           bx |= 1 << 19;  // adx
 #endif
+          bx |= 1 << 29;  // sha
+#ifndef DISABLE_AVX
+          bx |= 1 << 5;  // avx2
+#endif
+          break;
+        default:
+          break;
+      }
+      break;
+    case 0xd:  // processor extended state enumeration
+      switch (Get32(m->cx)) {
+        case 0:
+          ax = kXcr0;
+          bx = kXcr0 & 4 ? 832 : 576;  // size of xsave area
+          cx = kXcr0 & 4 ? 832 : 576;
+          break;
+        case 2:  // avx state component
+          if (kXcr0 & 4) {
+            ax = 256;
+            bx = 576;
+          }
           break;
         default:
           break;
@@ -137,6 +165,7 @@ void OpCpuid(P) {
     case 0x80000001:
       jit = !IsJitDisabled(&m->system->jit);
       cx |= 1 << 0;     // lahf
+      cx |= 1 << 5;     // lzcnt
       cx |= jit << 31;  // jit
       dx |= 1 << 0;     // fpu
       dx |= 1 << 8;     // cmpxchg8b
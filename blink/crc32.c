@@ -16,10 +16,17 @@
 │ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
 │ PERFORMANCE OF THIS SOFTWARE.                                                │
 ╚─────────────────────────────────────────────────────────────────────────────*/
+#ifdef __aarch64__
+#include <arm_acle.h>
+#endif
+
 #include "blink/bus.h"
 #include "blink/endian.h"
+#include "blink/intrin.h"
+#include "blink/jit.h"
 #include "blink/machine.h"
 #include "blink/modrm.h"
+#include "blink/stats.h"
 #include "blink/swap.h"
 #include "blink/types.h"
 
@@ -47,6 +54,41 @@ static u32 ReverseBits32(u32 x) {
 static u32 Castagnoli(u32 h, u64 w, long n) {
   long i;
   static int once;
+#if X86_INTRINSICS
+  if (X86_HAVE(Sse42)) {
+    u64 q = h;
+    switch (n) {
+      case 1:
+        asm("crc32b\t%1,%k0" : "+r"(q) : "rm"((u8)w));
+        break;
+      case 2:
+        asm("crc32w\t%1,%k0" : "+r"(q) : "rm"((u16)w));
+        break;
+      case 4:
+        asm("crc32l\t%1,%k0" : "+r"(q) : "rm"((u32)w));
+        break;
+      case 8:
+        asm("crc32q\t%1,%0" : "+r"(q) : "rm"(w));
+        break;
+      default:
+        __builtin_unreachable();
+    }
+    return q;
+  }
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+  switch (n) {
+    case 1:
+      return __crc32cb(h, w);
+    case 2:
+      return __crc32ch(h, w);
+    case 4:
+      return __crc32cw(h, w);
+    case 8:
+      return __crc32cd(h, w);
+    default:
+      __builtin_unreachable();
+  }
+#endif
   if (!once) {
     InitializeCrc32(kCastagnoli, ReverseBits32(0x1edc6f41));
     once = 1;
@@ -58,17 +100,59 @@ static u32 Castagnoli(u32 h, u64 w, long n) {
   return h;
 }
 
+#if defined(HAVE_JIT) && \
+    (defined(__x86_64__) || (defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)))
+// lowers crc32 to the host instruction, which both architectures have
+// for the castagnoli polynomial, e.g. crc32b %r12b,%eax or crc32cb w0,w0,w20
+static void JitCrc32(P) {
+  int log2sz = RegLog2(rde);
+  Jitter(A,
+         "B"      // res0 = GetRegOrMem(RexbRm)
+         "r0s1="  // sav1 = res0
+         "z2A");  // res0 = GetReg[force32bit](RexrReg)
+#ifdef __x86_64__
+  u8 *p, code[8];
+  p = code;
+  if (log2sz == 1) *p++ = 0x66;
+  *p++ = 0xf2;
+  *p++ = kAmdRexb | (log2sz == 3) << 3;
+  *p++ = 0x0f;
+  *p++ = 0x38;
+  *p++ = 0xf0 | !!log2sz;
+  *p++ = 0300 | kJitRes0 << 3 | (kJitSav1 & 7);
+  AppendJit(m->path.jb, code, p - code);
+#else
+  u32 code[] = {
+      0x1ac05000 | (u32)(log2sz == 3) << 31 | log2sz << 10 |  //
+      kJitSav1 << 16 | kJitRes0 << 5 | kJitRes0,
+  };
+  AppendJit(m->path.jb, code, sizeof(code));
+#endif
+  Jitter(A, "r0z3C");  // PutReg[force64bit](RexrReg, res0)
+  STATISTIC(++bits_lowered);
+}
+#endif
+
 static void OpCrc32(P) {
   Put64(RegRexrReg(m, rde),
         Castagnoli(Get32(RegRexrReg(m, rde)),
                    ReadRegisterOrMemoryBW(rde, GetModrmReadBW(A)),
                    1 << RegLog2(rde)));
+#if defined(HAVE_JIT) && defined(__x86_64__)
+  if (IsMakingPath(m) && X86_HAVE(Sse42)) {
+    JitCrc32(A);
+  }
+#elif defined(HAVE_JIT) && defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+  if (IsMakingPath(m)) {
+    JitCrc32(A);
+  }
+#endif
 }
 
 void Op2f01(P) {
   if (!Rep(rde) && !Osz(rde)) {
     OpUdImpl(m);  // TODO: movbe
-  } else if (Rep(rde) == 2 && !Osz(rde)) {
+  } else if (Rep(rde) == 2) {
     OpCrc32(A);
   } else {
     OpUdImpl(m);
@@ -36,7 +36,15 @@
 #define kOpCvt0f5b  16
 #define kOpCvt0fE6  20
 
+// the host already rounds like the guest on x86-64, see SetMxcsr(),
+// but rint() can't be used, since gcc inlines it assuming nearest
 static double SseRoundDouble(struct Machine *m, double x) {
+#ifdef MXCSR_NATIVE
+  i64 n;
+  if (!(fabs(x) < 0x1p63)) return x;
+  asm("cvtsd2si\t%1,%0" : "=r"(n) : "x"(x));
+  return n;
+#else
   switch ((m->mxcsr & kMxcsrRc) >> 13) {
     case 0:
       return rint(x);
@@ -49,6 +57,29 @@ static double SseRoundDouble(struct Machine *m, double x) {
     default:
       __builtin_unreachable();
   }
+#endif
+}
+
+static float SseRoundFloat(struct Machine *m, float x) {
+#ifdef MXCSR_NATIVE
+  i64 n;
+  if (!(fabsf(x) < 0x1p63f)) return x;
+  asm("cvtss2si\t%1,%0" : "=r"(n) : "x"(x));
+  return n;
+#else
+  switch ((m->mxcsr & kMxcsrRc) >> 13) {
+    case 0:
+      return rintf(x);
+    case 1:
+      return floorf(x);
+    case 2:
+      return ceilf(x);
+    case 3:
+      return truncf(x);
+    default:
+      __builtin_unreachable();
+  }
+#endif
 }
 
 static void OpGdqpWssCvttss2si(P) {
@@ -73,7 +104,7 @@ static void OpGdqpWssCvtss2si(P) {
   i64 n;
   union FloatPun f;
   f.i = Read32(GetModrmRegisterXmmPointerRead4(A));
-  n = rintf(f.f);
+  n = SseRoundFloat(m, f.f);
   if (!Rexw(rde)) n &= 0xffffffff;
   Put64(RegRexrReg(m, rde), n);
 }
@@ -181,22 +212,7 @@ static void OpPpiWpsqCvtps2pi(P) {
   p = GetModrmRegisterXmmPointerRead8(A);
   f[0].i = Read32(p + 0 * 4);
   f[1].i = Read32(p + 1 * 4);
-  switch ((m->mxcsr & kMxcsrRc) >> 13) {
-    case 0:
-      for (i = 0; i < 2; ++i) n[i] = rintf(f[i].f);
-      break;
-    case 1:
-      for (i = 0; i < 2; ++i) n[i] = floorf(f[i].f);
-      break;
-    case 2:
-      for (i = 0; i < 2; ++i) n[i] = ceilf(f[i].f);
-      break;
-    case 3:
-      for (i = 0; i < 2; ++i) n[i] = truncf(f[i].f);
-      break;
-    default:
-      __builtin_unreachable();
-  }
+  for (i = 0; i < 2; ++i) n[i] = SseRoundFloat(m, f[i].f);
   Put32(MmReg(m, rde) + 0, n[0]);
   Put32(MmReg(m, rde) + 4, n[1]);
 }
@@ -343,22 +359,7 @@ static void OpVdqWpsCvtps2dq(P) {
   f[1].i = Read32(p + 1 * 4);
   f[2].i = Read32(p + 2 * 4);
   f[3].i = Read32(p + 3 * 4);
-  switch ((m->mxcsr & kMxcsrRc) >> 13) {
-    case 0:
-      for (i = 0; i < 4; ++i) n[i] = rintf(f[i].f);
-      break;
-    case 1:
-      for (i = 0; i < 4; ++i) n[i] = floorf(f[i].f);
-      break;
-    case 2:
-      for (i = 0; i < 4; ++i) n[i] = ceilf(f[i].f);
-      break;
-    case 3:
-      for (i = 0; i < 4; ++i) n[i] = truncf(f[i].f);
-      break;
-    default:
-      __builtin_unreachable();
-  }
+  for (i = 0; i < 4; ++i) n[i] = SseRoundFloat(m, f[i].f);
   Put32(XmmRexrReg(m, rde) + 0 * 4, n[0]);
   Put32(XmmRexrReg(m, rde) + 1 * 4, n[1]);
   Put32(XmmRexrReg(m, rde) + 2 * 4, n[2]);
@@ -376,6 +377,7 @@ static void OpVdqWpdCvttpd2dq(P) {
   n[1] = d[1].f;
   Put32(XmmRexrReg(m, rde) + 0, n[0]);
   Put32(XmmRexrReg(m, rde) + 4, n[1]);
+  Put64(XmmRexrReg(m, rde) + 8, 0);
 }
 
 static void OpVdqWpdCvtpd2dq(P) {
@@ -389,6 +391,7 @@ static void OpVdqWpdCvtpd2dq(P) {
   for (i = 0; i < 2; ++i) n[i] = SseRoundDouble(m, d[i].f);
   Put32(XmmRexrReg(m, rde) + 0, n[0]);
   Put32(XmmRexrReg(m, rde) + 4, n[1]);
+  Put64(XmmRexrReg(m, rde) + 8, 0);
 }
 
 static void OpCvt(P, unsigned long op) {
@@ -452,10 +455,10 @@ static void OpCvt(P, unsigned long op) {
       OpVdqWpsCvttps2dq(A);
       break;
     case kOpCvt0fE6 + 1:
-      OpVdqWpdCvtpd2dq(A);
+      OpVdqWpdCvttpd2dq(A);
       break;
     case kOpCvt0fE6 + 2:
-      OpVdqWpdCvttpd2dq(A);
+      OpVdqWpdCvtpd2dq(A);
       break;
     case kOpCvt0fE6 + 3:
       OpVpdWdqCvtdq2pd(A);
@@ -141,17 +141,20 @@ int GetFlagClobbers(u64 rde) {
     case 0x083:  // aluwireg
     case 0x084:  // alubtest
     case 0x085:  // aluwtest
-    case 0x0A6:  // cmps
-    case 0x0A7:  // cmps
     case 0x0A8:  // test %al  $ib
     case 0x0A9:  // test %rax $ivds
-    case 0x0AE:  // scas
-    case 0x0AF:  // scas
     case 0x069:  // imul
     case 0x06B:  // Imul
     case 0x1AF:  // imul
     case 0x12E:  // comisd
     case 0x12F:  // comisd
+    case 0x20E:  // vtestps
+    case 0x20F:  // vtestpd
+    case 0x217:  // ptest
+    case 0x360:  // pcmpestrm
+    case 0x361:  // pcmpestri
+    case 0x362:  // pcmpistrm
+    case 0x363:  // pcmpistri
     case 0x1A4:  // shld $ib
     case 0x1A5:  // shld %cl
     case 0x1AC:  // shrd $ib
@@ -167,6 +170,12 @@ int GetFlagClobbers(u64 rde) {
     case 0x03F:  // aas
     case 0x0D5:  // aad
       return CF | ZF | SF | OF | AF | PF;
+    case 0x0A6:  // cmps
+    case 0x0A7:  // cmps
+    case 0x0AE:  // scas
+    case 0x0AF:  // scas
+      // repeated compares leave the flags alone if rcx is zero
+      return Rep(rde) ? 0 : CF | ZF | SF | OF | AF | PF;
     case 0x0C0:  // bsu $ib byte
     case 0x0C1:  // bsu $ib word
     case 0x0D0:  // bsu $1  byte
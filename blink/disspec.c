@@ -1258,7 +1258,38 @@ const char *DisSpecMap2(struct XedDecodedInst *x, char *p) {
 
 const char *DisSpecMap3(struct XedDecodedInst *x, char *p) {
   switch (Opcode(x->op.rde)) {
+    RCASE(0x08, "roundps %Vps Wps Ib");
+    RCASE(0x09, "roundpd %Vpd Wpd Ib");
+    RCASE(0x0A, "roundss %Vss Wss Ib");
+    RCASE(0x0B, "roundsd %Vsd Wsd Ib");
+    RCASE(0x0C, "blendps %Vps Wps Ib");
+    RCASE(0x0D, "blendpd %Vpd Wpd Ib");
+    RCASE(0x0E, "pblendw %Vdq Wdq Ib");
     RCASE(0x0F, DisOpPqQqIbVdqWdqIb(x, p, "palignr"));
+    RCASE(0x14, "pextrb Edqp %Vdq Ib");
+    RCASE(0x15, "pextrw Edqp %Vdq Ib");
+    case 0x16:
+      if (Rexw(x->op.rde)) {
+        return "pextrq Eq %Vdq Ib";
+      } else {
+        return "pextrd Ed %Vdq Ib";
+      }
+    RCASE(0x17, "extractps Ed %Vdq Ib");
+    RCASE(0x20, "pinsrb %Vdq Edqp Ib");
+    RCASE(0x21, "insertps %Vdq Wss Ib");
+    case 0x22:
+      if (Rexw(x->op.rde)) {
+        return "pinsrq %Vdq Eq Ib";
+      } else {
+        return "pinsrd %Vdq Ed Ib";
+      }
+    RCASE(0x40, "dpps %Vps Wps Ib");
+    RCASE(0x41, "dppd %Vpd Wpd Ib");
+    RCASE(0x42, "mpsadbw %Vdq Wdq Ib");
+    RCASE(0x60, "pcmpestrm %Vdq Wdq Ib");
+    RCASE(0x61, "pcmpestri %Vdq Wdq Ib");
+    RCASE(0x62, "pcmpistrm %Vdq Wdq Ib");
+    RCASE(0x63, "pcmpistri %Vdq Wdq Ib");
     RCASE(0xF0, "rorx %Gdqp Edqp Ib");
     case 0x44:  // pclmulqdq
       if (Osz(x->op.rde)) {
@@ -18,6 +18,7 @@
 ╚─────────────────────────────────────────────────────────────────────────────*/
 #include "blink/builtin.h"
 #include "blink/flag.h"
+#include "blink/jit.h"
 
 bool FLAG_zero;
 bool FLAG_wantjit;
@@ -28,8 +29,10 @@ bool FLAG_alsologtostderr;
 
 int FLAG_strace;
 int FLAG_vabits;
+int FLAG_jitthreshold = kJitThreshold;
 
 long FLAG_pagesize;
+long FLAG_jitmemory = kJitMemoryLimit;
 
 u64 FLAG_skew;
 u64 FLAG_vaspace;
@@ -41,6 +44,7 @@ i64 FLAG_automapstart;
 u64 FLAG_dyninterpaddr;
 
 const char *FLAG_logpath;
+const char *FLAG_jitcache;
 
 #ifndef DISABLE_OVERLAYS
 const char *FLAG_overlays;
@@ -13,8 +13,10 @@ extern bool FLAG_alsologtostderr;
 
 extern int FLAG_strace;
 extern int FLAG_vabits;
+extern int FLAG_jitthreshold;
 
 extern long FLAG_pagesize;
+extern long FLAG_jitmemory;
 
 extern u64 FLAG_skew;
 extern u64 FLAG_vaspace;
@@ -26,6 +28,7 @@ extern i64 FLAG_automapstart;
 extern u64 FLAG_dyninterpaddr;
 
 extern const char *FLAG_logpath;
+extern const char *FLAG_jitcache;
 extern const char *FLAG_overlays;
 extern const char *FLAG_prefix;
 
@@ -0,0 +1,244 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <math.h>
+#include <string.h>
+
+#include "blink/avx.h"
+#include "blink/endian.h"
+#include "blink/machine.h"
+#include "blink/macros.h"
+#include "blink/modrm.h"
+#include "blink/pun.h"
+#include "blink/rde.h"
+
+#ifndef DISABLE_AVX
+
+// fused multiply add instructions are encoded as 0f38 [9ab][6-f] where
+// the high nibble picks which operands get multiplied, and whose name
+// lists the operands in that order, e.g. vfmadd132 is dst = dst*rm+src
+// the low nibble picks the operation, where the odd ones are scalar.
+
+#define kFmaddsub 6
+#define kFmsubadd 7
+#define kFmadd    8
+#define kFmsub    10
+#define kFnmadd   12
+#define kFnmsub   14
+
+static float Fmas(int op, int i, float a, float b, float c) {
+  switch (op) {
+    case kFmaddsub:
+      return fmaf(a, b, i & 1 ? c : -c);
+    case kFmsubadd:
+      return fmaf(a, b, i & 1 ? -c : c);
+    case kFmadd:
+      return fmaf(a, b, c);
+    case kFmsub:
+      return fmaf(a, b, -c);
+    case kFnmadd:
+      return fmaf(-a, b, c);
+    case kFnmsub:
+      return fmaf(-a, b, -c);
+    default:
+      __builtin_unreachable();
+  }
+}
+
+static double Fmad(int op, int i, double a, double b, double c) {
+  switch (op) {
+    case kFmaddsub:
+      return fma(a, b, i & 1 ? c : -c);
+    case kFmsubadd:
+      return fma(a, b, i & 1 ? -c : c);
+    case kFmadd:
+      return fma(a, b, c);
+    case kFmsub:
+      return fma(a, b, -c);
+    case kFnmadd:
+      return fma(-a, b, c);
+    case kFnmsub:
+      return fma(-a, b, -c);
+    default:
+      __builtin_unreachable();
+  }
+}
+
+// x86 passes through the first nan operand in encoding order, i.e. the
+// destination then vex.vvvv then modrm.rm, and otherwise produces the
+// negative default nan, rather than letting negation flip its sign
+static u32 FmaNans(u32 x, u32 y, u32 z) {
+  if ((x & 0x7fffffff) > 0x7f800000) return x | 0x00400000;
+  if ((y & 0x7fffffff) > 0x7f800000) return y | 0x00400000;
+  if ((z & 0x7fffffff) > 0x7f800000) return z | 0x00400000;
+  return 0xffc00000;
+}
+
+static u64 FmaNand(u64 x, u64 y, u64 z) {
+  if ((x & 0x7fffffffffffffff) > 0x7ff0000000000000) {
+    return x | 0x0008000000000000;
+  }
+  if ((y & 0x7fffffffffffffff) > 0x7ff0000000000000) {
+    return y | 0x0008000000000000;
+  }
+  if ((z & 0x7fffffffffffffff) > 0x7ff0000000000000) {
+    return z | 0x0008000000000000;
+  }
+  return 0xfff8000000000000;
+}
+
+// vfmadd132ps, vfmadd213sd, vfnmsub231pd, vfmaddsub132ps, etc.
+void OpVfma(P) {
+  int i, n, w, op;
+  bool isscalar;
+  const u8 *a, *b, *c;
+  u8 d[32], v[32], r[32], z[32];
+  union FloatPun fa, fb, fc;
+  union DoublePun da, db, dc;
+  if (!Osz(rde)) OpUdImpl(m);
+  op = Opcode(rde) & 15;
+  if (op < kFmaddsub) OpUdImpl(m);
+  isscalar = op >= kFmadd && (op & 1);
+  op &= isscalar ? ~1 : ~0;
+  w = Rexw(rde) ? 8 : 4;
+  n = isscalar ? w : 16 << Ymm(rde);
+  LoadYmm(m, d, RexrReg(rde));
+  LoadYmm(m, v, Vreg(rde));
+  ReadVexRm(A, r, n, false);
+  switch (Opcode(rde) >> 4) {
+    case 0x9:  // 132
+      a = d, b = r, c = v;
+      break;
+    case 0xA:  // 213
+      a = v, b = d, c = r;
+      break;
+    case 0xB:  // 231
+      a = v, b = r, c = d;
+      break;
+    default:
+      __builtin_unreachable();
+  }
+  memcpy(z, d, sizeof(z));
+  for (i = 0; i < n / w; ++i) {
+    if (w == 8) {
+      da.i = Get64(a + i * 8);
+      db.i = Get64(b + i * 8);
+      dc.i = Get64(c + i * 8);
+      da.f = Fmad(op, i, da.f, db.f, dc.f);
+      if (isnan(da.f)) {
+        da.i = FmaNand(Get64(d + i * 8), Get64(v + i * 8), Get64(r + i * 8));
+      }
+      Put64(z + i * 8, da.i);
+    } else {
+      fa.i = Get32(a + i * 4);
+      fb.i = Get32(b + i * 4);
+      fc.i = Get32(c + i * 4);
+      fa.f = Fmas(op, i, fa.f, fb.f, fc.f);
+      if (isnan(fa.f)) {
+        fa.i = FmaNans(Get32(d + i * 4), Get32(v + i * 4), Get32(r + i * 4));
+      }
+      Put32(z + i * 4, fa.i);
+    }
+  }
+  PutVex(A, z, isscalar ? 16 : n);
+}
+
+static u32 HalfToFloat(u16 h) {
+  union FloatPun f;
+  u32 sign, exp, mant;
+  sign = (u32)(h >> 15) << 31;
+  exp = h >> 10 & 31;
+  mant = h & 1023;
+  if (exp == 31) {
+    // infinity or nan, where signaling nans get quieted
+    return sign | 0x7f800000 | mant << 13 | (mant ? 0x400000 : 0);
+  } else if (exp) {
+    return sign | (exp + 112) << 23 | mant << 13;
+  } else {
+    f.f = ldexpf(mant, -24);
+    return sign | f.i;
+  }
+}
+
+static u16 FloatToHalf(u32 x, int mode) {
+  int e;
+  u16 sign;
+  double a, q, ulp;
+  union FloatPun f;
+  f.i = x;
+  sign = x >> 31 << 15;
+  if (isnan(f.f)) {
+    return sign | 0x7e00 | (x >> 13 & 1023);
+  }
+  if (isinf(f.f)) {
+    return sign | 0x7c00;
+  }
+  if (!(a = fabs(f.f))) {
+    return sign;
+  }
+  // round to however many bits of precision the half has at this
+  // magnitude, which is exact since a float has only 24 bits itself
+  frexp(a, &e);
+  ulp = ldexp(1, MAX(e - 1, -14) - 10);
+  q = RoundDouble(sign ? -a / ulp : a / ulp, mode);
+  a = fabs(q) * ulp;
+  if (a > 65504) {
+    if (!mode || (mode == 1 && sign) || (mode == 2 && !sign)) {
+      return sign | 0x7c00;
+    } else {
+      return sign | 0x7bff;
+    }
+  }
+  if (a < 0x1p-14) {
+    return sign | (u16)(a * 0x1p24);
+  }
+  frexp(a, &e);
+  return sign | (e + 14) << 10 | ((u16)ldexp(a, 11 - e) & 1023);
+}
+
+void OpVcvtph2ps(P) {
+  int i, n;
+  u8 x[32], y[32];
+  if (!Osz(rde) || Rexw(rde)) OpUdImpl(m);
+  n = 16 << Ymm(rde);
+  ReadVexRm(A, y, n / 2, false);
+  for (i = 0; i < n / 4; ++i) {
+    Put32(x + i * 4, HalfToFloat(Get16(y + i * 2)));
+  }
+  PutVex(A, x, n);
+}
+
+void OpVcvtps2ph(P) {
+  u8 x[32], y[32];
+  int i, n, mode;
+  if (!Osz(rde) || Rexw(rde)) OpUdImpl(m);
+  n = 16 << Ymm(rde);
+  mode = GetRoundingMode(m, uimm0);
+  LoadYmm(m, x, RexrReg(rde));
+  memset(y, 0, sizeof(y));
+  for (i = 0; i < n / 4; ++i) {
+    Put16(y + i * 2, FloatToHalf(Get32(x + i * 4), mode));
+  }
+  if (IsModrmRegister(rde)) {
+    PutVexRm(A, y, 16);
+  } else {
+    WriteVexMemory(A, y, n / 2, false);
+  }
+}
+
+#endif /* DISABLE_AVX */
@@ -32,6 +32,7 @@
 #include "blink/modrm.h"
 #include "blink/pun.h"
 #include "blink/rde.h"
+#include "blink/stats.h"
 
 #define FPUREG 0
 #define MEMORY 1
@@ -64,26 +65,26 @@ static void OnFpuStackOverflow(struct Machine *m) {
   m->fpu.sw |= kFpuSwIe | kFpuSwC1 | kFpuSwSf;
 }
 
-static double OnFpuStackUnderflow(struct Machine *m) {
+static x87_t OnFpuStackUnderflow(struct Machine *m) {
   m->fpu.sw |= kFpuSwIe | kFpuSwSf;
   m->fpu.sw &= ~kFpuSwC1;
   return -NAN;
 }
 
-static double St(struct Machine *m, int i) {
+static x87_t St(struct Machine *m, int i) {
   if (FpuGetTag(m, i) == kFpuTagEmpty) OnFpuStackUnderflow(m);
   return *FpuSt(m, i);
 }
 
-static double St0(struct Machine *m) {
+static x87_t St0(struct Machine *m) {
   return St(m, 0);
 }
 
-static double St1(struct Machine *m) {
+static x87_t St1(struct Machine *m) {
   return St(m, 1);
 }
 
-static double StRm(struct Machine *m, u64 rde) {
+static x87_t StRm(struct Machine *m, u64 rde) {
   return St(m, ModrmRm(rde));
 }
 
@@ -91,24 +92,26 @@ static void FpuClearRoundup(struct Machine *m) {
   m->fpu.sw &= ~kFpuSwC1;
 }
 
+#ifndef X87_NATIVE
 static void FpuClearOutOfRangeIndicator(struct Machine *m) {
   m->fpu.sw &= ~kFpuSwC2;
 }
+#endif
 
-static void FpuSetSt0(struct Machine *m, double x) {
+static void FpuSetSt0(struct Machine *m, x87_t x) {
   *FpuSt(m, 0) = x;
 }
 
-static void FpuSetStRm(struct Machine *m, u64 rde, double x) {
+static void FpuSetStRm(struct Machine *m, u64 rde, x87_t x) {
   *FpuSt(m, ModrmRm(rde)) = x;
 }
 
-static void FpuSetStPop(struct Machine *m, int i, double x) {
+static void FpuSetStPop(struct Machine *m, int i, x87_t x) {
   *FpuSt(m, i) = x;
   FpuPop(m);
 }
 
-static void FpuSetStRmPop(struct Machine *m, u64 rde, double x) {
+static void FpuSetStRmPop(struct Machine *m, u64 rde, x87_t x) {
   FpuSetStPop(m, ModrmRm(rde), x);
 }
 
@@ -158,12 +161,12 @@ static void FpuSetMemoryDouble(struct Machine *m, double f) {
   FpuSetMemoryLong(m, u.i);
 }
 
-static double FpuGetMemoryLdbl(struct Machine *m) {
+static x87_t FpuGetMemoryLdbl(struct Machine *m) {
   u8 b[10];
   return DeserializeLdbl(Load(m, m->fpu.dp, 10, b));
 }
 
-static void FpuSetMemoryLdbl(struct Machine *m, double f) {
+static void FpuSetMemoryLdbl(struct Machine *m, x87_t f) {
   void *p[2];
   u8 b[10], t[10];
   SerializeLdbl(b, f);
@@ -171,19 +174,206 @@ static void FpuSetMemoryLdbl(struct Machine *m, double f) {
   EndStore(m, m->fpu.dp, 10, p, t);
 }
 
-static double f2xm1(double x) {
+#ifdef X87_NATIVE
+
+#define kFpuCwHost 0x037f /* what the system v abi leaves the host fpu in */
+
+#define kFpuSwExceptions \
+  (kFpuSwIe | kFpuSwDe | kFpuSwZe | kFpuSwOe | kFpuSwUe | kFpuSwPe)
+
+// prepares the host fpu for running a guest instruction. exceptions are
+// masked on the host, since the guest's are delivered later by fwait.
+// host exception flags are sticky, so they only need to be cleared if
+// the guest doesn't have them too, e.g. because it ran fnclex, which is
+// cheaper than clearing them every time. the flags that are left over
+// are then harmlessly merged back into the guest by FpuLeave()
+static void FpuEnter(struct Machine *m) {
+  u16 sw, cw;
+  asm volatile("fnstsw\t%0" : "=am"(sw));
+  if (sw & kFpuSwExceptions & ~m->fpu.sw) asm volatile("fnclex");
+  cw = (m->fpu.cw & (kFpuCwPc | kFpuCwRc)) | 0x7f;
+  if (cw != kFpuCwHost) asm volatile("fldcw\t%0" : /* no outputs */ : "m"(cw));
+}
+
+// merges the exceptions raised by the host instruction into the guest
+// status word, along with the subset `cc` of its condition codes
+static void FpuLeave(struct Machine *m, u32 cc) {
+  u16 sw, cw;
+  asm volatile("fnstsw\t%0" : "=am"(sw));
+  if ((m->fpu.cw & (kFpuCwPc | kFpuCwRc)) !=
+      (kFpuCwHost & (kFpuCwPc | kFpuCwRc))) {
+    cw = kFpuCwHost;
+    asm volatile("fldcw\t%0" : /* no outputs */ : "m"(cw));
+  }
+  m->fpu.sw = (m->fpu.sw & ~cc) | (sw & (cc | kFpuSwExceptions));
+}
+
+static bool FpuIsOutOfRange(x87_t x) {
+  return isfinite(x) && (x >= 0x1p63L || x <= -0x1p63L);
+}
+
+static x87_t f2xm1(struct Machine *m, x87_t x) {
+  FpuEnter(m);
+  asm volatile("f2xm1" : "+t"(x));
+  FpuLeave(m, kFpuSwC1);
+  return x;
+}
+
+static x87_t fyl2x(struct Machine *m, x87_t x, x87_t y) {
+  FpuEnter(m);
+  asm volatile("fyl2x" : "=t"(x) : "0"(x), "u"(y) : "st(1)");
+  FpuLeave(m, kFpuSwC1);
+  return x;
+}
+
+static x87_t fyl2xp1(struct Machine *m, x87_t x, x87_t y) {
+  FpuEnter(m);
+  asm volatile("fyl2xp1" : "=t"(x) : "0"(x), "u"(y) : "st(1)");
+  FpuLeave(m, kFpuSwC1);
+  return x;
+}
+
+static x87_t fscale(struct Machine *m, x87_t significand, x87_t exponent) {
+  FpuEnter(m);
+  asm volatile("fscale" : "+t"(significand) : "u"(exponent));
+  FpuLeave(m, kFpuSwC1);
+  return significand;
+}
+
+static x87_t fprem(struct Machine *m, x87_t dividend, x87_t modulus) {
+  FpuEnter(m);
+  asm volatile("fprem" : "+t"(dividend) : "u"(modulus));
+  FpuLeave(m, kFpuSwC0 | kFpuSwC1 | kFpuSwC2 | kFpuSwC3);
+  return dividend;
+}
+
+static x87_t fprem1(struct Machine *m, x87_t dividend, x87_t modulus) {
+  FpuEnter(m);
+  asm volatile("fprem1" : "+t"(dividend) : "u"(modulus));
+  FpuLeave(m, kFpuSwC0 | kFpuSwC1 | kFpuSwC2 | kFpuSwC3);
+  return dividend;
+}
+
+static x87_t FpuAdd(struct Machine *m, x87_t x, x87_t y) {
+  FpuEnter(m);
+  asm volatile("fadd\t%%st(1),%%st" : "=t"(x) : "0"(x), "u"(y));
+  FpuLeave(m, kFpuSwC1);
+  return x;
+}
+
+static x87_t FpuSub(struct Machine *m, x87_t x, x87_t y) {
+  FpuEnter(m);
+  asm volatile("fsub\t%%st(1),%%st" : "=t"(x) : "0"(x), "u"(y));
+  FpuLeave(m, kFpuSwC1);
+  return x;
+}
+
+static x87_t FpuMul(struct Machine *m, x87_t x, x87_t y) {
+  FpuEnter(m);
+  asm volatile("fmul\t%%st(1),%%st" : "=t"(x) : "0"(x), "u"(y));
+  FpuLeave(m, kFpuSwC1);
+  return x;
+}
+
+static x87_t FpuDiv(struct Machine *m, x87_t x, x87_t y) {
+  FpuEnter(m);
+  asm volatile("fdiv\t%%st(1),%%st" : "=t"(x) : "0"(x), "u"(y));
+  FpuLeave(m, kFpuSwC1);
+  return x;
+}
+
+static x87_t FpuRound(struct Machine *m, x87_t x) {
+  FpuEnter(m);
+  asm volatile("frndint" : "+t"(x));
+  FpuLeave(m, kFpuSwC1);
+  return x;
+}
+
+static x87_t FpuSqrt(struct Machine *m, x87_t x) {
+  FpuEnter(m);
+  asm volatile("fsqrt" : "+t"(x));
+  FpuLeave(m, kFpuSwC1);
+  return x;
+}
+
+static x87_t FpuSin(struct Machine *m, x87_t x) {
+  FpuEnter(m);
+  asm volatile("fsin" : "+t"(x));
+  FpuLeave(m, kFpuSwC1 | kFpuSwC2);
+  return x;
+}
+
+static x87_t FpuCos(struct Machine *m, x87_t x) {
+  FpuEnter(m);
+  asm volatile("fcos" : "+t"(x));
+  FpuLeave(m, kFpuSwC1 | kFpuSwC2);
+  return x;
+}
+
+static x87_t FpuPatan(struct Machine *m, x87_t x, x87_t y) {
+  FpuEnter(m);
+  asm volatile("fpatan" : "=t"(x) : "0"(x), "u"(y) : "st(1)");
+  FpuLeave(m, kFpuSwC1);
+  return x;
+}
+
+static float FpuToFloat(struct Machine *m, x87_t x) {
+  float f;
+  FpuEnter(m);
+  asm volatile("fsts\t%0" : "=m"(f) : "t"(x));
+  FpuLeave(m, kFpuSwC1);
+  return f;
+}
+
+static double FpuToDouble(struct Machine *m, x87_t x) {
+  double f;
+  FpuEnter(m);
+  asm volatile("fstl\t%0" : "=m"(f) : "t"(x));
+  FpuLeave(m, kFpuSwC1);
+  return f;
+}
+
+static i16 FpuToShort(struct Machine *m, x87_t x) {
+  i16 i;
+  FpuEnter(m);
+  asm volatile("fists\t%0" : "=m"(i) : "t"(x));
+  FpuLeave(m, kFpuSwC1);
+  return i;
+}
+
+static i32 FpuToInt(struct Machine *m, x87_t x) {
+  i32 i;
+  FpuEnter(m);
+  asm volatile("fistl\t%0" : "=m"(i) : "t"(x));
+  FpuLeave(m, kFpuSwC1);
+  return i;
+}
+
+static i64 FpuToLong(struct Machine *m, x87_t x) {
+  i64 i;
+  FpuEnter(m);
+  asm volatile("fistpll\t%0" : "=m"(i) : "t"(x) : "st");
+  FpuLeave(m, kFpuSwC1);
+  return i;
+}
+
+#else /* X87_NATIVE */
+
+static double f2xm1(struct Machine *m, double x) {
   return exp2(x) - 1;
 }
 
-static double fyl2x(double x, double y) {
+static double fyl2x(struct Machine *m, double x, double y) {
   return y * log2(x);
 }
 
-static double fyl2xp1(double x, double y) {
+static double fyl2xp1(struct Machine *m, double x, double y) {
   return y * log2(x + 1);
 }
 
-static double fscale(double significand, double exponent) {
+static double fscale(struct Machine *m, double significand,
+                     double exponent) {
+  FpuClearRoundup(m);
   if (isunordered(significand, exponent)) return NAN;
   return ldexp(significand, exponent);
 }
@@ -204,12 +394,12 @@ static double x87remainder(double x, double y, u32 *sw,
   return r;
 }
 
-static double fprem(double dividend, double modulus, u32 *sw) {
-  return x87remainder(dividend, modulus, sw, fmod, trunc);
+static double fprem(struct Machine *m, double dividend, double modulus) {
+  return x87remainder(dividend, modulus, &m->fpu.sw, fmod, trunc);
 }
 
-static double fprem1(double dividend, double modulus, u32 *sw) {
-  return x87remainder(dividend, modulus, sw, remainder, rint);
+static double fprem1(struct Machine *m, double dividend, double modulus) {
+  return x87remainder(dividend, modulus, &m->fpu.sw, remainder, rint);
 }
 
 static double FpuAdd(struct Machine *m, double x, double y) {
@@ -294,7 +484,7 @@ static double FpuDiv(struct Machine *m, double x, double y) {
 static double FpuRound(struct Machine *m, double x) {
   switch ((m->fpu.cw & kFpuCwRc) >> 10) {
     case 0:
-      return rint(x);
+      return RoundEven(x);
     case 1:
       return floor(x);
     case 2:
@@ -306,8 +496,50 @@ static double FpuRound(struct Machine *m, double x) {
   }
 }
 
-static void FpuCompare(struct Machine *m, double y) {
-  double x = St0(m);
+static double FpuSqrt(struct Machine *m, double x) {
+  FpuClearRoundup(m);
+  return sqrt(x);
+}
+
+static double FpuSin(struct Machine *m, double x) {
+  FpuClearOutOfRangeIndicator(m);
+  return sin(x);
+}
+
+static double FpuCos(struct Machine *m, double x) {
+  FpuClearOutOfRangeIndicator(m);
+  return cos(x);
+}
+
+static double FpuPatan(struct Machine *m, double x, double y) {
+  FpuClearRoundup(m);
+  return atan2(y, x);
+}
+
+static float FpuToFloat(struct Machine *m, double x) {
+  return x;
+}
+
+static double FpuToDouble(struct Machine *m, double x) {
+  return x;
+}
+
+static i16 FpuToShort(struct Machine *m, double x) {
+  return FpuRound(m, x);
+}
+
+static i32 FpuToInt(struct Machine *m, double x) {
+  return FpuRound(m, x);
+}
+
+static i64 FpuToLong(struct Machine *m, double x) {
+  return FpuRound(m, x);
+}
+
+#endif /* X87_NATIVE */
+
+static void FpuCompare(struct Machine *m, x87_t y) {
+  x87_t x = St0(m);
   m->fpu.sw &= ~(kFpuSwC0 | kFpuSwC1 | kFpuSwC2 | kFpuSwC3);
   if (!isunordered(x, y)) {
     if (x < y) m->fpu.sw |= kFpuSwC0;
@@ -318,7 +550,7 @@ static void FpuCompare(struct Machine *m, double y) {
 }
 
 static void OpFxam(struct Machine *m) {
-  double x;
+  x87_t x;
   x = *FpuSt(m, 0);
   m->fpu.sw &= ~(kFpuSwC0 | kFpuSwC1 | kFpuSwC2 | kFpuSwC3);
   if (signbit(x)) m->fpu.sw |= kFpuSwC1;
@@ -400,35 +632,70 @@ static void OpFcmovnu(struct Machine *m, u64 rde) {
 }
 
 static void OpFchs(struct Machine *m) {
+  FpuClearRoundup(m);
   FpuSetSt0(m, -St0(m));
 }
 
 static void OpFabs(struct Machine *m) {
-  FpuSetSt0(m, fabs(St0(m)));
+  x87_t x = St0(m);
+  FpuClearRoundup(m);
+  FpuSetSt0(m, signbit(x) ? -x : x);
 }
 
 static void OpF2xm1(struct Machine *m) {
-  FpuSetSt0(m, f2xm1(St0(m)));
+  FpuSetSt0(m, f2xm1(m, St0(m)));
 }
 
 static void OpFyl2x(struct Machine *m) {
-  FpuSetStPop(m, 1, fyl2x(St0(m), St1(m)));
+  FpuSetStPop(m, 1, fyl2x(m, St0(m), St1(m)));
 }
 
 static void OpFyl2xp1(struct Machine *m) {
-  FpuSetStPop(m, 1, fyl2xp1(St0(m), St1(m)));
+  FpuSetStPop(m, 1, fyl2xp1(m, St0(m), St1(m)));
 }
 
 static void OpFcos(struct Machine *m) {
-  FpuClearOutOfRangeIndicator(m);
-  FpuSetSt0(m, cos(St0(m)));
+  FpuSetSt0(m, FpuCos(m, St0(m)));
 }
 
 static void OpFsin(struct Machine *m) {
-  FpuClearOutOfRangeIndicator(m);
-  FpuSetSt0(m, sin(St0(m)));
+  FpuSetSt0(m, FpuSin(m, St0(m)));
+}
+
+#ifdef X87_NATIVE
+
+// the host won't push anything when the operand is out of range, which
+// the asm constraints can't express, so that case is handled up front
+static void OpFptan(struct Machine *m) {
+  x87_t x, one;
+  x = St0(m);
+  if (FpuIsOutOfRange(x)) {
+    m->fpu.sw |= kFpuSwC2;
+    return;
+  }
+  FpuEnter(m);
+  asm volatile("fptan" : "=t"(one), "=u"(x) : "0"(x));
+  FpuLeave(m, kFpuSwC1 | kFpuSwC2);
+  FpuSetSt0(m, x);
+  FpuPush(m, one);
+}
+
+static void OpFsincos(struct Machine *m) {
+  x87_t tsin, tcos;
+  tsin = St0(m);
+  if (FpuIsOutOfRange(tsin)) {
+    m->fpu.sw |= kFpuSwC2;
+    return;
+  }
+  FpuEnter(m);
+  asm volatile("fsincos" : "=t"(tcos), "=u"(tsin) : "0"(tsin));
+  FpuLeave(m, kFpuSwC1 | kFpuSwC2);
+  FpuSetSt0(m, tsin);
+  FpuPush(m, tcos);
 }
 
+#else /* X87_NATIVE */
+
 static void OpFptan(struct Machine *m) {
   FpuClearOutOfRangeIndicator(m);
   FpuSetSt0(m, tan(St0(m)));
@@ -444,9 +711,10 @@ static void OpFsincos(struct Machine *m) {
   FpuPush(m, tcos);
 }
 
+#endif /* X87_NATIVE */
+
 static void OpFpatan(struct Machine *m) {
-  FpuClearRoundup(m);
-  FpuSetStPop(m, 1, atan2(St1(m), St0(m)));
+  FpuSetStPop(m, 1, FpuPatan(m, St0(m), St1(m)));
 }
 
 static void OpFcom(struct Machine *m, u64 rde) {
@@ -499,11 +767,11 @@ static void OpFsubrEstSt(struct Machine *m, u64 rde) {
 }
 
 static void OpFdivEstSt(struct Machine *m, u64 rde) {
-  FpuSetStRm(m, rde, FpuDiv(m, StRm(m, rde), St0(m)));
+  FpuSetStRm(m, rde, FpuDiv(m, St0(m), StRm(m, rde)));
 }
 
 static void OpFdivrEstSt(struct Machine *m, u64 rde) {
-  FpuSetStRm(m, rde, FpuDiv(m, St0(m), StRm(m, rde)));
+  FpuSetStRm(m, rde, FpuDiv(m, StRm(m, rde), St0(m)));
 }
 
 static void OpFaddp(struct Machine *m, u64 rde) {
@@ -524,7 +792,7 @@ static void OpFsubp(struct Machine *m, u64 rde) {
 }
 
 static void OpFsubrp(struct Machine *m, u64 rde) {
-  FpuSetStPop(m, 1, FpuSub(m, StRm(m, rde), St0(m)));
+  FpuSetStRmPop(m, rde, FpuSub(m, StRm(m, rde), St0(m)));
 }
 
 static void OpFdivp(struct Machine *m, u64 rde) {
@@ -668,8 +936,7 @@ static void OpFidivrs(struct Machine *m) {
 }
 
 static void OpFsqrt(struct Machine *m) {
-  FpuClearRoundup(m);
-  FpuSetSt0(m, sqrt(St0(m)));
+  FpuSetSt0(m, FpuSqrt(m, St0(m)));
 }
 
 static void OpFrndint(struct Machine *m) {
@@ -677,16 +944,15 @@ static void OpFrndint(struct Machine *m) {
 }
 
 static void OpFscale(struct Machine *m) {
-  FpuClearRoundup(m);
-  FpuSetSt0(m, fscale(St0(m), St1(m)));
+  FpuSetSt0(m, fscale(m, St0(m), St1(m)));
 }
 
 static void OpFprem(struct Machine *m) {
-  FpuSetSt0(m, fprem(St0(m), St1(m), &m->fpu.sw));
+  FpuSetSt0(m, fprem(m, St0(m), St1(m)));
 }
 
 static void OpFprem1(struct Machine *m) {
-  FpuSetSt0(m, fprem1(St0(m), St1(m), &m->fpu.sw));
+  FpuSetSt0(m, fprem1(m, St0(m), St1(m)));
 }
 
 static void OpFdecstp(struct Machine *m) {
@@ -698,9 +964,19 @@ static void OpFincstp(struct Machine *m) {
 }
 
 static void OpFxtract(struct Machine *m) {
+#ifdef X87_NATIVE
+  x87_t x, y;
+  x = St0(m);
+  FpuEnter(m);
+  asm volatile("fxtract" : "=t"(y), "=u"(x) : "0"(x));
+  FpuLeave(m, kFpuSwC1);
+  FpuSetSt0(m, x);
+  FpuPush(m, y);
+#else
   double x = St0(m);
   FpuSetSt0(m, logb(x));
   FpuPush(m, ldexp(x, -ilogb(x)));
+#endif
 }
 
 static void OpFld(struct Machine *m, u64 rde) {
@@ -712,7 +988,7 @@ static void OpFlds(struct Machine *m) {
 }
 
 static void OpFsts(struct Machine *m) {
-  FpuSetMemoryFloat(m, St0(m));
+  FpuSetMemoryFloat(m, FpuToFloat(m, St0(m)));
 }
 
 static void OpFstps(struct Machine *m) {
@@ -721,11 +997,12 @@ static void OpFstps(struct Machine *m) {
 }
 
 static void OpFstpt(struct Machine *m) {
+  FpuClearRoundup(m);
   FpuSetMemoryLdbl(m, FpuPop(m));
 }
 
 static void OpFstl(struct Machine *m) {
-  FpuSetMemoryDouble(m, St0(m));
+  FpuSetMemoryDouble(m, FpuToDouble(m, St0(m)));
 }
 
 static void OpFstpl(struct Machine *m) {
@@ -734,15 +1011,18 @@ static void OpFstpl(struct Machine *m) {
 }
 
 static void OpFst(struct Machine *m, u64 rde) {
+  FpuClearRoundup(m);
   FpuSetStRm(m, rde, St0(m));
 }
 
 static void OpFstp(struct Machine *m, u64 rde) {
+  FpuClearRoundup(m);
   FpuSetStRmPop(m, rde, St0(m));
 }
 
 static void OpFxch(struct Machine *m, u64 rde) {
-  double t = StRm(m, rde);
+  x87_t t = StRm(m, rde);
+  FpuClearRoundup(m);
   FpuSetStRm(m, rde, St0(m));
   FpuSetSt0(m, t);
 }
@@ -755,36 +1035,36 @@ static void OpFldl(struct Machine *m) {
   FpuPush(m, FpuGetMemoryDouble(m));
 }
 
-static double Fld1(void) {
+static x87_t Fld1(void) {
   return 1;
 }
 
-static double Fldl2t(void) {
+static x87_t Fldl2t(void) {
   return 0xd.49a784bcd1b8afep-2L; /* log₂10 */
 }
 
-static double Fldl2e(void) {
+static x87_t Fldl2e(void) {
   return 0xb.8aa3b295c17f0bcp-3L; /* log₂𝑒 */
 }
 
-static double Fldpi(void) {
+static x87_t Fldpi(void) {
   return 0x1.921fb54442d1846ap+1L; /* π */
 }
 
-static double Fldlg2(void) {
+static x87_t Fldlg2(void) {
   return 0x9.a209a84fbcff799p-5L; /* log₁₀2 */
 }
 
-static double Fldln2(void) {
+static x87_t Fldln2(void) {
   return 0xb.17217f7d1cf79acp-4L; /* logₑ2 */
 }
 
-static double Fldz(void) {
+static x87_t Fldz(void) {
   return 0;
 }
 
 static void OpFldConstant(struct Machine *m, u64 rde) {
-  double x;
+  x87_t x;
   switch (ModrmRm(rde)) {
     CASE(0, x = Fld1());
     CASE(1, x = Fldl2t());
@@ -824,15 +1104,15 @@ static void OpFisttps(struct Machine *m) {
 }
 
 static void OpFists(struct Machine *m) {
-  FpuSetMemoryShort(m, FpuRound(m, St0(m)));
+  FpuSetMemoryShort(m, FpuToShort(m, St0(m)));
 }
 
 static void OpFistl(struct Machine *m) {
-  FpuSetMemoryInt(m, FpuRound(m, St0(m)));
+  FpuSetMemoryInt(m, FpuToInt(m, St0(m)));
 }
 
 static void OpFistll(struct Machine *m) {
-  FpuSetMemoryLong(m, FpuRound(m, St0(m)));
+  FpuSetMemoryLong(m, FpuToLong(m, St0(m)));
 }
 
 static void OpFistpl(struct Machine *m) {
@@ -851,7 +1131,7 @@ static void OpFistps(struct Machine *m) {
 }
 
 static void OpFcomi(struct Machine *m, u64 rde) {
-  double x, y;
+  x87_t x, y;
   x = St0(m);
   y = StRm(m, rde);
   if (!isunordered(x, y)) {
@@ -1006,15 +1286,39 @@ void FpuSetTag(struct Machine *m, unsigned i, unsigned t) {
   m->fpu.tw |= t << i;
 }
 
-void FpuPush(struct Machine *m, double x) {
-  if (FpuGetTag(m, -1) != kFpuTagEmpty) OnFpuStackOverflow(m);
+// the fxsave format only records whether each physical register is empty
+int FpuGetAbridgedTags(struct Machine *m) {
+  int i, t;
+  for (t = i = 0; i < 8; ++i) {
+    if (((m->fpu.tw >> (i * 2)) & 3) != kFpuTagEmpty) {
+      t |= 1 << i;
+    }
+  }
+  return t;
+}
+
+void FpuSetAbridgedTags(struct Machine *m, int t) {
+  int i;
+  for (m->fpu.tw = i = 0; i < 8; ++i) {
+    if (!(t & (1 << i))) {
+      m->fpu.tw |= kFpuTagEmpty << (i * 2);
+    }
+  }
+}
+
+void FpuPush(struct Machine *m, x87_t x) {
+  if (FpuGetTag(m, -1) != kFpuTagEmpty) {
+    OnFpuStackOverflow(m);
+  } else {
+    m->fpu.sw &= ~kFpuSwC1;
+  }
   m->fpu.sw = (m->fpu.sw & ~kFpuSwSp) | ((m->fpu.sw - (1 << 11)) & kFpuSwSp);
   *FpuSt(m, 0) = x;
   FpuSetTag(m, 0, kFpuTagValid);
 }
 
-double FpuPop(struct Machine *m) {
-  double x;
+x87_t FpuPop(struct Machine *m) {
+  x87_t x;
   if (FpuGetTag(m, 0) != kFpuTagEmpty) {
     x = *FpuSt(m, 0);
     FpuSetTag(m, 0, kFpuTagEmpty);
@@ -1025,14 +1329,102 @@ double FpuPop(struct Machine *m) {
   return x;
 }
 
+static void FpuSetLastOp(struct Machine *m, u64 rde, i64 dp) {
+  m->fpu.ip = MaskAddress(m->mode, m->ip - Oplength(rde));
+  m->fpu.op = (Opcode(rde) & 7) << 8 | ModrmMod(rde) << 6 |
+              ModrmReg(rde) << 3 | ModrmRm(rde);
+  m->fpu.dp = dp;
+}
+
+// the most common x87 instructions get called directly by jit paths,
+// which compute the effective address, rather than going through the
+// decoding in OpFpu(), since loops of fld, fmulp, and fstp ops dominate
+// the x87 code emitted by compilers.
+
+static void JitFld(struct Machine *m, u64 rde, i64 ea) {
+  FpuSetLastOp(m, rde, 0);
+  OpFld(m, rde);
+}
+
+static void JitFstp(struct Machine *m, u64 rde, i64 ea) {
+  FpuSetLastOp(m, rde, 0);
+  OpFstp(m, rde);
+}
+
+static void JitFmulp(struct Machine *m, u64 rde, i64 ea) {
+  FpuSetLastOp(m, rde, 0);
+  OpFmulp(m, rde);
+}
+
+static void JitFlds(struct Machine *m, u64 rde, i64 ea) {
+  FpuSetLastOp(m, rde, ea);
+  OpFlds(m);
+}
+
+static void JitFldl(struct Machine *m, u64 rde, i64 ea) {
+  FpuSetLastOp(m, rde, ea);
+  OpFldl(m);
+}
+
+static void JitFldt(struct Machine *m, u64 rde, i64 ea) {
+  FpuSetLastOp(m, rde, ea);
+  OpFldt(m);
+}
+
+static void JitFstps(struct Machine *m, u64 rde, i64 ea) {
+  FpuSetLastOp(m, rde, ea);
+  OpFstps(m);
+}
+
+static void JitFstpl(struct Machine *m, u64 rde, i64 ea) {
+  FpuSetLastOp(m, rde, ea);
+  OpFstpl(m);
+}
+
+static void JitFstpt(struct Machine *m, u64 rde, i64 ea) {
+  FpuSetLastOp(m, rde, ea);
+  OpFstpt(m);
+}
+
+static void JitFpu(P) {
+  void (*f)(struct Machine *, u64, i64);
+  switch (DISP(Opcode(rde), !IsModrmRegister(rde), ModrmReg(rde))) {
+    CASE(DISP(0xD9, FPUREG, 0), f = JitFld);
+    CASE(DISP(0xDD, FPUREG, 3), f = JitFstp);
+    CASE(DISP(0xDE, FPUREG, 1), f = JitFmulp);
+    CASE(DISP(0xD9, MEMORY, 0), f = JitFlds);
+    CASE(DISP(0xDD, MEMORY, 0), f = JitFldl);
+    CASE(DISP(0xDB, MEMORY, 5), f = JitFldt);
+    CASE(DISP(0xD9, MEMORY, 3), f = JitFstps);
+    CASE(DISP(0xDD, MEMORY, 3), f = JitFstpl);
+    CASE(DISP(0xDB, MEMORY, 7), f = JitFstpt);
+    default:
+      return;
+  }
+  if (IsModrmRegister(rde)) {
+    Jitter(A,
+           "a1i"  // arg1 = rde
+           "q"    // arg0 = machine
+           "c",   // call function
+           rde, f);
+  } else {
+    Jitter(A,
+           "L"      // res0 = LoadEffectiveAddress()
+           "r0a2="  // arg2 = res0
+           "a1i"    // arg1 = rde
+           "q"      // arg0 = machine
+           "c",     // call function
+           rde, f);
+  }
+  STATISTIC(++x87_lowered);
+}
+
 void OpFpu(P) {
   unsigned op;
   bool ismemory;
   op = Opcode(rde) & 7;
   ismemory = ModrmMod(rde) != 3;
-  m->fpu.ip = MaskAddress(m->mode, m->ip - Oplength(rde));
-  m->fpu.op = op << 8 | ModrmMod(rde) << 6 | ModrmReg(rde) << 3 | ModrmRm(rde);
-  m->fpu.dp = ismemory ? ComputeAddress(A) : 0;
+  FpuSetLastOp(m, rde, ismemory ? ComputeAddress(A) : 0);
   switch (DISP(op, ismemory, ModrmReg(rde))) {
     CASE(DISP(0xD8, FPUREG, 0), OpFaddStEst(m, rde));
     CASE(DISP(0xD8, FPUREG, 1), OpFmulStEst(m, rde));
@@ -1193,6 +1585,9 @@ void OpFpu(P) {
     default:
       OpUdImpl(m);
   }
+  if (IsMakingPath(m)) {
+    JitFpu(A);
+  }
 }
 
 #else /* DISABLE_X87 */
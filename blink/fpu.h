@@ -47,14 +47,25 @@
 #define kMxcsrRc  0x6000 /* rounding control */
 #define kMxcsrFtz 0x8000 /* flush to zero */
 
+#if defined(__x86_64__) && defined(__GNUC__)
+// the guest's rounding mode is kept in the host's mxcsr on x86-64
+#define MXCSR_NATIVE
+#endif
+
 #define FpuSt(m, i) ((m)->fpu.st + (((i) + ((m->fpu.sw & kFpuSwSp) >> 11)) & 7))
 
-double FpuPop(struct Machine *);
+x87_t FpuPop(struct Machine *);
+int FpuGetAbridgedTags(struct Machine *);
+double RoundEven(double);
+float RoundEvenf(float);
 int FpuGetTag(struct Machine *, unsigned);
-void FpuPush(struct Machine *, double);
+u32 GetMxcsr(struct Machine *);
+void FpuPush(struct Machine *, x87_t);
+void FpuSetAbridgedTags(struct Machine *, int);
 void FpuSetTag(struct Machine *, unsigned, unsigned);
 void OpFinit(struct Machine *);
 void OpFpu(P);
 void OpFwait(P);
+void SetMxcsr(struct Machine *, u32);
 
 #endif /* BLINK_FPU_H_ */
@@ -16,75 +16,91 @@
 │ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
 │ PERFORMANCE OF THIS SOFTWARE.                                                │
 ╚─────────────────────────────────────────────────────────────────────────────*/
+#include "blink/alu.h"
 #include "blink/assert.h"
 #include "blink/builtin.h"
 #include "blink/debug.h"
 #include "blink/endian.h"
 #include "blink/flags.h"
 #include "blink/machine.h"
+#include "blink/macros.h"
+#include "blink/modrm.h"
 #include "blink/rde.h"
 #include "blink/stats.h"
+#include "blink/x86.h"
 
 /**
- * @fileoverview Branch Micro-Op Fusion.
+ * @fileoverview Macro-Op Fusion.
+ *
+ * While a path is being recorded, some ops peek at the instructions
+ * that follow them, so a common idiom can be turned into one sequence
+ * of host code. The interpreter has already run the first op by then,
+ * which means its flags tell us which way a fused branch is going.
  */
 
-bool FuseBranchTest(P) {
 #ifdef HAVE_JIT
-  i64 bdisp;
-  u8 *p, jcc, jlen;
-  if (RegLog2(rde) < 2) {
-    LogCodOp(m, "can't fuse test: byte/word fuse unimplemented");
-    return false;
-  }
+
+struct FusedBranch {
+  i64 bdisp;  // branch displacement
+  u8 jcc;     // condition code of jump
+  u8 jlen;    // length of jump instruction
+  bool trace;
+  bool flip;
+};
+
+// returns true if condition only depends on zf or sf
+static bool IsZeroOrSign(u8 jcc) {
+  return jcc == 0x4 || jcc == 0x5 || jcc == 0x8 || jcc == 0x9;
+}
+
+// decodes conditional jump after the current op, and makes sure that
+// nothing at either destination needs the flags we won't be computing
+static bool GetFusedBranch(P, struct FusedBranch *b) {
+  u8 *p;
   if (4096 - (m->ip & 4095) < 6) {
-    LogCodOp(m, "can't fuse test: too close to the edge");
-    return false;
-  }
-  if (RexrReg(rde) != RexbRm(rde)) {
-    LogCodOp(m, "can't fuse test: different operands unimplemented");
+    LogCodOp(m, "can't fuse: too close to the edge");
     return false;
   }
   if (!(p = GetAddress(m, m->ip))) {
-    LogCodOp(m, "can't fuse test: null address");
+    LogCodOp(m, "can't fuse: null address");
     return false;
   }
   if ((p[0] & 0xf0) == 0x70) {  // Jcc Jbs
-    jlen = 2;
-    jcc = p[0] & 0x0f;
-    bdisp = (i8)Read8(p + 1);
+    b->jlen = 2;
+    b->jcc = p[0] & 0x0f;
+    b->bdisp = (i8)Read8(p + 1);
   } else if (p[0] == 0x0f && (p[1] & 0xf0) == 0x80) {  // Jcc Jvds
-    jlen = 6;
-    jcc = p[1] & 0x0f;
-    bdisp = (i32)Read32(p + 2);
+    b->jlen = 6;
+    b->jcc = p[1] & 0x0f;
+    b->bdisp = (i32)Read32(p + 2);
   } else {
-    LogCodOp(m, "can't fuse test: not followed by jump");
+    LogCodOp(m, "can't fuse: not followed by jump");
     return false;
   }
-#ifndef __x86_64__
-  switch (jcc) {
-    case 0x04:  // jz
-      break;
-    case 0x05:  // jnz
-      break;
-    default:
-      LogCodOp(m, "can't fuse test: unsupported jump operation");
-      return false;
-  }
-#endif
-  if (GetNeededFlags(m, m->ip + jlen + bdisp, CF | ZF | SF | OF | AF | PF)) {
-    LogCodOp(m, "can't fuse test: loop carries");
+  if (GetNeededFlags(m, m->ip + b->jlen + b->bdisp,
+                     CF | ZF | SF | OF | AF | PF)) {
+    LogCodOp(m, "can't fuse: loop carries");
     return false;
   }
-  if (GetNeededFlags(m, m->ip + jlen, CF | ZF | SF | OF | AF | PF)) {
-    LogCodOp(m, "can't fuse test: loop exit carries");
+  if (GetNeededFlags(m, m->ip + b->jlen, CF | ZF | SF | OF | AF | PF)) {
+    LogCodOp(m, "can't fuse: loop exit carries");
     return false;
   }
+  return true;
+}
+
+// decides which way the trace goes, and logs that we're fusing
+static void BeginFusedBranch(P, struct FusedBranch *b, const char *what) {
+  i64 next;
+  next = m->ip + b->jlen;
+  if (kConditionCode[b->jcc] && kConditionCode[b->jcc](m)) next += b->bdisp;
+  b->trace = kConditionCode[b->jcc] && CanExtendPath(A, m->ip + b->jlen, next);
+  b->flip = b->trace && next == m->ip + b->jlen;
 #if LOG_CPU
   LogCpu(m);
 #endif
   FlushCod(m->path.jb);
-  WriteCod("/\tfusing branch test+jcc\n");
+  WriteCod("/\tfusing branch %s+jcc\n", what);
   BeginCod(m, m->ip);
 #if LOG_JIX
   Jitter(A,
@@ -93,86 +109,163 @@ bool FuseBranchTest(P) {
          "q",   // arg0 = machine
          m->ip, FuseOp);
 #endif
-  Jitter(A,
-         "a1i"  // arg1 = skew + jlen
-         "m",   // call micro-op
-         m->path.skew + jlen, AdvanceIp);
-  m->path.skew = 0;
-#ifdef __x86_64__
-  Jitter(A, "A"    // res0 = GetReg(RexrReg)
-            "q");  // arg0 = machine
-  if (!Rexw(rde)) {
-    AlignJit(m->path.jb, 8, 4);
+}
+
+// moves instruction pointer past the jump before operands are loaded
+static void SkewFusedBranch(P, struct FusedBranch *b) {
+  if (IsModrmRegister(rde)) {
+    Jitter(A,
+           "a1i"  // arg1 = skew + jlen
+           "m",   // call micro-op
+           m->path.skew + b->jlen, AdvanceIp);
   } else {
-    AlignJit(m->path.jb, 8, 3);
-    AppendJit(m->path.jb, (u8[]){0x48}, 1);  // rex.w
+    Jitter(A,
+           "a2i"  // arg2 = delta
+           "a1i"  // arg1 = oplen
+           "m",   // call micro-op
+           m->path.skew + b->jlen, Oplength(rde) + b->jlen, SkewIp);
   }
-  u8 code[] = {
-      0x85, 0300 | kJitRes0 << 3 | kJitRes0,  // test %eax,%eax
-      (u8)(0x70 | jcc), 5,                    // jz/jnz +5
-  };
+  m->path.skew = 0;
+}
+
+#ifdef __x86_64__
+// appends `test` (0x84) or `cmp` (0x38) of `r` and `b` at the width of
+// the op, followed by a jcc that skips over the 5-byte jump after it.
+static void AppendFusedCompare(P, u8 op, int r, int b, u8 jcc) {
+  int n = 0;
+  u8 rex, code[6];
+  if (RegLog2(rde) == 1) code[n++] = 0x66;
+  rex = (RegLog2(rde) == 3 ? kAmdRexw : 0) | (r > 7 ? kAmdRexr : 0) |
+        (b > 7 ? kAmdRexb : 0);
+  if (rex) code[n++] = rex;
+  code[n++] = op | !!RegLog2(rde);
+  code[n++] = 0300 | (r & 7) << 3 | (b & 7);
+  code[n++] = 0x70 | jcc;  // jcc +5
+  code[n++] = 5;
+  AlignJit(m->path.jb, 8, (8 - n) & 7);
+  AppendJit(m->path.jb, code, n);
+}
 #elif defined(__aarch64__)
-  Jitter(A, "A"      // res0 = GetReg(RexrReg)
-            "r0a1="  // arg1 = res0
-            "q");    // arg0 = machine
-  u32 code[] = {
-      // b4000042 cbz  x2, #8
-      // 34000042 cbz  w2, #8
-      // b5000042 cbnz x2, #8
-      // 35000042 cbnz w2, #8
-      Rexw(rde) << 31 | 0x30000000 | jcc << 24 | (8 / 4) << 5 | kJitArg1,
-  };
+// appends code that sets nzcv from register `r` at the width of the op,
+// followed by a b.cond that skips over the instruction after it.
+static void AppendFusedTest(P, int r, u8 jcc) {
+  int n = 0;
+  u32 code[3];
+  unsigned bits = 8 << RegLog2(rde);
+  if (bits < 32) {
+    // 53181c21 lsl w1, w1, #24
+    // 53101c21 lsl w1, w1, #16
+    code[n++] = 0x53000000 | bits << 16 | (bits - 1) << 10 | r << 5 | kJitArg1;
+    r = kJitArg1;
+  }
+  // 6a01003f tst w1, w1
+  // ea01003f tst x1, x1
+  code[n++] = (u32)(bits == 64) << 31 | 0x6a00001f | r << 16 | r << 5;
+  // 54000040 b.eq #8
+  // 54000041 b.ne #8
+  // 54000044 b.mi #8
+  // 54000045 b.pl #8
+  code[n++] = 0x54000000 | (8 / 4) << 5 | (jcc & 8 ? 4 : 0) | (jcc & 1);
+  AppendJit(m->path.jb, code, n * sizeof(u32));
+}
 #else
 #error "architecture not implemented"
 #endif
-  AppendJit(m->path.jb, code, sizeof(code));
-  Connect(A, m->ip + jlen, true);
-  Jitter(A,
-         "a1i"  // arg1 = disp
-         "m"    // call micro-op
-         "q",   // arg0 = machine
-         bdisp, AdvanceIp);
-  AlignJit(m->path.jb, 8, 0);
-  Connect(A, m->ip + jlen + bdisp, false);
-  FinishPath(m);
-  m->path.skip = 1;
+
+// finishes fused branch, after its conditional jump has been emitted.
+// if `flip` is set, the jump was inverted so it'll skip over the side
+// exit when branch isn't taken, since the trace continues that way.
+static bool FuseBranch(P, struct FusedBranch *b) {
+  long end;
+  if (b->flip) {
+    end = m->path.jb->index;
+    Jitter(A,
+           "a1i"  // arg1 = disp
+           "m"    // call micro-op
+           "q",   // arg0 = machine
+           b->bdisp, AdvanceIp);
+    AlignJit(m->path.jb, 8, 0);
+    Connect(A, m->ip + b->jlen + b->bdisp);
+    FixupSideExit(m->path.jb, end);
+  } else {
+    Connect(A, m->ip + b->jlen);
+    Jitter(A,
+           "a1i"  // arg1 = disp
+           "m"    // call micro-op
+           "q",   // arg0 = machine
+           b->bdisp, AdvanceIp);
+  }
   STATISTIC(++fused_branches);
+  if (b->trace) {
+    // the jump has been fused so it's never dispatched, which means we
+    // need to move the instruction pointer past it ourselves.
+    m->ip += b->jlen + (b->flip ? 0 : b->bdisp);
+    ExtendPath(m);
+  } else {
+    AlignJit(m->path.jb, 8, 0);
+    Connect(A, m->ip + b->jlen + b->bdisp);
+    FinishPath(m);
+    m->path.skip = 1;
+  }
   return true;
-#else
-  return false;
-#endif
 }
+#endif
 
-bool FuseBranchCmp(P, bool imm) {
+/**
+ * Fuses `test` with the conditional jump that follows it.
+ */
+bool FuseBranchTest(P, bool imm) {
 #ifdef HAVE_JIT
-  i64 bdisp;
-  u8 *p, jcc, jlen;
-  if (RegLog2(rde) < 2) {
-    LogCodOp(m, "can't fuse cmp: byte/word fuse unimplemented");
-    return false;
-  }
-  if (4096 - (m->ip & 4095) < 6) {
-    LogCodOp(m, "can't fuse cmp: too close to the edge");
+  bool same;
+  struct FusedBranch b;
+  if (!GetFusedBranch(A, &b)) return false;
+#ifndef __x86_64__
+  if (!IsZeroOrSign(b.jcc)) {
+    LogCodOp(m, "can't fuse test: unsupported jump operation");
     return false;
   }
-  if (!(p = GetAddress(m, m->ip))) {
-    LogCodOp(m, "can't fuse cmp: null address");
-    return false;
+#endif
+  same = !imm && IsModrmRegister(rde) && RexrReg(rde) == RexbRm(rde);
+  BeginFusedBranch(A, &b, "test");
+  SkewFusedBranch(A, &b);
+  if (imm) {
+    Jitter(A, "s1i", uimm0);
+  } else if (!same) {
+    Jitter(A, "A"        // res0 = GetReg(RexrReg)
+              "r0s1=");  // sav1 = res0
   }
-  if ((p[0] & 0xf0) == 0x70) {  // Jcc Jbs
-    jlen = 2;
-    jcc = p[0] & 0x0f;
-    bdisp = (i8)Read8(p + 1);
-  } else if (p[0] == 0x0f && (p[1] & 0xf0) == 0x80) {  // Jcc Jvds
-    jlen = 6;
-    jcc = p[1] & 0x0f;
-    bdisp = (i32)Read32(p + 2);
-  } else {
-    LogCodOp(m, "can't fuse cmp: not followed by jump");
-    return false;
+#ifdef __x86_64__
+  Jitter(A, "B"    // res0 = GetRegOrMem(RexbRm)
+            "q");  // arg0 = machine
+  AppendFusedCompare(A, 0x84, same ? kJitRes0 : kJitSav1, kJitRes0,
+                     b.jcc ^ b.flip);
+#elif defined(__aarch64__)
+  Jitter(A, "B"      // res0 = GetRegOrMem(RexbRm)
+            "r0a1="  // arg1 = res0
+            "q");    // arg0 = machine
+  if (!same) {
+    // 8a010281 and x1, x20, x1
+    u32 code[] = {0x8a000000 | kJitArg1 << 16 | kJitSav1 << 5 | kJitArg1};
+    AppendJit(m->path.jb, code, sizeof(code));
   }
+  AppendFusedTest(A, kJitArg1, b.jcc ^ b.flip);
+#endif
+  STATISTIC(++fused_test_branches);
+  return FuseBranch(A, &b);
+#else
+  return false;
+#endif
+}
+
+/**
+ * Fuses `cmp` with the conditional jump that follows it.
+ */
+bool FuseBranchCmp(P, bool imm) {
+#ifdef HAVE_JIT
+  struct FusedBranch b;
+  if (!GetFusedBranch(A, &b)) return false;
 #ifndef __x86_64__
-  switch (jcc) {
+  switch (b.jcc) {
     case 0x0:  // jo
       break;
     case 0x1:  // jno
@@ -202,40 +295,8 @@ bool FuseBranchCmp(P, bool imm) {
       return false;
   }
 #endif
-  if (GetNeededFlags(m, m->ip + jlen + bdisp, CF | ZF | SF | OF | AF | PF)) {
-    LogCodOp(m, "can't fuse cmp: loop carries");
-    return false;
-  }
-  if (GetNeededFlags(m, m->ip + jlen, CF | ZF | SF | OF | AF | PF)) {
-    LogCodOp(m, "can't fuse cmp: loop exit carries");
-    return false;
-  }
-#if LOG_CPU
-  LogCpu(m);
-#endif
-  FlushCod(m->path.jb);
-  WriteCod("/\tfusing branch cmp+jcc\n");
-  BeginCod(m, m->ip);
-#if LOG_JIX
-  Jitter(A,
-         "a1i"  // arg1 = ip
-         "c"    // call function
-         "q",   // arg0 = machine
-         m->ip, FuseOp);
-#endif
-  if (IsModrmRegister(rde)) {
-    Jitter(A,
-           "a1i"  // arg1 = skew + jlen
-           "m",   // call micro-op
-           m->path.skew + jlen, AdvanceIp);
-  } else {
-    Jitter(A,
-           "a2i"  // arg2 = delta
-           "a1i"  // arg1 = oplen
-           "m",   // call micro-op
-           m->path.skew + jlen, Oplength(rde) + jlen, SkewIp);
-  }
-  m->path.skew = 0;
+  BeginFusedBranch(A, &b, "cmp");
+  SkewFusedBranch(A, &b);
   if (imm) {
     Jitter(A, "s1i", uimm0);
   } else {
@@ -245,17 +306,10 @@ bool FuseBranchCmp(P, bool imm) {
 #ifdef __x86_64__
   Jitter(A, "B"    // res0 = GetRegOrMem(RexbRm)
             "q");  // arg0 = machine
-  AlignJit(m->path.jb, 8, 3);
-  u8 code[] = {
-      // cmp %r12,%rax
-      (u8)((Rexw(rde) ? kAmdRexw : 0) | (kJitSav1 > 7 ? kAmdRexr : 0)),
-      0x39,
-      0300 | (kJitSav1 & 7) << 3 | kJitRes0,
-      // jz/jnz +5
-      (u8)(0x70 | jcc),
-      5,
-  };
+  AppendFusedCompare(A, 0x38, kJitSav1, kJitRes0, b.jcc ^ b.flip);
 #elif defined(__aarch64__)
+  u8 jcc;
+  unsigned bits;
   Jitter(A, "B"      // res0 = GetRegOrMem(RexbRm)
             "r0a1="  // arg1 = res0
             "q");    // arg0 = machine
@@ -273,7 +327,7 @@ bool FuseBranchCmp(P, bool imm) {
   // 5400000b b.lt #0 less than (signed)
   // 5400000c b.gt #0 greater than (signed)
   // 5400000d b.le #0 less than or equal to (signed)
-  switch (jcc) {
+  switch (b.jcc) {
     case 0x0:  // jo → b.vs
       jcc = 0x6;
       break;
@@ -313,28 +367,144 @@ bool FuseBranchCmp(P, bool imm) {
     default:
       __builtin_unreachable();
   }
-  u32 code[] = {
-      // 6b07007f cmp w3, w7
-      // eb07007f cmp x3, x7
-      Rexw(rde) << 31 | 0x6b00001f | kJitSav1 << 16 | kJitArg1 << 5,
-      // 54000000 b.xx
-      0x54000000 | (8 / 4) << 5 | jcc,
-  };
+  bits = 8 << RegLog2(rde);
+  if (bits < 32) {
+    // bytes and words are shifted to the top of the register, so the
+    // 32-bit compare yields the flags a narrow compare would've set
+    u32 code[] = {
+        // 53181c21 lsl w1, w1, #24
+        0x53000000 | bits << 16 | (bits - 1) << 10 | kJitArg1 << 5 | kJitArg1,
+        // 53181e82 lsl w2, w20, #24
+        0x53000000 | bits << 16 | (bits - 1) << 10 | kJitSav1 << 5 | kJitArg2,
+        // 6b02003f cmp w1, w2
+        0x6b00001f | kJitArg2 << 16 | kJitArg1 << 5,
+        // 54000000 b.xx
+        0x54000000 | (8 / 4) << 5 | (jcc ^ b.flip),
+    };
+    AppendJit(m->path.jb, code, sizeof(code));
+  } else {
+    u32 code[] = {
+        // 6b07007f cmp w3, w7
+        // eb07007f cmp x3, x7
+        Rexw(rde) << 31 | 0x6b00001f | kJitSav1 << 16 | kJitArg1 << 5,
+        // 54000000 b.xx
+        0x54000000 | (8 / 4) << 5 | (jcc ^ b.flip),
+    };
+    AppendJit(m->path.jb, code, sizeof(code));
+  }
+#endif
+  STATISTIC(++fused_cmp_branches);
+  return FuseBranch(A, &b);
 #else
-#error "architecture not implemented"
+  return false;
 #endif
-  AppendJit(m->path.jb, code, sizeof(code));
-  Connect(A, m->ip + jlen, true);
+}
+
+/**
+ * Returns true if arithmetic op can be fused with the jump after it.
+ *
+ * This is for ops like `dec` and `sub` which are followed by a branch
+ * that only looks at the zero or sign flags. In that case the op can
+ * be computed without any flags, and its result is tested afterwards.
+ * Logical ops always clear CF and OF, so testing their result gives us
+ * every flag a jump might want.
+ *
+ * If this returns true, the caller must generate code that puts the
+ * op's result in sav1 and stores it, and then call FuseBranchResult().
+ */
+bool CanFuseBranchAlu(P, int op) {
+#ifdef HAVE_JIT
+  bool logical;
+  struct FusedBranch b;
+  switch (op) {
+    case ALU_ADD:
+    case ALU_SUB:
+    case ALU_INC:
+    case ALU_DEC:
+      logical = false;
+      break;
+    case ALU_AND:
+    case ALU_OR:
+    case ALU_XOR:
+      logical = true;
+      break;
+    default:
+      return false;
+  }
+  if (!GetFusedBranch(A, &b)) return false;
+#ifdef __x86_64__
+  if (logical) return true;
+#endif
+  if (!IsZeroOrSign(b.jcc)) {
+    LogCodOp(m, "can't fuse alu: unsupported jump operation");
+    return false;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+/**
+ * Generates the branch for an op that CanFuseBranchAlu() accepted.
+ */
+void FuseBranchResult(P) {
+#ifdef HAVE_JIT
+  struct FusedBranch b;
+  unassert(GetFusedBranch(A, &b));
+  BeginFusedBranch(A, &b, "alu");
   Jitter(A,
-         "a1i"  // arg1 = disp
+         "a1i"  // arg1 = skew + jlen
+         "q"    // arg0 = machine
          "m"    // call micro-op
          "q",   // arg0 = machine
-         bdisp, AdvanceIp);
-  AlignJit(m->path.jb, 8, 0);
-  Connect(A, m->ip + jlen + bdisp, false);
-  FinishPath(m);
-  m->path.skip = 1;
-  STATISTIC(++fused_branches);
+         m->path.skew + b.jlen, AdvanceIp);
+  m->path.skew = 0;
+#ifdef __x86_64__
+  AppendFusedCompare(A, 0x84, kJitSav1, kJitSav1, b.jcc ^ b.flip);
+#elif defined(__aarch64__)
+  AppendFusedTest(A, kJitSav1, b.jcc ^ b.flip);
+#endif
+  FuseBranch(A, &b);
+#endif
+}
+
+/**
+ * Fuses `push %rbp` with the `mov %rsp,%rbp` that usually follows it.
+ */
+bool FusePrologue(P) {
+#ifdef HAVE_JIT
+  u8 *p;
+  if (RexbSrm(rde) != 5 || Eamode(rde) != XED_MODE_LONG) {
+    return false;
+  }
+  if (4096 - (m->ip & 4095) < 3) {
+    LogCodOp(m, "can't fuse push: too close to the edge");
+    return false;
+  }
+  if (!(p = GetAddress(m, m->ip))) {
+    LogCodOp(m, "can't fuse push: null address");
+    return false;
+  }
+  if (!(p[0] == 0x48 && ((p[1] == 0x89 && p[2] == 0345) ||    // mov %rsp,%rbp
+                         (p[1] == 0x8b && p[2] == 0354)))) {  // mov %rsp,%rbp
+    LogCodOp(m, "can't fuse push: not followed by mov");
+    return false;
+  }
+  if (GetJitHook(&m->system->jit, m->ip)) {
+    LogCodOp(m, "can't fuse push: mov is a jump target");
+    return false;
+  }
+  FlushCod(m->path.jb);
+  WriteCod("/\tfusing push+mov prologue\n");
+  BeginCod(m, m->ip);
+  Jitter(A, "m", FastEnter);
+  // the mov won't be dispatched, so we run it and move past it here
+  Put64(m->bp, Get64(m->sp));
+  m->ip += 3;
+  m->path.skew += 3;
+  m->path.end = MAX(m->path.end, m->ip);
+  STATISTIC(++fused_prologues);
   return true;
 #else
   return false;
@@ -0,0 +1,203 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "blink/gaps.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "blink/errno.h"
+#include "blink/macros.h"
+#include "blink/util.h"
+
+static struct Gap *NewGap(struct Gaps *g) {
+  struct Gap *t;
+  if ((t = (struct Gap *)calloc(1, sizeof(*t)))) {
+    t->prio = Vigna(&g->rng);
+  } else {
+    enomem();
+  }
+  return t;
+}
+
+static void FreeGapTree(struct Gap *t) {
+  if (t) {
+    FreeGapTree(t->lo);
+    FreeGapTree(t->hi);
+    free(t);
+  }
+}
+
+static struct Gap *Update(struct Gap *t) {
+  t->max = t->end - t->beg;
+  if (t->lo) t->max = MAX(t->max, t->lo->max);
+  if (t->hi) t->max = MAX(t->max, t->hi->max);
+  return t;
+}
+
+// concatenates treaps where every interval in `a` comes before `b`
+static struct Gap *Merge(struct Gap *a, struct Gap *b) {
+  if (!a) return b;
+  if (!b) return a;
+  if (a->prio > b->prio) {
+    a->hi = Merge(a->hi, b);
+    return Update(a);
+  } else {
+    b->lo = Merge(a, b->lo);
+    return Update(b);
+  }
+}
+
+// splits treap into intervals starting before `key` and the rest
+static void Split(struct Gap *t, i64 key, struct Gap **lo, struct Gap **hi) {
+  if (!t) {
+    *lo = *hi = 0;
+  } else if (t->beg < key) {
+    Split(t->hi, key, &t->hi, hi);
+    *lo = Update(t);
+  } else {
+    Split(t->lo, key, lo, &t->lo);
+    *hi = Update(t);
+  }
+}
+
+// removes last interval from treap and returns it
+static struct Gap *PopLast(struct Gap **t) {
+  struct Gap *x;
+  if ((*t)->hi) {
+    x = PopLast(&(*t)->hi);
+    Update(*t);
+  } else {
+    x = *t;
+    *t = x->lo;
+    x->lo = 0;
+  }
+  return x;
+}
+
+// creates index where only [beg,end) is unmapped
+int InitGaps(struct Gaps *g, i64 beg, i64 end) {
+  memset(g, 0, sizeof(*g));
+  g->rng = (uintptr_t)g;
+  return AddGap(g, beg, end);
+}
+
+void FreeGaps(struct Gaps *g) {
+  FreeGapTree(g->root);
+  g->root = 0;
+}
+
+// records that [beg,end) is no longer mapped
+int AddGap(struct Gaps *g, i64 beg, i64 end) {
+  struct Gap *a, *b, *c, *x, *y;
+  if (beg >= end) return 0;
+  if (!(x = NewGap(g))) return -1;
+  Split(g->root, beg, &a, &b);
+  Split(b, end + 1, &b, &c);
+  // absorb the interval before us if it overlaps or touches
+  if (a) {
+    y = PopLast(&a);
+    if (y->end >= beg) {
+      beg = y->beg;
+      end = MAX(end, y->end);
+      free(y);
+    } else {
+      a = Merge(a, Update(y));
+    }
+  }
+  // absorb intervals which begin inside [beg,end]
+  if (b) {
+    y = PopLast(&b);
+    end = MAX(end, y->end);
+    free(y);
+    FreeGapTree(b);
+  }
+  x->beg = beg;
+  x->end = end;
+  g->root = Merge(Merge(a, Update(x)), c);
+  return 0;
+}
+
+// records that [beg,end) is now mapped
+int RemoveGap(struct Gaps *g, i64 beg, i64 end) {
+  struct Gap *a, *b, *c, *x, *y;
+  if (beg >= end) return 0;
+  if (!(y = NewGap(g))) return -1;
+  Split(g->root, beg, &a, &b);
+  Split(b, end, &b, &c);
+  // intervals which begin inside [beg,end) may still hang off the end
+  if (b) {
+    x = PopLast(&b);
+    if (x->end > end) {
+      x->beg = end;
+      c = Merge(Update(x), c);
+    } else {
+      free(x);
+    }
+    FreeGapTree(b);
+  }
+  // the interval before us may straddle either side of [beg,end)
+  if (a) {
+    x = PopLast(&a);
+    if (x->end > end) {
+      y->beg = end;
+      y->end = x->end;
+      c = Merge(Update(y), c);
+      y = 0;
+    }
+    x->end = MIN(x->end, beg);
+    a = Merge(a, Update(x));
+  }
+  free(y);
+  g->root = Merge(a, c);
+  return 0;
+}
+
+// returns lowest address at or after `hint` where `size` bytes fit
+// @return address, or -1 if there's no interval big enough
+i64 FindGap(struct Gaps *g, i64 hint, i64 size) {
+  i64 res;
+  struct Gap *a, *b, *t;
+  for (t = g->root; t;) {
+    if (hint < t->beg) {
+      t = t->lo;
+    } else if (hint >= t->end) {
+      t = t->hi;
+    } else if (t->end - hint >= size) {
+      return hint;
+    } else {
+      break;
+    }
+  }
+  res = -1;
+  Split(g->root, hint + 1, &a, &b);
+  if (b && b->max >= size) {
+    for (t = b;;) {
+      if (t->lo && t->lo->max >= size) {
+        t = t->lo;
+      } else if (t->end - t->beg >= size) {
+        res = t->beg;
+        break;
+      } else {
+        t = t->hi;
+      }
+    }
+  }
+  g->root = Merge(a, b);
+  return res;
+}
@@ -0,0 +1,30 @@
+#ifndef BLINK_GAPS_H_
+#define BLINK_GAPS_H_
+#include "blink/types.h"
+
+// index of unmapped guest virtual address ranges. the intervals are
+// kept disjoint and non-adjacent in a treap that's ordered by start,
+// where each node knows the longest interval inside its subtree, so
+// first fit searches can skip over whole runs of fragmented memory.
+
+struct Gap {
+  i64 beg;  // first address of interval
+  i64 end;  // address after interval
+  i64 max;  // longest interval in this subtree
+  u64 prio;
+  struct Gap *lo;
+  struct Gap *hi;
+};
+
+struct Gaps {
+  u64 rng;
+  struct Gap *root;
+};
+
+int InitGaps(struct Gaps *, i64, i64);
+void FreeGaps(struct Gaps *);
+int AddGap(struct Gaps *, i64, i64);
+int RemoveGap(struct Gaps *, i64, i64);
+i64 FindGap(struct Gaps *, i64, i64);
+
+#endif /* BLINK_GAPS_H_ */
@@ -77,9 +77,7 @@ int LoadInstruction2(struct Machine *m, u64 pc) {
   unsigned key;
   u8 *addr, *page;
   if (atomic_load_explicit(&m->opcache->invalidated, memory_order_acquire)) {
-    ResetInstructionCache(m);
-    atomic_store_explicit(&m->opcache->invalidated, false,
-                          memory_order_relaxed);
+    ApplyShootdowns(m);
   }
   key = pc & (ARRAYLEN(m->opcache->icache) - 1);
   m->xedd = (struct XedDecodedInst *)m->opcache->icache[key];
@@ -0,0 +1,68 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2022 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "blink/intrin.h"
+#include "blink/thread.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+
+static struct X86Features {
+  pthread_once_t_ once;
+  u64 bits;
+} g_x86 = {
+    PTHREAD_ONCE_INIT_,
+};
+
+static void GetX86FeaturesInit(void) {
+  bool avx;
+  u32 ax, bx, cx, dx, max, xcr0;
+  asm("cpuid" : "=a"(max), "=b"(bx), "=c"(cx), "=d"(dx) : "0"(0), "2"(0));
+  asm("cpuid" : "=a"(ax), "=b"(bx), "=c"(cx), "=d"(dx) : "0"(1), "2"(0));
+  g_x86.bits = cx & ~(1u << 16);
+  // avx registers are only usable if the host kernel saves them, which
+  // it tells us by setting osxsave and enabling the sse / avx xcr0 bits
+  avx = false;
+  if ((cx & (1u << 27 | 1u << 28)) == (1u << 27 | 1u << 28)) {
+    asm("xgetbv" : "=a"(xcr0), "=d"(dx) : "c"(0));
+    avx = (xcr0 & 6) == 6;
+  }
+  if (!avx) g_x86.bits &= ~(1u << 12 | 1u << 29);  // fma and f16c
+  if (max >= 7) {
+    asm("cpuid" : "=a"(ax), "=b"(bx), "=c"(cx), "=d"(dx) : "0"(7), "2"(0));
+    if (!avx) bx &= ~(1u << 5);
+    g_x86.bits |= (u64)bx << 32;
+  }
+  asm("cpuid"
+      : "=a"(max), "=b"(bx), "=c"(cx), "=d"(dx)
+      : "0"(0x80000000), "2"(0));
+  if (max >= 0x80000001) {
+    asm("cpuid"
+        : "=a"(ax), "=b"(bx), "=c"(cx), "=d"(dx)
+        : "0"(0x80000001), "2"(0));
+    if (cx & (1u << 5)) g_x86.bits |= 1u << 16;  // lzcnt
+  }
+}
+
+// returns features of the host cpu, for deciding if a guest instruction
+// can be run natively, since blink itself is built for baseline x86-64.
+u64 GetX86Features(void) {
+  pthread_once_(&g_x86.once, GetX86FeaturesInit);
+  return g_x86.bits;
+}
+
+#endif /* __x86_64__ */
@@ -1,5 +1,7 @@
 #ifndef BLINK_INTRIN_H_
 #define BLINK_INTRIN_H_
+#include "blink/builtin.h"
+#include "blink/types.h"
 
 #if defined(__x86_64__) && defined(__GNUC__) && __GNUC__ >= 6
 #define X86_INTRINSICS 1
@@ -10,4 +12,26 @@ typedef char char_xmma_t
 #define X86_INTRINSICS 0
 #endif
 
+#if defined(__x86_64__) && defined(__GNUC__)
+// features of the host cpu, with cpuid(1).ecx in the low word and
+// cpuid(7).ebx in the high word, where avx bits are only set if they're usable
+// and lzcnt from cpuid(0x80000001).ecx is folded into reserved bit 16
+#define kX86Ssse3  (1ull << 9)
+#define kX86Fma    (1ull << 12)
+#define kX86Lzcnt  (1ull << 16)
+#define kX86Sse41  (1ull << 19)
+#define kX86Sse42  (1ull << 20)
+#define kX86Popcnt (1ull << 23)
+#define kX86Aes    (1ull << 25)
+#define kX86F16c   (1ull << 29)
+#define kX86Bmi1   (1ull << 35)
+#define kX86Avx2   (1ull << 37)
+#define kX86Bmi2   (1ull << 40)
+#define kX86Sha    (1ull << 61)
+u64 GetX86Features(void) pureconst;
+#define X86_HAVE(x) (GetX86Features() & kX86##x)
+#else
+#define X86_HAVE(x) 0
+#endif
+
 #endif /* BLINK_INTRIN_H_ */
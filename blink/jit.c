@@ -18,6 +18,7 @@
 ╚─────────────────────────────────────────────────────────────────────────────*/
 #include <errno.h>
 #include <limits.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
@@ -124,14 +125,31 @@ const u8 kJitSav[5] = {kJitSav0, kJitSav1, kJitSav2, kJitSav3, kJitSav4};
 
 static u8 g_code[kJitMemorySize];
 
+struct JitRegion {
+  u8 *addr;         // address of first block in region
+  int blocks;       // number of blocks in region
+  int leased;       // number of blocks currently owned by a jit
+  int peak;         // greatest number of blocks leased at once
+  long evictions;   // number of blocks reclaimed by EvictJitBlock()
+  unsigned lastused[kJitRegionSize / kJitBlockSize];
+};
+
 static struct JitGlobals {
   pthread_mutex_t_ lock;
   _Atomic(long) prot;
   int freecount;
   struct Dll *freeblocks;
+  bool cantgrow;
+  long memory;
+  _Atomic(int) nregions;
+  _Atomic(unsigned) clock;
+  _Atomic(unsigned) epoch;  // incremented each time a block is retired
+  struct Dll *readers;      // threads that might execute jit code
+  struct JitRegion regions[kJitMaxRegions];
 } g_jit = {
     PTHREAD_MUTEX_INITIALIZER_,
     PROT_READ | PROT_WRITE | PROT_EXEC,
+    .epoch = 1,  // since zero means reader is parked
 };
 
 static inline u64 RoundupTwoPow(u64 x) {
@@ -328,6 +346,7 @@ static void FreeJitBlock(struct JitBlock *jb) {
     dll_remove(&jb->freejumps, e);
     FreeJitJump(JITJUMP_CONTAINER(e));
   }
+  Free(jb->relocs);
   Free(jb);
 }
 
@@ -571,25 +590,30 @@ static void ClearEdges(struct JitEdges *edges) {
   edges->i = 0;
 }
 
-static bool IsCyclic(struct JitEdges *edges, i64 V[kJitDepth], int d, i64 dst) {
-  int i, s;
+// returns 1 if path for dst can reach path for V[0], -1 if we gave up
+// searching because the graph is too deep, otherwise 0 is returned
+static int IsCyclic(struct JitEdges *edges, i64 V[kJitDepth], int d, i64 dst) {
+  int i, s, rc;
+  if (dst == V[0]) {
+    return 1;
+  }
   if (d == kJitDepth) {
-    return true;
+    return -1;
   }
-  for (i = 0; i < d; ++i) {
+  for (i = 1; i < d; ++i) {
     if (dst == V[i]) {
-      return true;
+      return 0;  // already being searched
     }
   }
   V[d++] = dst;
   if (edges->dst[(s = GetEdge(edges, dst))]) {
     for (i = 0; i < edges->dst[s]->i; ++i) {
-      if (IsCyclic(edges, V, d, edges->dst[s]->p[i])) {
-        return true;
+      if ((rc = IsCyclic(edges, V, d, edges->dst[s]->p[i]))) {
+        return rc;
       }
     }
   }
-  return false;
+  return 0;
 }
 
 static inline uintptr_t DecodeJitFunc(int func) {
@@ -615,19 +639,6 @@ bool CanJitForImmediateEffect(void) {
   return atomic_load_explicit(&g_jit.prot, memory_order_relaxed) & PROT_EXEC;
 }
 
-static u8 *AllocateJitMemory(long *state) {
-  long i, brk;
-  uintptr_t p;
-  brk = *state;
-  p = (uintptr_t)g_code;
-  i = ROUNDUP(p + brk, FLAG_pagesize) - p;
-  if (i + kJitBlockSize > kJitMemorySize) {
-    return 0;
-  }
-  *state = i + kJitBlockSize;
-  return g_code + i;
-}
-
 static int MakeJitJump(u8 buf[5], uintptr_t pc, uintptr_t addr) {
   int n;
   intptr_t disp;
@@ -647,19 +658,49 @@ static int MakeJitJump(u8 buf[5], uintptr_t pc, uintptr_t addr) {
   return n;
 }
 
+// returns oldest epoch that any reader might still be executing within
+// @assume g_jit.lock
+static unsigned GetJitReaderEpoch(void) {
+  struct Dll *e;
+  unsigned res, epoch;
+  res = atomic_load_explicit(&g_jit.epoch, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  for (e = dll_first(g_jit.readers); e; e = dll_next(g_jit.readers, e)) {
+    epoch = atomic_load_explicit(&JITREADER_CONTAINER(e)->epoch,
+                                 memory_order_relaxed);
+    if (epoch && (int)(epoch - res) < 0) {
+      res = epoch;
+    }
+  }
+  return res;
+}
+
 // Obtains JitBlock from global pool or creates one if none exist.
 static struct JitBlock *AcquireJitBlock(struct Jit *jit) {
   struct Dll *e;
+  unsigned epoch;
   struct JitBlock *jb;
+  struct JitRegion *r;
   LOCK(&g_jit.lock);
-  if ((e = dll_first(g_jit.freeblocks))) {
-    dll_remove(&g_jit.freeblocks, e);
+  epoch = GetJitReaderEpoch();
+  for (jb = 0, e = dll_first(g_jit.freeblocks); e;
+       e = dll_next(g_jit.freeblocks, e)) {
     jb = JITBLOCK_CONTAINER(e);
-    unassert(g_jit.freecount > 0);
-    --g_jit.freecount;
-  } else {
+    if (!jb->wasretired || (int)(epoch - jb->epoch) > 0) {
+      dll_remove(&g_jit.freeblocks, e);
+      unassert(g_jit.freecount > 0);
+      --g_jit.freecount;
+      break;
+    }
+    // some thread might still be executing code inside this block
+    STATISTIC(++jit_blocks_deferred);
     jb = 0;
   }
+  if (jb) {
+    r = g_jit.regions + jb->region;
+    ++r->leased;
+    r->peak = MAX(r->peak, r->leased);
+  }
   UNLOCK(&g_jit.lock);
   if (jb) dll_make_last(&jit->agedblocks, &jb->aged);
   JIT_LOGF("acquired jit block %p (freecount=%d)", jb, g_jit.freecount);
@@ -684,18 +725,24 @@ static void ReleaseJitBlock(struct JitBlock *jb) {
   jb->committed = 0;
   jb->wasretired = false;
   jb->isprotected = false;
+  jb->isleased = false;
   dll_init(&jb->aged);
   LOCK(&g_jit.lock);
   dll_make_first(&g_jit.freeblocks, &jb->elem);
+  --g_jit.regions[jb->region].leased;
   ++g_jit.freecount;
   UNLOCK(&g_jit.lock);
 }
 
 // Frees JitBlock and adds it to the global free list in such a way that
 // it'll take a long time before it's reused. This is intended for a JIT
-// under active use that's trying to reclaim jit memory.
+// under active use that's trying to reclaim jit memory. The hooks for
+// paths inside the block must have been deleted by the caller, since it
+// won't be reused until every reader thread has observed a later epoch,
+// at which point each of them is certain to have seen the hooks vanish.
 // @assume jit->lock
 static void RetireJitBlock(struct Jit *jit, struct JitBlock *jb) {
+  struct Dll *e;
   JIT_LOGF("retiring jit block %p", jb);
   unassert(!jb->isprotected);
   unassert(dll_is_empty(jb->jumps));
@@ -708,21 +755,124 @@ static void RetireJitBlock(struct Jit *jit, struct JitBlock *jb) {
   jb->committed = 0;
   jb->wasretired = true;
   LOCK(&g_jit.lock);
+  jb->epoch = atomic_fetch_add_explicit(&g_jit.epoch, 1, memory_order_release);
+  // ask threads to drop back into the interpreter, in case they're stuck
+  // in a cycle of paths, so they'll observe the new epoch in short order
+  for (e = dll_first(g_jit.readers); e; e = dll_next(g_jit.readers, e)) {
+    atomic_store_explicit(JITREADER_CONTAINER(e)->attention, true,
+                          memory_order_release);
+  }
   dll_make_last(&g_jit.freeblocks, &jb->elem);
+  --g_jit.regions[jb->region].leased;
   ++g_jit.freecount;
   UNLOCK(&g_jit.lock);
 }
 
-// creates new jit block and sets up its jit memory
-static struct JitBlock *InitJitBlock(struct Jit *jit, long *state) {
+// creates jit blocks for region of memory and adds them to free list
+// @assume g_jit.lock
+static void AddJitRegion(u8 *addr, long size) {
+  int i, n;
   struct JitBlock *jb;
-  if ((jb = NewJitBlock())) {
-    if (!(jb->addr = AllocateJitMemory(state))) {
-      FreeJitBlock(jb);
-      jb = 0;
+  struct JitRegion *r;
+  n = atomic_load_explicit(&g_jit.nregions, memory_order_relaxed);
+  unassert(n < kJitMaxRegions);
+  unassert(size <= kJitRegionSize);
+  r = g_jit.regions + n;
+  r->addr = addr;
+  for (i = 0; i < size / kJitBlockSize && (jb = NewJitBlock()); ++i) {
+    jb->addr = addr + i * kJitBlockSize;
+    jb->region = n;
+    dll_make_last(&g_jit.freeblocks, &jb->elem);
+    ++g_jit.freecount;
+  }
+  r->blocks = i;
+  g_jit.memory += i * kJitBlockSize;
+  atomic_store_explicit(&g_jit.nregions, n + 1, memory_order_release);
+  JIT_LOGF("added jit region %d at %p with %d blocks", n, addr, i);
+}
+
+static bool IsWithinJitReach(u8 *addr) {
+  intptr_t lo, hi, image;
+  image = (intptr_t)IMAGE_END;
+  lo = (intptr_t)addr;
+  hi = lo + kJitRegionSize;
+  return image - lo <= kJitMemoryReach && hi - image <= kJitMemoryReach;
+}
+
+static u8 *MapJitRegion(u8 *want) {
+  u8 *got;
+  if (!IsWithinJitReach(want)) return 0;
+  got = (u8 *)Mmap(want, kJitRegionSize, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS_ | MAP_DEMAND, -1, 0, "jit");
+  if (got == (u8 *)MAP_FAILED) return 0;
+  if (got != want) {
+    Munmap(got, kJitRegionSize);
+    return 0;
+  }
+  return got;
+}
+
+// maps another region of jit memory, if we're permitted to have more.
+// regions are placed near the blink image, since our generated code
+// needs to be able to make relative calls into blink and one another
+static bool GrowJitMemory(void) {
+  int i;
+  u8 *base, *addr;
+  bool res = false;
+  LOCK(&g_jit.lock);
+  if (!g_jit.cantgrow &&
+      g_jit.nregions < kJitMaxRegions &&
+      g_jit.memory + kJitRegionSize <= FLAG_jitmemory) {
+    base = (u8 *)ROUNDDOWN((uintptr_t)IMAGE_END, kJitRegionSize);
+    for (addr = 0, i = 1; !addr && i <= kJitMemoryReach / kJitRegionSize;
+         ++i) {
+      if (!(addr = MapJitRegion(base - (long)i * kJitRegionSize))) {
+        addr = MapJitRegion(base + (long)i * kJitRegionSize);
+      }
+    }
+    if (addr) {
+      STATISTIC(++jit_regions_mapped);
+      AddJitRegion(addr, kJitRegionSize);
+      res = true;
+    } else {
+      LOG_ONCE(LOGF("couldn't find room for more jit memory near image"));
+      g_jit.cantgrow = true;
+    }
+  }
+  UNLOCK(&g_jit.lock);
+  return res;
+}
+
+static unsigned *GetJitLastUsed(struct JitBlock *jb) {
+  struct JitRegion *r = g_jit.regions + jb->region;
+  return r->lastused + (jb->addr - r->addr) / kJitBlockSize;
+}
+
+/**
+ * Records that JIT code is being executed.
+ *
+ * This is called when the interpreter dispatches into a JIT path, or a
+ * new path gets linked to it, so that when JIT memory fills up, the least
+ * recently executed block of code can be chosen for eviction. Threads in
+ * paths that jump into one another won't call this, but each eviction
+ * raises their attention so they'll pass back through the interpreter.
+ *
+ * @param code is address of JIT function
+ */
+void TouchJit(uintptr_t code) {
+  int i, n;
+  uintptr_t off;
+  struct JitRegion *r;
+  n = atomic_load_explicit(&g_jit.nregions, memory_order_acquire);
+  for (i = 0; i < n; ++i) {
+    r = g_jit.regions + i;
+    off = code - (uintptr_t)r->addr;
+    if (off < (uintptr_t)r->blocks * kJitBlockSize) {
+      r->lastused[off / kJitBlockSize] =
+          atomic_load_explicit(&g_jit.clock, memory_order_relaxed);
+      return;
     }
   }
-  return jb;
 }
 
 static void LockJit(struct Jit *jit) {
@@ -737,6 +887,68 @@ static void UnlockJit(struct Jit *jit) {
   }
 }
 
+/**
+ * Registers thread that may execute code generated by `jit`.
+ *
+ * Memory blocks which get retired won't be handed out again until each
+ * registered reader has called ObserveJitEpoch() after the retirement,
+ * since only then can we be certain that it isn't still running inside
+ * of them. Reader must be removed with RemoveJitReader() before freed.
+ *
+ * @param attention is raised when retired blocks are waiting on reader
+ */
+void AddJitReader(struct Jit *jit, struct JitReader *r,
+                  _Atomic(bool) *attention) {
+  dll_init(&r->elem);
+  r->attention = attention;
+  LockJit(jit);
+  LOCK(&g_jit.lock);
+  atomic_store_explicit(
+      &r->epoch, atomic_load_explicit(&g_jit.epoch, memory_order_relaxed),
+      memory_order_relaxed);
+  dll_make_last(&g_jit.readers, &r->elem);
+  UNLOCK(&g_jit.lock);
+  UnlockJit(jit);
+}
+
+/**
+ * Unregisters thread that may execute code generated by `jit`.
+ */
+void RemoveJitReader(struct Jit *jit, struct JitReader *r) {
+  LockJit(jit);
+  LOCK(&g_jit.lock);
+  dll_remove(&g_jit.readers, &r->elem);
+  UNLOCK(&g_jit.lock);
+  UnlockJit(jit);
+}
+
+/**
+ * Records that reader thread is currently outside of jit code.
+ *
+ * This must be called at a point where the thread won't be using any
+ * function it looked up previously, e.g. the main interpreter loop, so
+ * it'll consult GetJitHook() again before it executes jit code again.
+ */
+void ObserveJitEpoch(struct JitReader *r) {
+  atomic_store_explicit(
+      &r->epoch, atomic_load_explicit(&g_jit.epoch, memory_order_acquire),
+      memory_order_relaxed);
+  // a parked reader could otherwise look up a hook that was deleted,
+  // while the retirer still sees it as parked, like in dekker's lock
+  atomic_thread_fence(memory_order_seq_cst);
+}
+
+/**
+ * Records that reader won't execute jit code for a potentially long time.
+ *
+ * This is called when a thread enters a system call, which might block
+ * indefinitely, so it doesn't keep retired memory from being reused. The
+ * thread must call ObserveJitEpoch() before executing jit code again.
+ */
+void ParkJitReader(struct JitReader *r) {
+  atomic_store_explicit(&r->epoch, 0, memory_order_release);
+}
+
 /**
  * Initializes memory object for Just-In-Time (JIT) threader.
  *
@@ -747,13 +959,13 @@ static void UnlockJit(struct Jit *jit) {
  * @return 0 on success
  */
 int InitJit(struct Jit *jit, uintptr_t opt_staging_function) {
-  long brk;
+  u8 *addr;
   unsigned n;
-  struct JitBlock *jb;
   _Atomic(int) *funcs;
   _Atomic(uintptr_t) *virts;
   _Static_assert(kJitAlign >= 1, "");
   _Static_assert(kJitBlockSize >= 4096, "");
+  _Static_assert(kJitMemorySize <= kJitRegionSize, "");
   _Static_assert(kJitInitialHooks >= 2, "");
   unassert(FLAG_pagesize >= 4096);
   unassert(kJitBlockSize >= FLAG_pagesize);
@@ -768,10 +980,14 @@ int InitJit(struct Jit *jit, uintptr_t opt_staging_function) {
   unassert(funcs = (_Atomic(int) *)Calloc(n, sizeof(*funcs)));
   atomic_store_explicit(&jit->hooks.virts, virts, memory_order_relaxed);
   atomic_store_explicit(&jit->hooks.funcs, funcs, memory_order_relaxed);
-  for (brk = 0; (jb = InitJitBlock(jit, &brk));) {
-    dll_make_last(&g_jit.freeblocks, &jb->elem);
-    ++g_jit.freecount;
+  LOCK(&g_jit.lock);
+  if (!g_jit.nregions) {
+    // the static region counts towards the $BLINK_JIT_MEMORY limit too
+    addr = (u8 *)ROUNDUP((uintptr_t)g_code, FLAG_pagesize);
+    AddJitRegion(addr, MIN(g_code + kJitMemorySize - addr,
+                           MAX(FLAG_jitmemory, kJitBlockSize)));
   }
+  UNLOCK(&g_jit.lock);
   JIT_LOGF("initialized jit %p", jit);
   return 0;
 }
@@ -813,6 +1029,33 @@ int DestroyJit(struct Jit *jit) {
   return 0;
 }
 
+/**
+ * Prints occupancy of JIT memory regions, for the `-Z` flag.
+ */
+void PrintJitStats(void) {
+#ifndef NDEBUG
+  int i, n;
+  char b[64];
+  char name[32];
+  struct JitRegion *r;
+  n = atomic_load_explicit(&g_jit.nregions, memory_order_acquire);
+  for (i = 0; i < n; ++i) {
+    r = g_jit.regions + i;
+    snprintf(name, sizeof(name), "jit_region%d_blocks", i);
+    snprintf(b, sizeof(b), "%-32s = %d\n", name, r->blocks);
+    WriteErrorString(b);
+    snprintf(name, sizeof(name), "jit_region%d_peak", i);
+    snprintf(b, sizeof(b), "%-32s = %d\n", name, r->peak);
+    WriteErrorString(b);
+    if (r->evictions) {
+      snprintf(name, sizeof(name), "jit_region%d_evictions", i);
+      snprintf(b, sizeof(b), "%-32s = %ld\n", name, r->evictions);
+      WriteErrorString(b);
+    }
+  }
+#endif
+}
+
 /**
  * Releases global JIT resources at shutdown.
  */
@@ -1152,11 +1395,14 @@ static void DeleteJitPath(struct Jit *jit, i64 virt) {
       break;
     }
   }
-  // delete paths that point to this path
+  // delete paths that point to this path. the edge is removed before
+  // recursing, since paths may be linked together to form a cycle
   while (jit->redges.dst[(s = GetEdge(&jit->redges, virt))] &&
          jit->redges.dst[s]->i) {
     dep = jit->redges.dst[s]->p[jit->redges.dst[s]->i - 1];
     JIT_LOGF("jit path %#" PRIx64 " depends on %#" PRIx64, dep, virt);
+    RemoveEdge(&jit->redges, virt, dep);
+    RemoveEdge(&jit->edges, dep, virt);
     DeleteJitPath(jit, dep);
   }
   // delete edges associated with this path from bimap
@@ -1231,14 +1477,6 @@ static void ForceJitBlocksToRetire(struct Jit *jit) {
   dll_make_first(&jit->freejumps, jit->jumps);
   jit->jumps = 0;
   pgen = BeginUpdate(&jit->pagegen);
-  for (e = dll_first(jit->agedblocks); e; e = e2) {
-    e2 = dll_next(jit->agedblocks, e);
-    jb = AGEDBLOCK_CONTAINER(e);
-    if (!jb->isprotected) {
-      JIT_LOGF("forcing jit block %p to retire", jb);
-      RetireJitBlock(jit, jb);
-    }
-  }
   n = atomic_load_explicit(&jit->hooks.n, memory_order_relaxed);
   for (i = 0; i < n; ++i) {
     if (atomic_load_explicit(jit->hooks.virts + i, memory_order_relaxed)) {
@@ -1251,7 +1489,79 @@ static void ForceJitBlocksToRetire(struct Jit *jit) {
   jit->hooks.i = 0;
   ClearEdges(&jit->redges);
   ClearEdges(&jit->edges);
+  for (e = dll_first(jit->agedblocks); e; e = e2) {
+    e2 = dll_next(jit->agedblocks, e);
+    jb = AGEDBLOCK_CONTAINER(e);
+    if (!jb->isprotected && !jb->isleased) {
+      JIT_LOGF("forcing jit block %p to retire", jb);
+      RetireJitBlock(jit, jb);
+    }
+  }
+  EndUpdate(&jit->pagegen, pgen);
+}
+
+// finds least recently executed block that isn't in use by a thread
+// @assume jit->lock
+static struct JitBlock *GetJitVictim(struct Jit *jit) {
+  struct Dll *e;
+  unsigned age, oldest;
+  struct JitBlock *jb, *res;
+  unsigned now = atomic_load_explicit(&g_jit.clock, memory_order_relaxed);
+  for (oldest = 0, res = 0, e = dll_first(jit->agedblocks); e;
+       e = dll_next(jit->agedblocks, e)) {
+    jb = AGEDBLOCK_CONTAINER(e);
+    if (jb->isprotected || jb->isleased || !dll_is_empty(jb->staged)) {
+      continue;
+    }
+    age = now - *GetJitLastUsed(jb);
+    if (!res || age > oldest) {
+      oldest = age;
+      res = jb;
+    }
+  }
+  return res;
+}
+
+// reclaims least recently executed block of jit memory, by deleting
+// the paths it contains as well as any paths that jump into them
+// @assume jit->lock
+static bool EvictJitBlock(struct Jit *jit) {
+  u8 *code;
+  unsigned i, n, pgen;
+  struct Dll *e, *e2;
+  struct JitJump *jj;
+  struct JitBlock *jb;
+  int func;
+  uintptr_t key;
+  if (!(jb = GetJitVictim(jit))) return false;
+  JIT_LOGF("evicting least recently used jit block %p", jb);
+  STATISTIC(++jit_blocks_evicted);
+  pgen = BeginUpdate(&jit->pagegen);
+  n = atomic_load_explicit(&jit->hooks.n, memory_order_relaxed);
+  for (i = 0; i < n; ++i) {
+    key = atomic_load_explicit(jit->hooks.virts + i, memory_order_relaxed);
+    func = atomic_load_explicit(jit->hooks.funcs + i, memory_order_relaxed);
+    if (key && func && func != jit->staging) {
+      code = (u8 *)DecodeJitFunc(func);
+      if (jb->addr <= code && code < jb->addr + kJitBlockSize) {
+        STATISTIC(++jit_paths_evicted);
+        DeleteJitPath(jit, key);
+      }
+    }
+  }
+  // pending fixups inside the block would corrupt its next tenant
+  for (e = dll_first(jit->jumps); e; e = e2) {
+    e2 = dll_next(jit->jumps, e);
+    jj = JITJUMP_CONTAINER(e);
+    if (jb->addr <= jj->code && jj->code < jb->addr + kJitBlockSize) {
+      dll_remove(&jit->jumps, e);
+      dll_make_first(&jit->freejumps, e);
+    }
+  }
+  ++g_jit.regions[jb->region].evictions;
+  RetireJitBlock(jit, jb);
   EndUpdate(&jit->pagegen, pgen);
+  return true;
 }
 
 static bool CheckMmapResult(void *want, void *got) {
@@ -1323,11 +1633,19 @@ struct JitBlock *StartJit(struct Jit *jit, i64 opt_virt) {
       // we found a block with adequate free space owned by jit
       dll_remove(&jit->blocks, &jb->elem);
     } else {
-      if (g_jit.freecount <= kJitRetireQueue) {
+      // keep a queue of free blocks, so threads have time to leave the
+      // memory that was evicted, since retired blocks aren't reacquired
+      // until every thread has returned to the interpreter at least once
+      if (g_jit.freecount <= kJitRetireQueue && !GrowJitMemory() &&
+          !EvictJitBlock(jit)) {
         ForceJitBlocksToRetire(jit);
       }
       if (!(jb = AcquireJitBlock(jit))) {
-        LOG_ONCE(LOGF("ran out of jit memory"));
+        if (g_jit.freecount) {
+          JIT_LOGF("retired jit blocks might still be executing");
+        } else {
+          LOG_ONCE(LOGF("ran out of jit memory"));
+        }
       } else if (!PrepareJitMemory(jb->addr, kJitBlockSize)) {
         // this system isn't allowing us to use jit memory
         dll_remove(&jit->agedblocks, &jb->aged);
@@ -1337,6 +1655,7 @@ struct JitBlock *StartJit(struct Jit *jit, i64 opt_virt) {
       }
     }
     if (jb) {
+      jb->isleased = true;
       dll_make_first(&jb->freejumps, jit->freejumps);
       jit->freejumps = 0;
     }
@@ -1346,6 +1665,9 @@ struct JitBlock *StartJit(struct Jit *jit, i64 opt_virt) {
   }
   if (jb) {
     jb->virt = opt_virt;
+    jb->nir = 0;
+    jb->nrelocs = 0;
+    jb->unportable = false;
     unassert(!(jb->start & (kJitAlign - 1)));
     unassert(jb->start == jb->index);
     jb->pagegen = atomic_load_explicit(&jit->pagegen, memory_order_acquire);
@@ -1376,6 +1698,7 @@ static bool OomJit(struct JitBlock *jb) {
  */
 inline bool AppendJit(struct JitBlock *jb, const void *data, long size) {
   unassert(size > 0);
+  if (jb->nir) LowerJitIr(jb);
   jb->lastaction = 0;
   if (size <= GetJitRemaining(jb)) {
     memcpy(jb->addr + jb->index, data, size);
@@ -1523,6 +1846,7 @@ void ReinsertJitBlock_(struct Jit *jit, struct JitBlock *jb) {
   unassert(jb->start == jb->index);
   unassert(dll_is_empty(jb->jumps));
   unassert(dll_is_empty(jb->staged));
+  jb->isleased = false;
   if (jb->index < kJitBlockSize) {
     dll_make_first(&jit->blocks, &jb->elem);
   } else {
@@ -1564,6 +1888,7 @@ static void AbandonJitJumps(struct JitBlock *jb) {
  */
 bool RecordJitJump(struct JitBlock *jb, u64 virt, int addend) {
   struct JitJump *jj;
+  LowerJitIr(jb);
   if (jb->index > kJitBlockSize) return false;
 #if defined(__x86_64__)
   unassert(!(GetJitPc(jb) & 7));
@@ -1580,36 +1905,102 @@ bool RecordJitJump(struct JitBlock *jb, u64 virt, int addend) {
 }
 
 // @assume jit->lock
-static bool RecordJitEdgeImpl(struct Jit *jit, i64 src, i64 dst) {
+static int RecordJitEdgeImpl(struct Jit *jit, i64 src, i64 dst) {
+  int link;
   i64 visits[kJitDepth];
-  if (src == dst) return false;
+  if (src == dst) {
+    // jumping back to the start of the path doesn't need an edge, since
+    // deleting the path will already take the jump along with it
+    return kJitLinkCycle;
+  }
   visits[0] = src;
-  if (IsCyclic(&jit->edges, visits, 1, dst)) {
-    STATISTIC(++jit_cycles_avoided);
-    return false;
+  switch (IsCyclic(&jit->edges, visits, 1, dst)) {
+    case 0:
+      link = kJitLinkEdge;
+      break;
+    case 1:
+      link = kJitLinkCycle;
+      break;
+    default:
+      // graph is too deep to know, and we don't want DeleteJitPath()
+      // recursing through arbitrarily long chains of dependent paths
+      STATISTIC(++jit_cycles_avoided);
+      return kJitLinkNone;
   }
   if (!AddEdge(&jit->edges, src, dst)) {
-    return false;
+    return kJitLinkNone;
   }
   if (!AddEdge(&jit->redges, dst, src)) {
     RemoveEdge(&jit->edges, src, dst);
-    return false;
+    return kJitLinkNone;
   }
-  return true;
+  return link;
 }
 
 /**
- * Records JIT edge or returns false if it'd create a cycle.
+ * Records JIT edge from path `src` to path `dst`.
+ *
+ * Paths that are linked together into a cycle could run forever without
+ * ever dropping back into the main interpreter loop, so if the edge is
+ * cyclic, then the jump must go to the attention poll of the destination
+ * path, rather than jumping past its prologue.
+ *
+ * @return kJitLinkEdge if path may jump past prologue of `dst`, or
+ *     kJitLinkCycle if it must jump to the attention poll of `dst`, or
+ *     kJitLinkNone if the jump needs to go back to the interpreter
  */
-bool RecordJitEdge(struct Jit *jit, i64 src, i64 dst) {
-  bool res;
+int RecordJitEdge(struct Jit *jit, i64 src, i64 dst) {
+  int res;
   LockJit(jit);
   res = RecordJitEdgeImpl(jit, src, dst);
   UnlockJit(jit);
   return res;
 }
 
+/**
+ * Annotates most recent jump as going to path for guest address.
+ *
+ * This information is used by the persistent JIT cache, so that jumps
+ * between paths can be linked again after they're loaded from disk.
+ *
+ * @param virt is hash table key of destination
+ */
+void RecordJitLink(struct JitBlock *jb, i64 virt) {
+  struct JitReloc *r;
+  LowerJitIr(jb);
+  if (!jb->nrelocs) return;
+  r = jb->relocs + jb->nrelocs - 1;
+  if (r->kind == kJitRelocJump &&
+      jb->start + r->off + r->size == jb->index) {
+    r->kind = kJitRelocLink;
+    r->arg = virt;
+  }
+}
+
+static void RecordJitReloc(struct JitBlock *jb, int kind, long off,
+                           uintptr_t addr) {
+  int n;
+  struct JitReloc *p;
+  if (!FLAG_jitcache) return;
+  if (jb->index > kJitBlockSize) return;
+  if (jb->nrelocs == jb->relocscap) {
+    n = jb->relocscap ? jb->relocscap << 1 : 16;
+    if (!(p = (struct JitReloc *)Realloc(jb->relocs, n * sizeof(*p)))) {
+      jb->unportable = true;
+      return;
+    }
+    jb->relocs = p;
+    jb->relocscap = n;
+  }
+  p = jb->relocs + jb->nrelocs++;
+  p->kind = kind;
+  p->size = jb->index - off;
+  p->off = off - jb->start;
+  p->arg = addr;
+}
+
 static void DiscardGeneratedJitCode(struct JitBlock *jb) {
+  jb->nir = 0;
   jb->index = jb->start;
 }
 
@@ -1631,6 +2022,7 @@ bool FinishJit(struct Jit *jit, struct JitBlock *jb) {
   bool ok;
   u8 *addr;
   struct JitStage *js;
+  LowerJitIr(jb);
   unassert(jb->index > jb->start);
   unassert(jb->start >= jb->committed);
   // check if we lost race with page reset
@@ -1668,6 +2060,9 @@ bool FinishJit(struct Jit *jit, struct JitBlock *jb) {
       JIT_LOGF("finishing manual mode jit path in block %p", jb);
     }
     CommitJitJumps(jit, jb);
+    // new code counts as recently executed so it isn't evicted soon
+    *GetJitLastUsed(jb) =
+        atomic_fetch_add_explicit(&g_jit.clock, 1, memory_order_relaxed) + 1;
     // mark the generated jit memory as having been used
     // if there's only a tiny bit left we advance to end
     if (jb->index + kJitFit > kJitBlockSize) {
@@ -1687,6 +2082,10 @@ bool FinishJit(struct Jit *jit, struct JitBlock *jb) {
       JIT_LOGF("oom'd jit block %p at %#" PRIx64 " due to lack of room", jb,
                jb->virt);
       AbandonJitHook(jit, jb);
+      // don't hand out the rest of this block again, since the path will
+      // probably be hot enough to be remade soon, and it won't fit either
+      STATISTIC(AVERAGE(jit_average_block, jb->start));
+      jb->start = kJitBlockSize;
     } else {
       // otherwise we *don't* call this, so a staging hook remains
       JIT_LOGF("oom'd jit block %p at %#" PRIx64 " because long code is long",
@@ -1739,6 +2138,7 @@ bool AbandonJit(struct Jit *jit, struct JitBlock *jb) {
 bool AlignJit(struct JitBlock *jb, int align, int misalign) {
   unassert(align > 0 && IS2POW(align));
   unassert(misalign >= 0 && misalign < align);
+  LowerJitIr(jb);
   while ((jb->index & (align - 1)) != misalign) {
 #ifdef __x86_64__
     // Intel's Official Fat NOP Instructions
@@ -1785,17 +2185,8 @@ bool AlignJit(struct JitBlock *jb, int align, int misalign) {
   return true;
 }
 
-/**
- * Moves one register's value into another register.
- *
- * The `src` and `dst` register indices are architecture defined.
- * Predefined constants such as `kJitArg0` may be used to provide
- * register indices to this function in a portable way.
- *
- * @param dst is the index of the destination register
- * @param src is the index of the source register
- */
-bool AppendJitMovReg(struct JitBlock *jb, int dst, int src) {
+// encodes move of one register's value into another register
+static bool EmitJitMovReg(struct JitBlock *jb, int dst, int src) {
   long action;
   if (dst == src) return true;
   if (GetJitRemaining(jb) < 4) return OomJit(jb);
@@ -1823,17 +2214,38 @@ bool AppendJitMovReg(struct JitBlock *jb, int dst, int src) {
   return true;
 }
 
-/**
- * Appends function call instruction to JIT memory.
- *
- * @param jb is function builder object returned by StartJit()
- * @param func points to another callee function in memory
- * @return true if room was available, otherwise false
- */
-bool AppendJitCall(struct JitBlock *jb, void *func) {
+// encodes move of low 32 bits of register, zeroing the rest
+static bool EmitJitMovReg32(struct JitBlock *jb, int dst, int src) {
+  if (GetJitRemaining(jb) < 4) return OomJit(jb);
+#if defined(__x86_64__)
+  unassert(!(dst & ~15));
+  unassert(!(src & ~15));
+  if ((src | dst) & 8) {
+    jb->addr[jb->index++] =
+        (src & 8 ? kAmdRexr : 0) | (dst & 8 ? kAmdRexb : 0);
+  }
+  jb->addr[jb->index++] = 0x89;
+  jb->addr[jb->index++] = 0300 | (src & 7) << 3 | (dst & 7);
+#elif defined(__aarch64__)
+  // 0b00101010000000000000001111100000 mov w0, w0
+  unassert(!(dst & ~31));
+  unassert(!(src & ~31));
+  Put32(jb->addr + jb->index, 0x2a0003e0 | src << 16 | dst);
+  jb->index += 4;
+#endif
+  jb->lastaction = 0;
+  return true;
+}
+
+static bool EmitJitSetReg(struct JitBlock *, int, u64);
+
+// encodes function call instruction
+static bool EmitJitCall(struct JitBlock *jb, void *func) {
   int n;
+  long off;
   intptr_t disp;
   uintptr_t addr;
+  off = jb->index;
   addr = (uintptr_t)func;
 #if defined(__x86_64__)
   u8 buf[5];
@@ -1847,7 +2259,7 @@ bool AppendJitCall(struct JitBlock *jb, void *func) {
     Write32(buf + 1, disp & kAmdDispMask);
     n = 5;
   } else {
-    AppendJitSetReg(jb, kAmdAx, addr);
+    EmitJitSetReg(jb, kAmdAx, addr);
     buf[0] = kAmdCallAx[0];
     buf[1] = kAmdCallAx[1];
     n = 2;
@@ -1884,7 +2296,9 @@ bool AppendJitCall(struct JitBlock *jb, void *func) {
   buf[0] = kArmCall | (disp & kArmDispMask);
   n = 4;
 #endif
-  return AppendJit(jb, buf, n);
+  if (!AppendJit(jb, buf, n)) return false;
+  RecordJitReloc(jb, kJitRelocCall, off, addr);
+  return true;
 }
 
 /**
@@ -1895,20 +2309,19 @@ bool AppendJitCall(struct JitBlock *jb, void *func) {
  * @return true if room was available, otherwise false
  */
 bool AppendJitJump(struct JitBlock *jb, void *code) {
+  int n;
+  long off;
   u8 buf[5];
-  int n = MakeJitJump(buf, GetJitPc(jb), (uintptr_t)code);
-  return AppendJit(jb, buf, n);
+  LowerJitIr(jb);
+  off = jb->index;
+  n = MakeJitJump(buf, GetJitPc(jb), (uintptr_t)code);
+  if (!AppendJit(jb, buf, n)) return false;
+  RecordJitReloc(jb, kJitRelocJump, off, (uintptr_t)code);
+  return true;
 }
 
-/**
- * Sets register to immediate value.
- *
- * @param jb is function builder object returned by StartJit()
- * @param param is the zero-based index into the register file
- * @param value is the constant value to use as the parameter
- * @return true if room was available, otherwise false
- */
-bool AppendJitSetReg(struct JitBlock *jb, int reg, u64 value) {
+// encodes load of immediate value into register
+static bool EmitJitSetReg(struct JitBlock *jb, int reg, u64 value) {
   long lastaction;
 #if defined(__x86_64__)
   u8 rex = 0;
@@ -1981,6 +2394,7 @@ bool AppendJitSetReg(struct JitBlock *jb, int reg, u64 value) {
   jb->index += n * 4;
 #endif
   lastaction = jb->lastaction;
+  jb->lastaction = 0;
   if (ACTION(lastaction) == ACTION_MOVE &&  //
       MOVE_DST(lastaction) != reg &&        //
       MOVE_SRC(lastaction) != reg) {
@@ -2025,4 +2439,257 @@ bool AppendJitTrap(struct JitBlock *jb) {
   return AppendJit(jb, buf, sizeof(buf));
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// INTERMEDIATE REPRESENTATION
+//
+// Register moves, immediate loads, and calls aren't encoded right away.
+// They're queued in jb->ir until some other code is appended, or until
+// something asks for the program counter. At that point the queue gets
+// optimized and lowered into native code for whichever architecture is
+// being targeted. Everything the queue doesn't model is a barrier, and
+// all registers are assumed to be live when one is reached. Functions
+// are assumed to follow the host calling convention, i.e. they can use
+// every argument register and clobber every volatile register.
+//
+// This is only a peephole window over host registers, which is flushed
+// by the next barrier or after kJitIrSize ops, so it never sees a whole
+// path. Guest state isn't modeled here. Dead flag computations are left
+// out path-wide by the path builder, which asks GetNeededFlags() what
+// the code ahead reads, and stores to m->ip are skewed until some op
+// actually needs it (see MustUpdateIp() in path.c).
+
+#if defined(__x86_64__) && defined(__CYGWIN__)
+#define kJitVolatile 0x00000f07  // rax, rcx, rdx, r8-r11
+#elif defined(__x86_64__)
+#define kJitVolatile 0x00000fc7  // rax, rcx, rdx, rsi, rdi, r8-r11
+#elif defined(__aarch64__)
+#define kJitVolatile 0x0003ffff  // x0-x17
+#endif
+#define kJitParams \
+  (1u << kJitArg0 | 1u << kJitArg1 | 1u << kJitArg2 | 1u << kJitArg3)
+
+static void AddJitIr(struct JitBlock *jb, int op, int dst, int src, u64 arg,
+                     long size) {
+  struct JitIr *p;
+  if (jb->nir == kJitIrSize) LowerJitIr(jb);
+  STATISTIC(++jit_ir_ops);
+  p = jb->ir + jb->nir++;
+  p->op = op;
+  p->dst = dst;
+  p->src = src;
+  p->size = size;
+  p->arg = arg;
+}
+
+// returns true if loading immediate takes more than one instruction
+static bool IsCostlyImmediate(u64 x) {
+#if defined(__x86_64__)
+  return x > 0xffffffff && !((i64)x < 0 && (i64)x >= INT32_MIN);
+#elif defined(__aarch64__)
+  return x > 0xffff && !((i64)x < 0 && (i64)x >= -0x8000);
+#endif
+}
+
+// forward pass that gives each register a value number, so loads of a
+// value some register already holds can be deleted, costly immediates
+// may be copied from another register, and copies are traced back to
+// the register which originally produced the value
+static void NumberJitIr(struct JitIr *ir, int n) {
+  u64 kval[kJitIrSize];
+  int i, j, r, k, nk, next;
+  int vn[32], kvn[kJitIrSize], def[32];
+  for (r = 0; r < 32; ++r) vn[r] = r + 1, def[r] = -1;
+  for (next = 33, nk = i = 0; i < n; ++i) {
+    switch (ir[i].op) {
+      case kJitIrSetReg:
+        for (k = 0, j = 0; j < nk; ++j) {
+          if (kval[j] == ir[i].arg) {
+            k = kvn[j];
+            break;
+          }
+        }
+        if (!k) {
+          kval[nk] = ir[i].arg;
+          kvn[nk++] = k = next++;
+        }
+        if (vn[ir[i].dst] == k) {
+          ir[i].op = 0;
+          break;
+        }
+        if (IsCostlyImmediate(ir[i].arg)) {
+          for (r = 0; r < 32; ++r) {
+            if (vn[r] == k) {
+              STATISTIC(++jit_ir_rewritten);
+              ir[i].op = kJitIrMovReg;
+              ir[i].src = r;
+              break;
+            }
+          }
+        }
+        vn[ir[i].dst] = k;
+        def[ir[i].dst] = i;
+        break;
+      case kJitIrMovReg:
+        if (vn[ir[i].dst] == vn[ir[i].src]) {
+          ir[i].op = 0;
+          break;
+        }
+        if ((j = def[ir[i].src]) != -1 &&        //
+            ir[j].op == kJitIrMovReg &&           //
+            vn[ir[j].src] == vn[ir[i].src] &&     //
+            ir[j].src != ir[i].dst) {             //
+          STATISTIC(++jit_ir_rewritten);
+          ir[i].src = ir[j].src;  // copy propagation
+        }
+        vn[ir[i].dst] = vn[ir[i].src];
+        def[ir[i].dst] = i;
+        break;
+      case kJitIrMovR32:
+        vn[ir[i].dst] = next++;
+        def[ir[i].dst] = i;
+        break;
+      case kJitIrCall:
+      case kJitIrInline:
+        for (r = 0; r < 32; ++r) {
+          if (kJitVolatile & 1u << r) {
+            vn[r] = next++;
+            def[r] = -1;
+          }
+        }
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+// backward pass that deletes writes to registers nothing reads later
+static void KillDeadJitIr(struct JitIr *ir, int n) {
+  int i;
+  u32 live = -1;
+  for (i = n; i--;) {
+    switch (ir[i].op) {
+      case kJitIrSetReg:
+      case kJitIrMovReg:
+      case kJitIrMovR32:
+        if (!(live & 1u << ir[i].dst)) {
+          ir[i].op = 0;
+          break;
+        }
+        live &= ~(1u << ir[i].dst);
+        if (ir[i].op != kJitIrSetReg) {
+          live |= 1u << ir[i].src;
+        }
+        break;
+      case kJitIrCall:
+      case kJitIrInline:
+        live &= ~kJitVolatile;
+        live |= kJitParams;
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+/**
+ * Optimizes and encodes operations waiting in the queue.
+ *
+ * This needs to be called before reading `jb->index` directly, since
+ * the queued operations haven't been assigned a program counter yet.
+ */
+void LowerJitIr(struct JitBlock *jb) {
+  int i, n;
+  if (!(n = jb->nir)) return;
+  jb->nir = 0;
+  NumberJitIr(jb->ir, n);
+  KillDeadJitIr(jb->ir, n);
+  for (i = 0; i < n; ++i) {
+    switch (jb->ir[i].op) {
+      case kJitIrSetReg:
+        EmitJitSetReg(jb, jb->ir[i].dst, jb->ir[i].arg);
+        break;
+      case kJitIrMovReg:
+        EmitJitMovReg(jb, jb->ir[i].dst, jb->ir[i].src);
+        break;
+      case kJitIrMovR32:
+        EmitJitMovReg32(jb, jb->ir[i].dst, jb->ir[i].src);
+        break;
+      case kJitIrCall:
+        EmitJitCall(jb, (void *)(uintptr_t)jb->ir[i].arg);
+        break;
+      case kJitIrInline:
+        AppendJit(jb, (void *)(uintptr_t)jb->ir[i].arg, jb->ir[i].size);
+        break;
+      default:
+        STATISTIC(++jit_ir_deleted);
+        break;
+    }
+  }
+}
+
+/**
+ * Sets register to immediate value.
+ *
+ * @param jb is function builder object returned by StartJit()
+ * @param reg is the index of the destination register
+ * @param value is the constant value to use as the parameter
+ * @return true if room was available, otherwise false
+ */
+bool AppendJitSetReg(struct JitBlock *jb, int reg, u64 value) {
+  AddJitIr(jb, kJitIrSetReg, reg, 0, value, 0);
+  return jb->index <= kJitBlockSize;
+}
+
+/**
+ * Moves one register's value into another register.
+ *
+ * The `src` and `dst` register indices are architecture defined.
+ * Predefined constants such as `kJitArg0` may be used to provide
+ * register indices to this function in a portable way.
+ *
+ * @param dst is the index of the destination register
+ * @param src is the index of the source register
+ */
+bool AppendJitMovReg(struct JitBlock *jb, int dst, int src) {
+  if (dst != src) AddJitIr(jb, kJitIrMovReg, dst, src, 0, 0);
+  return jb->index <= kJitBlockSize;
+}
+
+/**
+ * Moves low 32 bits of one register into another, zeroing the rest.
+ *
+ * @param dst is the index of the destination register
+ * @param src is the index of the source register
+ */
+bool AppendJitMovReg32(struct JitBlock *jb, int dst, int src) {
+  AddJitIr(jb, kJitIrMovR32, dst, src, 0, 0);
+  return jb->index <= kJitBlockSize;
+}
+
+/**
+ * Appends function call instruction to JIT memory.
+ *
+ * @param jb is function builder object returned by StartJit()
+ * @param func points to another callee function in memory
+ * @return true if room was available, otherwise false
+ */
+bool AppendJitCall(struct JitBlock *jb, void *func) {
+  AddJitIr(jb, kJitIrCall, 0, 0, (uintptr_t)func, 0);
+  return jb->index <= kJitBlockSize;
+}
+
+/**
+ * Appends body of leaf function to JIT memory.
+ *
+ * The function must be position independent, must not return early,
+ * and must follow the host calling convention. It's copied when the
+ * queue is lowered, so `code` needs to remain valid until then.
+ */
+bool AppendJitInline(struct JitBlock *jb, const void *code, long size) {
+  unassert(size > 0);
+  AddJitIr(jb, kJitIrInline, 0, 0, (uintptr_t)code, size);
+  return jb->index <= kJitBlockSize;
+}
+
 #endif /* HAVE_JIT */
@@ -16,10 +16,42 @@
 #define kJitJumpTries    16
 #define kJitBlockSize    262144
 #define kJitMemorySize   32505856
+#define kJitRegionSize   33554432
+#define kJitMaxRegions   32
+#define kJitMemoryLimit  268435456
 #define kJitRetireQueue  (int)(kJitMemorySize / kJitBlockSize * .10)
 #define kJitSlabInts     (65536 / sizeof(struct JitInts))
 #define kJitInitialHooks 16384
 #define kJitInitialEdges 4096
+#define kJitMaxSideExits 16
+#define kJitHitsBits     12
+#define kJitThreshold    8
+#define kJitIbtcBits     8
+#define kJitRasSize      16
+
+#define kJitIrSize 64  // max pending ops before LowerJitIr() must run
+
+// jit memory must be within reach of the blink image, because hooks are
+// encoded relative to it, and our code makes relative calls and jumps
+#if defined(__x86_64__)
+#define kJitMemoryReach 0x40000000
+#else
+#define kJitMemoryReach 0x03000000
+#endif
+
+#define kJitIrSetReg 1  // dst = arg
+#define kJitIrMovReg 2  // dst = src
+#define kJitIrMovR32 3  // dst = src & 0xffffffff
+#define kJitIrCall   4  // call function at arg
+#define kJitIrInline 5  // copy size bytes of leaf function body at arg
+
+#define kJitRelocCall 1  // AppendJitCall() to function in blink image
+#define kJitRelocJump 2  // AppendJitJump() to some address in memory
+#define kJitRelocLink 3  // AppendJitJump() to path for guest address
+
+#define kJitLinkNone  0  // path must drop back into interpreter
+#define kJitLinkEdge  1  // path may jump past prologue of destination
+#define kJitLinkCycle 2  // path may jump to attention poll of destination
 
 #ifdef __x86_64__
 #define kJitRes0 kAmdAx
@@ -108,6 +140,7 @@
 #define JITBLOCK_CONTAINER(e)  DLL_CONTAINER(struct JitBlock, elem, e)
 #define JITFREED_CONTAINER(e)  DLL_CONTAINER(struct JitFreed, elem, e)
 #define AGEDBLOCK_CONTAINER(e) DLL_CONTAINER(struct JitBlock, aged, e)
+#define JITREADER_CONTAINER(e) DLL_CONTAINER(struct JitReader, elem, e)
 #define JIASLAB_CONTAINER(e)   DLL_CONTAINER(struct JitIntsSlab, elem, e)
 
 struct JitInts {
@@ -168,6 +201,21 @@ struct JitPage {
   struct Dll elem;
 };
 
+struct JitReloc {
+  u8 kind;   // kJitReloc{Call,Jump,Link}
+  u8 size;   // number of bytes of code the instruction used
+  u32 off;   // offset of instruction relative to start of function
+  i64 arg;   // absolute address, or guest address if linked
+};
+
+struct JitIr {
+  u8 op;     // kJitIr{SetReg,MovReg,MovR32,Call,Inline} or 0 if deleted
+  u8 dst;    // destination register index
+  u8 src;    // source register index
+  u32 size;  // number of bytes in inline function body
+  u64 arg;   // immediate value or function address
+};
+
 struct JitBlock {
   u8 *addr;
   i64 virt;
@@ -178,12 +226,28 @@ struct JitBlock {
   long lastaction;
   bool wasretired;
   bool isprotected;
+  bool isleased;
+  int region;
   unsigned pagegen;
+  unsigned epoch;           // jit epoch during which block was retired
   struct Dll elem;
   struct Dll aged;
   struct Dll *jumps;
   struct Dll *staged;
   struct Dll *freejumps;
+  bool unportable;          // code can't be saved to persistent cache
+  int nrelocs, relocscap;   // only recorded when FLAG_jitcache is set
+  struct JitReloc *relocs;  // position dependent calls and jumps made
+  int nir;                  // number of ops waiting to be lowered
+  struct JitIr ir[kJitIrSize];
+};
+
+// a thread that may execute jit code. memory that's been retired can't
+// be reused until each reader has been seen outside jit code afterwards
+struct JitReader {
+  _Atomic(unsigned) epoch;   // last epoch seen outside jit code, or zero
+  _Atomic(bool) *attention;  // raised when retired memory awaits readers
+  struct Dll elem;
 };
 
 struct JitHooks {
@@ -234,11 +298,21 @@ bool AppendJitJump(struct JitBlock *, void *);
 bool AppendJitCall(struct JitBlock *, void *);
 bool AppendJitSetReg(struct JitBlock *, int, u64);
 bool AppendJitMovReg(struct JitBlock *, int, int);
+bool AppendJitMovReg32(struct JitBlock *, int, int);
+bool AppendJitInline(struct JitBlock *, const void *, long);
+void LowerJitIr(struct JitBlock *);
 bool FinishJit(struct Jit *, struct JitBlock *);
 bool RecordJitJump(struct JitBlock *, u64, int);
-bool RecordJitEdge(struct Jit *, i64, i64);
+void RecordJitLink(struct JitBlock *, i64);
+int RecordJitEdge(struct Jit *, i64, i64);
 uintptr_t GetJitHook(struct Jit *, u64);
 int ResetJitPage(struct Jit *, i64);
+void TouchJit(uintptr_t);
+void AddJitReader(struct Jit *, struct JitReader *, _Atomic(bool) *);
+void RemoveJitReader(struct Jit *, struct JitReader *);
+void ObserveJitEpoch(struct JitReader *);
+void ParkJitReader(struct JitReader *);
+void PrintJitStats(void);
 
 int CommitJit_(struct Jit *, struct JitBlock *);
 void ReinsertJitBlock_(struct Jit *, struct JitBlock *);
@@ -258,7 +332,8 @@ static inline long GetJitRemaining(const struct JitBlock *jb) {
  *
  * @return absolute instruction pointer memory address in bytes
  */
-static inline uintptr_t GetJitPc(const struct JitBlock *jb) {
+static inline uintptr_t GetJitPc(struct JitBlock *jb) {
+  LowerJitIr(jb);
   return (uintptr_t)jb->addr + jb->index;
 }
 
@@ -0,0 +1,377 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "blink/builtin.h"
+#include "blink/elf.h"
+#include "blink/end.h"
+#include "blink/endian.h"
+#include "blink/flag.h"
+#include "blink/intrin.h"
+#include "blink/jit.h"
+#include "blink/log.h"
+#include "blink/machine.h"
+#include "blink/macros.h"
+#include "blink/stats.h"
+#include "blink/syscall.h"
+
+/**
+ * @fileoverview Persistent JIT Code Cache
+ *
+ * When the `-J PATH` flag or `$BLINK_JIT_CACHE` is set, each JIT path
+ * whose instructions live in the executable image gets appended to a
+ * file in that directory as it's generated. The next time the program
+ * is run, those paths are installed before the program starts, so the
+ * interpreter doesn't need to warm up again.
+ *
+ * The file name is a hash of (1) the program's ELF build-id, or all of
+ * its bytes if it doesn't have one, (2) the address the image has been
+ * loaded at, and (3) the identity of the blink executable along with
+ * the flags which change how code gets generated. Each record further
+ * stores a hash of the guest instruction bytes it was generated from,
+ * which are checked against guest memory before the path is installed.
+ *
+ * Generated code is mostly position independent, except for calls into
+ * blink functions and jumps to other paths. Those are recorded by jit.c
+ * as relocations, which get regenerated when the path is loaded. Paths
+ * with any other kind of absolute address aren't saved.
+ */
+
+#ifdef HAVE_JIT
+
+#define kJitCacheMagic    0x6a6b6e62  // "bnkj"
+#define kJitCacheVersion  2
+#define kJitCacheMaxGuest 65536
+
+struct JitCacheRecord {
+  u32 magic;
+  u32 size;      // bytes of record including relocs, code, and padding
+  i64 virt;      // guest address at which the path starts
+  i64 end;       // one past the last guest instruction byte
+  u64 hash;      // fnv hash of guest instruction bytes [virt,end)
+  u32 codesize;  // bytes of host code in path
+  u32 nrelocs;   // number of struct JitReloc which follow
+};
+
+static u64 Fnv(u64 h, const void *data, size_t size) {
+  size_t i;
+  for (i = 0; i < size; ++i) {
+    h ^= ((const u8 *)data)[i];
+    h *= 0x100000001b3;
+  }
+  return h;
+}
+
+static u64 HashProgram(const u8 *p, size_t n) {
+  u64 h, i, off, phoff;
+  u32 namesz, descsz;
+  const Elf64_Ehdr_ *ehdr;
+  const Elf64_Phdr_ *phdr;
+  const Elf64_Nhdr_ *nhdr;
+  h = 0xcbf29ce484222325;
+  if (n >= sizeof(*ehdr) && Read32(p) == Read32((const u8 *)"\177ELF")) {
+    ehdr = (const Elf64_Ehdr_ *)p;
+    phoff = Read64(ehdr->phoff);
+    for (i = 0; i < Read16(ehdr->phnum); ++i) {
+      if (phoff + (i + 1) * sizeof(*phdr) > n) break;
+      phdr = (const Elf64_Phdr_ *)(p + phoff) + i;
+      if (Read32(phdr->type) != PT_NOTE_) continue;
+      off = Read64(phdr->offset);
+      if (off > n || Read64(phdr->filesz) > n - off) continue;
+      while (off + sizeof(*nhdr) <= n) {
+        nhdr = (const Elf64_Nhdr_ *)(p + off);
+        namesz = ROUNDUP(Read32(nhdr->namesz), 4);
+        descsz = ROUNDUP(Read32(nhdr->descsz), 4);
+        if (namesz + descsz > n - off - sizeof(*nhdr)) break;
+        if (Read32(nhdr->type) == NT_GNU_BUILD_ID_ && namesz == 4 &&
+            !memcmp(nhdr + 1, "GNU", 4)) {
+          return Fnv(h, (const u8 *)(nhdr + 1) + namesz,
+                     Read32(nhdr->descsz));
+        }
+        off += sizeof(*nhdr) + namesz + descsz;
+        if (off >= Read64(phdr->offset) + Read64(phdr->filesz)) break;
+      }
+    }
+  }
+  return Fnv(h, p, n);
+}
+
+static bool HashBlink(u64 *h) {
+  struct stat st;
+  uintptr_t self;
+  if (stat("/proc/self/exe", &st) &&
+      (!g_blink_path || !strchr(g_blink_path, '/') ||
+       stat(g_blink_path, &st))) {
+    return false;
+  }
+  self = (uintptr_t)LoadJitCache - (uintptr_t)IMAGE_END;
+  *h = Fnv(*h, &st.st_ino, sizeof(st.st_ino));
+  *h = Fnv(*h, &st.st_size, sizeof(st.st_size));
+  *h = Fnv(*h, &st.st_mtime, sizeof(st.st_mtime));
+  *h = Fnv(*h, &self, sizeof(self));
+  return true;
+}
+
+static bool HashGuestCode(struct Machine *m, i64 virt, i64 end, u64 *h) {
+  u8 *buf;
+  bool ok;
+  if (end <= virt || end - virt > kJitCacheMaxGuest) return false;
+  if (!(buf = (u8 *)malloc(end - virt))) return false;
+  if ((ok = CopyFromUser(m, buf, virt, end - virt) != -1)) {
+    *h = Fnv(0xcbf29ce484222325, buf, end - virt);
+  }
+  free(buf);
+  return ok;
+}
+
+static bool IsInProgramImage(struct System *s, i64 virt, i64 end) {
+  return s->codesize &&                     //
+         s->codestart <= virt &&            //
+         virt < end &&                      //
+         end <= s->codestart + s->codesize;
+}
+
+/**
+ * Appends path being finished to persistent JIT cache, if possible.
+ *
+ * This must be called before FinishJit() since it reads the generated
+ * code in place. Paths which can't be relocated are silently skipped.
+ */
+void SaveJitPath(struct Machine *m) {
+  int fd, i;
+  char *buf;
+  size_t size;
+  struct JitBlock *jb;
+  struct JitReloc *r;
+  struct System *s = m->system;
+  struct JitCacheRecord rec;
+  jb = m->path.jb;
+  if (!s->jitcache) return;
+  if (jb->index > kJitBlockSize) return;
+  if (!IsInProgramImage(s, m->path.start, m->path.end)) return;
+  if (jb->unportable) {
+    STATISTIC(++jit_cache_unportable);
+    return;
+  }
+  rec.magic = kJitCacheMagic;
+  rec.virt = m->path.start;
+  rec.end = m->path.end;
+  rec.codesize = jb->index - jb->start;
+  rec.nrelocs = jb->nrelocs;
+  rec.size = sizeof(rec) + rec.nrelocs * sizeof(*r) + rec.codesize;
+  rec.size = ROUNDUP(rec.size, 8);
+  if (!HashGuestCode(m, rec.virt, rec.end, &rec.hash)) return;
+  if (!(buf = (char *)calloc(1, rec.size))) return;
+  memcpy(buf, &rec, sizeof(rec));
+  r = (struct JitReloc *)(buf + sizeof(rec));
+  memcpy(r, jb->relocs, rec.nrelocs * sizeof(*r));
+  memcpy(r + rec.nrelocs, jb->addr + jb->start, rec.codesize);
+  for (i = 0; i < rec.nrelocs; ++i) {
+    if (r[i].kind == kJitRelocCall) {
+      r[i].arg -= (uintptr_t)IMAGE_END;
+    } else if (r[i].kind == kJitRelocJump && r[i].arg == (i64)s->ender) {
+      r[i].arg = 0;
+    } else if (r[i].kind == kJitRelocJump) {
+      // jump to code generated in this process
+      STATISTIC(++jit_cache_unportable);
+      free(buf);
+      return;
+    }
+  }
+  size = rec.size;
+  if ((fd = open(s->jitcache, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                 0644)) != -1) {
+    // each record is appended using a single write, so that several
+    // processes running the same program can share the cache file
+    if (write(fd, buf, size) == size) {
+      STATISTIC(++jit_cache_saved);
+    }
+    close(fd);
+  }
+  free(buf);
+}
+
+static bool ReplayReloc(struct Machine *m, struct JitBlock *jb,
+                        const struct JitReloc *r) {
+  int link;
+  long entry;
+  uintptr_t f;
+  void *jump;
+  struct System *s = m->system;
+  switch (r->kind) {
+    case kJitRelocCall:
+      AppendJitCall(jb, IMAGE_END + r->arg);
+      LowerJitIr(jb);
+      return jb->index <= kJitBlockSize;
+    case kJitRelocJump:
+      return AppendJitJump(jb, (void *)s->ender);
+    case kJitRelocLink:
+      // this mirrors the logic of ConnectPath() in machine.c
+      if (!(link = RecordJitEdge(&s->jit, jb->virt, r->arg))) {
+        jump = (void *)s->ender;
+      } else {
+        entry = link == kJitLinkCycle ? GetPollOffset() : GetPrologueSize();
+        if (r->arg == jb->virt) {
+          jump = jb->addr + jb->start + entry;
+        } else if ((f = GetJitHook(&s->jit, r->arg)) &&
+                   f != (uintptr_t)JitlessDispatch) {
+          jump = (u8 *)f + entry;
+        } else {
+          if (!FLAG_noconnect) {
+            RecordJitJump(jb, r->arg, entry);
+          }
+          jump = (void *)s->ender;
+        }
+      }
+      return AppendJitJump(jb, jump);
+    default:
+      return false;
+  }
+}
+
+static bool LoadJitPath(struct Machine *m, const struct JitCacheRecord *rec) {
+  u64 hash;
+  u32 i, pos;
+  const u8 *code;
+  struct JitBlock *jb;
+  const struct JitReloc *r;
+  struct System *s = m->system;
+  if (GetJitHook(&s->jit, rec->virt)) return true;  // duplicate record
+  if (!IsInProgramImage(s, rec->virt, rec->end) ||
+      !HashGuestCode(m, rec->virt, rec->end, &hash) || hash != rec->hash) {
+    STATISTIC(++jit_cache_rejected);
+    return true;
+  }
+  if (!(jb = StartJit(&s->jit, rec->virt))) return false;
+  r = (const struct JitReloc *)(rec + 1);
+  code = (const u8 *)(r + rec->nrelocs);
+  for (pos = i = 0; i < rec->nrelocs; ++i) {
+    if (r[i].off < pos || r[i].off + r[i].size > rec->codesize) break;
+    if (r[i].off > pos) AppendJit(jb, code + pos, r[i].off - pos);
+    // code layout must be preserved exactly, because there may be
+    // relative branches within the path that cross the relocation
+    if (!ReplayReloc(m, jb, r + i) ||
+        jb->index - jb->start != r[i].off + r[i].size) {
+      break;
+    }
+    pos = r[i].off + r[i].size;
+  }
+  if (i < rec->nrelocs) {
+    STATISTIC(++jit_cache_rejected);
+    AbandonJit(&s->jit, jb);
+    return true;
+  }
+  if (rec->codesize > pos) AppendJit(jb, code + pos, rec->codesize - pos);
+  if (FinishJit(&s->jit, jb)) {
+    STATISTIC(++jit_cache_loaded);
+  }
+  return true;
+}
+
+static char *GetJitCachePath(struct Machine *m, const void *image,
+                             size_t size) {
+  u64 h;
+  char *path;
+  size_t n;
+  h = 0xcbf29ce484222325;
+  if (!HashBlink(&h)) {
+    LOGF("can't use jit cache because blink executable wasn't found");
+    return 0;
+  }
+  h = Fnv(h, (u64[]){kJitCacheVersion}, 8);
+  h = Fnv(h, (u64[]){HasLinearMapping()}, 8);
+  h = Fnv(h, (u64[]){FLAG_noconnect}, 8);
+#if defined(__x86_64__) && defined(__GNUC__)
+  // which host instructions got emitted depends on what the cpu has
+  h = Fnv(h, (u64[]){GetX86Features()}, 8);
+#endif
+  h = Fnv(h, (u64[]){HashProgram((const u8 *)image, size)}, 8);
+  h = Fnv(h, &m->system->codestart, sizeof(m->system->codestart));
+  n = strlen(FLAG_jitcache) + 1 + 16 + 4 + 1;
+  if ((path = (char *)malloc(n))) {
+    snprintf(path, n, "%s/%016" PRIx64 ".jit", FLAG_jitcache, h);
+  }
+  return path;
+}
+
+/**
+ * Installs JIT paths saved by previous runs of program.
+ *
+ * This should be called once the program image has been loaded into
+ * memory, but before it starts running.
+ *
+ * @param image is the program file content
+ * @param size is the number of bytes in image
+ */
+void LoadJitCache(struct Machine *m, const void *image, size_t size) {
+  int fd;
+  char *buf;
+  struct stat st;
+  size_t i, got;
+  ssize_t rc;
+  struct JitCacheRecord rec;
+  struct System *s = m->system;
+  free(s->jitcache);
+  s->jitcache = 0;
+  if (!FLAG_jitcache) return;
+  if (IsJitDisabled(&s->jit)) return;
+  if (!s->codesize) return;
+  if (!(s->jitcache = GetJitCachePath(m, image, size))) return;
+  if ((fd = open(s->jitcache, O_RDONLY | O_CLOEXEC)) == -1) return;
+  if (fstat(fd, &st) || !(buf = (char *)malloc(st.st_size + 1))) {
+    close(fd);
+    return;
+  }
+  for (got = 0; got < st.st_size; got += rc) {
+    if ((rc = read(fd, buf + got, st.st_size - got)) <= 0) break;
+  }
+  close(fd);
+  InitPaths(s);
+  for (i = 0; i + sizeof(rec) <= got; i += rec.size) {
+    memcpy(&rec, buf + i, sizeof(rec));
+    if (rec.magic != kJitCacheMagic || rec.size > got - i ||
+        rec.nrelocs > (rec.size - sizeof(rec)) / sizeof(struct JitReloc) ||
+        rec.size != ROUNDUP(sizeof(rec) +
+                                rec.nrelocs * sizeof(struct JitReloc) +
+                                rec.codesize,
+                            8)) {
+      LOGF("%s: jit cache is corrupted", s->jitcache);
+      break;
+    }
+    if (!rec.codesize) continue;
+    if (!LoadJitPath(m, (const struct JitCacheRecord *)(buf + i))) break;
+  }
+  free(buf);
+}
+
+#else
+
+void SaveJitPath(struct Machine *m) {
+}
+
+void LoadJitCache(struct Machine *m, const void *image, size_t size) {
+}
+
+#endif /* HAVE_JIT */
@@ -1,8 +1,21 @@
 #ifndef BLINK_LDBL_H_
 #define BLINK_LDBL_H_
+#include "blink/builtin.h"
 #include "blink/types.h"
 
-double DeserializeLdbl(const u8[10]);
-u8 *SerializeLdbl(u8[10], double);
+// x87 registers are held in the host's own 80-bit long double when it
+// has one, so the guest gets full extended precision, and fpu.c may run
+// instructions like fsin and fyl2x on the host fpu. other hosts make do
+// with double precision.
+#if !defined(DISABLE_X87) && defined(__x86_64__) && defined(__GNUC__) && \
+    __LDBL_MANT_DIG__ == 64
+#define X87_NATIVE
+typedef long double x87_t;
+#else
+typedef double x87_t;
+#endif
+
+x87_t DeserializeLdbl(const u8[10]);
+u8 *SerializeLdbl(u8[10], x87_t);
 
 #endif /* BLINK_LDBL_H_ */
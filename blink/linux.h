@@ -200,6 +200,10 @@
 #define MAP_FIXED_NOREPLACE_LINUX 0x00100000
 #define MAP_UNINITIALIZED_LINUX   0x04000000
 
+#define MREMAP_MAYMOVE_LINUX   1
+#define MREMAP_FIXED_LINUX     2
+#define MREMAP_DONTUNMAP_LINUX 4
+
 #define PROT_NONE_LINUX      0
 #define PROT_READ_LINUX      1
 #define PROT_WRITE_LINUX     2
@@ -1076,7 +1080,24 @@ struct fpstate_linux {
   u8 mxcr_mask[4];
   u8 st[8][16];
   u8 xmm[16][16];
-  u8 padding_[96];
+  u8 padding_[48];
+  u8 sw_magic1[4];  // FP_XSTATE_MAGIC1_LINUX if xstate_linux follows
+  u8 sw_extended_size[4];
+  u8 sw_xfeatures[8];
+  u8 sw_xstate_size[4];
+  u8 sw_padding_[28];
+};
+
+#define FP_XSTATE_MAGIC1_LINUX 0x46505853
+#define FP_XSTATE_MAGIC2_LINUX 0x46505845
+
+// extended state that linux places after fpstate_linux in signal frames
+struct xstate_linux {
+  u8 xfeatures[8];
+  u8 header_reserved_[56];
+  u8 ymmh[16][16];
+  u8 magic2[4];  // FP_XSTATE_MAGIC2_LINUX
+  u8 padding_[12];
 };
 
 struct ucontext_linux {
@@ -784,6 +784,7 @@ error: unsupported executable; we need:\n\
     elf->interpreter = strdup(elf->interpreter);
   }
   unassert(CheckMemoryInvariants(m->system));
+  LoadJitCache(m, map, mapsize);
   elf->execfn = strdup(elf->execfn);
   elf->prog = strdup(elf->prog);
   unassert(!VfsMunmap(map, mapsize));
@@ -25,6 +25,7 @@
 #include "blink/alu.h"
 #include "blink/assert.h"
 #include "blink/atomic.h"
+#include "blink/avx.h"
 #include "blink/bitscan.h"
 #include "blink/builtin.h"
 #include "blink/bus.h"
@@ -34,7 +35,9 @@
 #include "blink/flag.h"
 #include "blink/flags.h"
 #include "blink/fpu.h"
+#include "blink/intrin.h"
 #include "blink/jit.h"
+#include "blink/ldbl.h"
 #include "blink/likely.h"
 #include "blink/log.h"
 #include "blink/machine.h"
@@ -426,38 +429,268 @@ static void OpMovImm(P) {
   }
 }
 
-// we want to have independent jit paths jump directly into one another
-// to avoid having control flow drop back to the main interpreter loop.
-void Connect(P, u64 pc, bool avoid_cycles) {
+// returns nonzero if path under construction is allowed to jump directly
+// into the path for `pc`, in which case a jit edge gets recorded, and
+// the caller is expected to generate the jump using ConnectPath().
+int CanConnect(P, u64 pc) {
+#ifdef HAVE_JIT
+  int link;
+  // 1. cyclic paths need to poll attention for async sigs & exit
+  // 2. we don't want to stitch together paths on separate pages
+  link = RecordJitEdge(&m->system->jit, m->path.start, pc);
+  if (link == kJitLinkCycle) STATISTIC(++path_cycles);
+  return link;
+#else
+  return 0;
+#endif
+}
+
+void ConnectPath(P, u64 pc, int link) {
 #ifdef HAVE_JIT
   void *jump;
+  long entry;
   uintptr_t f;
-  STATISTIC(++path_connected_total);
-  // 1. cyclic paths can block asynchronous sigs & deadlock exit
-  // 2. we don't want to stitch together paths on separate pages
-  if ((!avoid_cycles && m->path.start == pc) ||
-      RecordJitEdge(&m->system->jit, m->path.start, pc)) {
-    // is a preexisting jit path installed at destination?
-    if ((f = GetJitHook(&m->system->jit, pc)) &&
-        f != (uintptr_t)JitlessDispatch) {
-      // tail call into the other generated jit path function
-      jump = (u8 *)f + GetPrologueSize();
-      STATISTIC(++path_connected_directly);
-    } else {
-      STATISTIC(++path_connected_lazily);
-      // generate assembly to drop back into main interpreter
-      // then apply an smc fixup later on, if dest is created
-      if (!FLAG_noconnect) {
-        RecordJitJump(m->path.jb, pc, GetPrologueSize());
-      }
-      jump = (void *)m->system->ender;
-    }
+  entry = link == kJitLinkCycle ? GetPollOffset() : GetPrologueSize();
+  if (pc == m->path.start) {
+    // loop back to the beginning of the path we're making
+    jump = m->path.jb->addr + m->path.jb->start + entry;
+    STATISTIC(++path_connected_directly);
+  } else if ((f = GetJitHook(&m->system->jit, pc)) &&
+             f != (uintptr_t)JitlessDispatch) {
+    // tail call into the other generated jit path function
+    jump = (u8 *)f + entry;
+    TouchJit(f);
+    STATISTIC(++path_connected_directly);
   } else {
+    STATISTIC(++path_connected_lazily);
     // generate assembly to drop back into main interpreter
-    STATISTIC(++path_connected_interpreter);
+    // then apply an smc fixup later on, if dest is created
+    if (!FLAG_noconnect) {
+      RecordJitJump(m->path.jb, pc, entry);
+      WarmPath(m, pc);
+    }
     jump = (void *)m->system->ender;
   }
   AppendJitJump(m->path.jb, jump);
+  RecordJitLink(m->path.jb, pc);
+#endif
+}
+
+// we want to have independent jit paths jump directly into one another
+// to avoid having control flow drop back to the main interpreter loop.
+void Connect(P, u64 pc) {
+#ifdef HAVE_JIT
+  int link;
+  STATISTIC(++path_connected_total);
+  if ((link = CanConnect(A, pc))) {
+    ConnectPath(A, pc, link);
+  } else {
+    // generate assembly to drop back into main interpreter
+    STATISTIC(++path_connected_interpreter);
+    AppendJitJump(m->path.jb, (void *)m->system->ender);
+    RecordJitLink(m->path.jb, pc);
+  }
+#endif
+}
+
+#ifdef HAVE_JIT
+#define kIbtcHash 0x9e3779b97f4a7c15  // must be the same as GetJitTarget()
+_Static_assert(sizeof(struct JitTarget) == 16, "");
+_Static_assert(offsetof(struct JitTarget, code) == 8, "");
+#endif
+
+// generates code that jumps to the path for m->ip if it's found in the
+// return address stack (when `ras` is set) or the indirect branch target
+// cache. tags are compared inline, and LookupJitTarget() only gets run
+// on a miss. if it can't find a path either, then execution falls
+// through to the code that comes next, which should drop back into the
+// interpreter. the inline lookup needs the same guards as the function
+// which is that attention isn't needed, and the cache is of this pagegen
+void ConnectIndirect(P, bool ras) {
+#ifdef HAVE_JIT
+  u32 sys = offsetof(struct Machine, system);
+  u32 gen = offsetof(struct System, jit) + offsetof(struct Jit, pagegen);
+  u32 ibtc = offsetof(struct Machine, ibtc);
+  u32 stack = offsetof(struct Machine, ras);
+#ifdef __x86_64__
+  int i, nmiss, nnext;
+  u8 *p, code[160], *miss[4], *next[2];
+  nmiss = nnext = 0;
+  p = code;
+  *p++ = 0x48;  // mov ip(%rbx),%rdx
+  *p++ = 0x8b;
+  *p++ = 0200 | kAmdDx << 3 | kJitSav0;
+  Write32(p, offsetof(struct Machine, ip)), p += 4;
+  *p++ = 0x80;  // cmpb $0,attention(%rbx)
+  *p++ = 0270 | kJitSav0;
+  Write32(p, offsetof(struct Machine, attention)), p += 4;
+  *p++ = 0x00;
+  *p++ = 0x75;  // jnz miss
+  *p++ = 0x00;
+  miss[nmiss++] = p;
+  *p++ = 0x48;  // mov system(%rbx),%rax
+  *p++ = 0x8b;
+  *p++ = 0200 | kAmdAx << 3 | kJitSav0;
+  Write32(p, sys), p += 4;
+  *p++ = 0x8b;  // mov pagegen(%rax),%eax
+  *p++ = 0200 | kAmdAx << 3 | kAmdAx;
+  Write32(p, gen), p += 4;
+  *p++ = 0x3b;  // cmp targetgen(%rbx),%eax
+  *p++ = 0200 | kAmdAx << 3 | kJitSav0;
+  Write32(p, offsetof(struct Machine, targetgen)), p += 4;
+  *p++ = 0x75;  // jne miss
+  *p++ = 0x00;
+  miss[nmiss++] = p;
+  if (ras) {
+    *p++ = 0x8b;  // mov rastop(%rbx),%eax
+    *p++ = 0200 | kAmdAx << 3 | kJitSav0;
+    Write32(p, offsetof(struct Machine, rastop)), p += 4;
+    *p++ = 0x83;  // and $kJitRasSize-1,%eax
+    *p++ = 0340 | kAmdAx;
+    *p++ = kJitRasSize - 1;
+    *p++ = 0xc1;  // shl $4,%eax
+    *p++ = 0340 | kAmdAx;
+    *p++ = 4;
+    *p++ = 0x48;  // cmp ras(%rbx,%rax),%rdx
+    *p++ = 0x3b;
+    *p++ = 0204 | kAmdDx << 3;
+    *p++ = kAmdAx << 3 | kJitSav0;
+    Write32(p, stack), p += 4;
+    *p++ = 0x75;  // jne next
+    *p++ = 0x00;
+    next[nnext++] = p;
+    *p++ = 0x48;  // mov ras+8(%rbx,%rax),%rax
+    *p++ = 0x8b;
+    *p++ = 0204 | kAmdAx << 3;
+    *p++ = kAmdAx << 3 | kJitSav0;
+    Write32(p, stack + 8), p += 4;
+    *p++ = 0x48;  // test %rax,%rax
+    *p++ = 0x85;
+    *p++ = 0300 | kAmdAx << 3 | kAmdAx;
+    *p++ = 0x74;  // jz next
+    *p++ = 0x00;
+    next[nnext++] = p;
+    *p++ = 0xff;  // jmp *%rax
+    *p++ = 0340 | kAmdAx;
+    for (i = 0; i < nnext; ++i) next[i][-1] = p - next[i];
+  }
+  *p++ = 0x48;  // mov $kIbtcHash,%rax
+  *p++ = 0xb8 | kAmdAx;
+  Write64(p, kIbtcHash), p += 8;
+  *p++ = 0x48;  // imul %rdx,%rax
+  *p++ = 0x0f;
+  *p++ = 0xaf;
+  *p++ = 0300 | kAmdAx << 3 | kAmdDx;
+  *p++ = 0x48;  // shr $64-kJitIbtcBits,%rax
+  *p++ = 0xc1;
+  *p++ = 0350 | kAmdAx;
+  *p++ = 64 - kJitIbtcBits;
+  *p++ = 0xc1;  // shl $4,%eax
+  *p++ = 0340 | kAmdAx;
+  *p++ = 4;
+  *p++ = 0x48;  // cmp ibtc(%rbx,%rax),%rdx
+  *p++ = 0x3b;
+  *p++ = 0204 | kAmdDx << 3;
+  *p++ = kAmdAx << 3 | kJitSav0;
+  Write32(p, ibtc), p += 4;
+  *p++ = 0x75;  // jne miss
+  *p++ = 0x00;
+  miss[nmiss++] = p;
+  *p++ = 0x48;  // mov ibtc+8(%rbx,%rax),%rax
+  *p++ = 0x8b;
+  *p++ = 0204 | kAmdAx << 3;
+  *p++ = kAmdAx << 3 | kJitSav0;
+  Write32(p, ibtc + 8), p += 4;
+  *p++ = 0x48;  // test %rax,%rax
+  *p++ = 0x85;
+  *p++ = 0300 | kAmdAx << 3 | kAmdAx;
+  *p++ = 0x74;  // jz miss
+  *p++ = 0x00;
+  miss[nmiss++] = p;
+  *p++ = 0xff;  // jmp *%rax
+  *p++ = 0340 | kAmdAx;
+  for (i = 0; i < nmiss; ++i) miss[i][-1] = p - miss[i];
+  unassert(p - code <= ARRAYLEN(code));
+  AppendJit(m->path.jb, code, p - code);
+#elif defined(__aarch64__)
+  int i, n, nmiss, nnext;
+  u32 code[40];
+  int miss[4], next[2];
+  _Static_assert(offsetof(struct Machine, ip) % 8 == 0, "");
+  _Static_assert(offsetof(struct Machine, system) / 8 < 4096, "");
+  _Static_assert(offsetof(struct Machine, targetgen) / 4 < 4096, "");
+  _Static_assert(offsetof(struct Machine, rastop) / 4 < 4096, "");
+  _Static_assert(offsetof(struct Machine, ibtc) < 1 << 24, "");
+  _Static_assert(offsetof(struct Machine, ras) < 1 << 24, "");
+  unassert(gen % 4 == 0 && gen / 4 < 4096);
+  n = nmiss = nnext = 0;
+  code[n++] = 0xf9400001 | offsetof(struct Machine, ip) / 8 << 10 |
+              kJitSav0 << 5;  // ldr x1,[x19,#ip]
+  code[n++] = 0x39400002 | offsetof(struct Machine, attention) << 10 |
+              kJitSav0 << 5;  // ldrb w2,[x19,#attention]
+  miss[nmiss++] = n;
+  code[n++] = 0x35000002;                         // cbnz w2,miss
+  code[n++] = 0xf9400002 | sys / 8 << 10 | kJitSav0 << 5;  // ldr x2,[x19,#system]
+  code[n++] = 0xb9400042 | gen / 4 << 10;         // ldr w2,[x2,#pagegen]
+  code[n++] = 0xb9400003 | offsetof(struct Machine, targetgen) / 4 << 10 |
+              kJitSav0 << 5;  // ldr w3,[x19,#targetgen]
+  code[n++] = 0x6b03005f;     // cmp w2,w3
+  miss[nmiss++] = n;
+  code[n++] = 0x54000001;  // b.ne miss
+  if (ras) {
+    code[n++] = 0xb9400002 | offsetof(struct Machine, rastop) / 4 << 10 |
+                kJitSav0 << 5;  // ldr w2,[x19,#rastop]
+    _Static_assert(kJitRasSize == 16, "");
+    code[n++] = 0x12000c42;  // and w2,w2,#15
+    code[n++] = 0x91400003 | (stack >> 12) << 10 |
+                kJitSav0 << 5;  // add x3,x19,#ras>>12,lsl #12
+    code[n++] = 0x91000063 | (stack & 4095) << 10;  // add x3,x3,#ras&4095
+    code[n++] = 0x8b021063;  // add x3,x3,x2,lsl #4
+    code[n++] = 0xa9400064;  // ldp x4,x0,[x3]
+    code[n++] = 0xeb01009f;  // cmp x4,x1
+    next[nnext++] = n;
+    code[n++] = 0x54000001;  // b.ne next
+    next[nnext++] = n;
+    code[n++] = 0xb4000000;  // cbz x0,next
+    code[n++] = 0xd61f0000;  // br x0
+    for (i = 0; i < nnext; ++i) code[next[i]] |= (n - next[i]) << 5;
+  }
+  code[n++] = 0xd2800002 | (kIbtcHash >> 0 & 0xffff) << 5;  // movz x2,#...
+  code[n++] = 0xf2a00002 | (kIbtcHash >> 16 & 0xffff) << 5;  // movk ..lsl16
+  code[n++] = 0xf2c00002 | (kIbtcHash >> 32 & 0xffff) << 5;  // movk ..lsl32
+  code[n++] = 0xf2e00002 | (kIbtcHash >> 48 & 0xffff) << 5;  // movk ..lsl48
+  code[n++] = 0x9b027c22;  // mul x2,x1,x2
+  code[n++] = 0xd340fc42 | (64 - kJitIbtcBits) << 16;  // lsr x2,x2,#56
+  code[n++] = 0x91400003 | (ibtc >> 12) << 10 |
+              kJitSav0 << 5;  // add x3,x19,#ibtc>>12,lsl #12
+  code[n++] = 0x91000063 | (ibtc & 4095) << 10;  // add x3,x3,#ibtc&4095
+  code[n++] = 0x8b021063;  // add x3,x3,x2,lsl #4
+  code[n++] = 0xa9400064;  // ldp x4,x0,[x3]
+  code[n++] = 0xeb01009f;  // cmp x4,x1
+  miss[nmiss++] = n;
+  code[n++] = 0x54000001;  // b.ne miss
+  miss[nmiss++] = n;
+  code[n++] = 0xb4000000;  // cbz x0,miss
+  code[n++] = 0xd61f0000;  // br x0
+  for (i = 0; i < nmiss; ++i) code[miss[i]] |= (n - miss[i]) << 5;
+  unassert(n <= ARRAYLEN(code));
+  AppendJit(m->path.jb, code, n * 4);
+#endif
+  AppendJitMovReg(m->path.jb, kJitArg0, kJitSav0);
+  AppendJitCall(m->path.jb, (void *)LookupJitTarget);
+#ifdef __x86_64__
+  u8 tail[] = {
+      0x48, 0x85, 0300 | kJitRes0 << 3 | kJitRes0,  // test %rax,%rax
+      0x74, 0x02,                                   // jz   +2
+      0xff, 0340 | kJitRes0,                        // jmp  *%rax
+  };
+#else
+  u32 tail[] = {
+      0xb4000000 | (8 / 4) << 5 | kJitRes0,  // cbz x0,#8
+      0xd61f0000 | kJitRes0 << 5,            // br  x0
+  };
+#endif
+  AppendJit(m->path.jb, tail, sizeof(tail));
 #endif
 }
 
@@ -490,28 +723,31 @@ static void AluRo(P, const aluop_f ops[4], const aluop_f fops[4]) {
 }
 
 static void OpAluTest(P) {
-  if (IsMakingPath(m) && FuseBranchTest(A)) {
+  if (IsMakingPath(m)) {
+    // flags are computed first so fusion can see which way we'll go
     kAlu[ALU_AND][RegLog2(rde)](
         m, ReadRegisterOrMemoryBW(rde, GetModrmReadBW(A)),
         ReadRegisterBW(
             rde, RegLog2(rde) ? RegRexrReg(m, rde) : ByteRexrReg(m, rde)));
-    return;
+    if (FuseBranchTest(A, false)) return;
   }
   AluRo(A, kAlu[ALU_AND], kAluFast[ALU_AND]);
 }
 
 static void OpAluCmp(P) {
-  if (IsMakingPath(m) && FuseBranchCmp(A, false)) {
+  if (IsMakingPath(m)) {
+    // flags are computed first so fusion can see which way we'll go
     kAlu[ALU_SUB][RegLog2(rde)](
         m, ReadRegisterOrMemoryBW(rde, GetModrmReadBW(A)),
         ReadRegisterBW(
             rde, RegLog2(rde) ? RegRexrReg(m, rde) : ByteRexrReg(m, rde)));
-    return;
+    if (FuseBranchCmp(A, false)) return;
   }
   AluRo(A, kAlu[ALU_SUB], kAluFast[ALU_SUB]);
 }
 
 static void OpAluFlip(P) {
+  int flags;
   aluop_f op = kAlu[(Opcode(rde) & 070) >> 3][RegLog2(rde)];
   u8 *q = RegLog2(rde) ? RegRexrReg(m, rde) : ByteRexrReg(m, rde);
   WriteRegisterBW(rde, q,
@@ -520,7 +756,18 @@ static void OpAluFlip(P) {
   if (IsMakingPath(m)) {
     STATISTIC(++alu_ops);
     LoadAluFlipArgs(A);
-    switch (GetNeededFlags(m, m->ip, CF | ZF | SF | OF | AF | PF)) {
+    flags = GetNeededFlags(m, m->ip, CF | ZF | SF | OF | AF | PF);
+    if (flags && CanFuseBranchAlu(A, (Opcode(rde) & 070) >> 3)) {
+      STATISTIC(++fused_alu_branches);
+      Jitter(A,
+             "m"      // call micro-op
+             "r0s1="  // sav1 = res0
+             "s1C",   // PutReg(RexrReg, sav1)
+             kJustAlu[(Opcode(rde) & 070) >> 3]);
+      FuseBranchResult(A);
+      return;
+    }
+    switch (flags) {
       case 0:
         STATISTIC(++alu_unflagged);
         if (GetFlagDeps(rde)) Jitter(A, "q");  // arg0 = sav0 (machine)
@@ -823,7 +1070,7 @@ void Terminate(P, void uop(struct Machine *, u64)) {
            "q",   // arg0 = sav0 (machine)
            disp, uop);
     AlignJit(m->path.jb, 8, 0);
-    Connect(A, m->ip, true);
+    Connect(A, m->ip);
     FinishPath(m);
   }
 }
@@ -843,15 +1090,21 @@ static cc_f GetCc(P) {
 
 static void OpJcc(P) {
   cc_f cc;
+  bool taken, trace;
   cc = GetCc(A);
+  taken = cc(m);
   if (IsMakingPath(m)) {
     FlushSkew(A);
+    // if this branch is being traced and wasn't taken, then the side
+    // exit is the jump, which we need to skip over when not taken.
+    trace = CanExtendPath(A, m->ip, taken ? m->ip + disp : m->ip);
 #ifdef __x86_64__
     Jitter(A, "mq", cc);
     AlignJit(m->path.jb, 8, 4);
     u8 code[] = {
         0x85, 0300 | kJitRes0 << 3 | kJitRes0,  // test %eax,%eax
-        0x75, 5,                                // jnz  +5
+        (u8)(trace && !taken ? 0x74 : 0x75),    // jz/jnz
+        5,                                      // +5
     };
 #else
     Jitter(A,
@@ -860,21 +1113,39 @@ static void OpJcc(P) {
            "q",     // arg0 = machine
            cc);
     u32 code[] = {
-        0xb5000000 | (8 / 4) << 5 | kJitArg2,  // cbnz x2,#8
+        // cbz/cbnz x2,#8
+        (trace && !taken ? 0xb4000000 : 0xb5000000) | (8 / 4) << 5 | kJitArg2,
     };
 #endif
     AppendJit(m->path.jb, code, sizeof(code));
-    Connect(A, m->ip, true);
-    Jitter(A,
-           "a1i"  // arg1 = disp
-           "m"    // call micro-op
-           "q",   // arg0 = machine
-           disp, FastJmp);
-    AlignJit(m->path.jb, 8, 0);
-    Connect(A, m->ip + disp, false);
-    FinishPath(m);
+    if (trace && !taken) {
+      long end = m->path.jb->index;
+      Jitter(A,
+             "a1i"  // arg1 = disp
+             "m"    // call micro-op
+             "q",   // arg0 = machine
+             disp, FastJmp);
+      AlignJit(m->path.jb, 8, 0);
+      Connect(A, m->ip + disp);
+      FixupSideExit(m->path.jb, end);
+      ExtendPath(m);
+    } else {
+      Connect(A, m->ip);
+      Jitter(A,
+             "a1i"  // arg1 = disp
+             "m"    // call micro-op
+             "q",   // arg0 = machine
+             disp, FastJmp);
+      if (trace) {
+        ExtendPath(m);
+      } else {
+        AlignJit(m->path.jb, 8, 0);
+        Connect(A, m->ip + disp);
+        FinishPath(m);
+      }
+    }
   }
-  if (cc(m)) {
+  if (taken) {
     m->ip += disp;
   }
 }
@@ -965,55 +1236,134 @@ static u64 AluPopcnt(u64 x, struct Machine *m) {
   m->flags = SetFlag(m->flags, FLAGS_CF, false);
   m->flags = SetFlag(m->flags, FLAGS_SF, false);
   m->flags = SetFlag(m->flags, FLAGS_OF, false);
+  m->flags = SetFlag(m->flags, FLAGS_AF, false);
   m->flags = SetFlag(m->flags, FLAGS_PF, false);
   return popcount(x);
 }
 
-static u64 AluLzcnt(u64 x, struct Machine *m, int bits) {
+static u64 AluTzcnt(u64 x, struct Machine *m, int bits) {
   u64 r = x ? bsf(x) : bits;
   m->flags = SetFlag(m->flags, FLAGS_CF, !x);
   m->flags = SetFlag(m->flags, FLAGS_ZF, !r);
   return r;
 }
-static u64 AluLzcnt64(u64 x, struct Machine *m) {
-  return AluLzcnt(x, m, 64);
+static u64 AluTzcnt64(u64 x, struct Machine *m) {
+  return AluTzcnt(x, m, 64);
 }
-static u64 AluLzcnt32(u64 x, struct Machine *m) {
-  return AluLzcnt(x, m, 32);
+static u64 AluTzcnt32(u64 x, struct Machine *m) {
+  return AluTzcnt(x, m, 32);
 }
-static u64 AluLzcnt16(u64 x, struct Machine *m) {
-  return AluLzcnt(x, m, 16);
+static u64 AluTzcnt16(u64 x, struct Machine *m) {
+  return AluTzcnt(x, m, 16);
 }
 static u64 AluBsf(u64 x, struct Machine *m) {
   m->flags = SetFlag(m->flags, FLAGS_ZF, !x);
   return x ? bsf(x) : 0;
 }
 
-static u64 AluTzcnt(u64 x, struct Machine *m, int bits) {
-  u64 r = x ? bsr(x) : bits;
+static u64 AluLzcnt(u64 x, struct Machine *m, int bits) {
+  u64 r = x ? bits - 1 - bsr(x) : bits;
   m->flags = SetFlag(m->flags, FLAGS_CF, !x);
   m->flags = SetFlag(m->flags, FLAGS_ZF, !r);
   return r;
 }
-static u64 AluTzcnt64(u64 x, struct Machine *m) {
-  return AluTzcnt(x, m, 64);
+static u64 AluLzcnt64(u64 x, struct Machine *m) {
+  return AluLzcnt(x, m, 64);
 }
-static u64 AluTzcnt32(u64 x, struct Machine *m) {
-  return AluTzcnt(x, m, 32);
+static u64 AluLzcnt32(u64 x, struct Machine *m) {
+  return AluLzcnt(x, m, 32);
 }
-static u64 AluTzcnt16(u64 x, struct Machine *m) {
-  return AluTzcnt(x, m, 16);
+static u64 AluLzcnt16(u64 x, struct Machine *m) {
+  return AluLzcnt(x, m, 16);
 }
 static u64 AluBsr(u64 x, struct Machine *m) {
   m->flags = SetFlag(m->flags, FLAGS_ZF, !x);
   return x ? bsr(x) : 0;
 }
 
+// lowers popcnt, tzcnt, and lzcnt to the host instruction when nothing
+// reads the flags they compute, since that's how compilers use them
+static bool JitBitscan(P) {
+#if defined(HAVE_JIT) && defined(__x86_64__)
+  u8 *p, code[8];
+  int flags, log2sz = WordLog2(rde);
+  switch (Opcode(rde)) {
+    case 0xB8:
+      if (!X86_HAVE(Popcnt)) return false;
+      flags = CF | ZF | SF | OF | AF | PF;
+      break;
+    case 0xBC:
+      if (!X86_HAVE(Bmi1)) return false;
+      flags = CF | ZF;
+      break;
+    case 0xBD:
+      if (!X86_HAVE(Lzcnt)) return false;
+      flags = CF | ZF;
+      break;
+    default:
+      __builtin_unreachable();
+  }
+  if (GetNeededFlags(m, m->ip, flags)) return false;
+  Jitter(A, "wB");  // res0 = GetRegOrMem[force16+bit](RexbRm)
+  p = code;
+  if (log2sz == 1) *p++ = 0x66;
+  *p++ = 0xf3;  // e.g. popcnt %rax,%rax
+  if (log2sz == 3) *p++ = kAmdRexw;
+  *p++ = 0x0f;
+  *p++ = Opcode(rde);
+  *p++ = 0300 | kJitRes0 << 3 | kJitRes0;
+  AppendJit(m->path.jb, code, p - code);
+  Jitter(A, "r0wC");  // PutReg[force16+bit](RexrReg, res0)
+  STATISTIC(++bits_lowered);
+  return true;
+#elif defined(HAVE_JIT) && defined(__aarch64__)
+  int n;
+  u32 code[4];
+  if (GetNeededFlags(m, m->ip, Opcode(rde) == 0xB8 ? CF | ZF | SF | OF | AF | PF
+                                                    : CF | ZF)) {
+    return false;
+  }
+  switch (Opcode(rde)) {
+    case 0xB8:
+      code[0] = 0x9e670000 | kJitRes0 << 5;  // fmov d0,x0
+      code[1] = 0x0e205800;                  // cnt v0.8b,v0.8b
+      code[2] = 0x0e31b800;                  // addv b0,v0.8b
+      code[3] = 0x9e660000 | kJitRes0;       // fmov x0,d0
+      n = 4;
+      break;
+    case 0xBC:
+      if (WordLog2(rde) == 1) return false;
+      code[0] = (Rexw(rde) ? 0xdac00000 : 0x5ac00000) |  // rbit x0,x0
+                kJitRes0 << 5 | kJitRes0;
+      code[1] = (Rexw(rde) ? 0xdac01000 : 0x5ac01000) |  // clz x0,x0
+                kJitRes0 << 5 | kJitRes0;
+      n = 2;
+      break;
+    case 0xBD:
+      if (WordLog2(rde) == 1) return false;
+      code[0] = (Rexw(rde) ? 0xdac01000 : 0x5ac01000) |  // clz x0,x0
+                kJitRes0 << 5 | kJitRes0;
+      n = 1;
+      break;
+    default:
+      __builtin_unreachable();
+  }
+  Jitter(A, "wB");  // res0 = GetRegOrMem[force16+bit](RexbRm)
+  AppendJit(m->path.jb, code, n * 4);
+  Jitter(A, "r0wC");  // PutReg[force16+bit](RexrReg, res0)
+  STATISTIC(++bits_lowered);
+  return true;
+#else
+  return false;
+#endif
+}
+
 static void Bitscan(P, u64 op(u64, struct Machine *)) {
   WriteRegister(
       rde, RegRexrReg(m, rde),
       op(ReadMemory(rde, GetModrmRegisterWordPointerReadOszRexw(A)), m));
   if (IsMakingPath(m)) {
+    if (Rep(rde) == 3 && JitBitscan(A)) return;
     Jitter(A,
            "wB"     // res0 = GetRegOrMem[force16+bit](RexbRm)
            "s0a1="  // arg1 = sav0
@@ -1028,11 +1378,11 @@ static void OpBsf(P) {
   u64 (*op)(u64, struct Machine *);
   if (Rep(rde) == 3) {
     if (Rexw(rde)) {
-      op = AluLzcnt64;
+      op = AluTzcnt64;
     } else if (!Osz(rde)) {
-      op = AluLzcnt32;
+      op = AluTzcnt32;
     } else {
-      op = AluLzcnt16;
+      op = AluTzcnt16;
     }
   } else {
     op = AluBsf;
@@ -1044,11 +1394,11 @@ static void OpBsr(P) {
   u64 (*op)(u64, struct Machine *);
   if (Rep(rde) == 3) {
     if (Rexw(rde)) {
-      op = AluTzcnt64;
+      op = AluLzcnt64;
     } else if (!Osz(rde)) {
-      op = AluTzcnt32;
+      op = AluLzcnt32;
     } else {
-      op = AluTzcnt16;
+      op = AluLzcnt16;
     }
   } else {
     op = AluBsr;
@@ -1157,19 +1507,27 @@ static void OpDoubleShift(P) {
 static void OpFxsave(P) {
   i64 v;
   u8 buf[32];
+#ifndef DISABLE_X87
+  int i;
+  u8 st[128];
+#endif
   memset(buf, 0, 32);
   Write16(buf + 0, m->fpu.cw);
 #ifndef DISABLE_X87
   Write16(buf + 2, m->fpu.sw);
-  Write8(buf + 4, m->fpu.tw);
+  Write8(buf + 4, FpuGetAbridgedTags(m));
   Write16(buf + 6, m->fpu.op);
   Write32(buf + 8, m->fpu.ip);
 #endif
-  Write32(buf + 24, m->mxcsr);
+  Write32(buf + 24, GetMxcsr(m));
   v = ComputeAddress(A);
   CopyToUser(m, v + 0, buf, 32);
 #ifndef DISABLE_X87
-  CopyToUser(m, v + 32, m->fpu.st, 128);
+  memset(st, 0, sizeof(st));
+  for (i = 0; i < 8; ++i) {
+    SerializeLdbl(st + i * 16, m->fpu.st[i]);
+  }
+  CopyToUser(m, v + 32, st, 128);
 #endif
   CopyToUser(m, v + 160, m->xmm, 256);
   SetWriteAddr(m, v, 416);
@@ -1178,32 +1536,86 @@ static void OpFxsave(P) {
 static void OpFxrstor(P) {
   i64 v;
   u8 buf[32];
+#ifndef DISABLE_X87
+  int i;
+  u8 st[128];
+#endif
   v = ComputeAddress(A);
   SetReadAddr(m, v, 416);
   CopyFromUser(m, buf, v + 0, 32);
 #ifndef DISABLE_X87
-  CopyFromUser(m, m->fpu.st, v + 32, 128);
+  CopyFromUser(m, st, v + 32, 128);
+  for (i = 0; i < 8; ++i) {
+    m->fpu.st[i] = DeserializeLdbl(st + i * 16);
+  }
 #endif
   CopyFromUser(m, m->xmm, v + 160, 256);
   m->fpu.cw = Load16(buf + 0);
 #ifndef DISABLE_X87
   m->fpu.sw = Load16(buf + 2);
-  m->fpu.tw = Load8(buf + 4);
+  FpuSetAbridgedTags(m, Load8(buf + 4));
   m->fpu.op = Load16(buf + 6);
   m->fpu.ip = Load32(buf + 8);
 #endif
-  m->mxcsr = Load32(buf + 24);
+  SetMxcsr(m, Load32(buf + 24));
 }
 
+// we only support the standard (non-compacted) format, whose legacy
+// region is laid out like fxsave, followed by a 64-byte header, and
+// then the upper halves of the ymm registers at offset 576
 static void OpXsave(P) {
+  i64 v;
+  u8 hdr[8];
+  u64 rfbm;
+  rfbm = Get32(m->ax) & kXcr0;
+  v = ComputeAddress(A);
+  if (v & 63) ThrowSegmentationFault(m, v);
+  if (rfbm & 3) OpFxsave(A);
+  if (rfbm & 4) CopyToUser(m, v + 576, m->ymmh, 256);
+  CopyFromUser(m, hdr, v + 512, 8);
+  Write64(hdr, Read64(hdr) | rfbm);
+  CopyToUser(m, v + 512, hdr, 8);
+  SetWriteAddr(m, v, 832);
+}
+
+static void OpXrstor(P) {
+  i64 v;
+  u64 bv, rfbm;
+  u8 hdr[16];
+  rfbm = Get32(m->ax) & kXcr0;
+  v = ComputeAddress(A);
+  if (v & 63) ThrowSegmentationFault(m, v);
+  CopyFromUser(m, hdr, v + 512, 16);
+  bv = Read64(hdr);
+  if ((bv & ~kXcr0) || Read64(hdr + 8)) ThrowProtectionFault(m);
+  if (rfbm & 3) OpFxrstor(A);
+  // components absent from xstate_bv are put in their initial state
+#ifndef DISABLE_X87
+  if ((rfbm & 1) && !(bv & 1)) {
+    m->fpu.cw = 0x037f;
+    m->fpu.sw = 0;
+    m->fpu.tw = -1;
+  }
+#endif
+  if ((rfbm & 2) && !(bv & 2)) {
+    memset(m->xmm, 0, sizeof(m->xmm));
+  }
+  if (rfbm & 4) {
+    if (bv & 4) {
+      CopyFromUser(m, m->ymmh, v + 576, 256);
+    } else {
+      memset(m->ymmh, 0, sizeof(m->ymmh));
+    }
+  }
+  SetReadAddr(m, v, 832);
 }
 
 static void OpLdmxcsr(P) {
-  m->mxcsr = Load32(ComputeReserveAddressRead4(A));
+  SetMxcsr(m, Load32(ComputeReserveAddressRead4(A)));
 }
 
 static void OpStmxcsr(P) {
-  Store32(ComputeReserveAddressWrite4(A), m->mxcsr);
+  Store32(ComputeReserveAddressWrite4(A), GetMxcsr(m));
 }
 
 static void OpRdfsbase(P) {
@@ -1282,7 +1694,11 @@ static void Op1ae(P) {
       }
       break;
     case 5:
-      OpLfence(A);
+      if (ismem) {
+        OpXrstor(A);
+      } else {
+        OpLfence(A);
+      }
       break;
     case 6:
       OpMfence(A);
@@ -1573,13 +1989,13 @@ static const nexgen32e_f kNexgen32e[] = {
     /*0A1*/ OpMovRaxOvqp,            //
     /*0A2*/ OpMovObAl,               //
     /*0A3*/ OpMovOvqpRax,            //
-    /*0A4*/ OpMovsb,                 // #73   (0.011594%)
+    /*0A4*/ OpMovs,                  // #73   (0.011594%)
     /*0A5*/ OpMovs,                  // #158  (0.000147%)
     /*0A6*/ OpCmps,                  //
     /*0A7*/ OpCmps,                  //
     /*0A8*/ OpTestAxImm,             // #115  (0.001247%)
     /*0A9*/ OpTestAxImm,             // #113  (0.001300%)
-    /*0AA*/ OpStosb,                 // #67   (0.013327%)
+    /*0AA*/ OpStos,                  // #67   (0.013327%)
     /*0AB*/ OpStos,                  // #194  (0.000044%)
     /*0AC*/ OpLods,                  // #198  (0.000035%)
     /*0AD*/ OpLods,                  // #296  (0.000000%)
@@ -1935,23 +2351,86 @@ static const nexgen32e_f kNexgen32e[] = {
     /*20B*/ OpSsePmulhrsw,           // #205  (0.000027%)
 };
 
-nexgen32e_f GetOp(long op) {
+static nexgen32e_f GetLegacyOp(long op) {
   if (op < ARRAYLEN(kNexgen32e)) {
     return kNexgen32e[op];
   } else {
     switch (op) {
+      XLAT(0x210, OpSseBlendv);
+      XLAT(0x214, OpSseBlendv);
+      XLAT(0x215, OpSseBlendv);
+      XLAT(0x217, OpSsePtest);
       XLAT(0x21c, OpSsePabsb);
       XLAT(0x21d, OpSsePabsw);
       XLAT(0x21e, OpSsePabsd);
+      XLAT(0x220, OpSsePmovx);
+      XLAT(0x221, OpSsePmovx);
+      XLAT(0x222, OpSsePmovx);
+      XLAT(0x223, OpSsePmovx);
+      XLAT(0x224, OpSsePmovx);
+      XLAT(0x225, OpSsePmovx);
+      XLAT(0x228, OpSsePmuldq);
+      XLAT(0x229, OpSsePcmpeqq);
       XLAT(0x22a, OpMovntdqaVdqMdq);
+      XLAT(0x22b, OpSsePackusdw);
+      XLAT(0x230, OpSsePmovx);
+      XLAT(0x231, OpSsePmovx);
+      XLAT(0x232, OpSsePmovx);
+      XLAT(0x233, OpSsePmovx);
+      XLAT(0x234, OpSsePmovx);
+      XLAT(0x235, OpSsePmovx);
+      XLAT(0x237, OpSsePcmpgtq);
+      XLAT(0x238, OpSsePminsb);
+      XLAT(0x239, OpSsePminsd);
+      XLAT(0x23a, OpSsePminuw);
+      XLAT(0x23b, OpSsePminud);
+      XLAT(0x23c, OpSsePmaxsb);
+      XLAT(0x23d, OpSsePmaxsd);
+      XLAT(0x23e, OpSsePmaxuw);
+      XLAT(0x23f, OpSsePmaxud);
       XLAT(0x240, OpSsePmulld);
+      XLAT(0x241, OpSsePhminposuw);
+      XLAT(0x2c8, OpSha1nexte);
+      XLAT(0x2c9, OpSha1msg1);
+      XLAT(0x2ca, OpSha1msg2);
+      XLAT(0x2cb, OpSha256rnds2);
+      XLAT(0x2cc, OpSha256msg1);
+      XLAT(0x2cd, OpSha256msg2);
+      XLAT(0x2db, OpAesimc);
+      XLAT(0x2dc, OpAesenc);
+      XLAT(0x2dd, OpAesenclast);
+      XLAT(0x2de, OpAesdec);
+      XLAT(0x2df, OpAesdeclast);
       XLAT(0x2f0, Op2f01);
       XLAT(0x2f1, Op2f01);
       XLAT(0x2f5, Op2f5);
       XLAT(0x2f6, Op2f6);
       XLAT(0x2f7, OpShx);
+      XLAT(0x308, OpSseRound);
+      XLAT(0x309, OpSseRound);
+      XLAT(0x30a, OpSseRound);
+      XLAT(0x30b, OpSseRound);
+      XLAT(0x30c, OpSseBlend);
+      XLAT(0x30d, OpSseBlend);
+      XLAT(0x30e, OpSseBlend);
       XLAT(0x30f, OpSsePalignr);
+      XLAT(0x314, OpSsePextr);
+      XLAT(0x315, OpSsePextr);
+      XLAT(0x316, OpSsePextr);
+      XLAT(0x317, OpSsePextr);
+      XLAT(0x320, OpSsePinsr);
+      XLAT(0x321, OpSseInsertps);
+      XLAT(0x322, OpSsePinsr);
+      XLAT(0x340, OpSseDp);
+      XLAT(0x341, OpSseDp);
+      XLAT(0x342, OpSseMpsadbw);
       XLAT(0x344, OpSsePclmulqdq);
+      XLAT(0x360, OpSsePcmpstr);
+      XLAT(0x361, OpSsePcmpstr);
+      XLAT(0x362, OpSsePcmpstr);
+      XLAT(0x363, OpSsePcmpstr);
+      XLAT(0x3cc, OpSha1rnds4);
+      XLAT(0x3df, OpAeskeygenassist);
       XLAT(0x3f0, OpRorx);
       default:
         return OpUd;
@@ -1959,6 +2438,30 @@ nexgen32e_f GetOp(long op) {
   }
 }
 
+nexgen32e_f GetOp(u64 rde) {
+#ifndef DISABLE_AVX
+  nexgen32e_f op;
+#endif
+  if (Vex(rde)) {
+    switch (Mopcode(rde)) {
+      case 0x2f5:  // bzhi, pdep, pext
+      case 0x2f6:  // mulx
+      case 0x2f7:  // bextr, shlx, sarx, shrx
+      case 0x3f0:  // rorx
+        return GetLegacyOp(Mopcode(rde));
+      default:
+#ifndef DISABLE_AVX
+        if ((op = GetAvxOp(Mopcode(rde)))) return op;
+        return GetLegacyOp(Mopcode(rde));
+#else
+        return OpUd;
+#endif
+    }
+  } else {
+    return GetLegacyOp(Mopcode(rde));
+  }
+}
+
 static bool CanJit(struct Machine *m) {
   return !IsJitDisabled(&m->system->jit);
 }
@@ -1973,14 +2476,14 @@ void JitlessDispatch(P) {
   uimm0 = m->xedd->op.uimm0;
   m->oplen = Oplength(rde);
   m->ip += Oplength(rde);
-  GetOp(Mopcode(rde))(A);
+  GetOp(rde)(A);
   if (m->stashaddr) CommitStash(m);
   m->oplen = 0;
 }
 
 static void GeneralDispatch(P) {
 #ifdef HAVE_JIT
-  int opclass;
+  int opclass, exits = 0;
   uintptr_t jitpc = 0;
   bool op_overlaps_page_boundary;
   bool path_would_overlap_page_boundary;
@@ -2012,6 +2515,7 @@ static void GeneralDispatch(P) {
     ++m->path.elements;
     STATISTIC(++path_elements);
     AddPath_StartOp(A);
+    exits = m->path.exits;
     jitpc = GetJitPc(m->path.jb);
     JIP_LOGF("adding [%s] from address %" PRIx64
              " to path starting at %" PRIx64,
@@ -2022,7 +2526,7 @@ static void GeneralDispatch(P) {
   m->oplen = Oplength(rde);
   m->ip += Oplength(rde);
   // call the c implementation of the opcode
-  GetOp(Mopcode(rde))(A);
+  GetOp(rde)(A);
   // cleanup after ReserveAddress() if a memory access overlapped a page
   if (m->stashaddr) {
     CommitStash(m);
@@ -2040,9 +2544,10 @@ static void GeneralDispatch(P) {
       AddPath_EndOp(A);
       STATISTIC(++path_elements_auto);
     }
-    if (opclass == kOpBranching) {
+    if (opclass == kOpBranching && m->path.exits == exits) {
       // branches, calls, and jumps always force end of path
       // unlike precious ops the branching op can be in path
+      // except conditional branches that extended the trace
       CompletePath(A);
     }
   }
@@ -2056,12 +2561,19 @@ void ExecuteInstruction(struct Machine *m) {
 #endif
 #ifdef HAVE_JIT
   u8 *dst;
+  int link;
   nexgen32e_f func;
   unassert(m->canhalt);
   if (CanJit(m)) {
     if ((func = (nexgen32e_f)GetJitHook(&m->system->jit, m->ip))) {
       if (!IsMakingPath(m)) {
+        if (func != JitlessDispatch) {
+          TouchJit((uintptr_t)func);
+        }
         func(DISPATCH_NOTHING);
+        // jit paths leave the length of their last op behind, which
+        // must not be rewound if fetching the next instruction faults
+        m->oplen = 0;
         return;
       } else if (func == JitlessDispatch) {
         JIT_LOGF("abandoning path starting at %" PRIx64
@@ -2077,14 +2589,18 @@ void ExecuteInstruction(struct Machine *m) {
         FlushSkew(DISPATCH_NOTHING);
         AppendJitSetReg(m->path.jb, kJitArg0, kJitSav0);
         STATISTIC(++path_spliced);
-        if (RecordJitEdge(&m->system->jit, m->path.start, m->ip)) {
-          dst = (u8 *)(uintptr_t)func + GetPrologueSize();
+        if ((link = CanConnect(DISPATCH_NOTHING, m->ip))) {
+          dst = (u8 *)(uintptr_t)func + (link == kJitLinkCycle
+                                              ? GetPollOffset()
+                                              : GetPrologueSize());
           STATISTIC(++path_connected_directly);
+          TouchJit((uintptr_t)func);
         } else {
           STATISTIC(++path_connected_interpreter);
           dst = (u8 *)m->system->ender;
         }
         AppendJitJump(m->path.jb, dst);
+        RecordJitLink(m->path.jb, m->ip);
         FinishPath(m);
         func(DISPATCH_NOTHING);
         return;
@@ -2114,6 +2630,9 @@ void Actor(struct Machine *mm) {
     if (!atomic_load_explicit(&m->attention, memory_order_acquire)) {
       ExecuteInstruction(m);
     } else {
+#ifdef HAVE_JIT
+      ObserveJitEpoch(&m->jitreader);
+#endif
       CheckForSignals(m);
     }
   }
@@ -2131,6 +2650,9 @@ void Blink(struct Machine *m) {
     m->canhalt = false;
     m->nofault = false;
     m->insyscall = false;
+#ifdef HAVE_JIT
+    ObserveJitEpoch(&m->jitreader);
+#endif
     CollectPageLocks(m);
     CollectGarbage(m, 0);
     if (IsMakingPath(m)) {
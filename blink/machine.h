@@ -10,7 +10,9 @@
 #include "blink/dll.h"
 #include "blink/elf.h"
 #include "blink/fds.h"
+#include "blink/gaps.h"
 #include "blink/jit.h"
+#include "blink/ldbl.h"
 #include "blink/linux.h"
 #include "blink/log.h"
 #include "blink/thread.h"
@@ -45,6 +47,13 @@
 #define kMachineExitTrap             -10
 #define kMachineFatalSystemSignal    -11
 
+// state components enabled in the xcr0 register: x87, sse, and avx
+#ifndef DISABLE_AVX
+#define kXcr0 7
+#else
+#define kXcr0 3
+#endif
+
 #define CR0_PE 0x01        // protected mode enabled
 #define CR0_MP 0x02        // monitor coprocessor
 #define CR0_EM 0x04        // no x87 fpu present if set
@@ -182,7 +191,7 @@ struct FileMap {
 
 struct MachineFpu {
 #ifndef DISABLE_X87
-  double st[8];
+  x87_t st[8];
   u32 sw;
   int tw;
   int op;
@@ -237,7 +246,7 @@ struct Elf {
 };
 
 struct OpCache {
-  u8 stash[16];   // for memory ops that overlap page
+  u8 stash[32];   // for memory ops that overlap page
   u64 codevirt;   // current rip page in guest memory
   u8 *codehost;   // current rip page in host memory
   u32 stashsize;  // for writes that overlap page
@@ -274,10 +283,12 @@ struct System {
   i64 memchurn;
   i64 codestart;
   long codesize;
+  char *jitcache;  // persistent jit cache file for program, or null
   _Atomic(long) rss;
   _Atomic(long) vss;
   struct Dis *dis;
   struct Dll *filemaps;
+  struct Gaps gaps;  // unmapped guest virtual address ranges
   struct MachineMemstat memstat;
   struct Dll *machines;
   uintptr_t ender;
@@ -296,6 +307,7 @@ struct System {
   pthread_mutex_t exec_lock;
   pthread_mutex_t sig_lock;
   pthread_mutex_t mmap_lock;
+  pthread_mutex_t shootdown_lock;
 #endif
   void (*onfilemap)(struct System *, struct FileMap *);
   void (*onsymbols)(struct System *);
@@ -311,17 +323,55 @@ struct System {
 
 struct JitPath {
   int skip;
+  int exits;
   int elements;
   u64 skew;
   i64 start;
+  i64 end;  // one past the highest guest instruction byte in path
   struct JitBlock *jb;
+  u8 tick;        // clock for evicting least recently used pins
+  u8 scratch;     // bitset of kJitSav[i] clobbered by the current op
+  u8 pinned[5];   // guest gpr plus one mirrored by kJitSav[i], or zero
+  u8 lastuse[5];  // tick at which kJitSav[i] pin was last referenced
+  u8 hits[1 << kJitHitsBits];  // tier-0 interpreter execution counters
 };
 
+#define kTlbWays     4   // associativity of each software tlb set
+#define kTlbSets     64  // sets of 4 KiB page translations (256 total)
+#define kHugeTlbSets 8   // sets of 2 MiB page translations (32 total)
+
+#define kShootdowns 8  // page ranges queued per thread before full flush
+
 struct MachineTlb {
   i64 page;
   u64 entry;
 };
 
+struct Shootdown {
+  i64 beg;  // first page whose translation changed
+  i64 end;  // page after last page that changed
+};
+
+struct ShootdownQueue {
+  int n;  // exceeds kShootdowns if the queue overflowed
+  struct Shootdown p[kShootdowns];
+};
+
+// the jit probes this with one unsigned compare of address+4096-tag so
+// every tag matches some page. empty slots use a tag that could only be
+// matched by non-canonical addresses, since zero would match the top page
+#define kInlineTlbEmpty ((i64)0x8000000000000000)
+
+struct InlineTlb {
+  i64 tag;         // guest page plus 4096, or kInlineTlbEmpty if unused
+  intptr_t delta;  // host address minus guest address for the page
+};
+
+struct JitTarget {
+  i64 virt;        // guest address of jit path
+  uintptr_t code;  // host address of path after its prologue
+};
+
 struct Machine {                         //
   u64 ip;                                // instruction pointer
   u8 oplen;                              // length of operation
@@ -378,6 +428,7 @@ struct Machine {                         //
     };                                   //
   };                                     //
   _Alignas(16) u8 xmm[16][16];           // 128-BIT VECTOR REGISTER FILE
+  _Alignas(16) u8 ymmh[16][16];          // upper halves of avx registers
   struct XedDecodedInst *xedd;           // ->opcache->icache if non-jit
   i64 readaddr;                          // so tui can show memory reads
   i64 writeaddr;                         // so tui can show memory write
@@ -399,7 +450,9 @@ struct Machine {                         //
   pthread_t thread;                      // POSIX thread of this machine
   struct FreeList freelist;              // to make system calls simpler
   struct PageLocks pagelocks;            // track page table entry locks
+  struct ShootdownQueue shootdowns;      // [invalidated] changed ranges
   struct JitPath path;                   // under construction jit route
+  struct JitReader jitreader;            // epoch of last jit quiescence
   _Atomicish(u64) signals;               // [attention] pending delivery
   _Atomicish(u64) sigmask;               // signals that've been blocked
   i64 bofram[2];                         // helps debug bootloading code
@@ -423,7 +476,10 @@ struct Machine {                         //
   bool boop;                             //
   i8 trapno;                             //
   i8 segvcode;                           //
-  struct MachineTlb tlb[32];             //
+  // software tlb; each set's ways are ordered most recently used first
+  struct MachineTlb tlb[kTlbSets][kTlbWays];
+  struct MachineTlb hugetlb[kHugeTlbSets][kTlbWays];
+  struct InlineTlb itlb[2][32];          // jit probes [read,write] tlb
   sigjmp_buf onhalt;                     //
   struct sigaltstack_linux sigaltstack;  //
   i64 robust_list;                       //
@@ -432,6 +488,10 @@ struct Machine {                         //
   sigset_t spawn_sigmask;                //
   struct Dll elem;                       //
   struct SmcQueue smcqueue;              //
+  unsigned rastop;                       // return address stack pointer
+  unsigned targetgen;                    // jit pagegen of ibtc and ras
+  struct JitTarget ras[kJitRasSize];     // return address stack for jit
+  struct JitTarget ibtc[1 << kJitIbtcBits];  // indirect branch targets
   struct OpCache opcache[1];             //
 };                                       //
 
@@ -451,14 +511,15 @@ _Noreturn void Blink(struct Machine *);
 _Noreturn void Actor(struct Machine *);
 void Jitter(P, const char *, ...);
 void FreeMachine(struct Machine *);
-void InvalidateSystem(struct System *, bool, bool);
+void InvalidateSystem(struct System *, i64, i64, bool, bool);
 void RemoveOtherThreads(struct System *);
 void KillOtherThreads(struct System *);
 void ResetCpu(struct Machine *);
 void ResetTlb(struct Machine *);
+void ApplyShootdowns(struct Machine *);
 void CollectGarbage(struct Machine *, size_t);
 void ResetInstructionCache(struct Machine *);
-nexgen32e_f GetOp(long);
+nexgen32e_f GetOp(u64);
 void LoadInstruction(struct Machine *, u64);
 int LoadInstruction2(struct Machine *, u64);
 void ExecuteInstruction(struct Machine *);
@@ -471,6 +532,7 @@ i64 ReserveVirtual(struct System *, i64, i64, u64, int, i64, bool, bool);
 char *FormatPml4t(struct Machine *);
 i64 FindVirtual(struct System *, i64, i64);
 int FreeVirtual(struct System *, i64, i64);
+i64 RemapVirtual(struct System *, i64, i64, i64, i64);
 void CleanseMemory(struct System *, size_t);
 void LoadArgv(struct Machine *, char *, char *, char **, char **, u8[16]);
 _Noreturn void HaltMachine(struct Machine *, int);
@@ -554,6 +616,7 @@ void FastCallAbs(u64, struct Machine *);
 void FastJmp(struct Machine *, u64);
 void FastJmpAbs(u64, struct Machine *);
 void FastLeave(struct Machine *);
+void FastEnter(struct Machine *);
 i64 PredictRet(struct Machine *, i64);
 
 typedef void (*putreg64_f)(u64, struct Machine *);
@@ -628,6 +691,19 @@ void OpRet(P);
 void OpRetf(P);
 void OpRetIw(P);
 void OpSsePclmulqdq(P);
+void OpAesimc(P);
+void OpAesenc(P);
+void OpAesenclast(P);
+void OpAesdec(P);
+void OpAesdeclast(P);
+void OpAeskeygenassist(P);
+void OpSha1nexte(P);
+void OpSha1msg1(P);
+void OpSha1msg2(P);
+void OpSha1rnds4(P);
+void OpSha256rnds2(P);
+void OpSha256msg1(P);
+void OpSha256msg2(P);
 void OpXaddEbGb(P);
 void OpXaddEvqpGvqp(P);
 void OpXchgGbEb(P);
@@ -728,15 +804,31 @@ void FlushSkew(P);
 bool CreatePath(P);
 void CompletePath(P);
 void AddPath_EndOp(P);
-bool FuseBranchTest(P);
+bool FuseBranchTest(P, bool);
 void AddPath_StartOp(P);
-void Connect(P, u64, bool);
+void Connect(P, u64);
+int CanConnect(P, u64);
+void ConnectPath(P, u64, int);
+void ExtendPath(struct Machine *);
+bool CanExtendPath(P, i64, i64);
+void FixupSideExit(struct JitBlock *, long);
 long GetPrologueSize(void);
+long GetPollOffset(void);
 bool FuseBranchCmp(P, bool);
+bool CanFuseBranchAlu(P, int);
+void FuseBranchResult(P);
+bool FusePrologue(P);
 i64 GetIp(struct Machine *);
 void FinishPath(struct Machine *);
 void FuseOp(struct Machine *, i64);
 void AbandonPath(struct Machine *);
+void InitPaths(struct System *);
+void WarmPath(struct Machine *, i64);
+void ConnectIndirect(P, bool);
+uintptr_t LookupJitTarget(struct Machine *);
+void PushJitTarget(struct Machine *, i64);
+void SaveJitPath(struct Machine *);
+void LoadJitCache(struct Machine *, const void *, size_t);
 void AddIp(struct Machine *, long);
 void BeginCod(struct Machine *, i64);
 void AdvanceIp(struct Machine *, long);
@@ -750,6 +842,8 @@ void LoadAluFlipArgs(P);
 i64 FastAnd8(struct Machine *, u64, u64);
 i64 FastSub8(struct Machine *, u64, u64);
 void ZeroRegFlags(struct Machine *, long);
+void ResetPinnedRegs(struct Machine *);
+void ReleaseScratchRegs(struct Machine *);
 
 i32 Imul32(i32, i32, struct Machine *);
 i64 Imul64(i64, i64, struct Machine *);
@@ -190,6 +190,39 @@ int Munmap(void *addr, size_t length) {
   return rc;
 }
 
+// resizes host memory mapping in place or moves it to `dest` if nonnull
+void *Mremap(void *addr,     //
+             size_t oldlen,  //
+             size_t newlen,  //
+             void *dest,     //
+             const char *owner) {
+  void *res;
+#if defined(HAVE_MREMAP) && defined(DISABLE_VFS)
+  if (dest) {
+    res = mremap(addr, oldlen, newlen, MREMAP_MAYMOVE | MREMAP_FIXED, dest);
+  } else {
+    res = mremap(addr, oldlen, newlen, 0);
+  }
+#else
+  // the vfs layer keeps track of host mappings on its own, so let the
+  // guest fall back to copying, as it would when out of address space
+  errno = ENOMEM;
+  res = MAP_FAILED;
+#endif
+#if LOG_MEM
+  char szbuf[16];
+  FormatSize(szbuf, newlen, 1024);
+  if (res != MAP_FAILED) {
+    MEM_LOGF("%s remapped [%p,%p) to %s byte map [%p,%p)", owner, addr,
+             (u8 *)addr + oldlen, szbuf, res, (u8 *)res + newlen);
+  } else {
+    MEM_LOGF("%s failed to remap [%p,%p) to %s byte map at %p: %s", owner,
+             addr, (u8 *)addr + oldlen, szbuf, dest, DescribeHostErrno(errno));
+  }
+#endif
+  return res;
+}
+
 int Mprotect(void *addr,     //
              size_t length,  //
              int prot,       //
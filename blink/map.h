@@ -55,6 +55,7 @@ void InitMap(void);
 int Munmap(void *, size_t);
 int Msync(void *, size_t, int, const char *);
 void *Mmap(void *, size_t, int, int, int, off_t, const char *);
+void *Mremap(void *, size_t, size_t, void *, const char *);
 int Mprotect(void *, size_t, int, const char *);
 void OverridePageSize(long);
 
@@ -172,6 +172,106 @@ void CollectPageLocks(struct Machine *m) {
   }
 }
 
+static bool IsShotDown(const struct Shootdown *p, int n, i64 beg, i64 end) {
+  int i;
+  for (i = 0; i < n; ++i) {
+    if (beg < p[i].end && p[i].beg < end) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// applies the page ranges other threads queued via InvalidateSystem()
+// so only translations of pages that actually changed are thrown away
+// unless the queue overflowed, in which case everything gets flushed.
+// decoded instructions are checked against memory each time they run
+// so dropping the cached code page is all the icache needs on its end
+void ApplyShootdowns(struct Machine *m) {
+  int i, j, n;
+  struct MachineTlb *e;
+  struct InlineTlb *t;
+  struct Shootdown p[kShootdowns];
+  LOCK(&m->system->shootdown_lock);
+  atomic_store_explicit(&m->invalidated, false, memory_order_relaxed);
+  atomic_store_explicit(&m->opcache->invalidated, false, memory_order_relaxed);
+  if ((n = m->shootdowns.n) <= kShootdowns) {
+    memcpy(p, m->shootdowns.p, n * sizeof(*p));
+  }
+  m->shootdowns.n = 0;
+  UNLOCK(&m->system->shootdown_lock);
+  if (n > kShootdowns) {
+    ResetTlb(m);
+    return;
+  }
+  STATISTIC(tlb_shootdowns += n);
+  for (i = 0; i < kTlbSets; ++i) {
+    for (j = 0; j < kTlbWays; ++j) {
+      e = m->tlb[i] + j;
+      if ((e->entry & PAGE_V) && IsShotDown(p, n, e->page, e->page + 4096)) {
+        e->entry = 0;
+      }
+    }
+  }
+  for (i = 0; i < kHugeTlbSets; ++i) {
+    for (j = 0; j < kTlbWays; ++j) {
+      e = m->hugetlb[i] + j;
+      if ((e->entry & PAGE_V) &&
+          IsShotDown(p, n, e->page, e->page + 0x200000)) {
+        e->entry = 0;
+      }
+    }
+  }
+  for (i = 0; i < 2; ++i) {
+    for (j = 0; j < ARRAYLEN(m->itlb[i]); ++j) {
+      t = m->itlb[i] + j;
+      if (t->tag != kInlineTlbEmpty &&
+          IsShotDown(p, n, t->tag - 4096, t->tag)) {
+        t->tag = kInlineTlbEmpty;
+        t->delta = 0;
+      }
+    }
+  }
+  if (m->opcache->codehost &&
+      IsShotDown(p, n, m->opcache->codevirt, m->opcache->codevirt + 4096)) {
+    m->opcache->codevirt = 0;
+    m->opcache->codehost = 0;
+  }
+}
+
+// probes one set of the software tlb for a translation. the hit will
+// be moved to the front of its set, so the last way is always the one
+// that was least recently used.
+static u64 ProbeTlb(struct MachineTlb set[kTlbWays], i64 page) {
+  int i;
+  struct MachineTlb hit;
+  for (i = 0; i < kTlbWays; ++i) {
+    if (set[i].page == page && (set[i].entry & PAGE_V)) {
+      if (i) {
+        hit = set[i];
+        memmove(set + 1, set, i * sizeof(*set));
+        set[0] = hit;
+      }
+      return set[0].entry;
+    }
+  }
+  return 0;
+}
+
+static void FillTlb(struct MachineTlb set[kTlbWays], i64 page, u64 entry) {
+  // a system call may have probed this page before locking it
+  if (set[0].page == page && (set[0].entry & PAGE_V)) {
+    set[0].entry = entry;
+    return;
+  }
+  if (set[kTlbWays - 1].entry & PAGE_V) {
+    STATISTIC(++tlb_conflicts);
+  }
+  memmove(set + 1, set, (kTlbWays - 1) * sizeof(*set));
+  set[0].page = page;
+  set[0].entry = entry;
+}
+
 // returns page directory entry associated with virtual address
 // @return raw page directory entry contents, or zero w/ errno
 // @raise EFAULT if a valid 4096 page didn't exist at address
@@ -181,15 +281,22 @@ u64 FindPageTableEntry(struct Machine *m, u64 page) {
   u8 *pslot;
   i64 table;
   u64 entry;
-  long tlbkey;
+  bool huge;
   unsigned level, index;
+  struct MachineTlb *set, *hugeset;
   if (atomic_load_explicit(&m->invalidated, memory_order_acquire)) {
-    ResetTlb(m);
-    atomic_store_explicit(&m->invalidated, false, memory_order_relaxed);
-  }
-  tlbkey = (page >> 12) & (ARRAYLEN(m->tlb) - 1);
-  if (m->tlb[tlbkey].page == page &&
-      ((entry = m->tlb[tlbkey].entry) & PAGE_V)) {
+    ApplyShootdowns(m);
+  }
+  set = m->tlb[(page >> 12) & (kTlbSets - 1)];
+  hugeset = m->hugetlb[(page >> 21) & (kHugeTlbSets - 1)];
+  if (!(entry = ProbeTlb(set, page)) &&
+      (entry = ProbeTlb(hugeset, page & -0x200000))) {
+    entry |= page & 0x1ff000;
+  }
+  // system calls may only use a cached translation if they've already
+  // locked the page, otherwise the slow path below needs to acquire it
+  // which lets the guest keep its tlb warm across system call boundary
+  if (entry && (!m->insyscall || m->nofault || HasPageLock(m, page))) {
     STATISTIC(++tlb_hits);
     return entry;
   }
@@ -200,6 +307,7 @@ u64 FindPageTableEntry(struct Machine *m, u64 page) {
     return (u64)(uintptr_t)efault0();
   }
 TryAgain:
+  huge = false;
   unassert((entry = m->system->cr3));
   level = 39;
   do {
@@ -215,13 +323,12 @@ TryAgain:
     }
     if ((entry & PAGE_PS) && level > 12) {
       // huge (1 GiB or 2 MiB) page; "rewrite" the TLB copy of the page table
-      // entry, to point to the 4 KiB subpage being accessed
-      // TODO: if partial TLB flushes are implemented in the future, we will
-      // also need to somehow record the original huge page size in the TLB,
-      // so we can correctly invalidate all TLB entries for the huge page
+      // entry, to point to the 4 KiB subpage being accessed. the 2 MiB slice
+      // that contains it is what gets remembered in the huge page partition
       u64 submask = ((u64)1 << level) - 4096;
       entry &= ~submask;
       entry |= page & submask;
+      huge = true;
       break;
     }
   } while ((level -= 9) >= 12);
@@ -251,14 +358,43 @@ TryAgain:
       return 0;
     }
   }
-  m->tlb[tlbkey].page = page;
-  m->tlb[tlbkey].entry = entry;
+  if (huge) {
+    FillTlb(hugeset, page & -0x200000, entry & ~(u64)0x1ff000);
+  } else {
+    FillTlb(set, page, entry);
+  }
   return entry;
 MapError:
   m->segvcode = SEGV_MAPERR_LINUX;
   return (uintptr_t)efault0();
 }
 
+#ifndef DISABLE_JIT
+// remembers translation so jit code can resolve it without a call
+// @param entry is page table entry, which user mode code may access
+static void AddInlineTlb(struct Machine *m, i64 virt, u64 entry, u8 *host) {
+  unsigned key;
+  i64 tag, delta;
+  if (m->insyscall) return;
+  key = (virt >> 12) & (ARRAYLEN(m->itlb[0]) - 1);
+  tag = (virt & -4096) + 4096;
+  if (tag == kInlineTlbEmpty) return;
+  if (m->itlb[0][key].tag == tag) return;
+  delta = (intptr_t)host - (virt & -4096);
+  STATISTIC(++tlb_inline_fills);
+  m->itlb[0][key].tag = tag;
+  m->itlb[0][key].delta = delta;
+  // writes to pages that might hold code still need to take the slow
+  // path so they can be added to the self-modifying code queue
+  if ((entry & PAGE_RW) &&
+      ((entry & (PAGE_U | PAGE_RW | PAGE_XD)) != (PAGE_U | PAGE_RW) ||
+       IsJitDisabled(&m->system->jit))) {
+    m->itlb[1][key].tag = tag;
+    m->itlb[1][key].delta = delta;
+  }
+}
+#endif
+
 u8 *LookupAddress2(struct Machine *m, i64 virt, u64 mask, u64 need) {
   u8 *host;
   u64 entry;
@@ -287,6 +423,9 @@ u8 *LookupAddress2(struct Machine *m, i64 virt, u64 mask, u64 need) {
   }
 #endif
   if ((host = GetPageAddress(m->system, entry, false))) {
+#ifndef DISABLE_JIT
+    if (need & PAGE_U) AddInlineTlb(m, virt, entry, host);
+#endif
     return host + (virt & 4095);
   } else {
     m->segvcode = SEGV_MAPERR_LINUX;
@@ -445,6 +584,15 @@ u8 *ReserveAddress(struct Machine *m, i64 v, size_t n, bool writable) {
   }
 }
 
+// copies one half of a page straddling access, touching the lowest byte
+// first, since with linear memory the host faults for us and si_addr is
+// expected to name the first inaccessible byte of the guest operand
+static void CopyHalf(u8 *d, const u8 *s, unsigned n) {
+  *d = *s;
+  atomic_signal_fence(memory_order_seq_cst);
+  memcpy(d + 1, s + 1, n - 1);
+}
+
 u8 *AccessRam(struct Machine *m, i64 v, size_t n, void *p[2], u8 *tmp,
               bool copy) {
   u8 *a, *b;
@@ -460,8 +608,8 @@ u8 *AccessRam(struct Machine *m, i64 v, size_t n, void *p[2], u8 *tmp,
   a = ResolveAddress(m, v);
   b = ResolveAddress(m, v + k);
   if (copy) {
-    memcpy(tmp, a, k);
-    memcpy(tmp + k, b, n - k);
+    CopyHalf(tmp, a, k);
+    CopyHalf(tmp + k, b, n - k);
   }
   p[0] = a;
   p[1] = b;
@@ -498,8 +646,8 @@ void EndStore(struct Machine *m, i64 v, size_t n, void *p[2], u8 *b) {
   unassert(n > k);
   unassert(p[0]);
   unassert(p[1]);
-  memcpy(p[0], b, k);
-  memcpy(p[1], b + k, n - k);
+  CopyHalf((u8 *)p[0], b, k);
+  CopyHalf((u8 *)p[1], b + k, n - k);
 }
 
 void EndStoreNp(struct Machine *m, i64 v, size_t n, void *p[2], u8 *b) {
@@ -208,6 +208,11 @@ struct System *NewSystem(int mode) {
       return 0;
     }
   }
+  if (InitGaps(&s->gaps, -0x800000000000, 0x800000000000)) {
+    free(s->real);
+    free(s);
+    return 0;
+  }
 #ifdef HAVE_JIT
   InitJit(&s->jit, (uintptr_t)JitlessDispatch);
 #endif
@@ -219,6 +224,7 @@ struct System *NewSystem(int mode) {
   unassert(!pthread_mutex_init(&s->machines_lock, 0));
   unassert(!pthread_cond_init(&s->pagelocks_cond, 0));
   unassert(!pthread_mutex_init(&s->pagelocks_lock, 0));
+  unassert(!pthread_mutex_init(&s->shootdown_lock, 0));
   s->blinksigs = (u64)1 << (SIGSYS_LINUX - 1) |   //
                  (u64)1 << (SIGILL_LINUX - 1) |   //
                  (u64)1 << (SIGFPE_LINUX - 1) |   //
@@ -240,6 +246,9 @@ static void FreeMachineUnlocked(struct Machine *m) {
   if (IsMakingPath(m)) {
     AbandonJit(&m->system->jit, m->path.jb);
   }
+#ifdef HAVE_JIT
+  RemoveJitReader(&m->system->jit, &m->jitreader);
+#endif
   m->sysdepth = 0;
   CollectPageLocks(m);
   CollectGarbage(m, 0);
@@ -326,10 +335,12 @@ void FreeSystem(struct System *s) {
   THR_LOGF("pid=%d FreeSystem", s->pid);
   unassert(dll_is_empty(s->machines));  // Use KillOtherThreads & FreeMachine
   FreeHostPages(s);
+  FreeGaps(&s->gaps);
   unassert(!pthread_mutex_destroy(&s->machines_lock));
   unassert(!pthread_cond_destroy(&s->machines_cond));
   unassert(!pthread_mutex_destroy(&s->pagelocks_lock));
   unassert(!pthread_cond_destroy(&s->pagelocks_cond));
+  unassert(!pthread_mutex_destroy(&s->shootdown_lock));
   unassert(!pthread_mutex_destroy(&s->exec_lock));
   unassert(!pthread_mutex_destroy(&s->mmap_lock));
   unassert(!pthread_mutex_destroy(&s->sig_lock));
@@ -337,6 +348,7 @@ void FreeSystem(struct System *s) {
   DestroyFds(&s->fds);
   free(s->elf.execfn);
   free(s->elf.prog);
+  free(s->jitcache);
   FreeFileMaps(s);
 #ifdef HAVE_JIT
   DestroyJit(&s->jit);
@@ -386,6 +398,9 @@ struct Machine *NewMachine(struct System *system, struct Machine *parent) {
   // TODO(jart): Child thread should add itself to system.
   dll_make_first(&system->machines, &m->elem);
   UNLOCK(&system->machines_lock);
+#ifdef HAVE_JIT
+  AddJitReader(&system->jit, &m->jitreader, &m->attention);
+#endif
   THR_LOGF("new machine thread pid=%d tid=%d", m->system->pid, m->tid);
   return m;
 }
@@ -473,14 +488,32 @@ bool IsValidAddrSize(i64 virt, i64 size) {
          virt + size <= 0x800000000000;
 }
 
-void InvalidateSystem(struct System *s, bool tlb, bool icache) {
+// queues page range for removal from each thread's translation cache
+static void AddShootdown(struct ShootdownQueue *q, i64 beg, i64 end) {
+  if (q->n > kShootdowns) return;
+  if (q->n && beg <= q->p[q->n - 1].end && q->p[q->n - 1].beg <= end) {
+    q->p[q->n - 1].beg = MIN(beg, q->p[q->n - 1].beg);
+    q->p[q->n - 1].end = MAX(end, q->p[q->n - 1].end);
+  } else if (q->n < kShootdowns) {
+    q->p[q->n].beg = beg;
+    q->p[q->n].end = end;
+    ++q->n;
+  } else {
+    ++q->n;  // overflow; the next check will flush everything
+  }
+}
+
+void InvalidateSystem(struct System *s, i64 virt, i64 size, bool tlb,
+                      bool icache) {
 #ifdef HAVE_THREADS
   struct Dll *e;
   struct Machine *m;
   if (tlb || icache) {
     LOCK(&s->machines_lock);
+    LOCK(&s->shootdown_lock);
     for (e = dll_first(s->machines); e; e = dll_next(s->machines, e)) {
       m = MACHINE_CONTAINER(e);
+      AddShootdown(&m->shootdowns, virt & -4096, ROUNDUP(virt + size, 4096));
       if (tlb) {
         atomic_store_explicit(&m->invalidated, true, memory_order_release);
       }
@@ -489,6 +522,7 @@ void InvalidateSystem(struct System *s, bool tlb, bool icache) {
                               memory_order_release);
       }
     }
+    UNLOCK(&s->shootdown_lock);
     UNLOCK(&s->machines_lock);
   }
 #endif
@@ -990,12 +1024,16 @@ i64 ReserveVirtual(struct System *s, i64 virt, i64 size, u64 flags, int fd,
         if ((virt += 4096) >= end) {
           s->rss += rss_delta;
           s->vss += vss_delta;
+          if (RemoveGap(&s->gaps, result, virt)) {
+            ERRF("mmap() crisis: ran out of memory for free range index");
+            PanicDueToMmap();
+          }
 #ifndef DISABLE_JIT
           if (HasLinearMapping() && !IsJitDisabled(&s->jit)) {
             result = ProtectRwxMemory(s, result, result, size, pagesize, prot);
           }
 #endif
-          InvalidateSystem(s, !!rss_delta,
+          InvalidateSystem(s, result, size, !!rss_delta,
                            executable_code_was_made_non_executable);
           return result;
         }
@@ -1006,30 +1044,16 @@ i64 ReserveVirtual(struct System *s, i64 virt, i64 size, u64 flags, int fd,
   }
 }
 
+// finds lowest unmapped interval of guest memory at or after `virt`
 i64 FindVirtual(struct System *s, i64 virt, i64 size) {
-  u64 i, pt, got, orig_virt = virt;
-  (void)orig_virt;
-StartOver:
-  if (!IsValidAddrSize(virt, size)) {
-    LOGF("FindVirtual [%#" PRIx64 ",%#" PRIx64 ") -> "
-         "[%#" PRIx64 ",%#" PRIx64 ") not possible",
-         orig_virt, orig_virt + size, virt, virt + size);
+  i64 res;
+  if (!IsValidAddrSize(virt, size) ||
+      (res = FindGap(&s->gaps, virt, ROUNDUP(size, 4096))) == -1) {
+    LOGF("FindVirtual [%#" PRIx64 ",%#" PRIx64 ") not possible", virt,
+         virt + size);
     return enomem();
   }
-  got = 0;
-  do {
-    for (i = 39, pt = s->cr3;; i -= 9) {
-      pt = LoadPte(GetPageAddress(s, pt, i == 39) +
-                   (((virt + got) >> i) & 511) * 8);
-      if (i == 12 || !(pt & PAGE_V)) break;
-    }
-    got += (u64)1 << i;
-    if ((pt & PAGE_V)) {
-      virt += got;
-      goto StartOver;
-    }
-  } while (got < size);
-  return virt;
+  return res;
 }
 
 int FreeVirtual(struct System *s, i64 virt, i64 size) {
@@ -1063,13 +1087,298 @@ int FreeVirtual(struct System *s, i64 virt, i64 size) {
     }
   }
   free(ranges.p);
+  if (AddGap(&s->gaps, virt, ROUNDUP(virt + size, 4096))) {
+    ERRF("munmap() crisis: ran out of memory for free range index");
+    PanicDueToMmap();
+  }
   s->vss += vss_delta;
   s->rss += rss_delta;
   s->memchurn -= vss_delta;
-  InvalidateSystem(s, !!rss_delta, executable_code_was_made_non_executable);
+  InvalidateSystem(s, virt, size, !!rss_delta,
+                   executable_code_was_made_non_executable);
   return rc;
 }
 
+// returns address of page table entry for `virt`, creating any missing
+// intermediary page tables if `create` is true, otherwise returning 0
+static u8 *GetPteAddress(struct System *s, i64 virt, bool create) {
+  u8 *mi;
+  u64 pt;
+  long level;
+  for (pt = s->cr3, level = 39;; level -= 9) {
+    mi = GetPageAddress(s, pt, level == 39) + ((virt >> level) & 511) * 8;
+    if (level == 12) return mi;
+    pt = LoadPte(mi);
+    if (!(pt & PAGE_V)) {
+      if (!create) return 0;
+      if ((pt = AllocatePageTable(s)) == -1) {
+        WriteErrorString("mremap() crisis: ran out of page table memory\n");
+        exit(250);
+      }
+      StorePte(mi, pt);
+    }
+  }
+}
+
+// relocates file map metadata for pages in [virt,virt+size) to `dest`
+static void MoveFileMaps(struct System *s, i64 virt, i64 size, i64 dest) {
+  u64 i, j, n, bit;
+  i64 beg, end;
+  struct Dll *e, *next;
+  struct FileMap *fm, *fm2;
+  for (e = dll_first(s->filemaps); e; e = next) {
+    next = dll_next(s->filemaps, e);
+    fm = FILEMAP_CONTAINER(e);
+    beg = MAX(virt, fm->virt);
+    end = MIN(virt + size, fm->virt + fm->size);
+    if (beg >= end) continue;
+    if (beg == fm->virt && end == fm->virt + fm->size) {
+      fm->virt += dest - virt;
+      fm2 = fm;
+    } else {
+      // a subset of the file map is moving, so split it off. the new
+      // object gets added to the front of the list, so this won't see
+      // it again. if allocation fails we lose the path of those pages
+      fm2 = AddFileMap(s, beg + (dest - virt), end - beg, fm->path,
+                       fm->offset + (beg - fm->virt));
+      i = (beg - fm->virt) / 4096;
+      n = ROUNDUP(end - beg, 4096) / 4096;
+      for (j = 0; j < n; ++j, ++i) {
+        bit = (u64)1 << (i % 64);
+        if (fm2 && !(fm->present[i / 64] & bit)) {
+          fm2->present[j / 64] &= ~((u64)1 << (j % 64));
+          --fm2->pages;
+        } else if (fm->present[i / 64] & bit) {
+          fm->present[i / 64] &= ~bit;
+          --fm->pages;
+        }
+      }
+      if (!fm->pages) {
+        dll_remove(&s->filemaps, e);
+        FreeFileMap(fm);
+      }
+      if (fm2 && !fm2->pages) {
+        dll_remove(&s->filemaps, &fm2->elem);
+        FreeFileMap(fm2);
+        fm2 = 0;
+      }
+    }
+    if (fm2 && s->dis && s->onfilemap) {
+      s->onfilemap(s, fm2);
+    }
+  }
+}
+
+// moves linear memory by hand, for when the kernel refuses to do it on
+// account of the interval spanning several host mappings, which might
+// happen if the guest changed the protection of only some of its pages
+static void *CopyLinearMemory(struct System *s, i64 virt, i64 oldsize,
+                              i64 newsize, i64 dest, const u64 *ptes) {
+  i64 i;
+  for (i = 0; i < oldsize; i += 4096) {
+    if (ptes[i / 4096] & PAGE_FILE) {
+      // copying would detach the pages from the file they came from
+      errno = EFAULT;
+      return MAP_FAILED;
+    }
+  }
+  if (Mprotect(ToHost(virt), oldsize, PROT_READ, "linear") ||
+      Mprotect(ToHost(dest), newsize, PROT_READ | PROT_WRITE, "linear")) {
+    return MAP_FAILED;
+  }
+  memcpy(ToHost(dest), ToHost(virt), oldsize);
+  for (i = 0; i < newsize; i += FLAG_pagesize) {
+    unassert(!Mprotect(
+        ToHost(dest + i), FLAG_pagesize,
+        DetermineHostProtection(GetProtection(
+            ptes[MIN(i, oldsize - 4096) / 4096])),
+        "linear"));
+  }
+  unassert(!Munmap(ToHost(virt), oldsize));
+  return ToHost(dest);
+}
+
+// moves and/or grows the mapping at [virt,virt+oldsize) so it becomes
+// [dest,dest+newsize), where dest is either equal to virt, or an empty
+// interval that doesn't overlap the old one. the caller must check the
+// old interval is fully mapped, and that newsize isn't less than it is
+//
+// in linear mode, the host memory is moved by the kernel. otherwise we
+// simply move the page table entries, so growing an anonymous mapping
+// costs time proportional to its number of pages rather than its size
+i64 RemapVirtual(struct System *s, i64 virt, i64 oldsize, i64 newsize,
+                 i64 dest) {
+  u8 *mi;
+  int prot;
+  void *got;
+  i64 i, tail;
+  u64 pt, last, *ptes;
+  bool executable_code_was_made_non_executable;
+  struct FileMap *fm;
+  MEM_LOGF("RemapVirtual(%#" PRIx64 ", %#" PRIx64 ", %#" PRIx64 ", %#" PRIx64
+           ")",
+           virt, oldsize, newsize, dest);
+  unassert(!(virt & 4095));
+  unassert(!(dest & 4095));
+  unassert(!(oldsize & 4095));
+  unassert(!(newsize & 4095));
+  unassert(newsize >= oldsize);
+  unassert(dest != virt || newsize > oldsize);
+  unassert(dest == virt || dest + newsize <= virt || virt + oldsize <= dest);
+  tail = newsize - oldsize;
+  last = LoadPte(GetPteAddress(s, virt + oldsize - 4096, false));
+  unassert(last & PAGE_V);
+  prot = GetProtection(last);
+
+  // we're only able to extend private anonymous memory, since blink
+  // doesn't keep track of the file descriptors backing mug pages.
+  if (!HasLinearMapping() && tail && (last & PAGE_MAP)) {
+    LOG_ONCE(MEM_LOGF("mremap() can't grow file or shared mappings "
+                      "(try not using `blink -m`)"));
+    return enomem();
+  }
+
+  // take the old page table entries away from the guest. this waits
+  // for any system calls in other threads to unlock the pages first.
+  ptes = 0;
+  executable_code_was_made_non_executable = false;
+  if (dest != virt) {
+    if (!(ptes = (u64 *)malloc(oldsize / 4096 * sizeof(*ptes)))) {
+      return -1;
+    }
+    for (i = 0; i < oldsize; i += 4096) {
+      unassert((mi = GetPteAddress(s, virt + i, false)));
+      for (;;) {
+        pt = LoadPte(mi);
+        unassert(pt & PAGE_V);
+        if (pt & PAGE_LOCKS) {
+          WaitForPageToNotBeLocked(s, virt + i, mi);
+        } else if (CasPte(mi, pt, 0)) {
+          break;
+        }
+      }
+      ptes[i / 4096] = pt;
+    }
+  }
+
+  if (HasLinearMapping()) {
+#ifndef DISABLE_JIT
+    // self-modifying code detection unprotects rwx memory one host page
+    // at a time, which splits it into several mappings as far as the
+    // kernel is concerned, so make them all the same again beforehand
+    if (!IsJitDisabled(&s->jit)) {
+      ProtectRwxMemory(s, 0, virt, oldsize, FLAG_pagesize, prot);
+    }
+#endif
+    if (dest == virt) {
+      if ((got = Mremap(ToHost(virt), oldsize, newsize, 0, "linear")) ==
+              MAP_FAILED &&
+          errno == EFAULT && !(last & PAGE_FILE)) {
+        if ((got = Mmap(ToHost(virt + oldsize), tail,
+                        DetermineHostProtection(prot),
+                        MAP_DEMAND | MAP_ANONYMOUS_ | MAP_PRIVATE, -1, 0,
+                        "linear")) == ToHost(virt + oldsize)) {
+          got = ToHost(virt);
+        } else {
+          if (got != MAP_FAILED) Munmap(got, tail);
+          got = MAP_FAILED;
+          errno = ENOMEM;
+        }
+      }
+    } else {
+      // reserve the destination first, so the kernel can't clobber any
+      // memory blink doesn't know about, e.g. its own executable image
+      got = Mmap(ToHost(dest), newsize, PROT_NONE,
+                 MAP_DEMAND | MAP_ANONYMOUS_ | MAP_PRIVATE, -1, 0, "mremap");
+      if (got == ToHost(dest)) {
+        if ((got = Mremap(ToHost(virt), oldsize, newsize, ToHost(dest),
+                          "linear")) == MAP_FAILED &&
+            (errno != EFAULT ||
+             (got = CopyLinearMemory(s, virt, oldsize, newsize, dest,
+                                     ptes)) == MAP_FAILED)) {
+          Munmap(ToHost(dest), newsize);
+        }
+      } else {
+        if (got != MAP_FAILED) Munmap(got, newsize);
+        got = MAP_FAILED;
+        errno = ENOMEM;
+      }
+    }
+    if (got == MAP_FAILED) goto Restore;
+  } else if (tail) {
+    if (ReserveVirtual(s, dest + oldsize, tail,
+                       last & (PAGE_U | PAGE_RW | PAGE_XD), -1, 0, false,
+                       false) == -1) {
+      goto Restore;
+    }
+  }
+
+  if (dest != virt) {
+    for (i = 0; i < oldsize; i += 4096) {
+      pt = ptes[i / 4096];
+      if (!(pt & PAGE_XD) && !(pt & PAGE_RSRV)) {
+        executable_code_was_made_non_executable = true;
+#ifndef DISABLE_JIT
+        if (!IsJitDisabled(&s->jit)) {
+          ResetJitPage(&s->jit, virt + i);
+        }
+#endif
+      }
+      if (HasLinearMapping()) {
+        pt = (pt & ~PAGE_TA) | (uintptr_t)ToHost(dest + i);
+      }
+      StorePte(GetPteAddress(s, dest + i, true), pt);
+    }
+    free(ptes);
+    MoveFileMaps(s, virt, oldsize, dest);
+    if (AddGap(&s->gaps, virt, virt + oldsize) ||
+        RemoveGap(&s->gaps, dest, dest + oldsize)) {
+      ERRF("mremap() crisis: ran out of memory for free range index");
+      PanicDueToMmap();
+    }
+    InvalidateSystem(s, virt, oldsize, true,
+                     executable_code_was_made_non_executable);
+  }
+
+  if (HasLinearMapping() && tail) {
+    // the kernel grew the host mapping, so describe it to the guest
+    pt = last & ~(PAGE_TA | PAGE_FILE | PAGE_LOCKS);
+    if ((last & PAGE_FILE) &&
+        (fm = GetFileMap(s, dest + oldsize - 4096)) &&
+        AddFileMap(s, dest + oldsize, tail, fm->path,
+                   fm->offset + (dest + oldsize - fm->virt))) {
+      pt |= PAGE_FILE;
+    }
+    for (i = oldsize; i < newsize; i += 4096) {
+      StorePte(GetPteAddress(s, dest + i, true),
+               pt | (uintptr_t)ToHost(dest + i));
+    }
+    if (RemoveGap(&s->gaps, dest + oldsize, dest + newsize)) {
+      ERRF("mremap() crisis: ran out of memory for free range index");
+      PanicDueToMmap();
+    }
+    s->memstat.committed += tail / 4096;
+    s->vss += tail / 4096;
+    s->rss += tail / 4096;
+  }
+
+#ifndef DISABLE_JIT
+  if (HasLinearMapping() && !IsJitDisabled(&s->jit)) {
+    ProtectRwxMemory(s, dest, dest, newsize, FLAG_pagesize, prot);
+  }
+#endif
+  return dest;
+
+Restore:
+  if (ptes) {
+    for (i = 0; i < oldsize; i += 4096) {
+      StorePte(GetPteAddress(s, virt + i, false), ptes[i / 4096]);
+    }
+    free(ptes);
+  }
+  return -1;
+}
+
 int GetProtection(u64 key) {
   int prot = 0;
   if (key & PAGE_U) prot |= PROT_READ;
@@ -1248,7 +1557,8 @@ FinishedCrawling:
       ProtectRwxMemory(s, rc, orig_virt, size, pagesize, prot);
     }
 #endif
-    InvalidateSystem(s, true, executable_code_was_made_non_executable);
+    InvalidateSystem(s, orig_virt, size, true,
+                     executable_code_was_made_non_executable);
   }
   return rc;
 MemoryDisappeared:
@@ -0,0 +1,83 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <math.h>
+
+#include "blink/fpu.h"
+#include "blink/machine.h"
+
+#ifdef MXCSR_NATIVE
+// rounding and denormal behavior is delegated to the host, but host
+// exceptions stay masked, since we don't deliver simd exceptions yet
+#define kMxcsrHost (kMxcsrRc | kMxcsrDaz | kMxcsrFtz)
+#define kMxcsrFlags \
+  (kMxcsrIe | kMxcsrDe | kMxcsrZe | kMxcsrOe | kMxcsrUe | kMxcsrPe)
+#endif
+
+/**
+ * Returns guest mxcsr, including flags raised by host operations.
+ */
+u32 GetMxcsr(struct Machine *m) {
+#ifdef MXCSR_NATIVE
+  u32 x;
+  asm volatile("stmxcsr\t%0" : "=m"(x));
+  m->mxcsr |= x & kMxcsrFlags;
+#endif
+  return m->mxcsr;
+}
+
+/**
+ * Changes guest mxcsr.
+ *
+ * On x86-64 hosts, the rounding mode, denormals-are-zero, and
+ * flush-to-zero bits are loaded into the host's mxcsr too, which then
+ * stays that way for as long as this thread runs the guest. That lets
+ * the interpreter and jit paths use plain host floating point ops.
+ */
+void SetMxcsr(struct Machine *m, u32 x) {
+  m->mxcsr = x;
+#ifdef MXCSR_NATIVE
+  x = (x & kMxcsrHost) | 0x1f80;
+  asm volatile("ldmxcsr\t%0" : /* no outputs */ : "m"(x));
+#endif
+}
+
+/**
+ * Rounds to nearest integer, ties to even, whatever the host mode is.
+ *
+ * We can't use rint() for this once the guest's rounding mode lives in
+ * the host mxcsr, because gcc inlines it as an add of 2⁵² which rounds
+ * in the current mode. The ieee remainder always rounds to nearest.
+ */
+double RoundEven(double x) {
+#ifdef MXCSR_NATIVE
+  if (!(fabs(x) < 0x1p52)) return x;
+  return copysign(x - remainder(x, 1), x);
+#else
+  return rint(x);
+#endif
+}
+
+float RoundEvenf(float x) {
+#ifdef MXCSR_NATIVE
+  if (!(fabsf(x) < 0x1p23f)) return x;
+  return copysignf(x - remainderf(x, 1), x);
+#else
+  return rintf(x);
+#endif
+}
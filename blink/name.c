@@ -186,13 +186,13 @@ const char *DescribeMopcode(int code) {
     XLAT(0x0A1, "OpMovRaxOvqp");
     XLAT(0x0A2, "OpMovObAl");
     XLAT(0x0A3, "OpMovOvqpRax");
-    XLAT(0x0A4, "OpMovsb");
+    XLAT(0x0A4, "OpMovs");
     XLAT(0x0A5, "OpMovs");
     XLAT(0x0A6, "OpCmps");
     XLAT(0x0A7, "OpCmps");
     XLAT(0x0A8, "OpTestAlIb");
     XLAT(0x0A9, "OpTestRaxIvds");
-    XLAT(0x0AA, "OpStosb");
+    XLAT(0x0AA, "OpStos");
     XLAT(0x0AB, "OpStos");
     XLAT(0x0AC, "OpLods");
     XLAT(0x0AD, "OpLods");
@@ -546,13 +546,65 @@ const char *DescribeMopcode(int code) {
     XLAT(0x209, "OpSsePsignw");
     XLAT(0x20A, "OpSsePsignd");
     XLAT(0x20B, "OpSsePmulhrsw");
+    XLAT(0x210, "OpSseBlendv");
+    XLAT(0x214, "OpSseBlendv");
+    XLAT(0x215, "OpSseBlendv");
+    XLAT(0x217, "OpSsePtest");
     XLAT(0x21c, "OpSsePabsb");
     XLAT(0x21d, "OpSsePabsw");
     XLAT(0x21e, "OpSsePabsd");
+    XLAT(0x220, "OpSsePmovx");
+    XLAT(0x221, "OpSsePmovx");
+    XLAT(0x222, "OpSsePmovx");
+    XLAT(0x223, "OpSsePmovx");
+    XLAT(0x224, "OpSsePmovx");
+    XLAT(0x225, "OpSsePmovx");
+    XLAT(0x228, "OpSsePmuldq");
+    XLAT(0x229, "OpSsePcmpeqq");
     XLAT(0x22a, "OpMovntdqaVdqMdq");
+    XLAT(0x22b, "OpSsePackusdw");
+    XLAT(0x230, "OpSsePmovx");
+    XLAT(0x231, "OpSsePmovx");
+    XLAT(0x232, "OpSsePmovx");
+    XLAT(0x233, "OpSsePmovx");
+    XLAT(0x234, "OpSsePmovx");
+    XLAT(0x235, "OpSsePmovx");
+    XLAT(0x237, "OpSsePcmpgtq");
+    XLAT(0x238, "OpSsePminsb");
+    XLAT(0x239, "OpSsePminsd");
+    XLAT(0x23a, "OpSsePminuw");
+    XLAT(0x23b, "OpSsePminud");
+    XLAT(0x23c, "OpSsePmaxsb");
+    XLAT(0x23d, "OpSsePmaxsd");
+    XLAT(0x23e, "OpSsePmaxuw");
+    XLAT(0x23f, "OpSsePmaxud");
     XLAT(0x240, "OpSsePmulld");
+    XLAT(0x241, "OpSsePhminposuw");
+    XLAT(0x2f0, "Op2f01");
+    XLAT(0x2f1, "Op2f01");
+    XLAT(0x308, "OpSseRound");
+    XLAT(0x309, "OpSseRound");
+    XLAT(0x30a, "OpSseRound");
+    XLAT(0x30b, "OpSseRound");
+    XLAT(0x30c, "OpSseBlend");
+    XLAT(0x30d, "OpSseBlend");
+    XLAT(0x30e, "OpSseBlend");
     XLAT(0x30f, "OpSsePalignr");
+    XLAT(0x314, "OpSsePextr");
+    XLAT(0x315, "OpSsePextr");
+    XLAT(0x316, "OpSsePextr");
+    XLAT(0x317, "OpSsePextr");
+    XLAT(0x320, "OpSsePinsr");
+    XLAT(0x321, "OpSseInsertps");
+    XLAT(0x322, "OpSsePinsr");
+    XLAT(0x340, "OpSseDp");
+    XLAT(0x341, "OpSseDp");
+    XLAT(0x342, "OpSseMpsadbw");
     XLAT(0x344, "OpSsePclmulqdq");
+    XLAT(0x360, "OpSsePcmpstr");
+    XLAT(0x361, "OpSsePcmpstr");
+    XLAT(0x362, "OpSsePcmpstr");
+    XLAT(0x363, "OpSsePcmpstr");
     default:
       return "UNKNOWN";
   }
@@ -127,7 +127,13 @@ static void InvlpgM(P) {
     ResetJitPage(&m->system->jit, virt);
   }
 #endif
-  InvalidateSystem(m->system, true, true);
+  InvalidateSystem(m->system, virt, 4096, true, true);
+}
+
+static void Xgetbv(P) {
+  if (Get32(m->cx)) ThrowProtectionFault(m);
+  Put64(m->ax, kXcr0);
+  Put64(m->dx, 0);
 }
 
 static void Smsw(P, bool ismem) {
@@ -189,13 +195,21 @@ void Op101(P) {
         }
       }
       break;
+#endif
     case 2:
       if (ismem) {
+#ifndef DISABLE_METAL
         LgdtMs(A);
-      } else {
+#else
         OpUdImpl(m);
+#endif
+      } else if (ModrmRm(rde) == 0) {
+        Xgetbv(A);
+      } else {
+        OpUdImpl(m);  // xsetbv is privileged
       }
       break;
+#ifndef DISABLE_METAL
     case 3:
       if (ismem) {
         LidtMs(A);
@@ -26,6 +26,7 @@
 #include "blink/builtin.h"
 #include "blink/debug.h"
 #include "blink/dis.h"
+#include "blink/endian.h"
 #include "blink/high.h"
 #include "blink/jit.h"
 #include "blink/log.h"
@@ -108,6 +109,12 @@ static const u8 kEnter[] = {
     0x48, 0x89, 0373,        // mov  %rdi,%rbx
 #endif
 };
+static const u8 kPoll[] = {
+    0x80, 0170 | kJitSav0,                      // cmpb $0x0,attention(%rbx)
+    offsetof(struct Machine, attention), 0x00,  //
+    0x74, 0x05,                                 // jz   +5 (skip jmp ender)
+};
+#define kPollJump 5  // jmp rel32
 static const u8 kLeave[] = {
     0x4c, 0x8b, 0175, 0xf8,  // mov -0x08(%rbp),%r15
     0x4c, 0x8b, 0165, 0xf0,  // mov -0x10(%rbp),%r14
@@ -132,6 +139,12 @@ static const u32 kEnter[] = {
     0xa90363f7,  // stp x23, x24, [sp, #48]
     0xaa0003f3,  // mov x19, x0
 };
+static const u32 kPoll[] = {
+    // ldrb w16, [x19, #attention]
+    0x39400010 | offsetof(struct Machine, attention) << 10 | kJitSav0 << 5,
+    0x34000010 | (8 / 4) << 5,  // cbz w16, #8 (skip b ender)
+};
+#define kPollJump 4  // b imm26
 static const u32 kLeave[] = {
     0xa94153f3,  // ldp x19, x20, [sp, #16]
     0xa9425bf5,  // ldp x21, x22, [sp, #32]
@@ -141,7 +154,29 @@ static const u32 kLeave[] = {
 #endif /* __x86_64__ */
 #endif /* HAVE_JIT */
 
+/**
+ * Returns number of bytes jumps between paths should skip over.
+ *
+ * Every path begins with a prologue that sets up its stack frame, and
+ * then polls `m->attention`, in which case it'll drop back into the main
+ * interpreter loop. Paths that are linked together without forming a
+ * cycle will skip over both.
+ */
 long GetPrologueSize(void) {
+#ifdef HAVE_JIT
+  return sizeof(kEnter) + sizeof(kPoll) + kPollJump;
+#else
+  return 0;
+#endif
+}
+
+/**
+ * Returns offset of attention poll in path prologue.
+ *
+ * Jumps that form a cycle of paths need to land here, so signals and
+ * thread termination may still be noticed by the main interpreter loop.
+ */
+long GetPollOffset(void) {
 #ifdef HAVE_JIT
   return sizeof(kEnter);
 #else
@@ -207,6 +242,7 @@ void FlushCod(struct JitBlock *jb) {
   char b[256];
   char spec[64];
   if (!g_cod) return;
+  LowerJitIr(jb);
   if (jb->index == jb->blocksize + 1) {
     WriteCod("/\tOOM!\n");
     jb->cod = jb->index;
@@ -224,7 +260,25 @@ void FlushCod(struct JitBlock *jb) {
 #endif
 }
 
+static bool IsPureVex(u64 rde) {
+#ifdef DISABLE_AVX
+  return false;
+#endif
+  switch (Mopcode(rde)) {
+    case 0x296 ... 0x29F:  // OpVfma
+    case 0x2A6 ... 0x2AF:  // OpVfma
+    case 0x2B6 ... 0x2BF:  // OpVfma
+      return Osz(rde) && IsModrmRegister(rde);
+    case 0x213:  // OpVcvtph2ps
+    case 0x31D:  // OpVcvtps2ph
+      return Osz(rde) && !Rexw(rde) && IsModrmRegister(rde);
+    default:
+      return false;
+  }
+}
+
 static bool IsPure(u64 rde) {
+  if (Vex(rde)) return IsPureVex(rde);
   switch (Mopcode(rde)) {
     case 0x004:  // OpAluAlIbAdd
     case 0x005:  // OpAluRaxIvds
@@ -524,7 +578,7 @@ static bool MustUpdateIp(P) {
   return false;
 }
 
-static void InitPaths(struct System *s) {
+void InitPaths(struct System *s) {
 #ifdef HAVE_JIT
   struct JitBlock *jb;
   if (!s->ender) {
@@ -543,17 +597,119 @@ static void InitPaths(struct System *s) {
 #endif
 }
 
+// tier-0 profiling, which counts how many times the interpreter runs
+// an address, so that only code which has been executed at least the
+// threshold number of times gets promoted to a jit path. one-shot code
+// such as initializers won't evict hot paths from jit memory this way.
+static u8 *GetHits(struct Machine *m, i64 pc) {
+  u64 h = (u64)pc * 0x9e3779b97f4a7c15;
+  return m->path.hits + (h >> (64 - kJitHitsBits));
+}
+
+static bool IsHot(struct Machine *m, i64 pc) {
+  u8 *hits;
+  int threshold;
+  if ((threshold = MIN(FLAG_jitthreshold, 255)) <= 1) return true;
+  hits = GetHits(m, pc);
+  if (++*hits < threshold) {
+    STATISTIC(++path_bypassed);
+    return false;
+  }
+  STATISTIC(++path_promoted);
+  *hits = threshold - 1;
+  return true;
+}
+
+/**
+ * Lets address be promoted to jit path the next time it's interpreted.
+ *
+ * This is used when a path exits to an address with a lazy jump fixup,
+ * since being reached by hot code means it's probably hot too, and its
+ * fixup only lives until some number of other paths get installed.
+ */
+void WarmPath(struct Machine *m, i64 pc) {
+  u8 *hits;
+  int threshold;
+  if ((threshold = MIN(FLAG_jitthreshold, 255)) <= 1) return;
+  hits = GetHits(m, pc);
+  *hits = MAX(*hits, threshold - 1);
+}
+
+static unsigned GetJitTargetGen(struct Machine *m) {
+  return atomic_load_explicit(&m->system->jit.pagegen, memory_order_acquire);
+}
+
+static struct JitTarget *GetJitTarget(struct Machine *m, i64 virt) {
+  u64 h = (u64)virt * 0x9e3779b97f4a7c15;
+  return m->ibtc + (h >> (64 - kJitIbtcBits));
+}
+
+// remembers jit path for guest address in indirect branch target cache
+// where `gen` must have been loaded before the hook was looked up, so a
+// page reset that happens in between leaves the entry looking stale
+static void AddJitTarget(struct Machine *m, i64 virt, uintptr_t func,
+                         unsigned gen) {
+  struct JitTarget *t;
+  if (gen != m->targetgen) {
+    memset(m->ras, 0, sizeof(m->ras));
+    memset(m->ibtc, 0, sizeof(m->ibtc));
+    m->targetgen = gen;
+  }
+  t = GetJitTarget(m, virt);
+  t->virt = virt;
+  t->code = func + GetPrologueSize();
+  STATISTIC(++jit_ibtc_fills);
+}
+
+/**
+ * Returns jit code for `m->ip` after an indirect branch, or zero.
+ *
+ * This is called by generated code when its inline lookup of the return
+ * address stack and indirect branch target cache misses. The path for
+ * `m->ip` is looked up in the jit hooks, and then added to the cache so
+ * the inline lookup can find it next time. Zero is returned if the main
+ * interpreter loop should be used instead, which is always the case when
+ * attention is needed, because paths that are linked by indirect
+ * branches may form cycles. Cached targets are dropped wholesale
+ * whenever the jit resets a page or retires its memory blocks.
+ */
+uintptr_t LookupJitTarget(struct Machine *m) {
+  unsigned gen;
+  uintptr_t func;
+  STATISTIC(++jit_ibtc_misses);
+  if (atomic_load_explicit(&m->attention, memory_order_relaxed)) return 0;
+  if ((gen = GetJitTargetGen(m)) & 1) return 0;  // hooks are changing
+  if (IsJitDisabled(&m->system->jit)) return 0;
+  if (!(func = GetJitHook(&m->system->jit, m->ip))) return 0;
+  if (func == (uintptr_t)JitlessDispatch) return 0;
+  AddJitTarget(m, m->ip, func, gen);
+  TouchJit(func);
+  return func + GetPrologueSize();
+}
+
+/**
+ * Pushes return address of call instruction onto return address stack.
+ */
+void PushJitTarget(struct Machine *m, i64 virt) {
+  struct JitTarget *t, *r;
+  r = m->ras + (m->rastop++ & (kJitRasSize - 1));
+  t = GetJitTarget(m, virt);
+  r->virt = virt;
+  r->code = t->virt == virt ? t->code : 0;
+}
+
 bool CreatePath(P) {
 #ifdef HAVE_JIT
   bool res;
   i64 pc, jpc;
+  _Static_assert(offsetof(struct Machine, attention) < 128, "");
   unassert(!IsMakingPath(m));
   InitPaths(m->system);
   if (m->path.skip > 0) {
     --m->path.skip;
     return false;
   }
-  if ((pc = GetPc(m))) {
+  if ((pc = GetPc(m)) && IsHot(m, pc)) {
     if ((m->path.jb = StartJit(&m->system->jit, pc))) {
       JIP_LOGF("starting new path jit_pc:%" PRIxPTR " at pc:%" PRIx64,
                GetJitPc(m->path.jb), pc);
@@ -561,6 +717,8 @@ bool CreatePath(P) {
       jpc = (uintptr_t)m->path.jb->addr + m->path.jb->index;
       (void)jpc;
       AppendJit(m->path.jb, kEnter, sizeof(kEnter));
+      AppendJit(m->path.jb, kPoll, sizeof(kPoll));
+      AppendJitJump(m->path.jb, (void *)m->system->ender);
 #if LOG_JIX
       Jitter(A,
              "a1i"  // arg1 = ip
@@ -572,7 +730,10 @@ bool CreatePath(P) {
       WriteCod("\nJit_%" PRIx64 "_%" PRIx64 ":\n", pc, jpc);
       FlushCod(m->path.jb);
       m->path.start = pc;
+      m->path.end = pc;
+      m->path.exits = 0;
       m->path.elements = 0;
+      ResetPinnedRegs(m);
       res = true;
     } else {
       res = false;
@@ -595,12 +756,17 @@ void CompletePath(P) {
 
 void FinishPath(struct Machine *m) {
   unassert(IsMakingPath(m));
+  LowerJitIr(m->path.jb);
   FlushCod(m->path.jb);
   STATISTIC(path_longest_bytes =
                 MAX(path_longest_bytes, m->path.jb->index - m->path.jb->start));
   STATISTIC(path_longest = MAX(path_longest, m->path.elements));
   STATISTIC(AVERAGE(path_average_elements, m->path.elements));
+  STATISTIC(AVERAGE(path_average_blocks, m->path.exits + 1));
   STATISTIC(AVERAGE(path_average_bytes, m->path.jb->index - m->path.jb->start));
+  if (FLAG_jitcache) {
+    SaveJitPath(m);
+  }
   if (FinishJit(&m->system->jit, m->path.jb)) {
     STATISTIC(++path_count);
     JIP_LOGF("staged path to %" PRIx64, m->path.start);
@@ -611,6 +777,64 @@ void FinishPath(struct Machine *m) {
   m->path.jb = 0;
 }
 
+/**
+ * Returns true if path should keep going past a conditional branch.
+ *
+ * Paths are grown into traces that follow whichever direction the
+ * branch took while it was being recorded, and the other direction
+ * becomes a side exit. We only follow branches that go forward on the
+ * same page, so a trace can never revisit itself, and we stop if the
+ * destination already has a hook, since jumping there is cheaper.
+ *
+ * @param from is address of instruction after the branch
+ * @param to is address the branch went while being recorded
+ */
+bool CanExtendPath(P, i64 from, i64 to) {
+  return to >= from &&                               //
+         (to & -4096) == (m->path.start & -4096) &&  //
+         m->path.exits < kJitMaxSideExits &&         //
+         !GetJitHook(&m->system->jit, to);
+}
+
+/**
+ * Records that path has continued past a conditional branch.
+ */
+void ExtendPath(struct Machine *m) {
+  unassert(IsMakingPath(m));
+  JIP_LOGF("extending path starting at %" PRIx64 " past branch",
+           m->path.start);
+  STATISTIC(++path_side_exits);
+  ++m->path.exits;
+}
+
+/**
+ * Points short forward branch ending at `end` to the current position.
+ *
+ * This is used for conditional branches that skip over a side exit,
+ * whose length isn't known until after it's been generated.
+ */
+void FixupSideExit(struct JitBlock *jb, long end) {
+  long delta;
+  LowerJitIr(jb);
+  // if the block ran out of room then the branch might not exist, in
+  // which case `end` could point past the block, into somebody else's
+  // code, and the path is going to be discarded by FinishJit() anyway
+  if (jb->index > kJitBlockSize) return;
+  delta = jb->index - end;
+#if defined(__x86_64__)
+  unassert(0 <= delta && delta <= 127);  // jcc rel8
+  jb->addr[end - 1] = delta;
+#elif defined(__aarch64__)
+  u32 insn;
+  delta += 4;  // b.cc, cbz, and cbnz are relative to themselves
+  unassert(0 <= delta && delta < (1 << 20));
+  insn = Get32(jb->addr + end - 4);
+  insn &= ~(0x7ffff << 5);
+  insn |= (delta / 4) << 5;
+  Put32(jb->addr + end - 4, insn);
+#endif
+}
+
 void AbandonPath(struct Machine *m) {
   WriteCod("/\tABANDONED\n");
   unassert(IsMakingPath(m));
@@ -639,12 +863,14 @@ void AddPath_StartOp(P) {
   Jitter(A, "qmq", LogCpu);
 #endif
   BeginCod(m, GetPc(m));
+  m->path.end = MAX(m->path.end, GetPc(m) + Oplength(rde));
 #ifndef NDEBUG
   if (FLAG_statistics) {
     Jitter(A,
            "a0i"  // arg0 = &instructions_jitted
            "m",   // call micro-op (CountOp)
            &instructions_jitted, CountOp);
+    m->path.jb->unportable = true;  // host pointer baked into the code
   }
 #endif
   if (AddPath_StartOp_Hook) {
@@ -687,6 +913,7 @@ void AddPath_StartOp(P) {
     m->path.skew += Oplength(rde);
   }
   AppendJitMovReg(m->path.jb, kJitArg0, kJitSav0);
+  ReleaseScratchRegs(m);
   m->reserving = false;
 }
 
@@ -731,6 +958,7 @@ void AddPath_EndOp(P) {
          "c",   // call function (EndOp)
          m->ip, EndOp);
 #endif
+  ReleaseScratchRegs(m);
   FlushCod(m->path.jb);
 }
 
@@ -741,7 +969,7 @@ bool AddPath(P) {
          "a2i"  // arg2 = disp
          "a1i"  // arg1 = rde
          "c",   // call function
-         uimm0, disp, rde, GetOp(Mopcode(rde)));
+         uimm0, disp, rde, GetOp(rde));
   return true;
 }
 
@@ -42,6 +42,7 @@
 #define Rep(x)      ((x & 00000300000000000000000) >> 063)
 #define WordLog2(x) ((x & 00030000000000000000000) >> 071)
 #define Vreg(x)     ((x & 01700000000000000000000) >> 074)
+#define Vex(x)      ((x & 00040000000000000000000) >> 073)
 
 #define Bite(x)     (~ModrmSrm(x) & 1)
 #define RexbBase(x) (Rexb(x) << 3 | SibBase(x))
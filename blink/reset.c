@@ -20,7 +20,9 @@
 #include <string.h>
 
 #include "blink/flags.h"
+#include "blink/fpu.h"
 #include "blink/machine.h"
+#include "blink/macros.h"
 #include "blink/stats.h"
 
 #define LDBL 3
@@ -35,8 +37,8 @@ static void ResetFpu(struct Machine *m) {
   m->fpu.sw = 0;
   m->fpu.tw = -1;
 #endif
-  // We diverge from System V ABI here since we don't have long double
-  // support yet. We only support double precision when using x87 fpu.
+  // We diverge from System V ABI here on hosts that don't have an 80-bit
+  // long double, since we only support double precision on those.
   //
   //	8087 FPU Control Word
   //	 IM: Invalid Operation ───────────────┐
@@ -52,7 +54,11 @@ static void ResetFpu(struct Machine *m) {
   //	                           ┌┤││  ││││││
   //	                          d││││rr││││││
   //          0b0000000000000000000001001111111
+#ifdef X87_NATIVE
+  m->fpu.cw = 0x037f;
+#else
   m->fpu.cw = 0x027f;
+#endif
 }
 
 static void ResetSse(struct Machine *m) {
@@ -76,8 +82,9 @@ static void ResetSse(struct Machine *m) {
   //           ┌───────────────┐│││││││││││││││
   //           │   reserved    ││││││││││││││││
   //         0b00000000000000000001111110000000
-  m->mxcsr = 0x1f80;
+  SetMxcsr(m, 0x1f80);
   memset(m->xmm, 0, sizeof(m->xmm));
+  memset(m->ymmh, 0, sizeof(m->ymmh));
 }
 
 void ResetCpu(struct Machine *m) {
@@ -97,11 +104,20 @@ void ResetCpu(struct Machine *m) {
   memset(&m->freelist, 0, sizeof(m->freelist));
   ResetSse(m);
   ResetFpu(m);
+  ResetTlb(m);
 }
 
 void ResetTlb(struct Machine *m) {
+  int i, j;
   STATISTIC(++tlb_resets);
   memset(m->tlb, 0, sizeof(m->tlb));
+  memset(m->hugetlb, 0, sizeof(m->hugetlb));
+  for (i = 0; i < ARRAYLEN(m->itlb); ++i) {
+    for (j = 0; j < ARRAYLEN(m->itlb[i]); ++j) {
+      m->itlb[i][j].tag = kInlineTlbEmpty;
+      m->itlb[i][j].delta = 0;
+    }
+  }
   m->opcache->codevirt = 0;
   m->opcache->codehost = 0;
 }
@@ -0,0 +1,256 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <string.h>
+
+#include "blink/endian.h"
+#include "blink/intrin.h"
+#include "blink/machine.h"
+#include "blink/modrm.h"
+#include "blink/rde.h"
+#include "blink/sse.h"
+
+// the sha instructions view an xmm register as four dwords, where the
+// highest dword holds the first word of state, e.g. A for sha1rnds4
+
+#define W(p, i) Get32((p) + (3 - (i)) * 4)
+
+static u32 Rol32(u32 x, int k) {
+  return x << k | x >> (32 - k);
+}
+
+static u32 Ror32(u32 x, int k) {
+  return x >> k | x << (32 - k);
+}
+
+static void PutW(u8 x[16], u32 a, u32 b, u32 c, u32 d) {
+  Put32(x + 12, a);
+  Put32(x + 8, b);
+  Put32(x + 4, c);
+  Put32(x + 0, d);
+}
+
+#if X86_INTRINSICS
+#define SHA_HOST(INSN, x, y)                \
+  if (X86_HAVE(Sha)) {                      \
+    char_xmmu_t a, b;                       \
+    memcpy(&a, x, 16);                      \
+    memcpy(&b, y, 16);                      \
+    asm(INSN "\t%1,%0" : "+x"(a) : "x"(b)); \
+    memcpy(x, &a, 16);                      \
+    return;                                 \
+  }
+#else
+#define SHA_HOST(INSN, x, y)
+#endif
+
+static void SseSha1nexte(u8 x[16], const u8 y[16]) {
+  SHA_HOST("sha1nexte", x, y);
+  PutW(x, W(y, 0) + Rol32(W(x, 0), 30), W(y, 1), W(y, 2), W(y, 3));
+}
+
+static void SseSha1msg1(u8 x[16], const u8 y[16]) {
+  SHA_HOST("sha1msg1", x, y);
+  PutW(x, W(x, 2) ^ W(x, 0), W(x, 3) ^ W(x, 1), W(y, 0) ^ W(x, 2),
+       W(y, 1) ^ W(x, 3));
+}
+
+static void SseSha1msg2(u8 x[16], const u8 y[16]) {
+  u32 w16, w17, w18, w19;
+  SHA_HOST("sha1msg2", x, y);
+  w16 = Rol32(W(x, 0) ^ W(y, 1), 1);
+  w17 = Rol32(W(x, 1) ^ W(y, 2), 1);
+  w18 = Rol32(W(x, 2) ^ W(y, 3), 1);
+  w19 = Rol32(W(x, 3) ^ w16, 1);
+  PutW(x, w16, w17, w18, w19);
+}
+
+static u32 Sha256s0(u32 w) {
+  return Ror32(w, 7) ^ Ror32(w, 18) ^ w >> 3;
+}
+
+static u32 Sha256s1(u32 w) {
+  return Ror32(w, 17) ^ Ror32(w, 19) ^ w >> 10;
+}
+
+static void SseSha256msg1(u8 x[16], const u8 y[16]) {
+  SHA_HOST("sha256msg1", x, y);
+  PutW(x, W(x, 0) + Sha256s0(W(y, 3)), W(x, 1) + Sha256s0(W(x, 0)),
+       W(x, 2) + Sha256s0(W(x, 1)), W(x, 3) + Sha256s0(W(x, 2)));
+}
+
+static void SseSha256msg2(u8 x[16], const u8 y[16]) {
+  u32 w16, w17, w18, w19;
+  SHA_HOST("sha256msg2", x, y);
+  w16 = W(x, 3) + Sha256s1(W(y, 1));
+  w17 = W(x, 2) + Sha256s1(W(y, 0));
+  w18 = W(x, 1) + Sha256s1(w16);
+  w19 = W(x, 0) + Sha256s1(w17);
+  PutW(x, w19, w18, w17, w16);
+}
+
+static void Sha1rnds4(u8 x[16], const u8 y[16], unsigned imm) {
+  int i;
+  u32 a, b, c, d, e, f, k, t;
+#if X86_INTRINSICS
+  if (X86_HAVE(Sha)) {
+    char_xmmu_t p, q;
+    memcpy(&p, x, 16);
+    memcpy(&q, y, 16);
+    switch (imm & 3) {
+      case 0:
+        asm("sha1rnds4\t$0,%1,%0" : "+x"(p) : "x"(q));
+        break;
+      case 1:
+        asm("sha1rnds4\t$1,%1,%0" : "+x"(p) : "x"(q));
+        break;
+      case 2:
+        asm("sha1rnds4\t$2,%1,%0" : "+x"(p) : "x"(q));
+        break;
+      case 3:
+        asm("sha1rnds4\t$3,%1,%0" : "+x"(p) : "x"(q));
+        break;
+      default:
+        __builtin_unreachable();
+    }
+    memcpy(x, &p, 16);
+    return;
+  }
+#endif
+  a = W(x, 0);
+  b = W(x, 1);
+  c = W(x, 2);
+  d = W(x, 3);
+  e = 0;
+  for (i = 0; i < 4; ++i) {
+    switch (imm & 3) {
+      case 0:
+        f = (b & c) ^ (~b & d);
+        k = 0x5a827999;
+        break;
+      case 1:
+        f = b ^ c ^ d;
+        k = 0x6ed9eba1;
+        break;
+      case 2:
+        f = (b & c) ^ (b & d) ^ (c & d);
+        k = 0x8f1bbcdc;
+        break;
+      case 3:
+        f = b ^ c ^ d;
+        k = 0xca62c1d6;
+        break;
+      default:
+        __builtin_unreachable();
+    }
+    t = f + Rol32(a, 5) + W(y, i) + e + k;
+    e = d;
+    d = c;
+    c = Rol32(b, 30);
+    b = a;
+    a = t;
+  }
+  PutW(x, a, b, c, d);
+}
+
+static void Sha256rnds2(u8 x[16], const u8 y[16], const u8 wk[16]) {
+  int i;
+  u32 a, b, c, d, e, f, g, h, t, ch, maj;
+#if X86_INTRINSICS
+  if (X86_HAVE(Sha)) {
+    char_xmmu_t p, q, r;
+    memcpy(&p, x, 16);
+    memcpy(&q, y, 16);
+    memcpy(&r, wk, 16);
+    asm("sha256rnds2\t%2,%1,%0" : "+x"(p) : "x"(q), "Yz"(r));
+    memcpy(x, &p, 16);
+    return;
+  }
+#endif
+  a = W(y, 0);
+  b = W(y, 1);
+  c = W(x, 0);
+  d = W(x, 1);
+  e = W(y, 2);
+  f = W(y, 3);
+  g = W(x, 2);
+  h = W(x, 3);
+  for (i = 0; i < 2; ++i) {
+    ch = (e & f) ^ (~e & g);
+    maj = (a & b) ^ (a & c) ^ (b & c);
+    t = ch + (Ror32(e, 6) ^ Ror32(e, 11) ^ Ror32(e, 25)) + Get32(wk + i * 4) +
+        h;
+    h = g;
+    g = f;
+    f = e;
+    e = t + d;
+    d = c;
+    c = b;
+    b = a;
+    a = t + maj + (Ror32(a, 2) ^ Ror32(a, 13) ^ Ror32(a, 22));
+  }
+  PutW(x, a, b, e, f);
+}
+
+static void OpSha(P, void kernel(u8[16], const u8[16])) {
+  if (Osz(rde) || Rep(rde)) OpUdImpl(m);
+  kernel(XmmRexrReg(m, rde), GetXmmAddress(A));
+  if (IsMakingPath(m)) {
+#if defined(HAVE_JIT) && defined(__x86_64__)
+    if (X86_HAVE(Sha) && JitSse(A)) return;
+#endif
+    Jitter(A,
+           "z4P"    // res0 = GetXmmOrMemPointer(RexbRm)
+           "r0s1="  // sav1 = res0
+           "z4Q"    // res0 = GetXmmPointer(RexrReg)
+           "s1a1="  // arg1 = sav1
+           "t"      // arg0 = res0
+           "c",     // call function
+           kernel);
+  }
+}
+
+void OpSha1nexte(P) {
+  OpSha(A, SseSha1nexte);
+}
+
+void OpSha1msg1(P) {
+  OpSha(A, SseSha1msg1);
+}
+
+void OpSha1msg2(P) {
+  OpSha(A, SseSha1msg2);
+}
+
+void OpSha256msg1(P) {
+  OpSha(A, SseSha256msg1);
+}
+
+void OpSha256msg2(P) {
+  OpSha(A, SseSha256msg2);
+}
+
+void OpSha256rnds2(P) {
+  if (Osz(rde) || Rep(rde)) OpUdImpl(m);
+  Sha256rnds2(XmmRexrReg(m, rde), GetXmmAddress(A), m->xmm[0]);
+}
+
+void OpSha1rnds4(P) {
+  if (Osz(rde) || Rep(rde)) OpUdImpl(m);
+  Sha1rnds4(XmmRexrReg(m, rde), GetXmmAddress(A), uimm0);
+}
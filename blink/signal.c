@@ -25,6 +25,7 @@
 #include "blink/atomic.h"
 #include "blink/bitscan.h"
 #include "blink/endian.h"
+#include "blink/fpu.h"
 #include "blink/ldbl.h"
 #include "blink/linux.h"
 #include "blink/log.h"
@@ -40,6 +41,7 @@ struct SignalFrame {
   struct siginfo_linux si;
   struct ucontext_linux uc;
   struct fpstate_linux fp;
+  struct xstate_linux xs;
 };
 
 bool IsSignalIgnoredByDefault(int sig) {
@@ -104,7 +106,7 @@ void DeliverSignal(struct Machine *m, int sig, int code) {
   Write16(sf.fp.cwd, m->fpu.cw);
 #ifndef DISABLE_X87
   Write16(sf.fp.swd, m->fpu.sw);
-  Write16(sf.fp.ftw, m->fpu.tw);
+  Write16(sf.fp.ftw, FpuGetAbridgedTags(m));
   Write16(sf.fp.fop, m->fpu.op);
   Write64(sf.fp.rip, m->fpu.ip);
   Write64(sf.fp.rdp, m->fpu.dp);
@@ -115,7 +117,19 @@ void DeliverSignal(struct Machine *m, int sig, int code) {
     }
   }
 #endif
+  Write32(sf.fp.mxcsr, GetMxcsr(m));
   memcpy(sf.fp.xmm, m->xmm, sizeof(sf.fp.xmm));
+  if (kXcr0 & 4) {
+    Write32(sf.fp.sw_magic1, FP_XSTATE_MAGIC1_LINUX);
+    Write32(sf.fp.sw_extended_size,
+            sizeof(sf.fp) + offsetof(struct xstate_linux, magic2) + 4);
+    Write64(sf.fp.sw_xfeatures, kXcr0);
+    Write32(sf.fp.sw_xstate_size,
+            sizeof(sf.fp) + offsetof(struct xstate_linux, magic2));
+    Write64(sf.xs.xfeatures, kXcr0);
+    memcpy(sf.xs.ymmh, m->ymmh, sizeof(sf.xs.ymmh));
+    Write32(sf.xs.magic2, FP_XSTATE_MAGIC2_LINUX);
+  }
   // set the thread signal mask to the one specified by the signal
   // handler. by default, the signal being delivered will be added
   // within the mask unless the guest program specifies SA_NODEFER
@@ -143,6 +157,7 @@ void DeliverSignal(struct Machine *m, int sig, int code) {
   // these values to edit the program's non-signal handler cpu state
   _Static_assert(!(sizeof(struct siginfo_linux) & 15), "");
   _Static_assert(!(sizeof(struct fpstate_linux) & 15), "");
+  _Static_assert(!(sizeof(struct xstate_linux) & 15), "");
   _Static_assert(!(sizeof(struct ucontext_linux) & 15), "");
   _Static_assert((sizeof(struct SignalFrame) & 15) == 8, "");
   sp = ROUNDDOWN(sp, 16);
@@ -201,7 +216,7 @@ void SigRestore(struct Machine *m) {
   memcpy(m->sp, sf.uc.rsp, 8);
 #ifndef DISABLE_X87
   m->fpu.sw = Read16(sf.fp.swd);
-  m->fpu.tw = Read16(sf.fp.ftw);
+  FpuSetAbridgedTags(m, Read16(sf.fp.ftw));
   m->fpu.op = Read16(sf.fp.fop);
   m->fpu.ip = Read64(sf.fp.rip);
   m->fpu.dp = Read64(sf.fp.rdp);
@@ -212,7 +227,14 @@ void SigRestore(struct Machine *m) {
     }
   }
 #endif
+  SetMxcsr(m, Read32(sf.fp.mxcsr));
   memcpy(m->xmm, sf.fp.xmm, sizeof(sf.fp.xmm));
+  if (Read32(sf.fp.sw_magic1) == FP_XSTATE_MAGIC1_LINUX &&
+      (Read64(sf.xs.xfeatures) & 4)) {
+    memcpy(m->ymmh, sf.xs.ymmh, sizeof(sf.xs.ymmh));
+  } else {
+    memset(m->ymmh, 0, sizeof(m->ymmh));
+  }
   m->restored = true;
   atomic_store_explicit(&m->attention, true, memory_order_release);
 }
@@ -16,15 +16,20 @@
 │ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
 │ PERFORMANCE OF THIS SOFTWARE.                                                │
 ╚─────────────────────────────────────────────────────────────────────────────*/
+#include <stddef.h>
 #include <string.h>
 
+#include "blink/assert.h"
+#include "blink/avx.h"
 #include "blink/case.h"
 #include "blink/endian.h"
 #include "blink/intrin.h"
+#include "blink/jit.h"
 #include "blink/likely.h"
 #include "blink/machine.h"
 #include "blink/macros.h"
 #include "blink/sse.h"
+#include "blink/stats.h"
 
 static void MmxPaddusb(u8 x[8], const u8 y[8]) {
   unsigned i;
@@ -1422,6 +1427,12 @@ static void NoMmxK(u8 x[8], unsigned k) {
 
 static void OpPsb(P, void MmxKernel(u8[8], unsigned),
                   void SseKernel(u8[16], unsigned)) {
+#ifndef DISABLE_AVX
+  if (Vex(rde)) {
+    OpAvxShift(A, SseKernel);
+    return;
+  }
+#endif
   if (Osz(rde)) {
     SseKernel(XmmRexbRm(m, rde), uimm0);
   } else {
@@ -1481,6 +1492,12 @@ optimizesize void Op173(P) {
 }
 
 void OpSsePalignr(P) {
+#ifndef DISABLE_AVX
+  if (Vex(rde)) {
+    OpAvxImm(A, SsePalignr);
+    return;
+  }
+#endif
   if (Osz(rde)) {
     SsePalignr(XmmRexrReg(m, rde), GetModrmRegisterXmmPointerRead16(A), uimm0);
   } else {
@@ -1492,8 +1509,172 @@ void OpSsePalignr(P) {
   }
 }
 
+#ifdef HAVE_JIT
+#ifdef __aarch64__
+// neon instructions that compute v0 = v0 op v1 like the sse operation
+static const struct SseNeon {
+  u16 mop;
+  u32 ins;
+} kSseNeon[] = {
+    {0x164, 0x4e213400},  // cmgt   v0.16b,v0.16b,v1.16b
+    {0x165, 0x4e613400},  // cmgt   v0.8h,v0.8h,v1.8h
+    {0x166, 0x4ea13400},  // cmgt   v0.4s,v0.4s,v1.4s
+    {0x174, 0x6e218c00},  // cmeq   v0.16b,v0.16b,v1.16b
+    {0x175, 0x6e618c00},  // cmeq   v0.8h,v0.8h,v1.8h
+    {0x176, 0x6ea18c00},  // cmeq   v0.4s,v0.4s,v1.4s
+    {0x1D4, 0x4ee18400},  // add    v0.2d,v0.2d,v1.2d
+    {0x1D5, 0x4e619c00},  // mul    v0.8h,v0.8h,v1.8h
+    {0x1D8, 0x6e212c00},  // uqsub  v0.16b,v0.16b,v1.16b
+    {0x1D9, 0x6e612c00},  // uqsub  v0.8h,v0.8h,v1.8h
+    {0x1DA, 0x6e216c00},  // umin   v0.16b,v0.16b,v1.16b
+    {0x1DB, 0x4e211c00},  // and    v0.16b,v0.16b,v1.16b
+    {0x1DC, 0x6e210c00},  // uqadd  v0.16b,v0.16b,v1.16b
+    {0x1DD, 0x6e610c00},  // uqadd  v0.8h,v0.8h,v1.8h
+    {0x1DE, 0x6e216400},  // umax   v0.16b,v0.16b,v1.16b
+    {0x1DF, 0x4e601c20},  // bic    v0.16b,v1.16b,v0.16b
+    {0x1E0, 0x6e211400},  // urhadd v0.16b,v0.16b,v1.16b
+    {0x1E3, 0x6e611400},  // urhadd v0.8h,v0.8h,v1.8h
+    {0x1E8, 0x4e212c00},  // sqsub  v0.16b,v0.16b,v1.16b
+    {0x1E9, 0x4e612c00},  // sqsub  v0.8h,v0.8h,v1.8h
+    {0x1EA, 0x4e616c00},  // smin   v0.8h,v0.8h,v1.8h
+    {0x1EB, 0x4ea11c00},  // orr    v0.16b,v0.16b,v1.16b
+    {0x1EC, 0x4e210c00},  // sqadd  v0.16b,v0.16b,v1.16b
+    {0x1ED, 0x4e610c00},  // sqadd  v0.8h,v0.8h,v1.8h
+    {0x1EE, 0x4e616400},  // smax   v0.8h,v0.8h,v1.8h
+    {0x1EF, 0x6e211c00},  // eor    v0.16b,v0.16b,v1.16b
+    {0x1F8, 0x6e218400},  // sub    v0.16b,v0.16b,v1.16b
+    {0x1F9, 0x6e618400},  // sub    v0.8h,v0.8h,v1.8h
+    {0x1FA, 0x6ea18400},  // sub    v0.4s,v0.4s,v1.4s
+    {0x1FB, 0x6ee18400},  // sub    v0.2d,v0.2d,v1.2d
+    {0x1FC, 0x4e218400},  // add    v0.16b,v0.16b,v1.16b
+    {0x1FD, 0x4e618400},  // add    v0.8h,v0.8h,v1.8h
+    {0x1FE, 0x4ea18400},  // add    v0.4s,v0.4s,v1.4s
+    {0x21C, 0x4e20b820},  // abs    v0.16b,v1.16b
+    {0x21D, 0x4e60b820},  // abs    v0.8h,v1.8h
+    {0x21E, 0x4ea0b820},  // abs    v0.4s,v1.4s
+    {0x229, 0x6ee18c00},  // cmeq   v0.2d,v0.2d,v1.2d
+    {0x237, 0x4ee13400},  // cmgt   v0.2d,v0.2d,v1.2d
+    {0x238, 0x4e216c00},  // smin   v0.16b,v0.16b,v1.16b
+    {0x239, 0x4ea16c00},  // smin   v0.4s,v0.4s,v1.4s
+    {0x23A, 0x6e616c00},  // umin   v0.8h,v0.8h,v1.8h
+    {0x23B, 0x6ea16c00},  // umin   v0.4s,v0.4s,v1.4s
+    {0x23C, 0x4e216400},  // smax   v0.16b,v0.16b,v1.16b
+    {0x23D, 0x4ea16400},  // smax   v0.4s,v0.4s,v1.4s
+    {0x23E, 0x6e616400},  // umax   v0.8h,v0.8h,v1.8h
+    {0x23F, 0x6ea16400},  // umax   v0.4s,v0.4s,v1.4s
+    {0x240, 0x4ea19c00},  // mul    v0.4s,v0.4s,v1.4s
+    {0x158, 0x4e21d400},  // fadd   v0.4s,v0.4s,v1.4s
+    {0x159, 0x6e21dc00},  // fmul   v0.4s,v0.4s,v1.4s
+    {0x15C, 0x4ea1d400},  // fsub   v0.4s,v0.4s,v1.4s
+    {0x15E, 0x6e21fc00},  // fdiv   v0.4s,v0.4s,v1.4s
+};
+#endif
+
+// generates code that performs a packed sse operation with the host's
+// own simd instruction, reading and writing m->xmm in memory directly.
+// we always load both operands into host registers first, because the
+// legacy sse instructions require memory operands to be 16-byte aligned
+bool JitSse(P) {
+  u32 reg, rm;
+  reg = offsetof(struct Machine, xmm) + RexrReg(rde) * 16;
+  rm = offsetof(struct Machine, xmm) + RexbRm(rde) * 16;
+#if defined(__x86_64__)
+  u8 *p, code[32];
+  unassert(Mopcode(rde) >= 0x100 && Mopcode(rde) < 0x300 && !Rep(rde));
+  if (Mopcode(rde) >= 0x200 && !X86_HAVE(Ssse3)) {
+    return false;  // e.g. pshufb and pabsb came after baseline x86-64
+  }
+  if (Mopcode(rde) >= 0x220 && !X86_HAVE(Sse42)) {
+    return false;  // sse4 instruction that the host might not have
+  }
+  if (Mopcode(rde) >= 0x2C8 && Mopcode(rde) <= 0x2CD && !X86_HAVE(Sha)) {
+    return false;
+  }
+  if (Mopcode(rde) >= 0x2DB && Mopcode(rde) <= 0x2DF && !X86_HAVE(Aes)) {
+    return false;
+  }
+  p = code;
+  if (IsModrmRegister(rde)) {
+    *p++ = 0xf3;  // movdqu rm(%rbx),%xmm1
+    *p++ = 0x0f;
+    *p++ = 0x6f;
+    *p++ = 0200 | 1 << 3 | kJitSav0;
+    Write32(p, rm), p += 4;
+  } else {
+    Jitter(A, "z4P");  // res0 = GetXmmOrMemPointer(RexbRm)
+    *p++ = 0xf3;       // movdqu (%rax),%xmm1
+    *p++ = 0x0f;
+    *p++ = 0x6f;
+    *p++ = 0000 | 1 << 3 | kJitRes0;
+  }
+  *p++ = 0xf3;  // movdqu reg(%rbx),%xmm0
+  *p++ = 0x0f;
+  *p++ = 0x6f;
+  *p++ = 0200 | 0 << 3 | kJitSav0;
+  Write32(p, reg), p += 4;
+  // same opcode as guest, e.g. paddb %xmm1,%xmm0
+  if (Osz(rde)) *p++ = 0x66;
+  *p++ = 0x0f;
+  if (Mopcode(rde) >= 0x200) *p++ = 0x38;
+  *p++ = Mopcode(rde);
+  *p++ = 0300 | 0 << 3 | 1;
+  *p++ = 0xf3;  // movdqu %xmm0,reg(%rbx)
+  *p++ = 0x0f;
+  *p++ = 0x7f;
+  *p++ = 0200 | 0 << 3 | kJitSav0;
+  Write32(p, reg), p += 4;
+  AppendJit(m->path.jb, code, p - code);
+  STATISTIC(++sse_lowered);
+  return true;
+#elif defined(__aarch64__)
+  int i;
+  u32 ins;
+  for (i = 0; i < ARRAYLEN(kSseNeon); ++i) {
+    if (kSseNeon[i].mop == Mopcode(rde)) {
+      break;
+    }
+  }
+  if (i == ARRAYLEN(kSseNeon)) {
+    return false;
+  }
+  ins = kSseNeon[i].ins;
+  if (Mopcode(rde) < 0x160 && Osz(rde)) {
+    ins |= 1 << 22;  // sz bit selects double precision for addpd etc.
+  }
+  if (IsModrmRegister(rde)) {
+    u32 load[] = {
+        0x3dc00001 | rm / 16 << 10 | kJitSav0 << 5,  // ldr q1,[x19,#rm]
+    };
+    AppendJit(m->path.jb, load, sizeof(load));
+  } else {
+    Jitter(A, "z4P");  // res0 = GetXmmOrMemPointer(RexbRm)
+    u32 load[] = {
+        0x3dc00001 | kJitRes0 << 5,  // ldr q1,[x0]
+    };
+    AppendJit(m->path.jb, load, sizeof(load));
+  }
+  u32 code[] = {
+      0x3dc00000 | reg / 16 << 10 | kJitSav0 << 5,  // ldr q0,[x19,#reg]
+      ins,                                          // v0 = v0 op v1
+      0x3d800000 | reg / 16 << 10 | kJitSav0 << 5,  // str q0,[x19,#reg]
+  };
+  AppendJit(m->path.jb, code, sizeof(code));
+  STATISTIC(++sse_lowered);
+  return true;
+#else
+  return false;
+#endif
+}
+#endif
+
 void OpSse(P, void MmxKernel(u8[8], const u8[8]),
            void SseKernel(u8[16], const u8[16])) {
+#ifndef DISABLE_AVX
+  if (Vex(rde)) {
+    OpAvx(A, SseKernel);
+    return;
+  }
+#endif
   IGNORE_RACES_START();
   if (Osz(rde)) {
     SseKernel(XmmRexrReg(m, rde), GetXmmAddress(A));
@@ -1506,6 +1687,9 @@ void OpSse(P, void MmxKernel(u8[8], const u8[8]),
   }
   IGNORE_RACES_END();
   if (IsMakingPath(m)) {
+#ifdef HAVE_JIT
+    if (Osz(rde) && JitSse(A)) return;
+#endif
     Jitter(A,
            "z4P"    // res0 = GetXmmOrMemPointer(RexbRm)
            "r0s1="  // sav1 = res0
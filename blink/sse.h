@@ -80,6 +80,31 @@ void OpSsePunpcklqdq(P);
 void OpSsePunpcklwd(P);
 void OpSsePxor(P);
 
+void OpSseBlend(P);
+void OpSseBlendv(P);
+void OpSseDp(P);
+void OpSseInsertps(P);
+void OpSseMpsadbw(P);
+void OpSsePackusdw(P);
+void OpSsePcmpeqq(P);
+void OpSsePcmpgtq(P);
+void OpSsePcmpstr(P);
+void OpSsePextr(P);
+void OpSsePhminposuw(P);
+void OpSsePinsr(P);
+void OpSsePmaxsb(P);
+void OpSsePmaxsd(P);
+void OpSsePmaxud(P);
+void OpSsePmaxuw(P);
+void OpSsePminsb(P);
+void OpSsePminsd(P);
+void OpSsePminud(P);
+void OpSsePminuw(P);
+void OpSsePmovx(P);
+void OpSsePmuldq(P);
+void OpSsePtest(P);
+void OpSseRound(P);
+
 void MmxPcmpgtb(u8[8], const u8[8]);
 void MmxPcmpgtw(u8[8], const u8[8]);
 void MmxPcmpeqb(u8[8], const u8[8]);
@@ -102,5 +127,6 @@ void MmxPhsubsw(u8[8], const u8[8]);
 void MmxPabsb(u8[8], const u8[8]);
 
 void OpSse(P, void (*)(u8[8], const u8[8]), void (*)(u8[16], const u8[16]));
+bool JitSse(P);
 
 #endif /* BLINK_SSE_H_ */
@@ -0,0 +1,716 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2022 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "blink/assert.h"
+#include "blink/bitscan.h"
+#include "blink/endian.h"
+#include "blink/flags.h"
+#include "blink/fpu.h"
+#include "blink/intrin.h"
+#include "blink/jit.h"
+#include "blink/machine.h"
+#include "blink/macros.h"
+#include "blink/modrm.h"
+#include "blink/pun.h"
+#include "blink/sse.h"
+#include "blink/stats.h"
+
+// sse4.1 and sse4.2 have no mmx forms, so the 66 prefix is mandatory
+static void OpSse4(P, void SseKernel(u8[16], const u8[16])) {
+  if (Osz(rde)) {
+    OpSse(A, 0, SseKernel);
+  } else {
+    OpUdImpl(m);
+  }
+}
+
+static void SsePmuldq(u8 x[16], const u8 y[16]) {
+  int i;
+  for (i = 0; i < 2; ++i) {
+    Put64(x + i * 8, (i64)(i32)Get32(x + i * 8) * (i32)Get32(y + i * 8));
+  }
+}
+
+static void SsePcmpeqq(u8 x[16], const u8 y[16]) {
+  int i;
+  for (i = 0; i < 2; ++i) {
+    Put64(x + i * 8, -(Get64(x + i * 8) == Get64(y + i * 8)));
+  }
+}
+
+static void SsePcmpgtq(u8 x[16], const u8 y[16]) {
+  int i;
+  for (i = 0; i < 2; ++i) {
+    Put64(x + i * 8, -((i64)Get64(x + i * 8) > (i64)Get64(y + i * 8)));
+  }
+}
+
+static void SsePackusdw(u8 x[16], const u8 y[16]) {
+  int i;
+  i32 t[8];
+  for (i = 0; i < 4; ++i) t[i] = Get32(x + i * 4);
+  for (i = 0; i < 4; ++i) t[i + 4] = Get32(y + i * 4);
+  for (i = 0; i < 8; ++i) Put16(x + i * 2, MAX(0, MIN(65535, t[i])));
+}
+
+static void SsePminsb(u8 x[16], const u8 y[16]) {
+  int i;
+  for (i = 0; i < 16; ++i) x[i] = MIN((i8)x[i], (i8)y[i]);
+}
+
+static void SsePmaxsb(u8 x[16], const u8 y[16]) {
+  int i;
+  for (i = 0; i < 16; ++i) x[i] = MAX((i8)x[i], (i8)y[i]);
+}
+
+static void SsePminuw(u8 x[16], const u8 y[16]) {
+  int i;
+  for (i = 0; i < 8; ++i) {
+    Put16(x + i * 2, MIN(Get16(x + i * 2), Get16(y + i * 2)));
+  }
+}
+
+static void SsePmaxuw(u8 x[16], const u8 y[16]) {
+  int i;
+  for (i = 0; i < 8; ++i) {
+    Put16(x + i * 2, MAX(Get16(x + i * 2), Get16(y + i * 2)));
+  }
+}
+
+static void SsePminsd(u8 x[16], const u8 y[16]) {
+  int i;
+  for (i = 0; i < 4; ++i) {
+    Put32(x + i * 4, MIN((i32)Get32(x + i * 4), (i32)Get32(y + i * 4)));
+  }
+}
+
+static void SsePmaxsd(u8 x[16], const u8 y[16]) {
+  int i;
+  for (i = 0; i < 4; ++i) {
+    Put32(x + i * 4, MAX((i32)Get32(x + i * 4), (i32)Get32(y + i * 4)));
+  }
+}
+
+static void SsePminud(u8 x[16], const u8 y[16]) {
+  int i;
+  for (i = 0; i < 4; ++i) {
+    Put32(x + i * 4, MIN(Get32(x + i * 4), Get32(y + i * 4)));
+  }
+}
+
+static void SsePmaxud(u8 x[16], const u8 y[16]) {
+  int i;
+  for (i = 0; i < 4; ++i) {
+    Put32(x + i * 4, MAX(Get32(x + i * 4), Get32(y + i * 4)));
+  }
+}
+
+static void SsePhminposuw(u8 x[16], const u8 y[16]) {
+  int i, j;
+  u16 w, min;
+  for (min = Get16(y), j = 0, i = 1; i < 8; ++i) {
+    if ((w = Get16(y + i * 2)) < min) {
+      min = w;
+      j = i;
+    }
+  }
+  memset(x, 0, 16);
+  Put16(x, min);
+  Put16(x + 2, j);
+}
+
+void OpSsePmuldq(P) { OpSse4(A, SsePmuldq); }
+void OpSsePcmpeqq(P) { OpSse4(A, SsePcmpeqq); }
+void OpSsePackusdw(P) { OpSse4(A, SsePackusdw); }
+void OpSsePcmpgtq(P) { OpSse4(A, SsePcmpgtq); }
+void OpSsePminsb(P) { OpSse4(A, SsePminsb); }
+void OpSsePminsd(P) { OpSse4(A, SsePminsd); }
+void OpSsePminuw(P) { OpSse4(A, SsePminuw); }
+void OpSsePminud(P) { OpSse4(A, SsePminud); }
+void OpSsePmaxsb(P) { OpSse4(A, SsePmaxsb); }
+void OpSsePmaxsd(P) { OpSse4(A, SsePmaxsd); }
+void OpSsePmaxuw(P) { OpSse4(A, SsePmaxuw); }
+void OpSsePmaxud(P) { OpSse4(A, SsePmaxud); }
+void OpSsePhminposuw(P) { OpSse4(A, SsePhminposuw); }
+
+// pblendvb, blendvps, blendvpd
+void OpSseBlendv(P) {
+  u8 *x, t[16];
+  int i, w;
+  if (!Osz(rde)) OpUdImpl(m);
+  switch (Opcode(rde)) {
+    case 0x10:
+      w = 1;
+      break;
+    case 0x14:
+      w = 4;
+      break;
+    case 0x15:
+      w = 8;
+      break;
+    default:
+      __builtin_unreachable();
+  }
+  memcpy(t, GetXmmAddress(A), 16);
+  x = XmmRexrReg(m, rde);
+  for (i = 0; i < 16; i += w) {
+    if (m->xmm[0][i + w - 1] & 0x80) {
+      memcpy(x + i, t + i, w);
+    }
+  }
+}
+
+void OpSsePtest(P) {
+  int i;
+  u64 x, y, zf, cf;
+  if (!Osz(rde)) OpUdImpl(m);
+  for (zf = cf = i = 0; i < 2; ++i) {
+    x = Get64(XmmRexrReg(m, rde) + i * 8);
+    y = Read64(GetXmmAddress(A) + i * 8);
+    zf |= x & y;
+    cf |= ~x & y;
+  }
+  m->flags = SetFlag(m->flags, FLAGS_ZF, !zf);
+  m->flags = SetFlag(m->flags, FLAGS_CF, !cf);
+  m->flags = SetFlag(m->flags, FLAGS_SF, false);
+  m->flags = SetFlag(m->flags, FLAGS_OF, false);
+  m->flags = SetFlag(m->flags, FLAGS_AF, false);
+  m->flags = SetFlag(m->flags, FLAGS_PF, false);
+}
+
+// pmovsxbw, pmovsxbd, ..., pmovzxdq
+void OpSsePmovx(P) {
+  u8 t[8], *p;
+  int i, k, from, to;
+  static const u8 kFrom[6] = {0, 0, 0, 1, 1, 2};
+  static const u8 kTo[6] = {1, 2, 3, 2, 3, 3};
+  if (!Osz(rde) || (k = Opcode(rde) & 15) > 5) OpUdImpl(m);
+  from = kFrom[k];
+  to = kTo[k];
+  if (IsModrmRegister(rde)) {
+    p = XmmRexbRm(m, rde);
+  } else {
+    p = ComputeReserveAddressRead(A, 16 >> to << from);
+  }
+  memcpy(t, p, 16 >> to << from);
+  p = XmmRexrReg(m, rde);
+  for (i = 0; i < 16 >> to; ++i) {
+    u64 x;
+    switch (from) {
+      case 0:
+        x = Opcode(rde) & 0x10 ? t[i] : (u64)(i8)t[i];
+        break;
+      case 1:
+        x = Opcode(rde) & 0x10 ? Get16(t + i * 2) : (u64)(i16)Get16(t + i * 2);
+        break;
+      case 2:
+        x = Opcode(rde) & 0x10 ? Get32(t + i * 4) : (u64)(i32)Get32(t + i * 4);
+        break;
+      default:
+        __builtin_unreachable();
+    }
+    switch (to) {
+      case 1:
+        Put16(p + i * 2, x);
+        break;
+      case 2:
+        Put32(p + i * 4, x);
+        break;
+      case 3:
+        Put64(p + i * 8, x);
+        break;
+      default:
+        __builtin_unreachable();
+    }
+  }
+}
+
+static int GetSseRoundingMode(struct Machine *m, u8 imm) {
+  return imm & 4 ? (m->mxcsr & kMxcsrRc) >> 13 : imm & 3;
+}
+
+static double SseRoundDouble(double x, int mode) {
+  switch (mode) {
+    case 0:
+      return RoundEven(x);
+    case 1:
+      return floor(x);
+    case 2:
+      return ceil(x);
+    case 3:
+      return trunc(x);
+    default:
+      __builtin_unreachable();
+  }
+}
+
+static float SseRoundFloat(float x, int mode) {
+  switch (mode) {
+    case 0:
+      return RoundEvenf(x);
+    case 1:
+      return floorf(x);
+    case 2:
+      return ceilf(x);
+    case 3:
+      return truncf(x);
+    default:
+      __builtin_unreachable();
+  }
+}
+
+// roundps, roundpd, roundss, roundsd
+void OpSseRound(P) {
+  u8 t[16];
+  int i, mode;
+  union FloatPun f;
+  union DoublePun d;
+  if (!Osz(rde)) OpUdImpl(m);
+  mode = GetSseRoundingMode(m, uimm0);
+  switch (Opcode(rde)) {
+    case 0x08:
+      memcpy(t, GetXmmAddress(A), 16);
+      for (i = 0; i < 4; ++i) {
+        f.i = Get32(t + i * 4);
+        f.f = SseRoundFloat(f.f, mode);
+        Put32(XmmRexrReg(m, rde) + i * 4, f.i);
+      }
+      break;
+    case 0x09:
+      memcpy(t, GetXmmAddress(A), 16);
+      for (i = 0; i < 2; ++i) {
+        d.i = Get64(t + i * 8);
+        d.f = SseRoundDouble(d.f, mode);
+        Put64(XmmRexrReg(m, rde) + i * 8, d.i);
+      }
+      break;
+    case 0x0A:
+      f.i = Read32(GetModrmRegisterXmmPointerRead4(A));
+      f.f = SseRoundFloat(f.f, mode);
+      Put32(XmmRexrReg(m, rde), f.i);
+      break;
+    case 0x0B:
+      d.i = Read64(GetModrmRegisterXmmPointerRead8(A));
+      d.f = SseRoundDouble(d.f, mode);
+      Put64(XmmRexrReg(m, rde), d.i);
+      break;
+    default:
+      __builtin_unreachable();
+  }
+}
+
+// blendps, blendpd, pblendw
+void OpSseBlend(P) {
+  u8 *x, t[16];
+  int i, n, w;
+  if (!Osz(rde)) OpUdImpl(m);
+  switch (Opcode(rde)) {
+    case 0x0C:
+      n = 4, w = 4;
+      break;
+    case 0x0D:
+      n = 2, w = 8;
+      break;
+    case 0x0E:
+      n = 8, w = 2;
+      break;
+    default:
+      __builtin_unreachable();
+  }
+  memcpy(t, GetXmmAddress(A), 16);
+  x = XmmRexrReg(m, rde);
+  for (i = 0; i < n; ++i) {
+    if (uimm0 & 1 << i) {
+      memcpy(x + i * w, t + i * w, w);
+    }
+  }
+}
+
+// pextrb, pextrw, pextrd, pextrq, extractps
+void OpSsePextr(P) {
+  u64 x;
+  int lg2;
+  u8 *p = XmmRexrReg(m, rde);
+  if (!Osz(rde)) OpUdImpl(m);
+  switch (Opcode(rde)) {
+    case 0x14:
+      lg2 = 0;
+      x = p[uimm0 & 15];
+      break;
+    case 0x15:
+      lg2 = 1;
+      x = Get16(p + (uimm0 & 7) * 2);
+      break;
+    case 0x16:
+      if (Rexw(rde)) {
+        lg2 = 3;
+        x = Get64(p + (uimm0 & 1) * 8);
+      } else {
+        lg2 = 2;
+        x = Get32(p + (uimm0 & 3) * 4);
+      }
+      break;
+    case 0x17:
+      lg2 = 2;
+      x = Get32(p + (uimm0 & 3) * 4);
+      break;
+    default:
+      __builtin_unreachable();
+  }
+  if (IsModrmRegister(rde)) {
+    Put64(RegRexbRm(m, rde), x);
+  } else {
+    p = ComputeReserveAddressWrite(A, 1 << lg2);
+    switch (lg2) {
+      case 0:
+        Write8(p, x);
+        break;
+      case 1:
+        Write16(p, x);
+        break;
+      case 2:
+        Write32(p, x);
+        break;
+      case 3:
+        Write64(p, x);
+        break;
+      default:
+        __builtin_unreachable();
+    }
+  }
+}
+
+// pinsrb, pinsrd, pinsrq
+void OpSsePinsr(P) {
+  u8 *p = XmmRexrReg(m, rde);
+  if (!Osz(rde)) OpUdImpl(m);
+  if (Opcode(rde) == 0x20) {
+    p[uimm0 & 15] = Read8(GetModrmRegisterWordPointerRead(A, 1));
+  } else if (Rexw(rde)) {
+    Put64(p + (uimm0 & 1) * 8, Read64(GetModrmRegisterWordPointerRead8(A)));
+  } else {
+    Put32(p + (uimm0 & 3) * 4, Read32(GetModrmRegisterWordPointerRead4(A)));
+  }
+}
+
+void OpSseInsertps(P) {
+  int i;
+  u32 x;
+  u8 *p = XmmRexrReg(m, rde);
+  if (!Osz(rde)) OpUdImpl(m);
+  if (IsModrmRegister(rde)) {
+    x = Get32(XmmRexbRm(m, rde) + (uimm0 >> 6) * 4);
+  } else {
+    x = Read32(ComputeReserveAddressRead4(A));
+  }
+  Put32(p + (uimm0 >> 4 & 3) * 4, x);
+  for (i = 0; i < 4; ++i) {
+    if (uimm0 & 1 << i) {
+      Put32(p + i * 4, 0);
+    }
+  }
+}
+
+// dpps, dppd
+void OpSseDp(P) {
+  int i;
+  u8 *x, *y;
+  union FloatPun f[4];
+  union DoublePun d[2];
+  if (!Osz(rde)) OpUdImpl(m);
+  x = XmmRexrReg(m, rde);
+  y = GetXmmAddress(A);
+  if (Opcode(rde) == 0x40) {
+    union FloatPun a, b, s;
+    for (i = 0; i < 4; ++i) {
+      a.i = Get32(x + i * 4);
+      b.i = Read32(y + i * 4);
+      f[i].f = uimm0 & 0x10 << i ? a.f * b.f : 0;
+    }
+    s.f = (f[0].f + f[1].f) + (f[2].f + f[3].f);
+    for (i = 0; i < 4; ++i) {
+      Put32(x + i * 4, uimm0 & 1 << i ? s.i : 0);
+    }
+  } else {
+    union DoublePun a, b, s;
+    for (i = 0; i < 2; ++i) {
+      a.i = Get64(x + i * 8);
+      b.i = Read64(y + i * 8);
+      d[i].f = uimm0 & 0x10 << i ? a.f * b.f : 0;
+    }
+    s.f = d[0].f + d[1].f;
+    for (i = 0; i < 2; ++i) {
+      Put64(x + i * 8, uimm0 & 1 << i ? s.i : 0);
+    }
+  }
+}
+
+void OpSseMpsadbw(P) {
+  u16 r[8];
+  int i, j, k;
+  u8 *x, *y;
+  if (!Osz(rde)) OpUdImpl(m);
+  x = XmmRexrReg(m, rde) + (uimm0 & 4);
+  y = GetXmmAddress(A) + (uimm0 & 3) * 4;
+  for (i = 0; i < 8; ++i) {
+    for (r[i] = k = 0; k < 4; ++k) {
+      j = x[i + k] - y[k];
+      r[i] += j < 0 ? -j : j;
+    }
+  }
+  for (i = 0; i < 8; ++i) {
+    Put16(XmmRexrReg(m, rde) + i * 2, r[i]);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// SSE4.2 STRING COMPARISON
+
+static int GetStrLength(const u8 *p, int n, int w) {
+  int i;
+  for (i = 0; i < n; ++i) {
+    if (w == 1 ? !p[i] : !Get16(p + i * 2)) {
+      break;
+    }
+  }
+  return i;
+}
+
+static int GetStrElement(const u8 *p, int i, int imm) {
+  switch (imm & 3) {
+    case 0:
+      return p[i];
+    case 1:
+      return Get16(p + i * 2);
+    case 2:
+      return (i8)p[i];
+    case 3:
+      return (i16)Get16(p + i * 2);
+    default:
+      __builtin_unreachable();
+  }
+}
+
+// computes IntRes2 of the pcmpXstrX family, where `a` is the register
+// operand and `b` is register or memory, with la and lb being lengths
+static u32 PcmpStr(const u8 *a, const u8 *b, int la, int lb, int n, int imm) {
+  int i, j, k;
+  u32 res = 0;
+  switch (imm >> 2 & 3) {
+    case 0:  // equal any
+      for (j = 0; j < lb; ++j) {
+        for (i = 0; i < la; ++i) {
+          if (GetStrElement(a, i, imm) == GetStrElement(b, j, imm)) {
+            res |= 1u << j;
+            break;
+          }
+        }
+      }
+      break;
+    case 1:  // ranges
+      for (j = 0; j < lb; ++j) {
+        for (i = 0; i + 1 < la; i += 2) {
+          if (GetStrElement(a, i, imm) <= GetStrElement(b, j, imm) &&
+              GetStrElement(b, j, imm) <= GetStrElement(a, i + 1, imm)) {
+            res |= 1u << j;
+            break;
+          }
+        }
+      }
+      break;
+    case 2:  // equal each
+      for (i = 0; i < n; ++i) {
+        if (i >= la && i >= lb) {
+          res |= 1u << i;
+        } else if (i < la && i < lb &&
+                   GetStrElement(a, i, imm) == GetStrElement(b, i, imm)) {
+          res |= 1u << i;
+        }
+      }
+      break;
+    case 3:  // equal ordered
+      for (j = 0; j < n; ++j) {
+        for (k = 0; k < la && j + k < n; ++k) {
+          if (j + k >= lb ||
+              GetStrElement(a, k, imm) != GetStrElement(b, j + k, imm)) {
+            break;
+          }
+        }
+        if (k == la || j + k == n) {
+          res |= 1u << j;
+        }
+      }
+      break;
+    default:
+      __builtin_unreachable();
+  }
+  switch (imm >> 4 & 3) {
+    case 1:
+      res ^= (1u << n) - 1;
+      break;
+    case 3:
+      res ^= (1u << lb) - 1;
+      break;
+    default:
+      break;
+  }
+  return res;
+}
+
+static int GetExplicitLength(const u8 *r, u64 rde, int n) {
+  i64 x;
+  x = Rexw(rde) ? (i64)Get64(r) : (i32)Get32(r);
+  if (x < 0) x = x == INT64_MIN ? n : -x;
+  return MIN(x, n);
+}
+
+#if defined(HAVE_JIT) && defined(__x86_64__)
+// runs the instruction natively, since its behavior depends on so many
+// bits of the immediate operand that the kernel above is slow
+static void JitSsePcmpstr(P) {
+  u8 *p, code[96];
+  u32 reg, rm;
+  reg = offsetof(struct Machine, xmm) + RexrReg(rde) * 16;
+  rm = offsetof(struct Machine, xmm) + RexbRm(rde) * 16;
+  p = code;
+  if (IsModrmRegister(rde)) {
+    *p++ = 0xf3;  // movdqu rm(%rbx),%xmm1
+    *p++ = 0x0f;
+    *p++ = 0x6f;
+    *p++ = 0200 | 1 << 3 | kJitSav0;
+    Write32(p, rm), p += 4;
+  } else {
+    Jitter(A, "z4P");  // res0 = GetXmmOrMemPointer(RexbRm)
+    *p++ = 0xf3;       // movdqu (%rax),%xmm1
+    *p++ = 0x0f;
+    *p++ = 0x6f;
+    *p++ = 0000 | 1 << 3 | kJitRes0;
+  }
+  *p++ = 0xf3;  // movdqu reg(%rbx),%xmm0
+  *p++ = 0x0f;
+  *p++ = 0x6f;
+  *p++ = 0200 | 0 << 3 | kJitSav0;
+  Write32(p, reg), p += 4;
+  if (~Opcode(rde) & 2) {
+    *p++ = 0x48;  // mov ax(%rbx),%rax
+    *p++ = 0x8b;
+    *p++ = 0200 | 0 << 3 | kJitSav0;
+    Write32(p, offsetof(struct Machine, ax)), p += 4;
+    *p++ = 0x48;  // mov dx(%rbx),%rdx
+    *p++ = 0x8b;
+    *p++ = 0200 | 2 << 3 | kJitSav0;
+    Write32(p, offsetof(struct Machine, dx)), p += 4;
+  }
+  // same opcode as guest, e.g. pcmpistri $imm,%xmm1,%xmm0
+  *p++ = 0x66;
+  if (Rexw(rde)) *p++ = 0x48;
+  *p++ = 0x0f;
+  *p++ = 0x3a;
+  *p++ = Opcode(rde);
+  *p++ = 0300 | 0 << 3 | 1;
+  *p++ = uimm0;
+  if (Opcode(rde) & 1) {
+    *p++ = 0x48;  // mov %rcx,cx(%rbx)
+    *p++ = 0x89;
+    *p++ = 0200 | 1 << 3 | kJitSav0;
+    Write32(p, offsetof(struct Machine, cx)), p += 4;
+  } else {
+    *p++ = 0xf3;  // movdqu %xmm0,xmm0(%rbx)
+    *p++ = 0x0f;
+    *p++ = 0x7f;
+    *p++ = 0200 | 0 << 3 | kJitSav0;
+    Write32(p, offsetof(struct Machine, xmm)), p += 4;
+  }
+  *p++ = 0x9c;  // pushfq
+  *p++ = 0x58;  // pop %rax
+  *p++ = 0x25;  // and $CF|ZF|SF|OF,%eax
+  Write32(p, CF | ZF | SF | OF), p += 4;
+  *p++ = 0x8b;  // mov flags(%rbx),%edx
+  *p++ = 0200 | 2 << 3 | kJitSav0;
+  Write32(p, offsetof(struct Machine, flags)), p += 4;
+  *p++ = 0x81;  // and $~(CF|ZF|SF|OF|AF|PF),%edx
+  *p++ = 0340 | 2;
+  Write32(p, 0x00ffffff & ~(CF | ZF | SF | OF | AF)), p += 4;
+  *p++ = 0x81;  // or $SetLazyParityByte(0,1),%edx
+  *p++ = 0310 | 2;
+  Write32(p, SetFlag(0, FLAGS_PF, false)), p += 4;
+  *p++ = 0x09;  // or %eax,%edx
+  *p++ = 0300 | 0 << 3 | 2;
+  *p++ = 0x89;  // mov %edx,flags(%rbx)
+  *p++ = 0200 | 2 << 3 | kJitSav0;
+  Write32(p, offsetof(struct Machine, flags)), p += 4;
+  unassert(p - code <= sizeof(code));
+  AppendJit(m->path.jb, code, p - code);
+  if (Opcode(rde) & 1) {
+    ResetPinnedRegs(m);  // %rcx was written behind the cache's back
+  }
+  STATISTIC(++sse_lowered);
+}
+#endif
+
+// pcmpestrm, pcmpestri, pcmpistrm, pcmpistri
+void OpSsePcmpstr(P) {
+  u32 res;
+  u8 a[16], b[16];
+  int i, n, w, la, lb;
+  if (!Osz(rde)) OpUdImpl(m);
+  w = (uimm0 & 1) + 1;
+  n = 16 / w;
+  memcpy(a, XmmRexrReg(m, rde), 16);
+  memcpy(b, GetModrmRegisterXmmPointerRead16(A), 16);
+  if (Opcode(rde) & 2) {
+    la = GetStrLength(a, n, w);
+    lb = GetStrLength(b, n, w);
+  } else {
+    la = GetExplicitLength(m->ax, rde, n);
+    lb = GetExplicitLength(m->dx, rde, n);
+  }
+  res = PcmpStr(a, b, la, lb, n, uimm0);
+  if (Opcode(rde) & 1) {
+    if (!res) {
+      i = n;
+    } else if (uimm0 & 0x40) {
+      i = bsr(res);
+    } else {
+      i = bsf(res);
+    }
+    Put64(m->cx, i);
+  } else if (uimm0 & 0x40) {
+    for (i = 0; i < n; ++i) {
+      memset(m->xmm[0] + i * w, res & 1u << i ? 255 : 0, w);
+    }
+  } else {
+    memset(m->xmm[0], 0, 16);
+    Put16(m->xmm[0], res);
+  }
+  m->flags = SetFlag(m->flags, FLAGS_CF, !!res);
+  m->flags = SetFlag(m->flags, FLAGS_ZF, lb < n);
+  m->flags = SetFlag(m->flags, FLAGS_SF, la < n);
+  m->flags = SetFlag(m->flags, FLAGS_OF, res & 1);
+  m->flags = SetFlag(m->flags, FLAGS_AF, false);
+  m->flags = SetFlag(m->flags, FLAGS_PF, false);
+#if defined(HAVE_JIT) && defined(__x86_64__)
+  if (IsMakingPath(m) && X86_HAVE(Sse42) && !Vex(rde)) {
+    JitSsePcmpstr(A);
+  }
+#endif
+}
@@ -27,6 +27,7 @@
 #include "blink/macros.h"
 #include "blink/modrm.h"
 #include "blink/pun.h"
+#include "blink/sse.h"
 #include "blink/stats.h"
 #include "blink/tsan.h"
 
@@ -122,7 +123,7 @@ void OpPextrwGdqpUdqIb(P) {
   u8 i;
   i = uimm0;
   i &= Osz(rde) ? 7 : 3;
-  Put16(RegRexrReg(m, rde), Get16(XmmRexbRm(m, rde) + i * 2));
+  Put64(RegRexrReg(m, rde), Get16(XmmRexbRm(m, rde) + i * 2));
 }
 
 void OpPinsrwVdqEwIb(P) {
@@ -359,7 +360,6 @@ void OpRcpps(P) {
 static void ComissKernel(const u8 rxr[8], const u8 reg[8], struct Machine *m) {
   bool zf, cf;
   union DoublePun xd, yd;
-  m->mxcsr &= ~kMxcsrIe;
   xd.i = Read64(rxr);
   yd.i = Read64(reg);
   if (!isunordered(xd.f, yd.f)) {
@@ -430,7 +430,6 @@ void OpComissVsWs(P) {
   m->flags = SetFlag(m->flags, FLAGS_SF, false);
   m->flags = SetFlag(m->flags, FLAGS_OF, false);
   if (!isucomiss) {
-    m->mxcsr &= ~kMxcsrIe;
     if (ie) {
       m->mxcsr |= kMxcsrIe;
       if (!(m->mxcsr & kMxcsrIm)) {
@@ -484,6 +483,9 @@ static void OpPsd(P, float fs(float x, float y), double fd(double x, double y),
     x[1].f = fd(x[1].f, y[1].f);
     Write64(p + 0 * 8, x[0].i);
     Write64(p + 1 * 8, x[1].i);
+    if (IsMakingPath(m)) {
+      JitSse(A);
+    }
   } else {
     u8 *p;
     union FloatPun x[4], y[4];
@@ -505,6 +507,9 @@ static void OpPsd(P, float fs(float x, float y), double fd(double x, double y),
     Write32(p + 1 * 4, x[1].i);
     Write32(p + 2 * 4, x[2].i);
     Write32(p + 3 * 4, x[3].i);
+    if (IsMakingPath(m)) {
+      JitSse(A);
+    }
   }
   IGNORE_RACES_END();
 }
@@ -634,13 +639,13 @@ void OpCmppsd(P) {
     union DoublePun x, y;
     y.i = Read64(GetModrmRegisterXmmPointerRead8(A));
     x.i = Read64(XmmRexrReg(m, rde));
-    x.f = Cmpd(imm, x.f, y.f);
+    x.i = Cmpd(imm, x.f, y.f);
     Write64(XmmRexrReg(m, rde), x.i);
   } else if (Rep(rde) == 3) {
     union FloatPun x, y;
     y.i = Read32(GetModrmRegisterXmmPointerRead4(A));
     x.i = Read32(XmmRexrReg(m, rde));
-    x.f = Cmps(imm, x.f, y.f);
+    x.i = Cmps(imm, x.f, y.f);
     Write32(XmmRexrReg(m, rde), x.i);
   } else if (Osz(rde)) {
     u8 *p;
@@ -651,8 +656,8 @@ void OpCmppsd(P) {
     p = XmmRexrReg(m, rde);
     x[0].i = Read64(p + 0 * 8);
     x[1].i = Read64(p + 1 * 8);
-    x[0].f = Cmpd(imm, x[0].f, y[0].f);
-    x[1].f = Cmpd(imm, x[1].f, y[1].f);
+    x[0].i = Cmpd(imm, x[0].f, y[0].f);
+    x[1].i = Cmpd(imm, x[1].f, y[1].f);
     Write64(p + 0 * 8, x[0].i);
     Write64(p + 1 * 8, x[1].i);
   } else {
@@ -668,10 +673,10 @@ void OpCmppsd(P) {
     x[1].i = Read32(p + 1 * 4);
     x[2].i = Read32(p + 2 * 4);
     x[3].i = Read32(p + 3 * 4);
-    x[0].f = Cmps(imm, x[0].f, y[0].f);
-    x[1].f = Cmps(imm, x[1].f, y[1].f);
-    x[2].f = Cmps(imm, x[2].f, y[2].f);
-    x[3].f = Cmps(imm, x[3].f, y[3].f);
+    x[0].i = Cmps(imm, x[0].f, y[0].f);
+    x[1].i = Cmps(imm, x[1].f, y[1].f);
+    x[2].i = Cmps(imm, x[2].f, y[2].f);
+    x[3].i = Cmps(imm, x[3].f, y[3].f);
     Write32(p + 0 * 4, x[0].i);
     Write32(p + 1 * 4, x[1].i);
     Write32(p + 2 * 4, x[2].i);
@@ -26,6 +26,7 @@
 #include "blink/macros.h"
 #include "blink/modrm.h"
 #include "blink/rde.h"
+#include "blink/stats.h"
 #include "blink/tsan.h"
 #include "blink/x86.h"
 
@@ -116,6 +117,7 @@ void OpPushZvq(P) {
   int osz = kStackOsz[Osz(rde)][Mode(rde)];
   PushN(A, ReadStackWord(RegRexbSrm(m, rde), osz), Eamode(rde), osz);
   if (IsMakingPath(m) && HasLinearMapping() && !Osz(rde)) {
+    if (FusePrologue(A)) return;
     Jitter(A,
            "a1i"
            "m",
@@ -181,7 +183,19 @@ static void OpCall(P, u64 func) {
   m->ip = func;
 }
 
+static void PushPrediction(P) {
+  Jitter(A,
+         "a1i"  // arg1 = return address
+         "q"    // arg0 = machine
+         "c"    // call function (PushJitTarget)
+         "q",   // arg0 = machine
+         m->ip, PushJitTarget);
+}
+
 void OpCallJvds(P) {
+  if (HasLinearMapping() && IsMakingPath(m)) {
+    PushPrediction(A);
+  }
   OpCall(A, m->ip + disp);
   if (HasLinearMapping() && IsMakingPath(m)) {
     Terminate(A, FastCall);
@@ -193,8 +207,16 @@ static u64 LoadAddressFromMemory(P) {
   return ReadMemWord(GetModrmRegisterWordPointerRead(A, osz), osz);
 }
 
+static void ConnectIndirectBranch(P) {
+  ConnectIndirect(A, false);
+  AppendJitJump(m->path.jb, (void *)m->system->ender);
+  FinishPath(m);
+}
+
 void OpCallEq(P) {
-  if (IsMakingPath(m) && HasLinearMapping() && !Osz(rde)) {
+  bool jit;
+  if ((jit = IsMakingPath(m) && HasLinearMapping() && !Osz(rde))) {
+    PushPrediction(A);
     Jitter(A,
            "z3B"    // res0 = GetRegOrMem[force64bit](RexbRm)
            "s0a1="  // arg1 = machine
@@ -203,10 +225,12 @@ void OpCallEq(P) {
            FastCallAbs);
   }
   OpCall(A, LoadAddressFromMemory(A));
+  if (jit) ConnectIndirectBranch(A);
 }
 
 void OpJmpEq(P) {
-  if (IsMakingPath(m) && HasLinearMapping() && !Osz(rde)) {
+  bool jit;
+  if ((jit = IsMakingPath(m) && HasLinearMapping() && !Osz(rde))) {
     Jitter(A,
            "z3B"    // res0 = GetRegOrMem[force64bit](RexbRm)
            "s0a1="  // arg1 = machine
@@ -215,6 +239,7 @@ void OpJmpEq(P) {
            FastJmpAbs);
   }
   m->ip = LoadAddressFromMemory(A);
+  if (jit) ConnectIndirectBranch(A);
 }
 
 void OpLeave(P) {
@@ -240,6 +265,8 @@ void OpLeave(P) {
 }
 
 void OpRet(P) {
+  int link;
+  long end;
   m->ip = Pop(A, 0);
   if (IsMakingPath(m) && HasLinearMapping() && !Osz(rde)) {
 #ifdef __x86_64__
@@ -251,7 +278,7 @@ void OpRet(P) {
     AlignJit(m->path.jb, 8, 3);
     u8 code[] = {
         0x48, 0x85, 0300 | kJitRes0 << 3 | kJitRes0,  // test %rax,%rax
-        0x75, 0x05,                                   // jnz   +5
+        0x75, 0x00,                                   // jnz   miss
     };
 #else
     Jitter(A,
@@ -261,11 +288,21 @@ void OpRet(P) {
            "q",     // arg0 = machine
            m->ip, PredictRet);
     u32 code[] = {
-        0xb5000000 | (8 / 4) << 5 | kJitArg2,  // cbnz x2,#8
+        0xb5000000 | kJitArg2,  // cbnz x2,miss
     };
 #endif
-    AppendJit(m->path.jb, code, sizeof(code));
-    Connect(A, m->ip, true);
+    // if the prediction can't be linked, then rely on the return
+    // address stack instead, which can still find the path for it
+    STATISTIC(++path_connected_total);
+    if ((link = CanConnect(A, m->ip))) {
+      AppendJit(m->path.jb, code, sizeof(code));
+      end = m->path.jb->index;
+      ConnectPath(A, m->ip, link);
+      FixupSideExit(m->path.jb, end);
+    } else {
+      STATISTIC(++path_connected_interpreter);
+    }
+    ConnectIndirect(A, true);
     AppendJitJump(m->path.jb, (void *)m->system->ender);
     FinishPath(m);
   }
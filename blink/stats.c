@@ -16,6 +16,8 @@
 │ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
 │ PERFORMANCE OF THIS SOFTWARE.                                                │
 ╚─────────────────────────────────────────────────────────────────────────────*/
+#include "blink/builtin.h"
+#include "blink/jit.h"
 #include "blink/log.h"
 #include "blink/stats.h"
 
@@ -39,6 +41,16 @@ void PrintStats(void) {
   if (S.a) APPEND("%-32s = %.6g\n", #S, S.a);
 #include "blink/stats.inc"
 #undef S
+  if (tlb_hits + tlb_misses) {
+    double lookups = tlb_hits + tlb_misses;
+    APPEND("%-32s = %.6g%%\n", "tlb_hit_rate", tlb_hits / lookups * 100);
+    APPEND("%-32s = %.6g%%\n", "tlb_miss_rate", tlb_misses / lookups * 100);
+    APPEND("%-32s = %.6g%%\n", "tlb_conflict_rate",
+           tlb_conflicts / lookups * 100);
+  }
   WriteErrorString(b);
+#ifdef HAVE_JIT
+  PrintJitStats();
+#endif
 #endif
 }
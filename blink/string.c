@@ -29,6 +29,7 @@
 #include "blink/macros.h"
 #include "blink/modrm.h"
 #include "blink/rde.h"
+#include "blink/stats.h"
 #include "blink/string.h"
 #include "blink/tsan.h"
 #include "blink/util.h"
@@ -127,69 +128,78 @@ static u64 SubtractCx(P, u64 x) {
   return cx;
 }
 
+// performs a single iteration of a string instruction, returning true
+// if it's a comparison whose repeat prefix says to stop here
+static bool StringElement(P, int op, unsigned n, i64 sgn) {
+  i64 v;
+  void *p[2];
+  u8 s[3][8];
+  switch (op) {
+    case STRING_CMPS:
+      kAlu[ALU_SUB][RegLog2(rde)](
+          m, ReadInt(Load(m, AddressSi(A), n, s[2]), RegLog2(rde)),
+          ReadInt(Load(m, AddressDi(A), n, s[1]), RegLog2(rde)));
+      AddDi(A, sgn * n);
+      AddSi(A, sgn * n);
+      return (Rep(rde) == 2 && GetFlag(m->flags, FLAGS_ZF)) ||
+             (Rep(rde) == 3 && !GetFlag(m->flags, FLAGS_ZF));
+    case STRING_MOVS:
+      memmove(BeginStore(m, (v = AddressDi(A)), n, p, s[0]),
+              Load(m, AddressSi(A), n, s[1]), n);
+      EndStore(m, v, n, p, s[0]);
+      AddDi(A, sgn * n);
+      AddSi(A, sgn * n);
+      return false;
+    case STRING_STOS:
+      memmove(BeginStore(m, (v = AddressDi(A)), n, p, s[0]), m->ax, n);
+      EndStore(m, v, n, p, s[0]);
+      AddDi(A, sgn * n);
+      return false;
+    case STRING_LODS:
+      if (n == 1) {
+        m->al = *Load(m, AddressSi(A), n, s[1]);
+      } else {
+        WriteRegister(rde, m->ax,
+                      ReadInt(Load(m, AddressSi(A), n, s[1]), RegLog2(rde)));
+      }
+      AddSi(A, sgn * n);
+      return false;
+    case STRING_SCAS:
+      kAlu[ALU_SUB][RegLog2(rde)](
+          m, ReadInt(m->ax, RegLog2(rde)),
+          ReadInt(Load(m, AddressDi(A), n, s[1]), RegLog2(rde)));
+      AddDi(A, sgn * n);
+      return (Rep(rde) == 2 && GetFlag(m->flags, FLAGS_ZF)) ||
+             (Rep(rde) == 3 && !GetFlag(m->flags, FLAGS_ZF));
+#ifndef DISABLE_METAL
+    case STRING_OUTS:
+      OpOut(m, Get16(m->dx),
+            ReadInt(Load(m, AddressSi(A), n, s[1]), RegLog2(rde)));
+      AddSi(A, sgn * n);
+      return false;
+    case STRING_INS:
+      WriteInt((u8 *)BeginStore(m, (v = AddressDi(A)), n, p, s[0]),
+               OpIn(m, Get16(m->dx)), RegLog2(rde));
+      EndStore(m, v, n, p, s[0]);
+      AddDi(A, sgn * n);
+      return false;
+#endif /* DISABLE_METAL */
+    default:
+      Abort();
+  }
+}
+
 static void StringOp(P, int op) {
   bool stop;
   unsigned n;
-  i64 sgn, v;
-  void *p[2];
-  u8 s[3][8];
-  stop = false;
+  i64 sgn;
   n = 1 << RegLog2(rde);
   sgn = GetFlag(m->flags, FLAGS_DF) ? -1 : 1;
   IGNORE_RACES_START();
   atomic_thread_fence(memory_order_acquire);
   do {
     if (Rep(rde) && !ReadCx(A)) break;
-    switch (op) {
-      case STRING_CMPS:
-        kAlu[ALU_SUB][RegLog2(rde)](
-            m, ReadInt(Load(m, AddressSi(A), n, s[2]), RegLog2(rde)),
-            ReadInt(Load(m, AddressDi(A), n, s[1]), RegLog2(rde)));
-        AddDi(A, sgn * n);
-        AddSi(A, sgn * n);
-        stop = (Rep(rde) == 2 && GetFlag(m->flags, FLAGS_ZF)) ||
-               (Rep(rde) == 3 && !GetFlag(m->flags, FLAGS_ZF));
-        break;
-      case STRING_MOVS:
-        memmove(BeginStore(m, (v = AddressDi(A)), n, p, s[0]),
-                Load(m, AddressSi(A), n, s[1]), n);
-        AddDi(A, sgn * n);
-        AddSi(A, sgn * n);
-        EndStore(m, v, n, p, s[0]);
-        break;
-      case STRING_STOS:
-        memmove(BeginStore(m, (v = AddressDi(A)), n, p, s[0]), m->ax, n);
-        AddDi(A, sgn * n);
-        EndStore(m, v, n, p, s[0]);
-        break;
-      case STRING_LODS:
-        memmove(m->ax, Load(m, AddressSi(A), n, s[1]), n);
-        AddSi(A, sgn * n);
-        break;
-      case STRING_SCAS:
-        kAlu[ALU_SUB][RegLog2(rde)](
-            m, ReadInt(Load(m, AddressDi(A), n, s[1]), RegLog2(rde)),
-            ReadInt(m->ax, RegLog2(rde)));
-        AddDi(A, sgn * n);
-        stop = (Rep(rde) == 2 && GetFlag(m->flags, FLAGS_ZF)) ||
-               (Rep(rde) == 3 && !GetFlag(m->flags, FLAGS_ZF));
-        break;
-#ifndef DISABLE_METAL
-      case STRING_OUTS:
-        OpOut(m, Get16(m->dx),
-              ReadInt(Load(m, AddressSi(A), n, s[1]), RegLog2(rde)));
-        AddSi(A, sgn * n);
-        break;
-      case STRING_INS:
-        WriteInt((u8 *)BeginStore(m, (v = AddressDi(A)), n, p, s[0]),
-                 OpIn(m, Get16(m->dx)), RegLog2(rde));
-        AddDi(A, sgn * n);
-        EndStore(m, v, n, p, s[0]);
-        break;
-#endif /* DISABLE_METAL */
-      default:
-        Abort();
-    }
+    stop = StringElement(A, op, n, sgn);
     if (Rep(rde)) {
       SubtractCx(A, 1);
     } else {
@@ -200,107 +210,223 @@ static void StringOp(P, int op) {
   IGNORE_RACES_END();
 }
 
-static void RepMovsbEnhanced(P) {
-  u8 *direal, *sireal;
-  u64 diactual, siactual, cx;
-  u16 dilow, silow;
-  long diremain, siremain, i, n;
-  if ((cx = ReadCx(A))) {
-    diactual = AddressDi(A);
-    siactual = AddressSi(A);
-    if (diactual != siactual) {
-      if (!GetFlag(m->flags, FLAGS_DF)) {
-        SetWriteAddr(m, diactual, cx);
-        SetReadAddr(m, siactual, cx);
-      } else {
-        SetWriteAddr(m, diactual - cx + 1, cx);
-        SetReadAddr(m, siactual - cx + 1, cx);
+// returns how many whole elements, of size 1 << w, the instruction can
+// visit starting at address v before either crossing a page boundary
+// or wrapping the index register r, in which case it returns zero
+static u64 GetChunk(P, u64 v, u8 r[8], int w, bool down) {
+  u64 x, k;
+  if (!down) {
+    k = (4096 - (v & 4095)) >> w;
+  } else if ((v & 4095) + (1 << w) <= 4096) {
+    k = ((v & 4095) >> w) + 1;
+  } else {
+    return 0;
+  }
+  switch (Eamode(rde)) {
+    case XED_MODE_LONG:
+      return k;
+    case XED_MODE_LEGACY:
+      x = Get32(r);
+      return MIN(k, !down ? (0x100000000 - x) >> w : (x >> w) + 1);
+    case XED_MODE_REAL:
+      x = Get16(r);
+      return MIN(k, !down ? (0x10000 - x) >> w : (x >> w) + 1);
+    default:
+      __builtin_unreachable();
+  }
+}
+
+// returns host address of string element, checking guest page access
+static u8 *TranslateString(struct Machine *m, i64 v, bool writable) {
+  u8 *r;
+  u64 need;
+  if (HasLinearMapping()) return ToHost(v);
+  need = 0;
+  if (Cpl(m) == 3) {
+    need = writable ? PAGE_U | PAGE_RW : PAGE_U;
+  }
+  if ((r = LookupAddress2(m, v, need, need))) return r;
+  ThrowSegmentationFault(m, v);
+}
+
+// fills k elements of n bytes each with the first n bytes of x
+static void FillString(u8 *p, const u8 *x, unsigned n, u64 k) {
+  u64 i, m;
+  if (n == 1) {
+    memset(p, *x, k);
+  } else {
+    memcpy(p, x, n);
+    for (m = k * n, i = n; i < m; i += i) {
+      memcpy(p + i, p, MIN(i, m - i));
+    }
+  }
+}
+
+// returns index of first element, in the order the instruction visits
+// them, where comparing p with q sets zf to `zf`, or k if there's none
+static u64 FindString(const u8 *p, const u8 *q, bool scas, unsigned n,
+                      long step, u64 k, bool zf) {
+  u64 i;
+  const u8 *e;
+  if (scas && n == 1 && step > 0 && zf) {
+    e = (const u8 *)memchr(p, *q, k);
+    return e ? e - p : k;
+  }
+  if (!scas && step > 0 && !zf && !memcmp(p, q, k * n)) {
+    return k;
+  }
+  for (i = 0; i < k; ++i) {
+    if (!memcmp(p, q, n) == zf) break;
+    p += step;
+    if (!scas) q += step;
+  }
+  return i;
+}
+
+// executes a repeated string instruction a page at a time, so guest
+// memory is translated once per chunk rather than once per element.
+// registers are brought up to date after each chunk, which makes the
+// instruction restartable if a fault happens, and lets us drop back to
+// the main loop so that signals can be delivered midway.
+static void RepString(P, int op) {
+  unsigned n;
+  u64 cx, k, j;
+  long sgn, step;
+  u8 *d, *s, *dlo, *slo;
+  bool stop, down, usesdi, usessi, writesdi;
+  if (!(cx = ReadCx(A))) return;
+  n = 1 << RegLog2(rde);
+  down = GetFlag(m->flags, FLAGS_DF);
+  sgn = down ? -1 : 1;
+  step = sgn * n;
+  usesdi = op != STRING_LODS;
+  usessi = op != STRING_STOS && op != STRING_SCAS;
+  writesdi = op == STRING_MOVS || op == STRING_STOS;
+  IGNORE_RACES_START();
+  atomic_thread_fence(memory_order_acquire);
+  for (stop = false;;) {
+    k = cx;
+    if (usesdi) {
+      k = MIN(k, GetChunk(A, AddressDi(A), m->di, RegLog2(rde), down));
+    }
+    if (usessi) {
+      k = MIN(k, GetChunk(A, AddressSi(A), m->si, RegLog2(rde), down));
+    }
+    if (!k) {
+      // element straddles a page boundary or wraps the index register
+      STATISTIC(++string_elements_slow);
+      stop = StringElement(A, op, n, sgn);
+      cx = SubtractCx(A, 1);
+    } else {
+      STATISTIC(++string_chunks);
+      d = s = 0;
+      if (usesdi) {
+        if (writesdi) {
+          SetWriteAddr(m, AddressDi(A), n);
+        } else {
+          SetReadAddr(m, AddressDi(A), n);
+        }
+        d = TranslateString(m, AddressDi(A), writesdi);
+      }
+      if (usessi) {
+        SetReadAddr(m, AddressSi(A), n);
+        s = TranslateString(m, AddressSi(A), false);
       }
-      IGNORE_RACES_START();
-      atomic_thread_fence(memory_order_acquire);
-      do {
-        direal = ResolveAddress(m, diactual);
-        sireal = ResolveAddress(m, siactual);
-        dilow = Get16(m->di);
-        silow = Get16(m->si);
-        if (!GetFlag(m->flags, FLAGS_DF)) {
-          diremain = 4096 - (diactual & 4095);
-          diremain = MIN(diremain, 65536 - dilow);
-          siremain = 4096 - (siactual & 4095);
-          siremain = MIN(siremain, 65536 - silow);
-          n = MIN(cx, MIN(diremain, siremain));
-          for (i = 0; i < n; ++i) {
-            direal[i] = sireal[i];
+      switch (op) {
+        case STRING_MOVS:
+          dlo = down ? d - (k - 1) * n : d;
+          slo = down ? s - (k - 1) * n : s;
+          if (dlo + k * n <= slo || slo + k * n <= dlo) {
+            memmove(dlo, slo, k * n);
+          } else {
+            // overlapping copies must replicate as they go, e.g.
+            // rep movsb with rdi=rsi+1 smears the first byte
+            for (j = 0; j < k; ++j) {
+              memmove(d + step * (long)j, s + step * (long)j, n);
+            }
           }
-          AddDi(A, n);
-          AddSi(A, n);
-        } else {
-          diremain = (diactual & 4095) + 1;
-          diremain = MIN(diremain, (long)dilow + 1);
-          siremain = (siactual & 4095) + 1;
-          siremain = MIN(siremain, (long)silow + 1);
-          n = MIN(cx, MIN(diremain, siremain));
-          for (i = 0; i < n; ++i) {
-            direal[-i] = sireal[-i];
+          AddDi(A, step * k);
+          AddSi(A, step * k);
+          cx = SubtractCx(A, k);
+          break;
+        case STRING_STOS:
+          FillString(down ? d - (k - 1) * n : d, m->ax, n, k);
+          AddDi(A, step * k);
+          cx = SubtractCx(A, k);
+          break;
+        case STRING_LODS:
+        case STRING_CMPS:
+        case STRING_SCAS:
+          // skip ahead to the element the instruction would stop at,
+          // then run it the slow way so the flags get computed for us
+          if (op == STRING_CMPS) {
+            j = FindString(s, d, false, n, step, k, Rep(rde) == 2);
+          } else if (op == STRING_SCAS) {
+            j = FindString(d, m->ax, true, n, step, k, Rep(rde) == 2);
+          } else {
+            j = k;
           }
-          AddDi(A, -n);
-          AddSi(A, -n);
-        }
-        cx = SubtractCx(A, n);
-        if (cx) {
-          diactual = AddressDi(A);
-          siactual = AddressSi(A);
-        }
-      } while (cx);
+          j = MIN(j, k - 1);
+          if (usesdi) AddDi(A, step * j);
+          if (usessi) AddSi(A, step * j);
+          SubtractCx(A, j);
+          stop = StringElement(A, op, n, sgn);
+          cx = SubtractCx(A, 1);
+          break;
+        default:
+          __builtin_unreachable();
+      }
+    }
+    if (!cx || stop) break;
+    if (atomic_load_explicit(&m->attention, memory_order_acquire)) {
+      // let the main loop deliver signals and then restart us
       atomic_thread_fence(memory_order_release);
       IGNORE_RACES_END();
+      HaltMachine(m, kMachineEscape);
     }
   }
-}
-
-static void RepStosbEnhanced(P) {
-  u8 *direal;
-  u64 diactual, cx;
-  u16 dilow;
-  unsigned diremain, n;
-  if ((cx = ReadCx(A))) {
-    diactual = AddressDi(A);
-    SetWriteAddr(m, diactual, cx);
-    IGNORE_RACES_START();
-    do {
-      direal = ResolveAddress(m, diactual);
-      dilow = Get16(m->di);
-      diremain = 4096 - (diactual & 4095);
-      diremain = MIN(diremain, 65536 - dilow);
-      n = MIN(cx, diremain);
-      memset(direal, m->al, n);
-      AddDi(A, n);
-      cx = SubtractCx(A, n);
-      if (cx) diactual = AddressDi(A);
-    } while (cx);
-    atomic_thread_fence(memory_order_release);
-    IGNORE_RACES_END();
-  }
+  atomic_thread_fence(memory_order_release);
+  IGNORE_RACES_END();
 }
 
 void OpMovs(P) {
-  StringOp(A, STRING_MOVS);
+  if (Rep(rde)) {
+    RepString(A, STRING_MOVS);
+  } else {
+    StringOp(A, STRING_MOVS);
+  }
 }
 
 void OpCmps(P) {
-  StringOp(A, STRING_CMPS);
+  if (Rep(rde)) {
+    RepString(A, STRING_CMPS);
+  } else {
+    StringOp(A, STRING_CMPS);
+  }
 }
 
 void OpStos(P) {
-  StringOp(A, STRING_STOS);
+  if (Rep(rde)) {
+    RepString(A, STRING_STOS);
+  } else {
+    StringOp(A, STRING_STOS);
+  }
 }
 
 void OpLods(P) {
-  StringOp(A, STRING_LODS);
+  if (Rep(rde)) {
+    RepString(A, STRING_LODS);
+  } else {
+    StringOp(A, STRING_LODS);
+  }
 }
 
 void OpScas(P) {
-  StringOp(A, STRING_SCAS);
+  if (Rep(rde)) {
+    RepString(A, STRING_SCAS);
+  } else {
+    StringOp(A, STRING_SCAS);
+  }
 }
 
 void OpIns(P) {
@@ -310,19 +436,3 @@ void OpIns(P) {
 void OpOuts(P) {
   StringOp(A, STRING_OUTS);
 }
-
-void OpMovsb(P) {
-  if (Rep(rde)) {
-    RepMovsbEnhanced(A);
-  } else {
-    OpMovs(A);
-  }
-}
-
-void OpStosb(P) {
-  if (Rep(rde) && !GetFlag(m->flags, FLAGS_DF)) {
-    RepStosbEnhanced(A);
-  } else {
-    OpStos(A);
-  }
-}
@@ -14,10 +14,8 @@ void OpCmps(P);
 void OpIns(P);
 void OpLods(P);
 void OpMovs(P);
-void OpMovsb(P);
 void OpOuts(P);
 void OpScas(P);
 void OpStos(P);
-void OpStosb(P);
 
 #endif /* BLINK_STRING_H_ */
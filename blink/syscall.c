@@ -247,7 +247,13 @@ bool DeliverSignalRecursively(struct Machine *m, int sig) {
   }
   m->restored = false;
   m->insyscall = false;
+#ifdef HAVE_JIT
+  ObserveJitEpoch(&m->jitreader);
+#endif
   SignalActor(m);
+#ifdef HAVE_JIT
+  ParkJitReader(&m->jitreader);
+#endif
   m->insyscall = true;
   m->restored = false;
   if (issigsuspend) {
@@ -412,6 +418,7 @@ static int Fork(struct Machine *m, u64 flags, u64 stack, u64 ctid) {
     LOCK(&m->system->pagelocks_lock);
     LOCK(&m->system->fds.lock);
     LOCK(&m->system->machines_lock);
+    LOCK(&m->system->shootdown_lock);
 #ifndef HAVE_PTHREAD_PROCESS_SHARED
     LOCK(&g_bus->futexes.lock);
 #endif
@@ -432,6 +439,7 @@ static int Fork(struct Machine *m, u64 flags, u64 stack, u64 ctid) {
 #ifndef HAVE_PTHREAD_PROCESS_SHARED
     UNLOCK(&g_bus->futexes.lock);
 #endif
+    UNLOCK(&m->system->shootdown_lock);
     UNLOCK(&m->system->machines_lock);
     UNLOCK(&m->system->fds.lock);
     UNLOCK(&m->system->pagelocks_lock);
@@ -1249,13 +1257,95 @@ static i64 SysMmap(struct Machine *m, i64 virt, u64 size, int prot, int flags,
   return res;
 }
 
+static i64 SysMremapImpl(struct Machine *m, i64 old_address, u64 old_size,
+                         u64 new_size, int flags, i64 new_address) {
+  i64 res, newautomap;
+  struct System *s = m->system;
+  if (flags & ~(MREMAP_MAYMOVE_LINUX | MREMAP_FIXED_LINUX)) {
+    LOGF("unsupported mremap() flags %#x", flags);
+    return einval();
+  }
+  if ((flags & MREMAP_FIXED_LINUX) && !(flags & MREMAP_MAYMOVE_LINUX)) {
+    return einval();
+  }
+  if (!old_size) {
+    // linux lets this create a second mapping of shared memory
+    LOG_ONCE(LOGF("mremap() of zero-sized shared mapping not supported"));
+    return einval();
+  }
+  if (!IsValidAddrSize(old_address, old_size) ||
+      !IsValidAddrSize(0, new_size)) {
+    return einval();
+  }
+  old_size = ROUNDUP(old_size, 4096);
+  new_size = ROUNDUP(new_size, 4096);
+  if ((flags & MREMAP_FIXED_LINUX) &&
+      (!IsValidAddrSize(new_address, new_size) ||
+       (new_address < old_address + (i64)old_size &&
+        old_address < new_address + (i64)new_size))) {
+    return einval();
+  }
+  if (!IsFullyMapped(s, old_address, old_size)) {
+    return efault();
+  }
+  if (new_size > old_size) {
+    CleanseMemory(s, new_size - old_size);
+    if (s->rss >= GetMaxRss(s)) {
+      LOGF("ran out of resident memory (%lx / %lx pages)", s->rss,
+           GetMaxRss(s));
+      return enomem();
+    }
+    if ((new_size - old_size) / 4096 + s->vss > GetMaxVss(s)) {
+      LOGF("not enough virtual memory (%lx / %lx pages) to grow map by "
+           "%" PRIx64,
+           s->vss, GetMaxVss(s), new_size - old_size);
+      return enomem();
+    }
+  }
+  if (new_size < old_size) {
+    if (FreeVirtual(s, old_address + new_size, old_size - new_size) == -1) {
+      return -1;
+    }
+    old_size = new_size;
+  }
+  if (flags & MREMAP_FIXED_LINUX) {
+    if (FreeVirtual(s, new_address, new_size) == -1) return -1;
+    return RemapVirtual(s, old_address, old_size, new_size, new_address);
+  }
+  if (new_size == old_size) {
+    return old_address;
+  }
+  if (IsValidAddrSize(old_address, new_size) &&
+      IsFullyUnmapped(s, old_address + old_size, new_size - old_size) &&
+      RemapVirtual(s, old_address, old_size, new_size, old_address) != -1) {
+    return old_address;
+  }
+  if (!(flags & MREMAP_MAYMOVE_LINUX)) {
+    return enomem();
+  }
+  if ((res = FindVirtual(s, s->automap, new_size)) == -1) {
+    return -1;
+  }
+  newautomap = ROUNDUP(res + new_size, FLAG_pagesize);
+  if (newautomap >= FLAG_automapend) {
+    newautomap = FLAG_automapstart;
+  }
+  if ((res = RemapVirtual(s, old_address, old_size, new_size, res)) != -1) {
+    s->automap = newautomap;
+  }
+  return res;
+}
+
 static i64 SysMremap(struct Machine *m, i64 old_address, u64 old_size,
                      u64 new_size, int flags, i64 new_address) {
-  // would be nice to have
-  // avoid being noisy in the logs
-  // hope program has fallback for failure
-  LOG_ONCE(MEM_LOGF("mremap() not supported yet"));
-  return enomem();
+  i64 res;
+  BEGIN_NO_PAGE_FAULTS;
+  LOCK(&m->system->mmap_lock);
+  res = SysMremapImpl(m, old_address, old_size, new_size, flags, new_address);
+  unassert(CheckMemoryInvariants(m->system));
+  UNLOCK(&m->system->mmap_lock);
+  END_NO_PAGE_FAULTS;
+  return res;
 }
 
 static int XlatMsyncFlags(int flags) {
@@ -5453,13 +5543,15 @@ void OpSyscall(P) {
   // therefore of the highest importance that they never crash under any
   // circumstances. in order to do ensure that we need to lock any pages
   // the system call accesses, so the user can't munmap() them away from
-  // some other thread. since we don't want to slow down instructions by
-  // adding locking logic to the tranlation lookaside buffer, we need to
-  // ensure any memory references the system call performs will tlb miss
+  // some other thread. FindPageTableEntry() won't honor a tlb hit while
+  // insyscall is set unless that page is already locked, so there's no
+  // need to flush the translation lookaside buffer on each system call
   m->insyscall = true;
-  if (!m->sysdepth++) {
-    atomic_store_explicit(&m->invalidated, true, memory_order_relaxed);
-  }
+#ifdef HAVE_JIT
+  // don't hold back the reuse of jit memory if this call blocks forever
+  ParkJitReader(&m->jitreader);
+#endif
+  ++m->sysdepth;
   // to make system calls simpler and safer, any temporary memory that's
   // allocated will be added to a free list to be collected later. since
   // OpSyscall() is potentially recursive when SA_RESTART signals happen
@@ -5717,4 +5809,7 @@ void OpSyscall(P) {
   unassert(!m->pagelocks.i || m->sysdepth);
   CollectGarbage(m, mark);
   m->insyscall = false;
+#ifdef HAVE_JIT
+  ObserveJitEpoch(&m->jitreader);
+#endif
 }
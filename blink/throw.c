@@ -100,6 +100,7 @@ void HaltMachine(struct Machine *m, int code) {
       DeliverSignalToUser(m, SIGSEGV_LINUX, SI_KERNEL_LINUX);
       break;
     case kMachineExitTrap:
+    case kMachineEscape:
       RestoreIp(m);
       break;
     default:
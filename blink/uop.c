@@ -19,6 +19,7 @@
 #include <ctype.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "blink/alu.h"
 #include "blink/assert.h"
@@ -1143,6 +1144,10 @@ MICRO_OP i64 JustNeg(u64 x) {
   return -x;
 }
 
+MICRO_OP i64 JustInc(u64 x) {
+  return x + 1;
+}
+
 MICRO_OP i64 JustDec(u64 x) {
   return x - 1;
 }
@@ -1217,9 +1222,17 @@ MICRO_OP void FastLeave(struct Machine *m) {
   Put64(m->bp, Read64(ToHost(v)));
 }
 
+MICRO_OP void FastEnter(struct Machine *m) {
+  u64 v = Get64(m->sp) - 8;
+  Write64(ToHost(v), Get64(m->bp));
+  Put64(m->sp, v);
+  Put64(m->bp, v);
+}
+
 MICRO_OP i64 PredictRet(struct Machine *m, i64 prediction) {
   u64 v = Get64(m->sp);
   Put64(m->sp, v + 8);
+  --m->rastop;
   m->ip = Read64(ToHost(v));
   return m->ip ^ prediction;
 }
@@ -1378,6 +1391,167 @@ long GetMicroOpLength(void *uop) {
   return res;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// PER-PATH GUEST REGISTER CACHE
+//
+// While a path is being generated, up to four of the guest's general
+// registers may be mirrored in the callee-saved kJitSav1..kJitSav4 host
+// registers, so that repeated reads of a hot register become a single
+// register move rather than a memory load. The cache is write-through:
+// every guest register write still lands in m->weg, since any memory
+// micro-op may fault and unwind out of the path without warning. That
+// means nothing ever needs to be spilled, and a pin can be forgotten
+// at any time. Pins are forgotten whenever a function that may modify
+// the register file is called, and the sav registers ops use as their
+// own scratch space are marked busy until the op is complete.
+
+#define kPinnedAll 0xffff
+
+static bool IsInTable(void *fun, const void *tab, size_t size) {
+  size_t j;
+  for (j = 0; j < size / sizeof(void (*)(void)); ++j) {
+    if (((void *const *)tab)[j] == fun) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// returns bitset of guest registers `fun` might modify
+static int GetClobberedRegs(void *fun) {
+#define IN(t) IsInTable(fun, t, sizeof(t))
+  int j;
+  if (IN(kAluFast) || IN(kAlu) || IN(kBsu) || IN(kJustAlu) ||  //
+      IN(kJustBsu) || IN(kJustBsu32) || IN(kJustBsuCl32) ||    //
+      IN(kJustBsuCl64) || IN(kFastDec) || IN(kConditionCode) ||  //
+      IN(kGetReg) || IN(kGetReg32) || IN(kGetReg64) ||          //
+      IN(kLoad) || IN(kStore) || IN(kSex) || IN(kBaseIndex)) {
+    return 0;
+  }
+  if (fun == (void *)kPutReg[0] || fun == (void *)kPutReg[1]) {
+    return 0;  // PutReg() forgets these itself
+  }
+  for (j = 0; j < 16; ++j) {
+    if (fun == (void *)kPutReg32[j] || fun == (void *)kPutReg64[j]) {
+      return 1 << j;
+    }
+  }
+  if (IN(kSax)) return 1 << 0;
+  if (IN(kConvert)) return 1 << 2;
+#undef IN
+  if (fun == (void *)Base || fun == (void *)Index ||              //
+      fun == (void *)Seg || fun == (void *)Truncate32 ||          //
+      fun == (void *)ResolveHost || fun == (void *)GetCl ||       //
+      fun == (void *)Pick || fun == (void *)AddIp ||              //
+      fun == (void *)SkewIp || fun == (void *)AdvanceIp ||        //
+      fun == (void *)CountOp || fun == (void *)FastJmp ||         //
+      fun == (void *)FastJmpAbs || fun == (void *)JustNeg ||      //
+      fun == (void *)JustInc || fun == (void *)JustDec ||         //
+      fun == (void *)JustMul32 || fun == (void *)JustMul64 ||     //
+      fun == (void *)Imul32 ||                                    //
+      fun == (void *)Not8 || fun == (void *)Not16 ||              //
+      fun == (void *)Not32 || fun == (void *)Not64 ||             //
+      fun == (void *)ReserveAddress || fun == (void *)GetXmmPtr ||  //
+      fun == (void *)kPutReg[4]) {
+    return 0;
+  }
+#ifdef HAVE_INT128
+  if (fun == (void *)Imul64) return 0;
+  if (fun == (void *)MulAxDx || fun == (void *)JustMulAxDx) {
+    return 1 << 0 | 1 << 2;
+  }
+#endif
+  if (fun == (void *)FastPush || fun == (void *)FastCall ||
+      fun == (void *)FastCallAbs || fun == (void *)PredictRet) {
+    return 1 << 4;
+  }
+  if (fun == (void *)FastLeave || fun == (void *)FastEnter) {
+    return 1 << 4 | 1 << 5;
+  }
+  return kPinnedAll;
+}
+
+static void ForgetPinnedRegs(struct Machine *m, int regs) {
+  int j;
+  for (j = 1; j < ARRAYLEN(m->path.pinned); ++j) {
+    if (m->path.pinned[j] && (regs & 1 << (m->path.pinned[j] - 1))) {
+      m->path.pinned[j] = 0;
+    }
+  }
+}
+
+static void ClobberPinnedRegs(struct Machine *m, void *fun) {
+  if (fun == (void *)GetWegPtr || fun == (void *)GetBegPtr) {
+    // the op is about to write the register file through a pointer
+    // so stop caching registers until it's finished.
+    m->path.scratch = -1;
+    ForgetPinnedRegs(m, kPinnedAll);
+  } else {
+    ForgetPinnedRegs(m, GetClobberedRegs(fun));
+  }
+}
+
+// marks sav register as being used as scratch space by current op
+static void UseSavReg(struct Machine *m, int reg) {
+  int j;
+  for (j = 1; j < ARRAYLEN(kJitSav); ++j) {
+    if (kJitSav[j] == reg) {
+      m->path.pinned[j] = 0;
+      m->path.scratch |= 1 << j;
+    }
+  }
+}
+
+static int FindPinnedReg(struct Machine *m, unsigned reg) {
+  int j;
+  for (j = 1; j < ARRAYLEN(m->path.pinned); ++j) {
+    if (m->path.pinned[j] == reg + 1) {
+      m->path.lastuse[j] = ++m->path.tick;
+      return j;
+    }
+  }
+  return 0;
+}
+
+static int AllocPinnedReg(struct Machine *m, unsigned reg) {
+  int j, k, best;
+  static const u8 kPreference[] = {2, 4, 3, 1};
+  for (best = k = 0; k < ARRAYLEN(kPreference); ++k) {
+    j = kPreference[k];
+    if (m->path.scratch & 1 << j) continue;
+    if (!m->path.pinned[j]) {
+      best = j;
+      break;
+    }
+    if (!best || (u8)(m->path.tick - m->path.lastuse[j]) >
+                     (u8)(m->path.tick - m->path.lastuse[best])) {
+      best = j;
+    }
+  }
+  if (best) {
+    m->path.pinned[best] = reg + 1;
+    m->path.lastuse[best] = ++m->path.tick;
+  }
+  return best;
+}
+
+/**
+ * Forgets which guest registers are cached by the path being built.
+ */
+void ResetPinnedRegs(struct Machine *m) {
+  m->path.tick = 0;
+  m->path.scratch = 0;
+  memset(m->path.pinned, 0, sizeof(m->path.pinned));
+  memset(m->path.lastuse, 0, sizeof(m->path.lastuse));
+}
+
+/**
+ * Releases the sav registers an op used as scratch space.
+ */
+void ReleaseScratchRegs(struct Machine *m) {
+  m->path.scratch = 0;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // PRINTF-STYLE X86 MICROCODING WITH POSTFIX NOTATION
 
@@ -1394,13 +1568,15 @@ static inline unsigned CheckBelow(unsigned x, unsigned n) {
 static void CallFunction(struct Machine *m, void *fun) {
   AppendJitCall(m->path.jb, fun);
   ClobberEverythingExceptResult(m);
+  ClobberPinnedRegs(m, fun);
 }
 
 static void CallMicroOp(struct Machine *m, void *fun) {
 #ifdef TRIVIALLY_RELOCATABLE
   long len;
   if ((len = GetMicroOpLength(fun)) > 0) {
-    AppendJit(m->path.jb, fun, len);
+    AppendJitInline(m->path.jb, fun, len);
+    ClobberPinnedRegs(m, fun);
   } else {
     LOG_ONCE(LOGF("jit micro-operation at address %" PRIxPTR
                   " has branches or static memory references",
@@ -1412,9 +1588,28 @@ static void CallMicroOp(struct Machine *m, void *fun) {
 #endif
 }
 
-static void GetReg_32_64(struct Machine *m, void *fun) {
-  AppendJitMovReg(m->path.jb, kJitArg0, kJitSav0);
-  CallMicroOp(m, fun);
+static void GetReg_32_64(struct Machine *m, unsigned log2sz, unsigned reg) {
+  int j;
+  if ((j = FindPinnedReg(m, reg))) {
+    STATISTIC(++jit_regs_reused);
+    if (log2sz == 3) {
+      AppendJitMovReg(m->path.jb, kJitRes0, kJitSav[j]);
+    } else {
+      AppendJitMovReg32(m->path.jb, kJitRes0, kJitSav[j]);
+    }
+  } else {
+    AppendJitMovReg(m->path.jb, kJitArg0, kJitSav0);
+    if ((j = AllocPinnedReg(m, reg))) {
+      STATISTIC(++jit_regs_pinned);
+      CallMicroOp(m, kGetReg64[reg]);
+      AppendJitMovReg(m->path.jb, kJitSav[j], kJitRes0);
+      if (log2sz == 2) {
+        AppendJitMovReg32(m->path.jb, kJitRes0, kJitRes0);
+      }
+    } else {
+      CallMicroOp(m, log2sz == 3 ? kGetReg64[reg] : kGetReg32[reg]);
+    }
+  }
 }
 
 static void GetReg(P, unsigned log2sz, unsigned reg, unsigned breg) {
@@ -1427,10 +1622,8 @@ static void GetReg(P, unsigned log2sz, unsigned reg, unsigned breg) {
              (u64)kByteReg[breg], kGetReg[0]);
       break;
     case 2:
-      GetReg_32_64(m, kGetReg32[reg]);
-      break;
     case 3:
-      GetReg_32_64(m, kGetReg64[reg]);
+      GetReg_32_64(m, log2sz, reg);
       break;
     default:
       Jitter(A,
@@ -1442,11 +1635,20 @@ static void GetReg(P, unsigned log2sz, unsigned reg, unsigned breg) {
   }
 }
 
-static void PutReg_32_64(struct Machine *m, void *fun) {
+static void PutReg_32_64(struct Machine *m, unsigned log2sz, unsigned reg) {
+  int j;
   ItemsRequired(1);
+  if ((j = FindPinnedReg(m, reg)) || (j = AllocPinnedReg(m, reg))) {
+    if (log2sz == 3) {
+      AppendJitMovReg(m->path.jb, kJitSav[j], stack[i - 1]);
+    } else {
+      AppendJitMovReg32(m->path.jb, kJitSav[j], stack[i - 1]);
+    }
+  }
   AppendJitMovReg(m->path.jb, kJitArg1, kJitSav0);
   AppendJitMovReg(m->path.jb, kJitArg0, stack[i - 1]);
-  CallMicroOp(m, fun);
+  CallMicroOp(m, log2sz == 3 ? kPutReg64[reg] : kPutReg32[reg]);
+  if (j) m->path.pinned[j] = reg + 1;
   --i;
 }
 
@@ -1454,6 +1656,7 @@ static void PutReg(P, unsigned log2sz, unsigned reg, unsigned breg) {
   switch (log2sz) {
     case 0:
       ItemsRequired(1);
+      ForgetPinnedRegs(m, 1 << (kByteReg[breg] >> 3));
       Jitter(A,
              "a2="  // arg2 = <pop>
              "a1i"  // arg1 = register index
@@ -1463,6 +1666,7 @@ static void PutReg(P, unsigned log2sz, unsigned reg, unsigned breg) {
       break;
     case 1:
       ItemsRequired(1);
+      ForgetPinnedRegs(m, 1 << reg);
       Jitter(A,
              "a2="  // arg2 = <pop>
              "a1i"  // arg1 = register index
@@ -1471,10 +1675,8 @@ static void PutReg(P, unsigned log2sz, unsigned reg, unsigned breg) {
              (u64)reg, kPutReg[1]);
       break;
     case 2:
-      PutReg_32_64(m, kPutReg32[reg]);
-      break;
     case 3:
-      PutReg_32_64(m, kPutReg64[reg]);
+      PutReg_32_64(m, log2sz, reg);
       break;
     case 4:
       // note: r0 == a0 on aarch64
@@ -1494,6 +1696,105 @@ static void PutReg(P, unsigned log2sz, unsigned reg, unsigned breg) {
   }
 }
 
+// turns virtual address in res0 into host pointer for memory operand
+// this probes m->itlb inline, and only calls ReserveAddress() on miss
+static void ReserveHost(P, unsigned log2sz, bool writable) {
+#if defined(__x86_64__) || defined(__aarch64__)
+  int j, n;
+  long miss[2], hit;
+  struct JitBlock *jb = m->path.jb;
+  i64 inv = offsetof(struct Machine, invalidated);
+  i64 tlb = offsetof(struct Machine, itlb) + writable * sizeof(m->itlb[0]);
+  n = 0;
+  _Static_assert(sizeof(struct InlineTlb) == 16, "");
+  _Static_assert(ARRAYLEN(m->itlb[0]) == 32, "");
+#if defined(__x86_64__)
+  _Static_assert(kJitSav0 == kAmdBx, "");
+  u8 code1[] = {
+      0x80, 0273, inv, inv >> 8, inv >> 16, inv >> 24, 0,  // cmpb $0,inv(%rbx)
+      0x75, 0x00,                                          // jnz miss
+  };
+  u8 code2[] = {
+      0x89, 0301,                                    // mov %eax,%ecx
+      0xc1, 0351, 8,                                 // shr $8,%ecx
+      0x81, 0341, 0xf0, 0x01, 0, 0,                  // and $0x1f0,%ecx
+      0x48, 0x8d, 0220, 0, 0x10, 0, 0,               // lea 4096(%rax),%rdx
+      0x48, 0x2b, 0224, 0013,                        // sub tlb(%rbx,%rcx),%rdx
+      tlb, tlb >> 8, tlb >> 16, tlb >> 24,           //
+      0x48, 0x81, 0372,                              // cmp $4096-n,%rdx
+      (4096 - (1 << log2sz)), (4096 - (1 << log2sz)) >> 8, 0, 0,
+      0x77, 0x00,                                    // ja miss
+  };
+  u8 code3[] = {
+      0x48, 0x03, 0204, 0013,  // add tlb+8(%rbx,%rcx),%rax
+      tlb + 8, (tlb + 8) >> 8, (tlb + 8) >> 16, (tlb + 8) >> 24,
+  };
+  u8 code4[] = {0x48, 0xff, 0001};  // incq (%rcx)
+  u8 code5[] = {0xeb, 0x00};        // jmp hit
+#define kCounterReg kAmdCx
+#elif defined(__aarch64__)
+  _Static_assert(kJitSav0 == 19, "");
+  u32 code1[] = {
+      0x8b010261,  // add x1, x19, x1
+      0x08dffc22,  // ldarb w2, [x1]
+      0x35000002,  // cbnz w2, miss
+  };
+  u32 code2[] = {
+      0x8b010261,  // add x1, x19, x1
+      0xd34c4002,  // ubfx x2, x0, #12, #5
+      0x8b021021,  // add x1, x1, x2, lsl #4
+      0xa9400c22,  // ldp x2, x3, [x1]
+      0xcb020002,  // sub x2, x0, x2
+      0x91400442,  // add x2, x2, #4096
+      0xf100005f | (4096 - (1 << log2sz)) << 10,  // cmp x2, #4096-n
+      0x54000008,  // b.hi miss
+  };
+  u32 code3[] = {
+      0x8b030000,  // add x0, x0, x3
+  };
+  u32 code4[] = {
+      0xf9400022,  // ldr x2, [x1]
+      0x91000442,  // add x2, x2, #1
+      0xf9000022,  // str x2, [x1]
+  };
+  u32 code5[] = {0xb400001f};  // cbz xzr, hit
+#define kCounterReg 1
+  AppendJitSetReg(jb, 1, inv);
+#endif
+  AppendJit(jb, code1, sizeof(code1));
+  miss[n++] = jb->index;
+#ifdef __aarch64__
+  AppendJitSetReg(jb, 1, tlb);
+#endif
+  AppendJit(jb, code2, sizeof(code2));
+  miss[n++] = jb->index;
+  AppendJit(jb, code3, sizeof(code3));
+#ifndef NDEBUG
+  if (FLAG_statistics) {
+    AppendJitSetReg(jb, kCounterReg, (uintptr_t)&tlb_inline_hits);
+    AppendJit(jb, code4, sizeof(code4));
+    jb->unportable = true;  // host pointer baked into the code
+  }
+#endif
+#undef kCounterReg
+  AppendJit(jb, code5, sizeof(code5));
+  hit = jb->index;
+  for (j = 0; j < n; ++j) {
+    FixupSideExit(jb, miss[j]);
+  }
+#endif
+  Jitter(A,
+         "a3i"    // arg3 = writable
+         "a2i"    // arg2 = bytes to access
+         "r0a1="  // arg1 = virtual address
+         "q"      // arg0 = machine
+         "c",     // res0 = call function (turn virtual into pointer)
+         (u64)writable, (u64)(1 << log2sz), ReserveAddress);
+#if defined(__x86_64__) || defined(__aarch64__)
+  FixupSideExit(jb, hit);
+#endif
+}
+
 static unsigned JitterImpl(P, const char *fmt, va_list va, unsigned k,
                            unsigned depth) {
   unsigned c, log2sz;
@@ -1554,11 +1855,13 @@ static unsigned JitterImpl(P, const char *fmt, va_list va, unsigned k,
 
       case 'i':  // set reg imm, e.g. ("a1i", 123) [mov $123,%rsi]
         ItemsRequired(1);
+        UseSavReg(m, stack[i - 1]);
         AppendJitSetReg(m->path.jb, stack[--i], va_arg(va, u64));
         break;
 
       case '=':  // <src><dst>= mov reg, e.g. s0a0= [mov %rbx,%rdi]
         ItemsRequired(2);
+        UseSavReg(m, stack[i - 1]);
         AppendJitMovReg(m->path.jb, stack[i - 1], stack[i - 2]);
         i -= 2;
         break;
@@ -1599,16 +1902,12 @@ static unsigned JitterImpl(P, const char *fmt, va_list va, unsigned k,
                    ResolveHost, kLoad[log2sz]);
           }
         } else {
+          Jitter(A, "L");  // load effective address
+          ReserveHost(A, log2sz, false);
           Jitter(A,
-                 "L"         // load effective address
-                 "a3i"       // arg3 = false
-                 "a2i"       // arg2 = bytes to read
-                 "r0a1="     // arg1 = virtual address
-                 "q"         // arg0 = machine
-                 "c"         // call function (turn virtual into pointer)
                  "t"         // arg0 = pointer
                  LOADSTORE,  // call micro-op (read vector shared memory)
-                 (u64)0, (u64)(1 << log2sz), ReserveAddress, kLoad[log2sz]);
+                 kLoad[log2sz]);
         }
         break;
 
@@ -1639,17 +1938,14 @@ static unsigned JitterImpl(P, const char *fmt, va_list va, unsigned k,
             }
           } else {
             Jitter(A,
-                   "s3="       // sav3 = <pop>
-                   "L"         // load effective address
-                   "a3i"       // arg3 = true
-                   "a2i"       // arg2 = byte width of write operation
-                   "r0a1="     // arg1 = res0
-                   "q"         // arg0 = machine
-                   "c"         // call function (turn virtual into pointer)
+                   "s3="  // sav3 = <pop>
+                   "L");  // load effective address
+            ReserveHost(A, log2sz, true);
+            Jitter(A,
                    "s3a1="     // arg1 = sav3
                    "t"         // arg0 = res0
                    LOADSTORE,  // call function (write word to shared memory)
-                   (u64)1, (u64)(1 << log2sz), ReserveAddress, kStore[log2sz]);
+                   kStore[log2sz]);
           }
         } else {
           if (IsModrmRegister(rde)) {
@@ -1692,19 +1988,16 @@ static unsigned JitterImpl(P, const char *fmt, va_list va, unsigned k,
             }
           } else {
             Jitter(A,
-                   "r1s4="     // sav4 = res1
-                   "r0s3="     // sav3 = res0
-                   "L"         // load effective address
-                   "a3i"       // arg3 = true
-                   "a2i"       // arg2 = bytes to write
-                   "r0a1="     // arg1 = res0
-                   "q"         // arg0 = machine
-                   "c"         // call function (turn virtual into pointer)
+                   "r1s4="  // sav4 = res1
+                   "r0s3="  // sav3 = res0
+                   "L");    // load effective address
+            ReserveHost(A, log2sz, true);
+            Jitter(A,
                    "s4a2="     // arg2 = sav4
                    "s3a1="     // arg1 = sav3
                    "t"         // arg0 = res0
                    LOADSTORE,  // call micro-op (store vector to shared memory)
-                   (u64)1, (u64)(1 << log2sz), ReserveAddress, kStore[log2sz]);
+                   kStore[log2sz]);
           }
         }
         break;
@@ -1721,10 +2014,7 @@ static unsigned JitterImpl(P, const char *fmt, va_list va, unsigned k,
                    "m",   // call micro-op
                    RexbRm(rde), disp, Base);
           } else {
-            Jitter(A,
-                   "q"   // arg0 = machine
-                   "m",  // call micro-op
-                   kGetReg64[RexbRm(rde)]);
+            GetReg(A, 3, RexbRm(rde), 0);
           }
         } else if (!SibHasBase(rde) && !SibHasIndex(rde)) {
           Jitter(A, "r0i", disp);  // res0 = absolute
@@ -1735,10 +2025,7 @@ static unsigned JitterImpl(P, const char *fmt, va_list va, unsigned k,
             AppendJitMovReg(m->path.jb, kJitArg0, kJitSav0);
             CallMicroOp(m, Base);
           } else {
-            Jitter(A,
-                   "q"   // arg0 = machine
-                   "m",  // call micro-op
-                   kGetReg64[RexbBase(rde)]);
+            GetReg(A, 3, RexbBase(rde), 0);
           }
         } else if (!SibHasBase(rde) && SibHasIndex(rde)) {
           Jitter(A,
@@ -1806,14 +2093,8 @@ static unsigned JitterImpl(P, const char *fmt, va_list va, unsigned k,
                    ResolveHost);
           }
         } else {
-          Jitter(A,
-                 "L"      // load effective address
-                 "a3i"    // arg3 = false
-                 "a2i"    // arg2 = bytes to read
-                 "r0a1="  // arg1 = virtual address
-                 "q"      // arg0 = machine
-                 "c",     // res0 = call function (turn virtual into pointer)
-                 (u64)0, (u64)(1 << log2sz), ReserveAddress);
+          Jitter(A, "L");  // load effective address
+          ReserveHost(A, log2sz, false);
         }
         break;
 
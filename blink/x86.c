@@ -447,7 +447,7 @@ static int xed_vex_c4_scanner(struct XedDecodedInst *x, int *imm_width,
     x->op.rde |= (u64)vrex << 63 | rexx << 17 | rexb << 15 | rexb << 10 |
                  rexw << 6 | rexr << 3;
     x->op.rde |= ymm << 30;
-    x->op.rde |= (u64)vexdest210 << 60;
+    x->op.rde |= (u64)vexdest210 << 60 | (u64)1 << 59;
     *vexvalid = 1;
     length += 2;
     x->length = length;
@@ -472,13 +472,13 @@ static int xed_vex_c5_scanner(struct XedDecodedInst *x, int *vexvalid) {
     // rex.r:         1-bit
     b = x->bytes[length];
     rexr = !(b & 128);
-    vrex = !!(b & 64);
+    vrex = !(b & 64);
     vexdest210 = (~b >> 3) & 7;
     ymm = (b >> 2) & 1;
     xed_set_vex_prefix(x, b & 3);
     x->op.rde |= (u64)vrex << 63 | rexr << 3;
     x->op.rde |= ymm << 30;
-    x->op.rde |= (u64)vexdest210 << 60;
+    x->op.rde |= (u64)vexdest210 << 60 | (u64)1 << 59;
     *vexvalid = 1;
     length++;
     x->length = length;
@@ -726,7 +726,7 @@ static int xed_decode_instruction_length(struct XedDecodedInst *x) {
   int imm_width = 0;
   int disp_width = 0;
   if ((e = xed_prefix_scanner(x))) return e;
-#ifndef DISABLE_BMI2
+#if !defined(DISABLE_BMI2) || !defined(DISABLE_AVX)
   if ((e = xed_vex_scanner(x, &imm_width, &vexvalid))) return e;
 #endif
   if (!vexvalid && (e = xed_opcode_scanner(x, &imm_width))) return e;
@@ -0,0 +1,19 @@
+CC = cc
+AR = ar
+MODE ?= 
+TMPDIR = /root/repo/o/tmp
+PREFIX = /usr/local
+CFLAGS =  -fno-align-functions -fno-common -pthread -fpie -g -O2 -fno-omit-frame-pointer -fno-optimize-sibling-calls
+CPPFLAGS = -D_FILE_OFFSET_BITS=64 -D_DARWIN_C_SOURCE -D_DEFAULT_SOURCE -D_BSD_SOURCE -D_GNU_SOURCE
+UOPFLAGS = -fno-stack-protector -fno-sanitize=all -O2 -fomit-frame-pointer
+TARGET_ARCH = 
+LDFLAGS = -pthread -Wl,-z,noseparate-code -Wl,-z,norelro -Wl,-z,common-page-size=65536,-z,max-page-size=65536 -pie 
+LDLIBS = -lz  -lrt -lm 
+HOST_OS = GNU/Linux
+HOST_ARCH = x86_64
+HOST_SYSTEM = Linux
+CONFIG_HOSTNAME = vm
+CONFIG_COMMAND = ./configure 
+CONFIG_ARGUMENTS = -DCONFIG_ARGUMENTS="\"\""
+BLINK_UNAME_V = -DBLINK_UNAME_V="\"DEFAULT\""
+ZLIB = 
@@ -0,0 +1,134 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <stdlib.h>
+#include <string.h>
+
+#include "blink/assert.h"
+#include "blink/gaps.h"
+#include "blink/macros.h"
+#include "blink/util.h"
+#include "test/test.h"
+
+#define N 256
+
+struct Gaps g;
+bool mapped[N];
+
+void SetUp(void) {
+  unassert(!InitGaps(&g, 0, N));
+  memset(mapped, 0, sizeof(mapped));
+}
+
+void TearDown(void) {
+  FreeGaps(&g);
+}
+
+static i64 CheckTree(struct Gap *t, i64 *prev) {
+  i64 max, hi;
+  if (!t) return 0;
+  max = CheckTree(t->lo, prev);
+  ASSERT_LT(*prev, t->beg);  // disjoint and never adjacent
+  ASSERT_LT(t->beg, t->end);
+  for (i64 i = *prev < 0 ? 0 : *prev; i < t->beg; ++i) ASSERT_TRUE(mapped[i]);
+  for (i64 i = t->beg; i < t->end; ++i) ASSERT_FALSE(mapped[i]);
+  *prev = t->end;
+  max = MAX(max, t->end - t->beg);
+  hi = CheckTree(t->hi, prev);
+  max = MAX(max, hi);
+  ASSERT_EQ(max, t->max);
+  return max;
+}
+
+static void CheckGaps(void) {
+  i64 prev = -1;
+  CheckTree(g.root, &prev);
+  for (i64 i = prev < 0 ? 0 : prev; i < N; ++i) ASSERT_TRUE(mapped[i]);
+}
+
+static i64 FindGapSlowly(i64 hint, i64 size) {
+  i64 i, j;
+  for (i = hint; i + size <= N; ++i) {
+    for (j = 0; j < size; ++j) {
+      if (mapped[i + j]) break;
+    }
+    if (j == size) return i;
+  }
+  return -1;
+}
+
+static void Map(i64 beg, i64 end) {
+  ASSERT_EQ(0, RemoveGap(&g, beg, end));
+  for (i64 i = beg; i < end; ++i) mapped[i] = true;
+}
+
+static void Unmap(i64 beg, i64 end) {
+  ASSERT_EQ(0, AddGap(&g, beg, end));
+  for (i64 i = beg; i < end; ++i) mapped[i] = false;
+}
+
+TEST(gaps, testEmpty_findsHint) {
+  EXPECT_EQ(7, FindGap(&g, 7, 10));
+  EXPECT_EQ(-1, FindGap(&g, 250, 10));
+  EXPECT_EQ(0, FindGap(&g, 0, N));
+}
+
+TEST(gaps, testCollision_skipsToFirstFit) {
+  Map(10, 20);
+  Map(24, 30);
+  CheckGaps();
+  EXPECT_EQ(0, FindGap(&g, 0, 10));
+  EXPECT_EQ(30, FindGap(&g, 5, 6));
+  EXPECT_EQ(20, FindGap(&g, 8, 4));
+  EXPECT_EQ(20, FindGap(&g, 20, 4));
+  EXPECT_EQ(21, FindGap(&g, 21, 3));
+}
+
+TEST(gaps, testUnmap_coalescesNeighbors) {
+  Map(0, N);
+  Unmap(10, 20);
+  Unmap(30, 40);
+  Unmap(20, 30);
+  CheckGaps();
+  ASSERT_NOTNULL(g.root);
+  EXPECT_EQ(10, g.root->beg);
+  EXPECT_EQ(40, g.root->end);
+  EXPECT_EQ(10, FindGap(&g, 0, 30));
+}
+
+TEST(gaps, testRandomOperations_matchBitmap) {
+  int i, j;
+  u64 rng[1] = {123};
+  i64 beg, end, hint, size;
+  for (i = 0; i < 3000; ++i) {
+    beg = Vigna(rng) % N;
+    end = beg + Vigna(rng) % 24 + 1;
+    end = MIN(end, N);
+    if (Vigna(rng) & 1) {
+      Map(beg, end);
+    } else {
+      Unmap(beg, end);
+    }
+    CheckGaps();
+    for (j = 0; j < 8; ++j) {
+      hint = Vigna(rng) % N;
+      size = Vigna(rng) % 16 + 1;
+      ASSERT_EQ(FindGapSlowly(hint, size), FindGap(&g, hint, size));
+    }
+  }
+}
@@ -65,6 +65,13 @@ o/$(MODE)/test/func/%.com:						\
 	@echo "o/$(MODE)/blink/blink -m $< || exit" >>$@
 	@echo "echo [test] o/$(MODE)/blink/blink -j $< >&2" >>$@
 	@echo "o/$(MODE)/blink/blink -j $< || exit" >>$@
+	@echo "echo [test] BLINK_JIT_MEMORY=1 o/$(MODE)/blink/blink $< >&2" >>$@
+	@echo "BLINK_JIT_MEMORY=1 o/$(MODE)/blink/blink $< || exit" >>$@
+	@echo "rm -rf $@.jit && mkdir -p $@.jit || exit" >>$@
+	@echo "echo [test] o/$(MODE)/blink/blink -J $@.jit $< >&2" >>$@
+	@echo "o/$(MODE)/blink/blink -J $@.jit $< || exit" >>$@
+	@echo "echo [test] o/$(MODE)/blink/blink -J $@.jit $< >&2" >>$@
+	@echo "o/$(MODE)/blink/blink -J $@.jit $< || exit" >>$@
 	@echo "echo [test] o/$(MODE)/blink/blink -L/dev/null -sss $< >&2" >>$@
 	@echo "o/$(MODE)/blink/blink -L/dev/null -sss $< || exit" >>$@
 	@echo "echo [test] o/$(MODE)/blink/blink -L/dev/null -msss $< >&2" >>$@
@@ -0,0 +1,55 @@
+// checks jit memory isn't reused while another thread still runs in it
+// this is most likely to fail when blink is run with BLINK_JIT_MEMORY=1
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define COUNT 2000
+#define SIZE  128
+
+volatile int done;
+volatile long spins;
+
+void *Spin(void *arg) {
+  while (!done) ++spins;
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  int i, j, n;
+  long sum = 0;
+  pthread_t th;
+  unsigned char *p, *code;
+  code = mmap(0, COUNT * SIZE, PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (code == MAP_FAILED) return 1;
+  // generate lots of distinct functions, so the jit runs out of memory
+  for (i = 0; i < COUNT; ++i) {
+    p = code + i * SIZE;
+    for (n = 0; n + 8 < SIZE;) {
+      p[n++] = 0x05;  // add $i,%eax
+      memcpy(p + n, &i, 4);
+      n += 4;
+      p[n++] = 0x01;  // add %edi,%eax
+      p[n++] = 0xf8;
+    }
+    p[n++] = 0xc3;  // ret
+  }
+  if (mprotect(code, COUNT * SIZE, PROT_READ | PROT_EXEC)) return 2;
+  for (i = 0; i < COUNT; ++i) {
+    if (i == COUNT / 8) {
+      // the spin loop cycles inside jit code without returning to the
+      // interpreter, while this thread causes its block to be evicted
+      if (pthread_create(&th, 0, Spin, 0)) return 3;
+      while (!spins) sched_yield();
+    }
+    for (j = 0; j < 12; ++j) {
+      sum += ((int (*)(int))(code + i * SIZE))(j);
+    }
+  }
+  done = 1;
+  if (pthread_join(th, 0)) return 4;
+  if (!sum) return 5;
+  return 0;
+}
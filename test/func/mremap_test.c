@@ -0,0 +1,175 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "blink/macros.h"
+#include "test/test.h"
+
+#define pagesize 65536
+
+void SetUp(void) {
+}
+
+void TearDown(void) {
+}
+
+static u8 *Map(size_t size) {
+  return (u8 *)mmap(0, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+}
+
+static bool IsUnmapped(u8 *p, size_t size) {
+  u8 *q;
+  q = (u8 *)mmap(p, size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS |
+                 MAP_FIXED_NOREPLACE, -1, 0);
+  if (q == (u8 *)MAP_FAILED) return false;
+  munmap(q, size);
+  return q == p;
+}
+
+TEST(mremap, grow_preservesContents) {
+  u8 *p, *q;
+  ASSERT_NE((intptr_t)MAP_FAILED, (intptr_t)(p = Map(pagesize * 2)));
+  memset(p, 'a', pagesize);
+  memset(p + pagesize, 'b', pagesize);
+  ASSERT_NE((intptr_t)MAP_FAILED,
+            (intptr_t)(q = (u8 *)mremap(p, pagesize * 2, pagesize * 64,
+                                        MREMAP_MAYMOVE)));
+  ASSERT_EQ('a', q[0]);
+  ASSERT_EQ('a', q[pagesize - 1]);
+  ASSERT_EQ('b', q[pagesize]);
+  ASSERT_EQ('b', q[pagesize * 2 - 1]);
+  ASSERT_EQ(0, q[pagesize * 2]);
+  q[pagesize * 64 - 1] = 'c';
+  ASSERT_EQ(0, munmap(q, pagesize * 64));
+}
+
+TEST(mremap, grow_staysInPlaceIfThereIsRoom) {
+  u8 *p, *q;
+  ASSERT_NE((intptr_t)MAP_FAILED, (intptr_t)(p = Map(pagesize * 3)));
+  ASSERT_EQ(0, munmap(p + pagesize, pagesize * 2));
+  p[0] = 'a';
+  q = (u8 *)mremap(p, pagesize, pagesize * 3, 0);
+  ASSERT_EQ((intptr_t)p, (intptr_t)q);
+  ASSERT_EQ('a', q[0]);
+  q[pagesize * 3 - 1] = 'b';
+  ASSERT_EQ(0, munmap(q, pagesize * 3));
+}
+
+TEST(mremap, grow_failsIfBlockedAndNotAllowedToMove) {
+  u8 *p;
+  ASSERT_NE((intptr_t)MAP_FAILED, (intptr_t)(p = Map(pagesize * 2)));
+  errno = 0;
+  ASSERT_EQ((intptr_t)MAP_FAILED,
+            (intptr_t)mremap(p, pagesize, pagesize * 2, 0));
+  ASSERT_EQ(ENOMEM, errno);
+  ASSERT_EQ(0, munmap(p, pagesize * 2));
+}
+
+TEST(mremap, shrink_unmapsTail) {
+  u8 *p, *q;
+  ASSERT_NE((intptr_t)MAP_FAILED, (intptr_t)(p = Map(pagesize * 3)));
+  p[0] = 'a';
+  q = (u8 *)mremap(p, pagesize * 3, pagesize, 0);
+  ASSERT_EQ((intptr_t)p, (intptr_t)q);
+  ASSERT_EQ('a', q[0]);
+  ASSERT_EQ(true, IsUnmapped(p + pagesize, pagesize * 2));
+  ASSERT_EQ(0, munmap(q, pagesize));
+}
+
+TEST(mremap, fixed_replacesDestination) {
+  u8 *p, *q, *r;
+  ASSERT_NE((intptr_t)MAP_FAILED, (intptr_t)(p = Map(pagesize * 2)));
+  ASSERT_NE((intptr_t)MAP_FAILED, (intptr_t)(q = Map(pagesize * 4)));
+  memset(p, 'a', pagesize * 2);
+  memset(q, 'b', pagesize * 4);
+  r = (u8 *)mremap(p, pagesize * 2, pagesize * 3,
+                   MREMAP_MAYMOVE | MREMAP_FIXED, q);
+  ASSERT_EQ((intptr_t)q, (intptr_t)r);
+  ASSERT_EQ('a', r[0]);
+  ASSERT_EQ('a', r[pagesize * 2 - 1]);
+  ASSERT_EQ(0, r[pagesize * 2]);
+  ASSERT_EQ('b', r[pagesize * 3]);
+  ASSERT_EQ(true, IsUnmapped(p, pagesize * 2));
+  ASSERT_EQ(0, munmap(q, pagesize * 4));
+}
+
+TEST(mremap, fixed_movesFileMapping) {
+  FILE *f;
+  u8 *a, *p, *q, *r;
+  ASSERT_NOTNULL(a = (u8 *)malloc(pagesize * 2));
+  memset(a, 'a', pagesize);
+  memset(a + pagesize, 'b', pagesize);
+  ASSERT_NOTNULL(f = tmpfile());
+  ASSERT_EQ(2, fwrite(a, pagesize, 2, f));
+  ASSERT_EQ(0, fflush(f));
+  ASSERT_NE((intptr_t)MAP_FAILED,
+            (intptr_t)(p = (u8 *)mmap(0, pagesize * 2, PROT_READ, MAP_PRIVATE,
+                                      fileno(f), 0)));
+  ASSERT_NE((intptr_t)MAP_FAILED, (intptr_t)(q = Map(pagesize * 2)));
+  r = (u8 *)mremap(p, pagesize * 2, pagesize * 2,
+                   MREMAP_MAYMOVE | MREMAP_FIXED, q);
+  ASSERT_EQ((intptr_t)q, (intptr_t)r);
+  ASSERT_EQ(0, memcmp(a, r, pagesize * 2));
+  ASSERT_EQ(0, munmap(r, pagesize * 2));
+  ASSERT_EQ(0, fclose(f));
+  free(a);
+}
+
+TEST(mremap, grow_movesExecutableMemoryAfterItWasWritten) {
+  u8 *p, *q;
+  // blink protects jit-able memory from writes one host page at a time
+  ASSERT_NE((intptr_t)MAP_FAILED,
+            (intptr_t)(p = (u8 *)mmap(0, 8192,
+                                      PROT_READ | PROT_WRITE | PROT_EXEC,
+                                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)));
+  p[0] = 'a';
+  ASSERT_NE((intptr_t)MAP_FAILED,
+            (intptr_t)(q = (u8 *)mremap(p, 8192, 262144, MREMAP_MAYMOVE)));
+  ASSERT_EQ('a', q[0]);
+  ASSERT_EQ(0, q[1]);
+  ASSERT_EQ(0, q[8191]);
+  ASSERT_EQ(0, q[8192]);
+  q[1] = 'b';
+  q[8191] = 'c';
+  q[262143] = 'd';
+  ASSERT_EQ('b', q[1]);
+  ASSERT_EQ('c', q[8191]);
+  ASSERT_EQ(0, munmap(q, 262144));
+}
+
+TEST(mremap, badArguments) {
+  u8 *p;
+  ASSERT_NE((intptr_t)MAP_FAILED, (intptr_t)(p = Map(pagesize * 2)));
+  errno = 0;
+  ASSERT_EQ((intptr_t)MAP_FAILED,
+            (intptr_t)mremap(p, pagesize, pagesize, MREMAP_FIXED, p));
+  ASSERT_EQ(EINVAL, errno);
+  errno = 0;
+  ASSERT_EQ((intptr_t)MAP_FAILED,
+            (intptr_t)mremap(p, pagesize * 2, pagesize,
+                             MREMAP_MAYMOVE | MREMAP_FIXED, p + pagesize));
+  ASSERT_EQ(EINVAL, errno);
+  ASSERT_EQ(0, munmap(p, pagesize * 2));
+  errno = 0;
+  ASSERT_EQ((intptr_t)MAP_FAILED,
+            (intptr_t)mremap(p, pagesize, pagesize * 2, MREMAP_MAYMOVE));
+  ASSERT_EQ(EFAULT, errno);
+}
@@ -0,0 +1,38 @@
+// test string elements straddling into an unmapped page fault on its start
+#include <setjmp.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+char *p;
+sigjmp_buf jb;
+
+void OnSigSegv(int sig, siginfo_t *si, void *vctx) {
+  if (si->si_addr != p + 4096) _exit(5);
+  siglongjmp(jb, 1);
+}
+
+int main(int argc, char *argv[]) {
+  long n;
+  void *di, *si;
+  p = mmap(0, 8192, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1,
+           0);
+  if (p == MAP_FAILED) return 2;
+  if (munmap(p + 4096, 4096)) return 3;
+  struct sigaction sa = {.sa_sigaction = OnSigSegv, .sa_flags = SA_SIGINFO};
+  if (sigaction(SIGSEGV, &sa, 0)) return 4;
+  if (!sigsetjmp(jb, 1)) {
+    n = 2;
+    di = p + 4096 - 5;
+    asm volatile("rep stosl" : "+D"(di), "+c"(n) : "a"(0) : "memory");
+    return 6;
+  }
+  if (!sigsetjmp(jb, 1)) {
+    n = 2;
+    si = p + 4096 - 9;
+    asm volatile("rep lodsq" : "+S"(si), "+c"(n) : : "rax", "memory");
+    return 7;
+  }
+  return 0;
+}
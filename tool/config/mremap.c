@@ -0,0 +1,17 @@
+// checks for mremap() system call
+#include <string.h>
+#include <sys/mman.h>
+
+int main(int argc, char *argv[]) {
+  char *p, *q;
+  p = (char *)mmap(0, 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                   -1, 0);
+  if (p == MAP_FAILED) return 1;
+  strcpy(p, "hello");
+  q = (char *)mremap(p, 4096, 65536, MREMAP_MAYMOVE);
+  if (q == MAP_FAILED) return 2;
+  if (strcmp(q, "hello")) return 3;
+  q[65535] = 1;
+  if (munmap(q, 65536)) return 4;
+  return 0;
+}